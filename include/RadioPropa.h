@@ -16,13 +16,18 @@
 #include "radiopropa/ParticleState.h"
 #include "radiopropa/Random.h"
 #include "radiopropa/Referenced.h"
+#include "radiopropa/Scene.h"
 #include "radiopropa/Source.h"
 #include "radiopropa/ScalarField.h"
+#include "radiopropa/RaySolver.h"
+#include "radiopropa/Surface.h"
+#include "radiopropa/TriangleMesh.h"
 #include "radiopropa/Units.h"
 #include "radiopropa/Variant.h"
 #include "radiopropa/Vector3.h"
 #include "radiopropa/Version.h"
 
+#include "radiopropa/module/BatchModule.h"
 #include "radiopropa/module/Boundary.h"
 #include "radiopropa/module/BreakCondition.h"
 #include "radiopropa/module/HDF5Output.h"
@@ -32,9 +37,13 @@
 #include "radiopropa/module/OutputShell.h"
 #include "radiopropa/module/ParticleCollector.h"
 #include "radiopropa/module/PropagationCK.h"
+#include "radiopropa/module/PropagationBatchCK.h"
+#include "radiopropa/module/PropagationRK.h"
+#include "radiopropa/module/PropagationStratified.h"
 #include "radiopropa/module/SimplePropagation.h"
 #include "radiopropa/module/TextOutput.h"
 #include "radiopropa/module/Tools.h"
+#include "radiopropa/module/TransmissiveLayer.h"
 #include "radiopropa/magneticField/MagneticField.h"
 #include "radiopropa/magneticField/MagneticFieldGrid.h"
 
@@ -3,7 +3,8 @@
 
 #include "radiopropa/ParticleState.h"
 #include "radiopropa/Referenced.h"
-#include "radiopropa/AssocVector.h"
+#include "radiopropa/PropertyMap.h"
+#include "radiopropa/Random.h"
 #include "radiopropa/Variant.h"
 
 #include <vector>
@@ -18,32 +19,67 @@ namespace radiopropa {
  @brief All information about the cosmic ray.
 
  The Candidate is a passive object, that holds the information about the state
- of the cosmic ray and the simulation itself.
+ of the cosmic ray and the simulation itself.\n
+ The Candidate itself holds only what the modules access in every step: the current and previous state, the step
+ bookkeeping and the flags. The provenance (source and created state), the secondaries, the properties, the serial
+ number and the random stream live in a separately allocated cold part, so that the hot part of the candidates
+ stays compact when many of them are scanned. The public members source, created, secondaries and properties
+ refer into the cold part.
  */
 class Candidate: public Referenced {
 public:
-	ParticleState source; /**< Particle state at the source */
-	ParticleState created; /**< Particle state of parent particle at the time of creation */
 	ParticleState current; /**< Current particle state */
 	ParticleState previous; /**< Particle state at the end of the previous step */
 
-	std::vector<ref_ptr<Candidate> > secondaries; /**< Secondary particles from interactions */
+private:
+	double trajectoryLength; /**< Comoving distance [m] the candidate has traveled so far */
+	double currentStep; /**< Size of the currently performed step in [m] comoving units */
+	double nextStep; /**< Proposed size of the next propagation step in [m] comoving units */
+	Vector3d previousDerivative; /**< dx/ds at the beginning of the current step */
+	Vector3d currentDerivative; /**< dx/ds at the end of the current step */
+	double weight; /**< Weight of the candidate */
+	bool active; /**< Active status */
+	bool stepDerivatives; /**< Derivatives of the current step have been published */
+	bool pooled; /**< Allocated by the CandidatePool, which recycles it */
 
-	typedef Loki::AssocVector<std::string, Variant> PropertyMap;
-	PropertyMap properties; /**< Map of property names and their values. */
+	/** Members that are not accessed in every step */
+	struct Cold {
+		ParticleState source;
+		ParticleState created;
+		std::vector<ref_ptr<Candidate> > secondaries;
+		radiopropa::PropertyMap properties;
+		uint64_t serialNumber;
+		RandomStream random; /**< Random numbers of the candidate, keyed by the run seed and the serial number */
+		Cold(const ParticleState &state) :
+				source(state), created(state), serialNumber(0) {
+		}
+	};
+	Cold *cold;
+
+public:
+	ParticleState &source; /**< Particle state at the source */
+	ParticleState &created; /**< Particle state of parent particle at the time of creation */
+
+	std::vector<ref_ptr<Candidate> > &secondaries; /**< Secondary particles from interactions */
+
+	typedef radiopropa::PropertyMap PropertyMap; /**< Former type of the property map, for compatibility */
+	PropertyMap &properties; /**< Map of interned property keys and their values. */
 
 	/** Parent candidate. 0 if no parent (initial particle). Must not be a ref_ptr to prevent circular referencing. */
 	Candidate *parent;
 
 private:
-	bool active; /**< Active status */
-	double weight; /**< Weight of the candidate */
-	double trajectoryLength; /**< Comoving distance [m] the candidate has traveled so far */
-	double currentStep; /**< Size of the currently performed step in [m] comoving units */
-	double nextStep; /**< Proposed size of the next propagation step in [m] comoving units */
-
 	static uint64_t nextSerialNumber;
-	uint64_t serialNumber;
+	/** Assign the next serial number and restart the random stream with it */
+	void assignSerialNumber();
+
+	friend class CandidatePool;
+	/** Return to the state of a newly created candidate, keeping the allocated containers */
+	void reset(const ParticleState &state);
+
+protected:
+	/** Return the candidate to the CandidatePool instead of deleting it, if it was acquired from the pool */
+	void dispose() const;
 
 public:
 	Candidate(
@@ -61,6 +97,11 @@ public:
 	 */
 	Candidate(const ParticleState &state);
 
+	/** Copies the candidate including its cold part; the copy is not pooled */
+	Candidate(const Candidate &c);
+	Candidate &operator=(const Candidate &c);
+	~Candidate();
+
 	bool isActive() const;
 	void setActive(bool b);
 
@@ -81,6 +122,64 @@ public:
 	void setCurrentStep(double step);
 	double getCurrentStep() const;
 
+	/**
+	 Publish the derivatives dx/ds of the position at the beginning and the end of the current step.
+	 Together with the previous and the current position they define a cubic Hermite interpolant of the
+	 trajectory within the step (dense output).
+	 Only the propagation module should use this, after setCurrentStep, which discards the derivatives of the
+	 preceding step. Without derivatives the trajectory within the step is interpolated linearly.
+	 */
+	void setStepDerivatives(const Vector3d &previous, const Vector3d &current);
+	bool hasStepDerivatives() const;
+
+	/** Interpolated position at the fraction (0 - 1) of the current step */
+	Vector3d getInterpolatedPosition(double fraction) const;
+
+	/** Interpolated direction at the fraction (0 - 1) of the current step */
+	Vector3d getInterpolatedDirection(double fraction) const;
+
+	/**
+	 Locate the fraction of the current step at which f(position) changes sign,
+	 given the values fPrevious and fCurrent at the previous and the current position.
+	 The returned fraction lies on the side of the current position, i.e. f has the sign of fCurrent there.
+	 */
+	template<typename Function>
+	double locateCrossing(const Function &f, double fPrevious, double fCurrent) const {
+		// Illinois variant of regula falsi on the interpolated trajectory
+		double a = 0, b = 1;
+		double fa = fPrevious, fb = fCurrent;
+		int side = 0;
+		for (int i = 0; i < 100; i++) {
+			if ((fb == 0) || (b - a < 1e-12))
+				break;
+			double c = (a * fb - b * fa) / (fb - fa);
+			double fc = f(getInterpolatedPosition(c));
+			if (fc == 0)
+				return c;
+			if ((fc < 0) == (fb < 0)) {
+				b = c;
+				fb = fc;
+				if (side == -1)
+					fa /= 2;
+				side = -1;
+			} else {
+				a = c;
+				fa = fc;
+				if (side == +1)
+					fb /= 2;
+				side = +1;
+			}
+		}
+		return b;
+	}
+
+	/**
+	 Move the current state back to the fraction (0 - 1) of the current step,
+	 shortening the current step and the trajectory length accordingly.
+	 Used by observers and boundaries to report the state at the crossing.
+	 */
+	void truncateStep(double fraction);
+
 	/**
 	 Sets the proposed next step.
 	 Only the propagation module should use this.
@@ -93,6 +192,15 @@ public:
 	 */
 	void limitNextStep(double step);
 
+	/**
+	 Properties by interned key (see propertyKey), for modules that set or read properties in every step.
+	 */
+	void setProperty(PropertyKey key, const Variant &value);
+	const Variant &getProperty(PropertyKey key) const;
+	bool removeProperty(PropertyKey key);
+	bool hasProperty(PropertyKey key) const;
+
+	/** Properties by name, looked up in the keys cached by the calling thread; only setProperty registers new names */
 	void setProperty(const std::string &name, const Variant &value);
 	const Variant &getProperty(const std::string &name) const;
 	bool removeProperty(const std::string &name);
@@ -120,6 +228,14 @@ public:
 	uint64_t getSerialNumber() const;
 	void setSerialNumber(const uint64_t snr);
 
+	/**
+	 Random numbers of the candidate. The stream is keyed by RandomStream::getRunSeed() and the serial number, and
+	 restarts when the serial number is set. Secondaries added with addSecondary get a stream split from this one
+	 by their index, so that the random numbers of a tree do not depend on the order in which it is propagated.
+	 */
+	RandomStream &getRandomStream();
+	void setRandomStream(const RandomStream &stream);
+
 	/** Serial number of candidate at source*/
 	uint64_t getSourceSerialNumber() const;
 
@@ -145,6 +261,39 @@ public:
 	void restart();
 };
 
+/**
+ @class CandidatePool
+ @brief Per-thread free lists of candidates, which are reused instead of allocated
+
+ Candidates acquired from the pool whose last reference is removed are returned to the free list of the calling thread, with their
+ secondaries released and the property map cleared, but the memory of both kept. acquire takes a candidate from
+ the free list and resets it to the state of a new candidate, so that steady-state propagation does not need
+ the global allocator, which is a contention point between the OpenMP threads.
+ Sources, secondaries and clones are acquired from the pool. Candidates created with new are deleted as usual.\n
+ Candidates may be released by another thread than the one that acquired them, they then move to the free list
+ of that thread. The number of candidates kept per thread is limited by the capacity (1024 by default),
+ surplus candidates are deleted.
+ */
+class CandidatePool {
+	static void recycle(Candidate *candidate);
+	friend class Candidate;
+
+public:
+	static ref_ptr<Candidate> acquire(const ParticleState &state = ParticleState());
+
+	/** Maximum number of free candidates kept per thread, 0 disables the pool */
+	static void setCapacity(size_t capacity);
+	static size_t getCapacity();
+	/** Delete the free candidates of the calling thread */
+	static void clear();
+
+	/** Number of candidates allocated by acquire, summed over all threads since the last resetStatistics */
+	static size_t getAllocations();
+	/** Number of candidates reused by acquire, summed over all threads since the last resetStatistics */
+	static size_t getReuses();
+	static void resetStatistics();
+};
+
 } // namespace radiopropa
 
 #endif // CRPROPA_CANDIDATE_H
@@ -1,6 +1,8 @@
 #ifndef CRPROPA_COMMON_H
 #define CRPROPA_COMMON_H
 
+#include "radiopropa/Units.h"
+
 #include <string>
 #include <vector>
 
@@ -11,6 +13,9 @@
 
 namespace radiopropa {
 
+// Steps starting closer than this to an observer plane, an interface or a surface have just left it
+static const double surfaceEpsilon = 1e-9 * meter;
+
 // Returns the full path to a CRPropa data file
 std::string getDataPath(std::string filename);
 
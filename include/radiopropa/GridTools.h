@@ -2,6 +2,7 @@
 #define CRPROPA_GRIDTOOLS_H
 
 #include "radiopropa/Grid.h"
+#include "radiopropa/ScalarField.h"
 #include "radiopropa/magneticField/MagneticField.h"
 #include <string>
 
@@ -16,6 +17,10 @@
  Vector components are stored per grid point in xyz-order.
  In case of plain-text files the vector components are separated by a blank or tab and grid points are stored one per line.
  All functions offer a conversion factor that is multiplied to all values.
+
+ Any ScalarField, including fields implemented in Python, can be baked into a ScalarFieldGrid or a
+ TabulatedDepthProfile, which are evaluated natively during the propagation.
+ A baked grid can be saved together with its volume and reloaded.
  */
 
 namespace radiopropa {
@@ -61,6 +66,47 @@ void fromMagneticField(ref_ptr<VectorGrid> grid, ref_ptr<MagneticField> field);
 /** Fill scalar grid from provided magnetic field */
 void fromMagneticFieldStrength(ref_ptr<ScalarGrid> grid, ref_ptr<MagneticField> field);
 
+/**
+ Fill a scalar grid with the values of a scalar field at the cell centers.
+ The field is evaluated one z-column at a time with ScalarField::getValues.
+ @param parallel	evaluate the columns in parallel with OpenMP, requires a thread-safe field
+ */
+void fromScalarField(ref_ptr<ScalarGrid> grid, ref_ptr<ScalarField> field,
+		bool parallel = true);
+
+/**
+ Sample a scalar field on Nx * Ny * Nz cell centers of a volume and return the interpolated grid field.
+ With Ny = 1 the result does not depend on y and is effectively a 2-D table in x and z.
+ @param origin	lower corner of the volume
+ @param extent	size of the volume along each axis
+ @param parallel	evaluate in parallel with OpenMP, requires a thread-safe field
+ */
+ref_ptr<ScalarFieldGrid> bakeScalarField(ref_ptr<ScalarField> field,
+		Vector3d origin, Vector3d extent, size_t Nx, size_t Ny, size_t Nz,
+		bool parallel = true);
+
+/**
+ Sample a scalar field at depths zMin ... zMax (inclusive) on the vertical through position
+ and return the interpolated depth profile.
+ @param parallel	evaluate in parallel with OpenMP, requires a thread-safe field
+ */
+ref_ptr<TabulatedDepthProfile> bakeDepthProfile(ref_ptr<ScalarField> field,
+		double zMin, double zMax, size_t samples,
+		Vector3d position = Vector3d(0.), bool parallel = true);
+
+/** Save a ScalarFieldGrid with its volume to a binary file */
+void dumpScalarFieldGrid(ref_ptr<ScalarFieldGrid> field, std::string filename);
+
+/** Load a ScalarFieldGrid saved with dumpScalarFieldGrid */
+ref_ptr<ScalarFieldGrid> loadScalarFieldGrid(std::string filename);
+
+/** Save the samples of a TabulatedDepthProfile to a plain text file */
+void dumpDepthProfile(ref_ptr<TabulatedDepthProfile> profile,
+		std::string filename);
+
+/** Load a TabulatedDepthProfile from a plain text file with columns z and n */
+ref_ptr<TabulatedDepthProfile> loadDepthProfile(std::string filename);
+
 /** Load a VectorGrid from a binary file with single precision */
 void loadGrid(ref_ptr<VectorGrid> grid, std::string filename,
 		double conversion = 1);
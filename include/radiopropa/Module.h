@@ -6,6 +6,7 @@
 #include "radiopropa/Common.h"
 
 #include <string>
+#include <vector>
 
 namespace radiopropa {
 
@@ -27,8 +28,32 @@ public:
 	inline void process(ref_ptr<Candidate> candidate) const {
 		process(candidate.get());
 	}
+
+	/**
+	 Process a block of candidates at once.
+	 The default implementation calls process() for each candidate. Modules
+	 that can operate on many rays in lockstep (e.g. PropagationBatchCK)
+	 override this.
+	 */
+	virtual void processBatch(const std::vector<Candidate *> &candidates) const;
+
+	/**
+	 Whether the module calls objects implemented in Python (see isPythonObject), e.g. its refractivity field,
+	 observer features or other modules. Modules holding such objects override this, the default is false.
+	 */
+	virtual bool usesPythonObjects() const;
 };
 
+/**
+ Whether an object is implemented in Python, i.e. calls to it need the GIL.
+ The check is installed by the Python bindings, without them no object is a Python object.
+ */
+bool isPythonObject(const Referenced *object);
+void setPythonObjectCheck(bool (*check)(const Referenced *object));
+
+/** Whether a module is implemented in Python or calls objects that are (see Module::usesPythonObjects) */
+bool isPythonModule(const Module *module);
+
 
 /**
  @class AbstractCondition
@@ -40,6 +65,7 @@ protected:
 	bool makeRejectedInactive, makeAcceptedInactive;
 	std::string rejectFlagKey, rejectFlagValue;
 	std::string acceptFlagKey, acceptFlagValue;
+	PropertyKey rejectFlagProperty, acceptFlagProperty; /*< interned flag keys */
 
 	void reject(Candidate *candidate) const;
 	inline void reject(ref_ptr<Candidate> candidate) const {
@@ -59,6 +85,7 @@ public:
 	void setMakeAcceptedInactive(bool makeInactive);
 	void setRejectFlag(std::string key, std::string value);
 	void setAcceptFlag(std::string key, std::string value);
+	bool usesPythonObjects() const;
 };
 
 } // namespace radiopropa
@@ -7,6 +7,7 @@
 
 #include <list>
 #include <sstream>
+#include <vector>
 
 namespace radiopropa {
 
@@ -19,10 +20,58 @@ public:
 	typedef std::list<ref_ptr<Module> > module_list_t;
 	typedef std::vector<ref_ptr<Candidate> > candidate_vector_t;
 
+	/**
+	 Distribution of the candidates on the threads in run.
+	 The propagation time of the candidates varies by orders of magnitude, e.g. rays absorbed at the surface and rays
+	 bouncing for kilometres, which leaves threads idle with a static schedule.
+	 */
+	enum Schedule {
+		StaticSchedule, ///< chunks of chunkSize candidates assigned round robin before the run
+		DynamicSchedule, ///< chunks of chunkSize candidates handed to the next idle thread
+		GuidedSchedule, ///< like DynamicSchedule, with chunks shrinking from the remaining count per thread to chunkSize
+		WorkStealingSchedule ///< a contiguous share per thread, processed in chunks; idle threads steal half of the remaining share of another thread
+	};
+
+	/**
+	 Treatment of Python modules (see isPythonModule) and sources in parallel runs.
+	 Each call of a Python module acquires the GIL, which serializes the threads and can make a parallel run
+	 slower than a serial one.
+	 */
+	enum PythonModulePolicy {
+		PythonSerial, ///< run on a single thread if the list contains Python modules
+		PythonParallel, ///< run on all threads anyway, e.g. if the Python modules are cheap compared to the propagation
+		PythonFail ///< throw if a parallel run would call Python modules
+	};
+
 	ModuleList();
 	virtual ~ModuleList();
 	void setShowProgress(bool show = true); ///< activate a progress bar
 
+	/** Set the schedule of run for candidate vectors and sources, the default is DynamicSchedule with chunks of 1 */
+	void setSchedule(Schedule schedule, std::size_t chunkSize = 1);
+	Schedule getSchedule() const;
+	std::size_t getChunkSize() const;
+	/** Wall-clock time in seconds that each thread spent propagating candidates in the last parallel run */
+	std::vector<double> getThreadBusyTimes() const;
+
+	/**
+	 Propagate the secondaries of a finished candidate (e.g. the transmitted and reflected parts created at interfaces)
+	 as OpenMP tasks, so that the tree of secondaries of one primary is shared by all threads.
+	 run returns when the whole tree is finished, the parent/child relations in Candidate::secondaries are kept.
+	 Outside of a parallel run a team of threads is started for the tree, unless the list contains Python modules
+	 and the policy is not PythonParallel. Disabled by default, since the modules then have to be thread safe even
+	 if a single candidate is run. Has no effect if secondariesFirst is set.
+	 */
+	void setParallelSecondaries(bool parallel = true);
+	bool getParallelSecondaries() const;
+
+	/** Set the treatment of Python modules in parallel runs, the default is PythonSerial */
+	void setPythonModulePolicy(PythonModulePolicy policy);
+	PythonModulePolicy getPythonModulePolicy() const;
+	/** Whether the list contains a Python module or a module that calls Python objects (see isPythonModule) */
+	bool hasPythonModules() const;
+	bool usesPythonObjects() const;
+
 	void add(Module* module);
 	void remove(std::size_t i);
 	std::size_t size() const;
@@ -30,12 +79,23 @@ public:
 
 	void process(Candidate* candidate) const; ///< call process in all modules
 	void process(ref_ptr<Candidate> candidate) const; ///< call process in all modules
+	void processBatch(const std::vector<Candidate *> &candidates) const; ///< call processBatch in all modules
 
 	void run(Candidate* candidate, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a single candidate
 	void run(ref_ptr<Candidate> candidate, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a single candidate
 	void run(candidate_vector_t &candidates, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a candidate vector
 	void run(SourceInterface* source, size_t count, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a number of candidates from the given source
 
+	/**
+	 Run simulation for a candidate vector, propagating blocks of batchSize
+	 candidates in lockstep through processBatch. Finished candidates are
+	 removed from their block after each step; secondaries are run
+	 individually once their block has finished.
+	 Blocks of 64 to 128 candidates keep the stage buffers of
+	 PropagationBatchCK in the L1/L2 cache.
+	 */
+	void runBatch(candidate_vector_t &candidates, size_t batchSize = 64, bool recursive = true);
+
 	std::string getDescription() const;
 	void showModules() const;
 	
@@ -50,6 +110,17 @@ public:
 private:
 	module_list_t modules;
 	bool showProgress;
+	Schedule schedule;
+	std::size_t chunkSize;
+	std::vector<double> busyTimes;
+	bool parallelSecondaries;
+	PythonModulePolicy pythonModulePolicy;
+
+	int getNumberOfThreads(const SourceInterface *source = 0) const;
+	void runSecondaries(Candidate *candidate);
+
+	template<typename Task>
+	void runScheduled(std::size_t count, int nThreads, Task &task);
 };
 
 /**
@@ -13,17 +13,16 @@ namespace radiopropa {
  is assumed to be traveling at the exact speed of light.
  The cosmic ray state is defined by particle ID, frequency and position and
  direction vector.
- For faster lookup mass and charge of the particle are stored as members.
+ Mass and charge are derived from the particle ID when needed, they are meaningless for radio rays and
+ storing them would enlarge each of the four states of every Candidate.
  */
 class ParticleState {
 private:
-	int id; ///< particle ID (Particle Data Group numbering scheme)
-	double frequency; ///< total frequency
-	double amplitude; ///< total frequency
 	Vector3d position; ///< position vector in comoving coordinates
 	Vector3d direction; ///< unit vector of velocity or momentum
-	double pmass; ///< particle rest mass
-	double charge; ///< particle charge
+	double frequency; ///< total frequency
+	double amplitude; ///< total frequency
+	int id; ///< particle ID (Particle Data Group numbering scheme)
 
 public:
 	ParticleState(int id = 0, double frequency = 0,
@@ -0,0 +1,110 @@
+#ifndef CRPROPA_PROPERTYMAP_H
+#define CRPROPA_PROPERTYMAP_H
+
+#include "radiopropa/Variant.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace radiopropa {
+
+/** Interned identifier of a property name, see propertyKey */
+typedef unsigned int PropertyKey;
+
+/**
+ Interned key of a property name, registered on first use.
+ Each thread caches the registered keys, so that only the registration of a new name and the first lookup of
+ names registered by other threads take a lock. Modules still look up their keys once (e.g. when the name is set)
+ and use the key API of Candidate while processing.
+ */
+PropertyKey propertyKey(const std::string &name);
+/** Key of a property name without registering it, false if the name was never registered */
+bool findPropertyKey(const std::string &name, PropertyKey &key);
+/** Name of an interned property key, read from the cache of the calling thread */
+const std::string &propertyName(PropertyKey key);
+
+/**
+ @class PropertyMap
+ @brief Properties of a candidate by interned key
+
+ The first properties are stored in an inline slot array, so that the usual handful of flags and indices
+ needs no heap allocation, further properties go to an overflow vector. Lookups compare integer keys only.
+ The order of the properties is not preserved when one is removed.\n
+ For compatibility with the former map of names, const_iterator yields the name as first and the value as second.
+ */
+class PropertyMap {
+public:
+	static const size_t slots = 4; ///< number of properties stored inline
+
+	/** Name and value of a property, as dereferenced from a const_iterator */
+	struct Entry {
+		const std::string &first;
+		const Variant &second;
+		Entry(const std::string &first, const Variant &second) :
+				first(first), second(second) {
+		}
+		const Entry *operator->() const {
+			return this;
+		}
+	};
+
+	class const_iterator {
+		const PropertyMap *map;
+		size_t i;
+	public:
+		const_iterator(const PropertyMap *map = 0, size_t i = 0) :
+				map(map), i(i) {
+		}
+		Entry operator*() const {
+			return Entry(propertyName(map->getKey(i)), map->getValue(i));
+		}
+		Entry operator->() const {
+			return **this;
+		}
+		const_iterator &operator++() {
+			i++;
+			return *this;
+		}
+		const_iterator operator++(int) {
+			const_iterator previous = *this;
+			i++;
+			return previous;
+		}
+		bool operator==(const const_iterator &other) const {
+			return (map == other.map) && (i == other.i);
+		}
+		bool operator!=(const const_iterator &other) const {
+			return !(*this == other);
+		}
+	};
+
+	PropertyMap();
+
+	const_iterator begin() const;
+	const_iterator end() const;
+
+	size_t size() const;
+	bool empty() const;
+	/** Key and value of the i-th property */
+	PropertyKey getKey(size_t i) const;
+	const Variant &getValue(size_t i) const;
+
+	/** Value of a property, 0 if it is not set */
+	const Variant *find(PropertyKey key) const;
+	Variant *find(PropertyKey key);
+	void set(PropertyKey key, const Variant &value);
+	/** Remove a property, false if it was not set */
+	bool erase(PropertyKey key);
+	void clear();
+
+private:
+	PropertyKey keys[slots];
+	Variant values[slots];
+	size_t count; /*< number of used slots */
+	std::vector<std::pair<PropertyKey, Variant> > overflow;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_PROPERTYMAP_H
@@ -70,6 +70,7 @@
 #include <cmath>
 #include <stdexcept>
 #include <algorithm>
+#include <vector>
 
 #include <stdint.h>
 
@@ -160,6 +161,8 @@ public:
 	double randBrokenPowerLaw(double index1, double index2, double breakpoint, double min, double max );
 
 	/// Seed the generator with a simple uint32
+	/// For the instance() of the master thread this also sets the run seed of RandomStream,
+	/// from which sources and candidates draw their random numbers
 	void seed( const uint32 oneSeed );
 	/// Seed the generator with an array of uint32's
 	/// There are 2^19937-1 possible initial states.  This function allows
@@ -178,7 +181,9 @@ public:
 	friend std::ostream& operator<<( std::ostream& os, const Random& mtrand );
 	friend std::istream& operator>>( std::istream& is, Random& mtrand );
 
+	/// Generator of the calling thread, created on first use
 	static Random &instance();
+	/// Seed the generator of thread i with oneSeed + i, and set the run seed of RandomStream
 	static void seedThreads(const uint32 oneSeed);
 	
 protected:
@@ -215,6 +220,87 @@ protected:
 
 };
 
+/**
+ @class RandomStream
+ @brief Counter-based random number generator (Philox4x32-10)
+
+ The n-th 32-bit number of a stream is a function of the seed, the stream id and n only, computed by ten rounds
+ of the Philox4x32 bijection of Salmon et al., "Parallel random numbers: as easy as 1, 2, 3" (SC11), with the
+ seed as key and the counter (n / 4, stream id) as block.
+ The state is a few words, streams are independent of each other and of the order in which they are drawn from,
+ and any position in a stream is reached in constant time.\n
+ Each Candidate owns a stream keyed by the run seed and its serial number, secondaries added with
+ Candidate::addSecondary continue with a stream split from their parent.
+ ModuleList::run(SourceInterface*, ...) draws candidate i from the stream of its serial number, so that a run gives
+ bit-identical results for any number of threads, provided the run seed is set.
+ The magnetic lens, which samples outside of a run, still draws from Random.
+ */
+class RandomStream {
+public:
+	RandomStream(uint64_t seed = 0, uint64_t stream = 0, uint64_t counter = 0);
+
+	/// Select the stream and the position in it (number of 32-bit numbers drawn)
+	void seed(uint64_t seed, uint64_t stream, uint64_t counter = 0);
+	uint64_t getSeed() const;
+	uint64_t getStream() const;
+	uint64_t getCounter() const;
+	void setCounter(uint64_t counter);
+
+	/// Independent stream with the same seed, e.g. for the i-th secondary of a candidate
+	RandomStream split(uint64_t i) const;
+
+	uint32_t randInt(); ///< integer in [0,2^32-1]
+	uint32_t randInt(uint32_t n); ///< integer in [0,n]
+	double rand(); ///< real number in [0,1)
+	double randDblExc(); ///< real number in (0,1)
+	double operator()() {return rand();} ///< same as rand()
+
+	/// Normal distributed random number (the second parameter is the standard deviation, as for Random)
+	double randNorm(double mean = 0.0, double variance = 1.0);
+	double randUniform(double min, double max);
+	double randExponential();
+	double randPowerLaw(double index, double min, double max);
+	size_t randBin(const std::vector<float> &cdf);
+	size_t randBin(const std::vector<double> &cdf);
+	Vector3d randVector();
+	Vector3d randVectorAroundMean(const Vector3d &meanDirection, double angle);
+	Vector3d randConeVector(const Vector3d &meanDirection, double angularRadius);
+	Vector3d randomInterpolatedPosition(const Vector3d &a, const Vector3d &b);
+
+	/// Fill with the next count numbers of rand(), generating many blocks per call of the Philox rounds
+	void fillUniform(double *values, size_t count);
+	/// Fill with normal distributed numbers, using both values of each Box-Muller pair
+	void fillNormal(double *values, size_t count, double mean = 0.0, double sigma = 1.0);
+
+	/// Seed of the streams of new candidates and of the thread streams.
+	/// Drawn from /dev/urandom at startup unless set here, by Random::seedThreads or by seeding
+	/// Random::instance() on the master thread; set it for reproducible runs
+	static void setRunSeed(uint64_t seed);
+	static uint64_t getRunSeed();
+
+	/// Stream of the calling thread: the stream of the candidate within ModuleList::run, else one stream per thread
+	static RandomStream &instance();
+
+	/**
+	 @class Scope
+	 @brief Makes a stream the instance of the calling thread for its lifetime
+	 */
+	class Scope {
+		RandomStream *previous;
+	public:
+		Scope(RandomStream &stream);
+		~Scope();
+	};
+
+private:
+	uint64_t key;
+	uint64_t stream;
+	uint64_t counter;
+	uint32_t buffer[4]; // block (counter / 4)
+
+	void generate();
+};
+
 } //namespace radiopropa
 
 #endif  // RANDOM_H
@@ -0,0 +1,121 @@
+#ifndef CRPROPA_RAYSOLVER_H
+#define CRPROPA_RAYSOLVER_H
+
+#include "radiopropa/Referenced.h"
+#include "radiopropa/ScalarField.h"
+#include "radiopropa/Units.h"
+#include "radiopropa/Vector3.h"
+
+#include <vector>
+
+namespace radiopropa {
+
+/**
+ @class RaySolution
+ @brief A ray connecting an emitter and a receiver
+ */
+class RaySolution {
+public:
+	enum Type {
+		Direct, /*< no turning point and no reflection */
+		Refracted, /*< turning point inside the medium */
+		Reflected /*< reflected at the surface */
+	};
+
+	Type type;
+	Vector3d launchDirection; /*< direction at the emitter */
+	Vector3d receiveDirection; /*< direction at the receiver */
+	double pathLength; /*< c times the propagation time */
+	double launchAngle; /*< zenith angle of the launch direction [rad] */
+	int reflections; /*< number of surface reflections */
+
+	RaySolution() :
+			type(Direct), pathLength(0), launchAngle(0), reflections(0) {
+	}
+};
+
+/**
+ @class RaySolver
+ @brief Finds all rays connecting an emitter and a receiver in a z-stratified medium.
+
+ In a medium whose refractive index depends only on z the ray stays in the vertical plane containing emitter and receiver.
+ The ray is traced in this plane as a function of the horizontal distance r, so that every ray ends exactly at the horizontal
+ distance of the receiver. The depth reached there is a continuous function of the launch angle, whose roots are bracketed
+ by scanning the launch angle and then refined with the secant method (Illinois variant), which keeps the bracket.\n
+ Rays reaching the surface at z = surface are reflected if the surface is reflective (default), which yields the
+ surface-reflected solutions. If the emitter or the receiver is above the surface, e.g. a surface antenna, the rays
+ are not reflected but traced through the surface according to the field.\n
+ Many emitter-receiver pairs are solved in parallel with OpenMP.
+ */
+class RaySolver: public Referenced {
+public:
+	/** Depth, vertical slowness and path length of a ray */
+	class State {
+	public:
+		double z, p, s;
+		State(double z = 0, double p = 0, double s = 0) :
+				z(z), p(p), s(s) {
+		}
+	};
+
+private:
+	ref_ptr<ScalarField> field;
+	double surface; /*< depth of the surface */
+	bool reflective; /*< reflect rays at the surface */
+	size_t samples; /*< number of launch angles scanned for brackets */
+	double tolerance; /*< target error of the ray integration */
+	double accuracy; /*< maximum depth mismatch at the receiver */
+	size_t maxSteps; /*< maximum number of integration steps per ray */
+
+	State dYdr(const State &y, const Vector3d &position, double beta) const;
+	State tryStep(const State &y, double r, double h, const Vector3d &start,
+			const Vector3d &horizontal, double beta, State &error) const;
+	bool trace(const Vector3d &start, const Vector3d &horizontal, double distance,
+			double theta, bool reflect, State &state, int &reflections,
+			bool &turned) const;
+	double verticalPathLength(const Vector3d &start, double z) const;
+
+public:
+	RaySolver(ref_ptr<ScalarField> field = NULL, double surface = 0);
+
+	/**
+	 Trace a ray in the vertical plane through start along horizontal to the
+	 horizontal distance distance. Returns false if the ray did not arrive
+	 within the maximum number of steps. Rays starting above the surface are
+	 not reflected.
+	 @param theta	zenith angle of the launch direction
+	 @param state	depth, vertical slowness and path length at the end
+	 @param reflections	number of surface reflections on the way
+	 @param turned	true if the ray changed its vertical direction inside the medium
+	 */
+	bool trace(const Vector3d &start, const Vector3d &horizontal, double distance,
+			double theta, State &state, int &reflections, bool &turned) const;
+
+	/** All rays connecting emitter and receiver, ordered by path length */
+	std::vector<RaySolution> solve(const Vector3d &emitter,
+			const Vector3d &receiver) const;
+
+	/** Solve the pairs (emitters[i], receivers[i]) in parallel */
+	std::vector<std::vector<RaySolution> > solve(
+			const std::vector<Vector3d> &emitters,
+			const std::vector<Vector3d> &receivers) const;
+
+	void setField(ref_ptr<ScalarField> field);
+	void setSurface(double surface);
+	void setReflectiveSurface(bool reflective);
+	void setSamples(size_t samples);
+	void setTolerance(double tolerance);
+	void setAccuracy(double accuracy);
+	void setMaximumSteps(size_t maxSteps);
+
+	double getSurface() const;
+	bool isReflectiveSurface() const;
+	size_t getSamples() const;
+	double getTolerance() const;
+	double getAccuracy() const;
+	size_t getMaximumSteps() const;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_RAYSOLVER_H
@@ -68,7 +68,7 @@ public:
 #endif
 
 		if (newRef == 0) {
-			delete this;
+			dispose();
 		}
 		return newRef;
 	}
@@ -83,6 +83,11 @@ public:
 
 protected:
 
+	/** Called when the last reference is removed, deletes the object unless a derived class recycles it */
+	virtual void dispose() const {
+		delete this;
+	}
+
 	virtual inline ~Referenced() {
 #ifdef DEBUG
 		if (_referenceCount)
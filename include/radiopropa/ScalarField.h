@@ -4,6 +4,10 @@
 #include "radiopropa/Units.h"
 #include "radiopropa/Vector3.h"
 #include "radiopropa/Referenced.h"
+#include "radiopropa/Grid.h"
+
+#include <cstddef>
+#include <vector>
 
 #ifdef CRPROPA_HAVE_MUPARSER
 #include "muParser.h"
@@ -21,6 +25,32 @@ public:
 	}
 	virtual double getValue(const Vector3d &position) const {return 1.;};
 	virtual Vector3d getGradient(const Vector3d &position) const {return Vector3d(1,0,0);};
+
+	/**
+	 Evaluate field and gradient at the same position in one call.
+	 The default implementation calls getValue and getGradient, so fields
+	 that only implement those (e.g. Python subclasses) keep working.
+	 Fields whose value and gradient share expensive terms override it.
+	 */
+	virtual void getValueAndGradient(const Vector3d &position, double &value,
+			Vector3d &gradient) const;
+
+	/**
+	 Evaluate the field at count positions given as separate coordinate arrays.
+	 The default implementation loops over getValue; fields with a cheap
+	 closed form override it with a vectorizable loop.
+	 */
+	virtual void getValues(size_t count, const double *x, const double *y,
+			const double *z, double *values) const;
+
+	/**
+	 Evaluate field and gradient at count positions given as separate
+	 coordinate arrays. The default implementation loops over
+	 getValueAndGradient.
+	 */
+	virtual void getValuesAndGradients(size_t count, const double *x,
+			const double *y, const double *z, double *values, double *gx,
+			double *gy, double *gz) const;
 };
 
 
@@ -33,6 +63,13 @@ public:
 	virtual ~LinearIncrease();
 	virtual double getValue(const Vector3d &position) const;
 	virtual Vector3d getGradient(const Vector3d &position) const;
+	virtual void getValueAndGradient(const Vector3d &position, double &value,
+			Vector3d &gradient) const;
+	virtual void getValues(size_t count, const double *x, const double *y,
+			const double *z, double *values) const;
+	virtual void getValuesAndGradients(size_t count, const double *x,
+			const double *y, const double *z, double *values, double *gx,
+			double *gy, double *gz) const;
 };
 
 /**
@@ -48,6 +85,13 @@ class GorhamIceModel: public ScalarField
 		virtual ~GorhamIceModel();
 		virtual double getValue(const Vector3d &position) const;
 		virtual Vector3d getGradient(const Vector3d &position) const;
+		virtual void getValueAndGradient(const Vector3d &position, double &value,
+				Vector3d &gradient) const;
+		virtual void getValues(size_t count, const double *x, const double *y,
+				const double *z, double *values) const;
+		virtual void getValuesAndGradients(size_t count, const double *x,
+				const double *y, const double *z, double *values, double *gx,
+				double *gy, double *gz) const;
 };
 
 
@@ -69,11 +113,94 @@ public:
 	n2linear(double _n0, double _a);
 
 	virtual ~n2linear();
+	double getN0() const; ///< refractive index at z = 0
+	double getA() const; ///< slope of n^2 in z
 	virtual double getValue(const Vector3d &position) const;
 	virtual Vector3d getGradient(const Vector3d &position) const;
+	virtual void getValueAndGradient(const Vector3d &position, double &value,
+			Vector3d &gradient) const;
+	virtual void getValues(size_t count, const double *x, const double *y,
+			const double *z, double *values) const;
+	virtual void getValuesAndGradients(size_t count, const double *x,
+			const double *y, const double *z, double *values, double *gx,
+			double *gy, double *gz) const;
 };
 
 
+/**
+ @class ScalarFieldGrid
+ @brief Scalar field given by a ScalarGrid, e.g. a measured or simulated refractive index map
+
+ The field is interpolated trilinearly between the grid samples and the gradient is the exact derivative
+ of the interpolation weights, so that value and gradient are consistent.
+ The volume covered by the grid is given per axis by an origin and an extent, the samples are placed at the
+ centers of the Nx * Ny * Nz cells as in Grid. By default the volume of the grid itself is used.
+ Outside of the outermost samples the field is clamped to the edge values (constant along the clamped axis),
+ instead of being continued periodically.
+ */
+class ScalarFieldGrid: public ScalarField {
+	ref_ptr<ScalarGrid> grid;
+	Vector3d origin; /*< lower corner of the volume */
+	Vector3d extent; /*< size of the volume along each axis */
+	Vector3d spacing; /*< distance between samples along each axis */
+
+	void updateSpacing();
+public:
+	ScalarFieldGrid(ref_ptr<ScalarGrid> grid);
+	ScalarFieldGrid(ref_ptr<ScalarGrid> grid, const Vector3d &origin,
+			const Vector3d &extent);
+	void setGrid(ref_ptr<ScalarGrid> grid);
+	ref_ptr<ScalarGrid> getGrid();
+	void setOrigin(const Vector3d &origin);
+	void setExtent(const Vector3d &extent);
+	Vector3d getOrigin() const;
+	Vector3d getExtent() const;
+
+	virtual double getValue(const Vector3d &position) const;
+	virtual Vector3d getGradient(const Vector3d &position) const;
+	virtual void getValueAndGradient(const Vector3d &position, double &value,
+			Vector3d &gradient) const;
+};
+
+/**
+ @class TabulatedDepthProfile
+ @brief Refractive index profile n(z) tabulated at depths z, e.g. from density logs
+
+ The samples are connected by a piecewise cubic Hermite interpolant, which does not overshoot between the samples
+ and has a continuous gradient. The slope at an inner sample is the harmonic mean of the neighbouring secants
+ with the Brodlie weights (as in PCHIP), or zero at a local extremum; the slopes at the ends are the end secants.
+ The spline is built once in the constructor.
+ At run time the interval containing z is found through a table of uniform bins no wider than the closest
+ pair of samples, so that the lookup is O(1) without a binary search.
+ Above and below the tabulated range the profile is continued with the edge values.
+ */
+class TabulatedDepthProfile: public ScalarField {
+	std::vector<double> z, n; /*< samples */
+	std::vector<double> c1, c2, c3; /*< cubic coefficients of the intervals */
+	std::vector<size_t> bins; /*< first interval of each uniform bin */
+	double binOrigin, binScale; /*< lower edge and inverse width of the bins */
+
+	size_t findInterval(double z) const;
+public:
+	/**
+	 @param z	depths of the samples, strictly increasing
+	 @param n	refractive index at the depths
+	 */
+	TabulatedDepthProfile(const std::vector<double> &z,
+			const std::vector<double> &n);
+	const std::vector<double> &getDepths() const;
+	const std::vector<double> &getIndices() const;
+
+	virtual double getValue(const Vector3d &position) const;
+	virtual Vector3d getGradient(const Vector3d &position) const;
+	virtual void getValueAndGradient(const Vector3d &position, double &value,
+			Vector3d &gradient) const;
+	virtual void getValues(size_t count, const double *x, const double *y,
+			const double *z, double *values) const;
+	virtual void getValuesAndGradients(size_t count, const double *x,
+			const double *y, const double *z, double *values, double *gx,
+			double *gy, double *gz) const;
+};
 
 } // namespace radiopropa
 
@@ -0,0 +1,101 @@
+#ifndef CRPROPA_SCENE_H
+#define CRPROPA_SCENE_H
+
+#include "radiopropa/Referenced.h"
+#include "radiopropa/Vector3.h"
+
+#include <string>
+#include <vector>
+
+namespace radiopropa {
+
+/**
+ @class Scene
+ @brief Geometric primitives of the boundaries and observers of a simulation, sorted into one acceleration structure
+
+ Each boundary or observer registers its surfaces with addToScene (or they are added directly), and a single query
+ returns a lower bound of the distance from a position to the nearest surface and the index of that primitive.
+ The bounded primitives are sorted into a bounding volume hierarchy, so that the cost of a query grows
+ logarithmically with the number of primitives; unbounded planes are tested one by one.
+ The hierarchy is built by the first query after primitives were added, or explicitly with build(). SceneStepLimiter
+ builds it when the scene is set, so that queries from parallel threads only read the scene.\n
+ The distances are exact for planes, spheres, boxes, cylinders, discs and rectangles. For ellipsoids the distance is
+ bounded from below by half of the difference between the sum of the distances to the focal points and the major axis.
+ */
+class Scene: public Referenced {
+public:
+	enum Type {
+		PlanePrimitive,
+		SpherePrimitive,
+		BoxPrimitive,
+		EllipsoidPrimitive,
+		CylinderPrimitive,
+		DiscPrimitive,
+		RectanglePrimitive
+	};
+
+private:
+	/** Parameters of a primitive, the meaning depends on the type */
+	struct Primitive {
+		Type type;
+		Vector3d a, b, c;
+		double r, s;
+	};
+
+	/** Node of the bounding volume hierarchy */
+	struct Node {
+		Vector3d lower, upper; /*< bounding box */
+		unsigned int start; /*< first primitive of a leaf, or index of the second child */
+		unsigned int count; /*< number of primitives of a leaf, 0 for inner nodes */
+	};
+
+	std::vector<Primitive> primitives;
+	std::vector<unsigned int> bounded; /*< bounded primitives in hierarchy order */
+	std::vector<unsigned int> unbounded; /*< planes */
+	std::vector<Vector3d> lowers, uppers; /*< bounding boxes of the primitives */
+	std::vector<Node> nodes;
+	int built; /*< whether the hierarchy contains all primitives, published atomically */
+
+	size_t add(const Primitive &primitive, const Vector3d &lower,
+			const Vector3d &upper);
+	bool isBuilt() const;
+	unsigned int buildNode(unsigned int first, unsigned int count);
+
+public:
+	Scene();
+
+	/** Sort the primitives into the bounding volume hierarchy, if primitives were added since the last build */
+	void build();
+
+	/** Plane through origin with the given normal */
+	size_t addPlane(Vector3d origin, Vector3d normal);
+	size_t addSphere(Vector3d center, double radius);
+	/** Axis-aligned box from origin to origin + size */
+	size_t addBox(Vector3d origin, Vector3d size);
+	/** Ellipsoid of revolution given by two focal points and the major axis (sum of the distances to the focal points) */
+	size_t addEllipsoid(Vector3d focalPoint1, Vector3d focalPoint2,
+			double majorAxis);
+	/** Cylinder along z, centered at origin */
+	size_t addCylinder(Vector3d origin, double height, double radius);
+	size_t addDisc(Vector3d center, Vector3d normal, double radius);
+	/** Rectangle spanned by two perpendicular edges u and v from a corner */
+	size_t addRectangle(Vector3d corner, Vector3d u, Vector3d v);
+
+	/** Lower bound of the distance of a position to the surface of one primitive */
+	double distanceTo(size_t primitive, const Vector3d &position) const;
+
+	/**
+	 Lower bound of the distance of a position to the nearest surface in the scene, infinite for an empty scene.
+	 @param primitive	index of the nearest primitive
+	 */
+	double distance(const Vector3d &position, size_t &primitive) const;
+	double distance(const Vector3d &position) const;
+
+	size_t getNumberOfPrimitives() const;
+	Type getType(size_t primitive) const;
+	std::string getDescription() const;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_SCENE_H
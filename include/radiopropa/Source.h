@@ -32,6 +32,8 @@ class SourceInterface : public Referenced {
 public:
 	virtual ref_ptr<Candidate> getCandidate() const = 0;
 	virtual std::string getDescription() const = 0;
+	/** Whether the source calls objects implemented in Python, e.g. its features (see isPythonObject) */
+	virtual bool usesPythonObjects() const;
 };
 
 /**
@@ -48,6 +50,7 @@ public:
 	void add(SourceFeature* feature);
 	ref_ptr<Candidate> getCandidate() const;
 	std::string getDescription() const;
+	bool usesPythonObjects() const;
 };
 
 /**
@@ -64,6 +67,7 @@ public:
 	void add(Source* source, double weight = 1);
 	ref_ptr<Candidate> getCandidate() const;
 	std::string getDescription() const;
+	bool usesPythonObjects() const;
 };
 
 
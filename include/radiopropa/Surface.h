@@ -0,0 +1,123 @@
+#ifndef CRPROPA_SURFACE_H
+#define CRPROPA_SURFACE_H
+
+#include "radiopropa/Grid.h"
+#include "radiopropa/Referenced.h"
+#include "radiopropa/Vector3.h"
+
+#include <string>
+#include <vector>
+
+namespace radiopropa {
+
+/**
+ @class Surface
+ @brief Abstract base class for surfaces that rays can cross, e.g. the ice surface or the bedrock
+ */
+class Surface: public Referenced {
+protected:
+	/**
+	 Moeller-Trumbore test of the segment a + t * d, 0 <= t <= tMax, against the triangle v0, v0 + e1, v0 + e2.
+	 The barycentric coordinates have a small tolerance, so that segments through an edge cannot slip between
+	 neighboring triangles.
+	 */
+	static bool intersectTriangle(const Vector3d &a, const Vector3d &d,
+			const Vector3d &v0, const Vector3d &e1, const Vector3d &e2,
+			double tMax, double &t);
+
+public:
+	virtual ~Surface() {
+	}
+
+	/**
+	 First intersection of the segment from a to b with the surface.
+	 @param t	fraction (0 - 1) of the segment at the intersection
+	 @param normal	unit normal of the surface at the intersection
+	 @param element	index of the surface element (e.g. triangle) that was hit
+	 @return	false if the segment does not intersect the surface
+	 */
+	virtual bool intersect(const Vector3d &a, const Vector3d &b, double &t,
+			Vector3d &normal, size_t &element) const = 0;
+
+	bool intersect(const Vector3d &a, const Vector3d &b) const {
+		double t;
+		Vector3d normal;
+		size_t element;
+		return intersect(a, b, t, normal, element);
+	}
+
+	/** Short description with the size of the surface, e.g. the number of triangles */
+	virtual std::string getDescription() const = 0;
+};
+
+/**
+ @class Heightmap
+ @brief Surface z = h(x, y) given by a regular elevation raster (digital elevation model)
+
+ The heights are indexed as in a Grid with Nz = 1: sample (ix, iy) is located at origin + (ix + 0.5, iy + 0.5) * spacing
+ and stored at ix * Ny + iy, so that a raster can be written with dumpGrid of a ScalarGrid.
+ Each cell between four samples is split into two triangles along the diagonal from (ix, iy) to (ix + 1, iy + 1).\n
+ A pyramid of the minimum and maximum heights of blocks of 2^L x 2^L cells (a min/max quadtree) is built when the
+ heightmap is created. A segment descends only into the blocks whose bounding boxes it passes, so that whole tiles
+ that cannot be intersected are skipped. The pyramid takes about 2.7 bytes per cell.\n
+ Large rasters are memory mapped read-only from a raw file of floats instead of being read into memory,
+ so that they are loaded lazily by the operating system and shared by all threads and processes.
+ */
+class Heightmap: public Surface {
+	Vector3d origin;
+	size_t Nx, Ny;
+	double spacing;
+
+	std::vector<float> heights; /*< samples if not memory mapped */
+	const float *data; /*< samples */
+	void *mapping; /*< memory mapped file */
+	size_t mappingSize;
+
+	/** interleaved minimum and maximum of the blocks of 2^(L+1) cells per level L */
+	std::vector<std::vector<float> > pyramid;
+	std::vector<size_t> pyramidNx, pyramidNy;
+
+	// the memory mapping is unmapped on destruction, so copies are not allowed
+	Heightmap(const Heightmap &);
+	Heightmap &operator=(const Heightmap &);
+
+	void buildPyramid();
+	void cellRange(size_t level, size_t i, size_t j, float &lower, float &upper) const;
+	bool intersectCell(size_t i, size_t j, const Vector3d &a, const Vector3d &d,
+			double &t, Vector3d &normal, size_t &element) const;
+
+public:
+	/** Heightmap with the samples of a ScalarGrid with Nz = 1, the z-coordinate of the grid origin is ignored */
+	Heightmap(ref_ptr<ScalarGrid> grid);
+
+	/**
+	 Memory map a heightmap from a binary file of single precision floats, as written by dumpGrid.
+	 @param origin	lower corner of the raster, the z-coordinate is ignored
+	 @param Nx	number of samples along x
+	 @param Ny	number of samples along y
+	 @param spacing	distance between samples
+	 */
+	Heightmap(std::string filename, Vector3d origin, size_t Nx, size_t Ny,
+			double spacing);
+	~Heightmap();
+
+	using Surface::intersect;
+	bool intersect(const Vector3d &a, const Vector3d &b, double &t,
+			Vector3d &normal, size_t &element) const;
+
+	/** Height of the surface at (x, y), clamped to the edges of the raster */
+	double getHeight(double x, double y) const;
+	/** Height of sample (ix, iy) */
+	float getSample(size_t ix, size_t iy) const;
+
+	Vector3d getOrigin() const;
+	size_t getNx() const;
+	size_t getNy() const;
+	double getSpacing() const;
+	bool isMemoryMapped() const;
+	std::string getDescription() const;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_SURFACE_H
@@ -0,0 +1,76 @@
+#ifndef CRPROPA_TRIANGLEMESH_H
+#define CRPROPA_TRIANGLEMESH_H
+
+#include "radiopropa/Surface.h"
+
+#include <string>
+#include <vector>
+
+namespace radiopropa {
+
+/**
+ @class TriangleMesh
+ @brief Triangulated surface, e.g. the ice surface, the bedrock or internal layers
+
+ The triangles are sorted into a bounding volume hierarchy when the mesh is created, so that the first intersection
+ of a segment with the surface is found in logarithmic time of the number of triangles.
+ The hierarchy is built by splitting the triangles at the median of their centers along the longest axis of the
+ node, which takes O(N log N) and a few seconds for 10^6 triangles.
+ The mesh is immutable afterwards and can be shared between threads.
+ */
+class TriangleMesh: public Surface {
+public:
+	/** Node of the bounding volume hierarchy */
+	struct Node {
+		Vector3d lower, upper; /*< bounding box */
+		unsigned int start; /*< first triangle of a leaf, or index of the second child */
+		unsigned int count; /*< number of triangles of a leaf, 0 for inner nodes */
+	};
+
+private:
+	std::vector<Vector3d> vertices;
+	std::vector<unsigned int> indices; /*< three vertices per triangle, in hierarchy order */
+	std::vector<unsigned int> triangleIds; /*< original index of the triangles in hierarchy order */
+	std::vector<Vector3d> edges; /*< two edges per triangle, in hierarchy order */
+	std::vector<Node> nodes;
+
+	void build();
+	unsigned int buildNode(std::vector<unsigned int> &order,
+			const std::vector<Vector3d> &centers, unsigned int first,
+			unsigned int count);
+
+public:
+	/**
+	 @param vertices	corners of the triangles
+	 @param indices	three indices into vertices per triangle
+	 */
+	TriangleMesh(const std::vector<Vector3d> &vertices,
+			const std::vector<unsigned int> &indices);
+
+	/**
+	 First intersection of the segment from a to b with the surface.
+	 The normal is oriented by the vertex order of the triangle (counter-clockwise) and the element is the index of the triangle.
+	 */
+	using Surface::intersect;
+	bool intersect(const Vector3d &a, const Vector3d &b, double &t,
+			Vector3d &normal, size_t &triangle) const;
+
+	size_t getNumberOfTriangles() const;
+	size_t getNumberOfVertices() const;
+	size_t getNumberOfNodes() const;
+	std::string getDescription() const;
+	Vector3d getLowerCorner() const;
+	Vector3d getUpperCorner() const;
+};
+
+/**
+ Load a triangle mesh from a Wavefront OBJ file (vertices and faces, polygons are split into triangles)
+ or a binary STL file, depending on the file extension.
+ @param conversion	factor multiplied to all coordinates
+ */
+ref_ptr<TriangleMesh> loadTriangleMesh(std::string filename,
+		double conversion = 1);
+
+} // namespace radiopropa
+
+#endif // CRPROPA_TRIANGLEMESH_H
@@ -30,21 +30,6 @@
 	bool operator == (const VALUE &a) const { check(TYPE); return data._##NAME == a; } \
 	Variant(const VALUE &a) { data._ ## NAME = a; type = TYPE; }
 
-// Helper to set pointer type methods to variant
-#define VARIANT_ADD_TYPE_DECL_PTR_BASE(NAME, TYPE, VALUE) \
-	bool is ## NAME() const { return (type == TYPE); } \
-	VALUE &as ## NAME() { check(TYPE); return *data._##NAME; } \
-	const VALUE &as ## NAME() const	{ check(TYPE); return *data._##NAME; } \
-	static Variant from ## NAME(const VALUE &a) { return Variant(a); } \
-
-// Helper to set pointer type methods to variant
-#define VARIANT_ADD_TYPE_DECL_PTR(NAME, TYPE, VALUE) \
-	bool operator != (const VALUE &a) const { check(TYPE); return *data._##NAME != a; } \
-	bool operator == (const VALUE &a) const { check(TYPE); return *data._##NAME == a; } \
-	VARIANT_ADD_TYPE_DECL_PTR_BASE(NAME, TYPE, VALUE) \
-	Variant &operator =(const VALUE &a) { if (type != TYPE) { clear(); data._##NAME = new VALUE; } type = TYPE; (*data._##NAME) = a; return *this; } \
-	Variant(const VALUE &a) { data._ ## NAME = new VALUE(a); type = TYPE; }
-
 namespace radiopropa
 {
 
@@ -54,6 +39,10 @@ namespace radiopropa
 
  Allows storage of multiple data types in one base class. used to construct a
  map of `arbitrarry' data types.
+ Strings of up to smallStringSize characters are stored inline, so that copying
+ the usual flags does not allocate; longer strings are stored on the heap.
+ As an inline string has no std::string to refer to, asString() returns a copy
+ instead of a reference; assign a new string to modify the stored value.
 
  */
 class Variant
@@ -101,6 +90,25 @@ public:
 	~Variant();
 
 	Variant(const Variant& a);
+#if __cplusplus >= 201103L
+	Variant(Variant &&a) noexcept :
+			type(a.type), smallString(a.type == TYPE_STRING && a.smallString), data(a.data)
+	{
+		a.type = TYPE_NONE;
+	}
+	Variant &operator =(Variant &&a) noexcept
+	{
+		if (this != &a)
+		{
+			clear();
+			type = a.type;
+			smallString = (a.type == TYPE_STRING) && a.smallString;
+			data = a.data;
+			a.type = TYPE_NONE;
+		}
+		return *this;
+	}
+#endif
 
 	const std::type_info& getTypeInfo() const;
 
@@ -114,7 +122,7 @@ public:
 	static const char *getTypeName(Type type);
 
 	// copy the data to buffer via memcpy. Returns the size of the data
-	size_t copyToBuffer(void* buffer);
+	size_t copyToBuffer(void* buffer) const;
 	/// returns size of used data type in bytes
 	size_t getSize() const;
 
@@ -166,7 +174,16 @@ public:
 
 	VARIANT_ADD_TYPE_DECL_POD(Double, TYPE_DOUBLE, double)
 
-	VARIANT_ADD_TYPE_DECL_PTR(String, TYPE_STRING, std::string)
+	enum { smallStringSize = 22 }; ///< maximum length of the strings stored inline
+
+	bool isString() const { return (type == TYPE_STRING); }
+	/// returns a copy of the string; modifying it does not change the Variant
+	std::string asString() const { check(TYPE_STRING); return std::string(stringData(), stringSize()); }
+	static Variant fromString(const std::string &a) { return Variant(a); }
+	Variant &operator =(const std::string &a) { assignString(a.data(), a.size()); return *this; }
+	bool operator ==(const std::string &a) const;
+	bool operator !=(const std::string &a) const { return !operator ==(a); }
+	Variant(const std::string &a);
 	Variant(const char *s);
 	std::string toString() const;
 	static Variant fromString(const std::string &str, Type type);
@@ -177,7 +194,7 @@ public:
 	bool operator !=(const char *a) const
 	{
 		check(TYPE_STRING);
-		return data._String->compare(a) != 0;
+		return std::strcmp(stringData(), a) != 0;
 	}
 
 	// clear pointer based data types
@@ -185,6 +202,7 @@ public:
 
 protected:
 	Type type;
+	bool smallString; /*< the string is stored inline in data._Small */
 
 	union
 	{
@@ -200,9 +218,19 @@ protected:
 		double _Double;
 		float _Float;
 		std::string *_String;
+		char _Small[smallStringSize + 2]; /*< characters, terminating zero and the length in the last byte */
 	} data;
 
 private:
+	const char *stringData() const
+	{
+		return smallString ? data._Small : data._String->c_str();
+	}
+	size_t stringSize() const
+	{
+		return smallString ? size_t(data._Small[smallStringSize + 1]) : data._String->size();
+	}
+	void assignString(const char *s, size_t n);
 	void copy(const Variant &a);
 	void check(const Type t) const;
 	void check(const Type t);
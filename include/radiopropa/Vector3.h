@@ -225,6 +225,21 @@ public:
 		return std::max(x, std::max(y, z));
 	}
 
+	// element-wise minimum
+	Vector3<T> min(const Vector3<T> &v) const {
+		return Vector3<T>(std::min(x, v.x), std::min(y, v.y), std::min(z, v.z));
+	}
+
+	// element-wise maximum
+	Vector3<T> max(const Vector3<T> &v) const {
+		return Vector3<T>(std::max(x, v.x), std::max(y, v.y), std::max(z, v.z));
+	}
+
+	// element along the axis 0 (x), 1 (y) or 2 (z)
+	T getComponent(int axis) const {
+		return (axis == 0) ? x : ((axis == 1) ? y : z);
+	}
+
 	// dot product
 	T dot(const Vector3<T> &v) const {
 		return x * v.x + y * v.y + z * v.z;
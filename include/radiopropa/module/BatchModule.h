@@ -0,0 +1,68 @@
+#ifndef CRPROPA_BATCHMODULE_H
+#define CRPROPA_BATCHMODULE_H
+
+#include "radiopropa/Module.h"
+
+#include <vector>
+
+namespace radiopropa {
+
+/**
+ @class CandidateBlock
+ @brief State of a block of candidates in contiguous arrays, as handed to BatchModule::processBlock
+
+ Positions and directions are stored row by row as arrays of shape (size, 3), amplitudes, step sizes
+ (the size of the current step) and the active mask as arrays of shape (size).
+ If the Python bindings are built with NumPy, the arrays are available as NumPy views (positions(), directions(), amplitudes(), stepSizes(), active()).
+ Changes through the views are written back to the candidates at the end of processBlock. A view kept beyond
+ processBlock holds a reference to the arrays (see getStorage), so it stays valid but no longer belongs to the block:
+ the next load of a block whose storage is still referenced fills a new storage.
+ */
+class CandidateBlock {
+	struct Storage: public Referenced {
+		std::vector<double> positions;
+		std::vector<double> directions;
+		std::vector<double> amplitudes;
+		std::vector<double> stepSizes;
+		std::vector<unsigned char> active;
+	};
+	ref_ptr<Storage> storage;
+
+public:
+	CandidateBlock();
+
+	/** Copy the state of the candidates into the arrays */
+	void load(const std::vector<Candidate *> &candidates);
+	/** Write directions and amplitudes back to the candidates and deactivate the candidates cleared in the mask */
+	void store(const std::vector<Candidate *> &candidates) const;
+
+	size_t size() const;
+	double *getPositions();
+	double *getDirections();
+	double *getAmplitudes();
+	double *getStepSizes();
+	unsigned char *getActive();
+	/** Owner of the arrays, for views that add a reference to keep them alive */
+	const Referenced *getStorage() const;
+};
+
+/**
+ @class BatchModule
+ @brief Abstract base class for modules that process a block of candidates at once through arrays
+
+ Intended for modules implemented in Python, which pay the overhead of the interpreter once per block instead of
+ once per candidate and step, and can operate on the arrays with NumPy. The directions, amplitudes and the active
+ mask changed in processBlock are written back to the candidates; positions and step sizes are read only.\n
+ Use it together with ModuleList::runBatch. When called through process() it processes a block of one candidate.
+ The block of each thread is reused from call to call.
+ */
+class BatchModule: public Module {
+public:
+	void process(Candidate *candidate) const;
+	void processBatch(const std::vector<Candidate *> &candidates) const;
+	virtual void processBlock(CandidateBlock &block) const = 0;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_BATCHMODULE_H
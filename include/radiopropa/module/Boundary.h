@@ -2,6 +2,9 @@
 #define CRPROPA_BOUNDARY_H
 
 #include "radiopropa/Module.h"
+#include "radiopropa/Scene.h"
+#include "radiopropa/Surface.h"
+#include "radiopropa/Units.h"
 
 namespace radiopropa {
 
@@ -49,13 +52,33 @@ public:
 	std::string getDescription() const;
 };
 
+/**
+ @class ReflectiveSurface
+ @brief Surface that reflects particles specularly, e.g. the ice surface given by a Heightmap
+
+ When the straight segment from the previous to the current position crosses the surface, the candidate is moved
+ back to the intersection and its direction is mirrored at the surface normal.
+ Steps that start on the surface after a reflection are not counted as another crossing.
+ */
+class ReflectiveSurface: public Module {
+private:
+	ref_ptr<Surface> surface;
+
+public:
+	ReflectiveSurface(ref_ptr<Surface> surface);
+	void process(Candidate *candidate) const;
+	void setSurface(ref_ptr<Surface> surface);
+	ref_ptr<Surface> getSurface() const;
+	std::string getDescription() const;
+};
+
 /**
  @class CubicBoundary
  @brief Flags a particle when exiting the cube.
 
  The particle is made inactive and flagged as "Rejected".
- By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
- This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ The candidate is moved back to the crossing of the boundary, interpolated within the step.
+ Optionally (setLimitStep) the module conservatively limits the step size to prevent overshooting the boundary by more than a margin.
  */
 class CubicBoundary: public AbstractCondition {
 private:
@@ -72,6 +95,8 @@ public:
 	void setSize(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	/** Add the boundary to a scene, for step limiting with SceneStepLimiter */
+	void addToScene(Scene &scene) const;
 	std::string getDescription() const;
 };
 
@@ -80,8 +105,8 @@ public:
  @brief Flag a particle when leaving the sphere.
 
  The particle is made inactive and flagged as "Rejected".
- By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
- This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ The candidate is moved back to the crossing of the boundary, interpolated within the step.
+ Optionally (setLimitStep) the module conservatively limits the step size to prevent overshooting the boundary by more than a margin.
  */
 class SphericalBoundary: public AbstractCondition {
 private:
@@ -98,6 +123,8 @@ public:
 	void setRadius(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	/** Add the boundary to a scene, for step limiting with SceneStepLimiter */
+	void addToScene(Scene &scene) const;
 	std::string getDescription() const;
 };
 
@@ -107,8 +134,8 @@ public:
 
  This module flags particles when outside of the ellipsoid, defined by two focal points and a major axis (length).
  The particle is made inactive and flagged as "Rejected".
- By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
- This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ The candidate is moved back to the crossing of the boundary, interpolated within the step.
+ Optionally (setLimitStep) the module conservatively limits the step size to prevent overshooting the boundary by more than a margin.
  */
 class EllipsoidalBoundary: public AbstractCondition {
 private:
@@ -127,6 +154,8 @@ public:
 	void setMajorAxis(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	/** Add the boundary to a scene, for step limiting with SceneStepLimiter */
+	void addToScene(Scene &scene) const;
 	std::string getDescription() const;
 };
 
@@ -136,6 +165,7 @@ public:
  @brief Flags a particle when leaving the cylinder.
  This module flags particles when outside of the cylinder, defined by a radius and a height.
  The particle is made inactive and by default is flagged "OutOfBounds".
+ The candidate is moved back to the crossing of the boundary, interpolated within the step.
  Optionally the module can ensure the candidate does not overshoot the boundary by more than a set margin.
  */
 class CylindricalBoundary: public AbstractCondition {
@@ -156,6 +186,33 @@ public:
 	void setRadius(double radius);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	/** Add the boundary to a scene, for step limiting with SceneStepLimiter */
+	void addToScene(Scene &scene) const;
+	std::string getDescription() const;
+};
+
+/**
+ @class SceneStepLimiter
+ @brief Limits the step size to the distance to the nearest surface of a scene
+
+ Replaces the individual step limitation (setLimitStep) of the boundaries and observers added to the scene with
+ addToScene: one query of the acceleration structure per step instead of one distance computation per module,
+ so that the cost per step does not grow with the number of boundaries and observers.
+ The crossings themselves are still handled by the modules. Since they interpolate the crossing within the step,
+ the step is allowed to overshoot the nearest surface by a margin.
+ */
+class SceneStepLimiter: public Module {
+private:
+	ref_ptr<Scene> scene;
+	double margin;
+
+public:
+	SceneStepLimiter(ref_ptr<Scene> scene, double margin = 1e-3 * meter);
+	void process(Candidate *candidate) const;
+	void setScene(ref_ptr<Scene> scene);
+	void setMargin(double margin);
+	ref_ptr<Scene> getScene() const;
+	double getMargin() const;
 	std::string getDescription() const;
 };
 
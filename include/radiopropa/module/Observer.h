@@ -9,6 +9,9 @@
 #include "../Candidate.h"
 #include "../Module.h"
 #include "../Referenced.h"
+#include "../Scene.h"
+#include "../Surface.h"
+#include "../Units.h"
 #include "../Vector3.h"
 
 namespace radiopropa {
@@ -26,7 +29,15 @@ protected:
 	std::string description;
 public:
 	virtual DetectionState checkDetection(Candidate *candidate) const;
+	/**
+	 Check the candidate without modifying its step. A detection at a crossing within the current step reports
+	 the fraction (0 - 1) of the step at the crossing, the Observer then truncates the step to the earliest one.
+	 By default the end of the step is reported for the state of checkDetection.
+	 */
+	virtual DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
 	virtual void onDetection(Candidate *candidate) const;
+	/** Add the surfaces of the feature to a scene, for step limiting with SceneStepLimiter */
+	virtual void addToScene(Scene &scene) const;
 	virtual std::string getDescription() const;
 };
 
@@ -37,6 +48,7 @@ public:
 class Observer: public Module {
 	std::string flagKey;
 	std::string flagValue;
+	PropertyKey flagProperty;
 private:
 	std::vector<ref_ptr<ObserverFeature> > features;
 	ref_ptr<Module> detectionAction;
@@ -50,6 +62,9 @@ public:
 	std::string getDescription() const;
 	void setFlag(std::string key, std::string value);
 	void setDeactivateOnDetection(bool deactivate);
+	/** Add the surfaces of all features to a scene */
+	void addToScene(Scene &scene) const;
+	bool usesPythonObjects() const;
 };
 
 /**
@@ -65,6 +80,9 @@ public:
 /**
  @class ObserverSmallSphere
  @brief Detects particles upon entering a sphere
+
+ The detection is reported at the crossing of the sphere surface, interpolated within the step,
+ so that the step size does not need to be limited near the observer.
  */
 class ObserverSmallSphere: public ObserverFeature {
 private:
@@ -73,6 +91,8 @@ private:
 public:
 	ObserverSmallSphere(Vector3d center = Vector3d(0.), double radius = 0);
 	DetectionState checkDetection(Candidate *candidate) const;
+	DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
+	void addToScene(Scene &scene) const;
 	void setCenter(const Vector3d &center);
 	void setRadius(float radius);
 	std::string getDescription() const;
@@ -81,6 +101,9 @@ public:
 /**
  @class ObserverTracking
  @brief Tracks particles inside a sphere
+
+ Tracking starts at the crossing of the sphere surface, interpolated within the step.
+ Inside the sphere the step size is limited to stepSize.
  */
 class ObserverTracking: public ObserverFeature {
 private:
@@ -90,12 +113,15 @@ private:
 public:
 	ObserverTracking(Vector3d center, double radius, double stepSize = 0);
 	DetectionState checkDetection(Candidate *candidate) const;
+	DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
 	std::string getDescription() const;
 };
 
 /**
  @class ObserverLargeSphere
  @brief Detects particles upon exiting a sphere
+
+ The detection is reported at the crossing of the sphere surface, interpolated within the step.
  */
 class ObserverLargeSphere: public ObserverFeature {
 private:
@@ -104,6 +130,8 @@ private:
 public:
 	ObserverLargeSphere(Vector3d center = Vector3d(0.), double radius = 0);
 	DetectionState checkDetection(Candidate *candidate) const;
+	DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
+	void addToScene(Scene &scene) const;
 	std::string getDescription() const;
 };
 
@@ -111,15 +139,169 @@ public:
  @class ObserverPoint
  @brief Detects particles when reaching x = 0
 
- This module limits the next step size to prevent candidates from overshooting.
+ The detection is reported at the crossing of x = 0, interpolated within the step.
  Should be renamed to Observer1D, once old observer-scheme is removed.
  */
 class ObserverPoint: public ObserverFeature {
 public:
 	DetectionState checkDetection(Candidate *candidate) const;
+	DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
+	std::string getDescription() const;
+};
+
+/**
+ @class ObserverSurface
+ @brief Detects particles crossing a surface, e.g. a TriangleMesh or a Heightmap
+
+ The detection is reported at the first intersection of the straight segment from the previous to the current position
+ with the surface, found in logarithmic time with the acceleration structure of the surface.
+ */
+class ObserverSurface: public ObserverFeature {
+private:
+	ref_ptr<Surface> surface;
+public:
+	ObserverSurface(ref_ptr<Surface> surface);
+	DetectionState checkDetection(Candidate *candidate) const;
+	DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
+	std::string getDescription() const;
+};
+
+/**
+ @class ObserverPlane
+ @brief Detects particles crossing a plane, in either direction
+
+ The plane is given by a point and its normal.
+ The detection is reported at the crossing of the plane, interpolated within the step: position, direction and
+ trajectory length of the candidate are moved back to the crossing.
+ A step starting on the plane (e.g. after a detection without deactivation) is not detected again.\n
+ A curved step can cross the plane twice without a sign change of the distance. Optionally the next step is therefore
+ limited to the distance to the detection area, which is a lower bound of the path length to the next crossing.
+ The limit is at least minimumStep, so that rays do not crawl towards the plane.
+ */
+class ObserverPlane: public ObserverFeature {
+protected:
+	Vector3d origin;
+	Vector3d normal;
+	bool limitStep;
+	double minimumStep;
+
+	/** Whether a position on the plane belongs to the detection area */
+	virtual bool contains(const Vector3d &position) const;
+public:
+	/**
+	 @param origin	a point on the plane
+	 @param normal	normal vector of the plane, need not be normalized
+	 */
+	ObserverPlane(Vector3d origin, Vector3d normal);
+	DetectionState checkDetection(Candidate *candidate) const;
+	DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
+	void addToScene(Scene &scene) const;
+
+	/** Signed distance of a position to the plane, positive on the side of the normal */
+	double distance(const Vector3d &position) const;
+	/** Distance of a position to the detection area */
+	virtual double distanceToArea(const Vector3d &position) const;
+
+	/**
+	 Limit the next step to the distance to the detection area.
+	 @param minimumStep	lower bound of the limit
+	 */
+	void setStepLimiting(bool limit, double minimumStep = 1e-3 * meter);
+
+	Vector3d getOrigin() const;
+	Vector3d getNormal() const;
+	std::string getDescription() const;
+};
+
+/**
+ @class ObserverRectangle
+ @brief Detects particles crossing a rectangle, see ObserverPlane
+
+ The rectangle is spanned by two perpendicular edges u and v from a corner.
+ */
+class ObserverRectangle: public ObserverPlane {
+private:
+	Vector3d u, v;
+protected:
+	bool contains(const Vector3d &position) const;
+public:
+	ObserverRectangle(Vector3d corner, Vector3d u, Vector3d v);
+	double distanceToArea(const Vector3d &position) const;
+	void addToScene(Scene &scene) const;
+	std::string getDescription() const;
+};
+
+/**
+ @class ObserverDisc
+ @brief Detects particles crossing a disc, see ObserverPlane
+ */
+class ObserverDisc: public ObserverPlane {
+private:
+	double radius;
+protected:
+	bool contains(const Vector3d &position) const;
+public:
+	ObserverDisc(Vector3d center, Vector3d normal, double radius);
+	double distanceToArea(const Vector3d &position) const;
+	void addToScene(Scene &scene) const;
 	std::string getDescription() const;
 };
 
+/**
+ @class ObserverReceiverArray
+ @brief Detects particles entering the spheres around the receivers of an array, e.g. radio antennas
+
+ Replaces one ObserverSmallSphere per receiver: the receivers are sorted into a k-d tree when the observer is created,
+ so that a step only tests the receivers near its segment and the cost per step grows logarithmically with the
+ number of receivers. The first receiver entered within a step is reported at the crossing of its sphere and its
+ index is stored in the candidate property ReceiverIndex. The observer is meant to be used with
+ Observer::setDeactivateOnDetection(false), further receivers are then detected in the following steps.
+ A step starting on a sphere (e.g. after its detection) does not enter it again.\n
+ Optionally the next step is limited to the distance to the nearest sphere that does not contain the candidate,
+ but at least to minimumStep.
+ */
+class ObserverReceiverArray: public ObserverFeature {
+private:
+	std::vector<Vector3d> positions; /*< receivers in the order of creation */
+	std::vector<Vector3d> tree; /*< receivers in the order of the k-d tree */
+	std::vector<unsigned int> ids; /*< index of the receivers in the order of the k-d tree */
+	std::vector<unsigned char> axes; /*< splitting axis of the tree nodes */
+	double radius;
+	bool limitStep;
+	double minimumStep;
+
+	void build(std::vector<unsigned int> &order, size_t begin, size_t end);
+	void findEntry(size_t begin, size_t end, const Vector3d &a,
+			const Vector3d &d, const Vector3d &lower, const Vector3d &upper,
+			double &t, size_t &receiver) const;
+	void findNearest(size_t begin, size_t end, const Vector3d &position,
+			double exclude, double &distance2, size_t &receiver) const;
+public:
+	/**
+	 @param positions	positions of the receivers
+	 @param radius	radius of the sphere around each receiver
+	 */
+	ObserverReceiverArray(const std::vector<Vector3d> &positions, double radius);
+	DetectionState checkDetection(Candidate *candidate) const;
+	DetectionState checkCrossing(Candidate *candidate, double &fraction) const;
+	/** Store the index of the receiver on whose sphere the candidate was detected */
+	void onDetection(Candidate *candidate) const;
+	void addToScene(Scene &scene) const;
+
+	/**
+	 Limit the next step to the distance to the nearest receiver sphere.
+	 @param minimumStep	lower bound of the limit
+	 */
+	void setStepLimiting(bool limit, double minimumStep = 1e-3 * meter);
+
+	/** Distance of a position to the nearest sphere that does not contain it */
+	double distanceToNearest(const Vector3d &position) const;
+
+	size_t getNumberOfReceivers() const;
+	Vector3d getReceiver(size_t i) const;
+	double getRadius() const;
+	std::string getDescription() const;
+};
 
 /**
  @class ObserverInactiveVeto
@@ -22,6 +22,7 @@ protected:
 	struct Property
 	{
 		std::string name;
+		PropertyKey key; /*< interned name */
 		std::string comment;
 		Variant defaultValue;
 	};
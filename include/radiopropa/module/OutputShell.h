@@ -2,7 +2,7 @@
 #define CRPROPA_OUTPUTSHELL_H
 
 #include "radiopropa/Module.h"
-#include "radiopropa/AssocVector.h"
+#include "radiopropa/PropertyMap.h"
 #include "radiopropa/Variant.h"
 
 namespace radiopropa {
@@ -33,7 +33,7 @@ public:
  */
 class ShellPropertyOutput: public Module {
 public:
-	typedef Loki::AssocVector<std::string, Variant> PropertyMap;
+	typedef radiopropa::PropertyMap PropertyMap; /**< Former type of the property map, for compatibility */
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
 };
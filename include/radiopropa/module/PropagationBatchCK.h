@@ -0,0 +1,82 @@
+#ifndef CRPROPA_PROPAGATIONBATCHCK_H
+#define CRPROPA_PROPAGATIONBATCHCK_H
+
+#include "radiopropa/Module.h"
+#include "radiopropa/Units.h"
+#include "radiopropa/ScalarField.h"
+
+#include <vector>
+
+namespace radiopropa {
+
+/**
+ @class PropagationBatchCK
+ @brief Propagation of blocks of rays through a scalar field using the Cash-Karp method.
+
+ This module solves the same Eikonal equation of motion as PropagationCK, but advances a block of rays in lockstep.\n
+ The phase-points of all rays are kept in a structure-of-arrays buffer, so that the Runge-Kutta arithmetic runs in tight loops over the rays that the compiler can vectorize.\n
+ Every ray keeps its own adaptive step size. Rays that reached the target error are masked out of further attempts of the same step.\n
+ Use it together with ModuleList::runBatch. When called through process() it propagates a block of one ray and behaves like PropagationCK.
+ */
+class PropagationBatchCK: public Module {
+public:
+	/** Phase-points of a block of rays in structure-of-arrays layout */
+	class Y {
+	public:
+		std::vector<double> x, y, z; /*< positions */
+		std::vector<double> ux, uy, uz; /*< directions */
+
+		void resize(size_t n);
+		size_t size() const;
+		/** Component i in the order x, y, z, ux, uy, uz */
+		std::vector<double> &operator[](size_t i);
+		const std::vector<double> &operator[](size_t i) const;
+	};
+
+	/** Scratch buffers of one step, sized for a block of rays */
+	class Workspace {
+	public:
+		Y k[6]; /*< Runge-Kutta stages */
+		Y yn; /*< intermediate phase-points */
+		std::vector<double> n, gx, gy, gz; /*< field values and gradients */
+
+		void resize(size_t n);
+	};
+
+private:
+	ref_ptr<ScalarField> field;
+	double tolerance; /*< target relative error of the numerical integration */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+
+public:
+	PropagationBatchCK(ref_ptr<ScalarField> field = NULL, double tolerance = 1e-4,
+			double minStep = (1E-3 * meter), double maxStep = (1 * meter));
+	void process(Candidate *candidate) const;
+	void processBatch(const std::vector<Candidate *> &candidates) const;
+
+	/**
+	 Derivative of the first count phase-points with respect to the path length s = c t:
+	 dx/ds = u / n, du/ds = grad(n) / n^2
+	 */
+	void dYdt(const Y &y, Y &dyds, size_t count, Workspace &w) const;
+
+	/** Perform a Cash-Karp step of length h[i] for the first count rays of y */
+	void tryStep(const Y &y, Y &out, Y &error, const double *h, size_t count,
+			Workspace &w) const;
+
+	void setField(ref_ptr<ScalarField> field);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+	bool usesPythonObjects() const;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_PROPAGATIONBATCHCK_H
@@ -60,7 +60,8 @@ public:
 	// du/dt = q*c^2/E * (u x B)
 	Y dYdt(const Y &y, ParticleState &p, double z) const;
 
-	void tryStep(const Y &y, Y &out, Y &error, double t,
+	/** Perform a step of duration t, returns the first stage k[0] = dYdt(y) */
+	Y tryStep(const Y &y, Y &out, Y &error, double t,
 			ParticleState &p, double z) const;
 
 	void setField(ref_ptr<ScalarField> field);
@@ -72,6 +73,7 @@ public:
 	double getMinimumStep() const;
 	double getMaximumStep() const;
 	std::string getDescription() const;
+	bool usesPythonObjects() const;
 };
 
 } // namespace radiopropa
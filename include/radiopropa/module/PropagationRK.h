@@ -0,0 +1,122 @@
+#ifndef CRPROPA_PROPAGATIONRK_H
+#define CRPROPA_PROPAGATIONRK_H
+
+#include "radiopropa/Module.h"
+#include "radiopropa/Units.h"
+#include "radiopropa/ScalarField.h"
+#include "radiopropa/module/PropagationCK.h"
+
+namespace radiopropa {
+
+/**
+ @class CashKarpTableau
+ @brief Butcher tableau of the Cash-Karp 5(4) method
+ */
+struct CashKarpTableau {
+	enum { stages = 6, order = 5, embeddedOrder = 4, fsal = 0 };
+	static const double a[stages][stages];
+	static const double b[stages]; /*< weights of the propagated solution */
+	static const double bs[stages]; /*< weights of the embedded solution */
+	static const char *name;
+};
+
+/**
+ @class DormandPrinceTableau
+ @brief Butcher tableau of the Dormand-Prince 5(4) method
+
+ The last stage is evaluated at the new phase-point (first same as last)
+ and is reused as the first stage of the following step.
+ */
+struct DormandPrinceTableau {
+	enum { stages = 7, order = 5, embeddedOrder = 4, fsal = 1 };
+	static const double a[stages][stages];
+	static const double b[stages];
+	static const double bs[stages];
+	static const char *name;
+};
+
+/**
+ @class BogackiShampineTableau
+ @brief Butcher tableau of the Bogacki-Shampine 3(2) method (first same as last)
+ */
+struct BogackiShampineTableau {
+	enum { stages = 4, order = 3, embeddedOrder = 2, fsal = 1 };
+	static const double a[stages][stages];
+	static const double b[stages];
+	static const double bs[stages];
+	static const char *name;
+};
+
+/**
+ @class Fehlberg78Tableau
+ @brief Butcher tableau of the Runge-Kutta-Fehlberg 7(8) method
+
+ The 7th order solution is propagated, the 8th order solution is used for
+ the error estimate.
+ */
+struct Fehlberg78Tableau {
+	enum { stages = 13, order = 7, embeddedOrder = 8, fsal = 0 };
+	static const double a[stages][stages];
+	static const double b[stages];
+	static const double bs[stages];
+	static const char *name;
+};
+
+/**
+ @class PropagationRK
+ @brief Propagation through a scalar field using an embedded Runge-Kutta method.
+
+ This module solves the Eikonal equation of motion of a ray propagating through a refractivity field, like PropagationCK.\n
+ The integration method is given by the Butcher tableau Tableau. The stages are kept in fixed-size arrays on the stack and all loops run over compile-time bounds, so that no memory is allocated during a step.\n
+ The step size control tries to keep the relative error close to, but smaller than the designated tolerance.
+ For methods with the first-same-as-last property the last stage of an accepted step is reused as the first stage of the next step of the same candidate.\n
+ The template is instantiated for CashKarpTableau, DormandPrinceTableau, BogackiShampineTableau and Fehlberg78Tableau.
+ */
+template<typename Tableau>
+class PropagationRK: public Module {
+public:
+	typedef PropagationCK::Y Y;
+
+private:
+	ref_ptr<ScalarField> field;
+	double tolerance; /*< target relative error of the numerical integration */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+
+public:
+	PropagationRK(ref_ptr<ScalarField> field = NULL, double tolerance = 1e-4,
+			double minStep = (1E-3 * meter), double maxStep = (1 * meter));
+	void process(Candidate *candidate) const;
+
+	/**
+	 Derivative of the phase-point with respect to the path length s = c t:
+	 dx/ds = u / n, du/ds = grad(n) / n^2
+	 */
+	Y dYdt(const Y &y) const;
+
+	/**
+	 Perform a step of length h. The first stage k[0] = dYdt(y) has to be
+	 provided by the caller, as it does not depend on h.
+	 */
+	void tryStep(const Y &y, Y &out, Y &error, double h, Y *k) const;
+
+	void setField(ref_ptr<ScalarField> field);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+	bool usesPythonObjects() const;
+};
+
+typedef PropagationRK<CashKarpTableau> PropagationRKCashKarp;
+typedef PropagationRK<DormandPrinceTableau> PropagationRKDormandPrince;
+typedef PropagationRK<BogackiShampineTableau> PropagationRKBogackiShampine;
+typedef PropagationRK<Fehlberg78Tableau> PropagationRKFehlberg78;
+
+} // namespace radiopropa
+
+#endif // CRPROPA_PROPAGATIONRK_H
@@ -0,0 +1,81 @@
+#ifndef CRPROPA_PROPAGATIONSTRATIFIED_H
+#define CRPROPA_PROPAGATIONSTRATIFIED_H
+
+#include "radiopropa/Module.h"
+#include "radiopropa/Units.h"
+#include "radiopropa/ScalarField.h"
+
+#include <vector>
+
+namespace radiopropa {
+
+/**
+ @class PropagationStratified
+ @brief Propagation through a refractive index that only depends on the depth z.
+
+ In a z-stratified medium the azimuth of the ray and the Snell invariant beta = n(z) sin(theta) are conserved.
+ The ray is then fully described by its depth z, the vertical component p = n(z) cos(theta) of the slowness vector
+ and the horizontal distance r travelled.
+ With the path length s = c t used by the other propagation modules, dz/ds = p / n^2, dp/ds = (dn/dz) / n and dr/ds = beta / n^2.
+ These equations are smooth through turning points (p = 0), so a single propagation step can cover a whole
+ arc of the ray including reflections at the turning point.\n
+ For n2linear (n^2 linear in z) the path is a parabola and is computed in closed form following Mo, Yeh and Manocha;
+ the path length is then a cubic polynomial of p.
+ For any other field the three equations are integrated with an adaptive Dormand-Prince method.\n
+ The field has to depend on z only; the x and y components of its gradient are ignored.
+ Segments end exactly on the horizontal planes added with addHorizontalPlane, so that observers and boundaries at these
+ depths see the crossing without limiting the step size.
+ */
+class PropagationStratified: public Module {
+public:
+	/** Depth, vertical slowness and horizontal distance of a ray */
+	class State {
+	public:
+		double z, p, r;
+		State(double z = 0, double p = 0, double r = 0) :
+				z(z), p(p), r(r) {
+		}
+	};
+
+private:
+	ref_ptr<ScalarField> field;
+	double tolerance; /*< target relative error of the numerical integration */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+	std::vector<double> planes; /*< depths at which segments end */
+
+	double propagateLinear(const n2linear *f, const Vector3d &start,
+			double beta, double length, State &state) const;
+	double propagateNumerical(const Vector3d &start, const Vector3d &horizontal,
+			double beta, double length, State &state) const;
+
+public:
+	PropagationStratified(ref_ptr<ScalarField> field = NULL,
+			double tolerance = 1e-8, double minStep = (1E-3 * meter),
+			double maxStep = (1 * kilo * meter));
+	void process(Candidate *candidate) const;
+
+	/** Derivative of the ray state with respect to the path length */
+	State dYds(const State &y, const Vector3d &start, const Vector3d &horizontal,
+			double beta) const;
+
+	/** Dormand-Prince step of length h, returns the embedded error estimate */
+	State tryStep(const State &y, double h, const Vector3d &start,
+			const Vector3d &horizontal, double beta, State &error) const;
+
+	void addHorizontalPlane(double z);
+	void setField(ref_ptr<ScalarField> field);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+	bool usesPythonObjects() const;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_PROPAGATIONSTRATIFIED_H
@@ -24,6 +24,7 @@ public:
 	void add(Module* module);
 	void process(Candidate* candidate) const;
 	std::string getDescription() const;
+	bool usesPythonObjects() const;
 };
 
 class ParticleFilter: public AbstractCondition {
@@ -0,0 +1,120 @@
+#ifndef CRPROPA_TRANSMISSIVELAYER_H
+#define CRPROPA_TRANSMISSIVELAYER_H
+
+#include "radiopropa/Module.h"
+#include "radiopropa/ScalarField.h"
+#include "radiopropa/Surface.h"
+
+namespace radiopropa {
+
+/**
+ @class FresnelInterface
+ @brief Abstract base class for interfaces between two media that partially reflect and transmit rays.
+
+ At the crossing the refractive indices on both sides are taken from the scalar field at sampleDistance in front of and
+ behind the interface. The candidate is reflected specularly and a secondary is spawned in the Snell-refracted direction.
+ The amplitudes are multiplied with the magnitudes of the Fresnel coefficients for the chosen polarization,
+ the phase jump of the reflected wave is not tracked.
+ Beyond the critical angle the ray is totally reflected and no secondary is created.
+ */
+class FresnelInterface: public Module {
+public:
+	enum Polarization {
+		TE, /*< electric field perpendicular to the plane of incidence (s) */
+		TM /*< electric field in the plane of incidence (p) */
+	};
+
+protected:
+	ref_ptr<ScalarField> field;
+	Polarization polarization;
+	double sampleDistance;
+
+	/**
+	 Reflect the candidate at position on the interface and spawn the transmitted secondary.
+	 @param back	unit normal of the interface pointing to the incident side
+	 */
+	void split(Candidate *candidate, const Vector3d &position,
+			const Vector3d &back) const;
+
+public:
+	FresnelInterface(ref_ptr<ScalarField> field, Polarization polarization = TE);
+
+	/**
+	 Fresnel amplitude coefficients for a wave from a medium n1 into a medium n2.
+	 @param cosIncidence	cosine of the angle of incidence
+	 @param cosTransmission	cosine of the angle of transmission, 0 for total reflection
+	 @param r	reflection coefficient
+	 @param t	transmission coefficient
+	 @return	false in case of total internal reflection
+	 */
+	bool fresnelCoefficients(double n1, double n2, double cosIncidence,
+			double &cosTransmission, double &r, double &t) const;
+
+	void setField(ref_ptr<ScalarField> field);
+	void setPolarization(Polarization polarization);
+	void setSampleDistance(double distance);
+
+	Polarization getPolarization() const;
+	double getSampleDistance() const;
+	bool usesPythonObjects() const;
+};
+
+/**
+ @class TransmissiveLayer
+ @brief Planar interface between two media, see FresnelInterface
+
+ The plane is given by a point and its normal.
+ When a ray crosses the plane during a step, the candidate is moved back to the crossing, interpolated within the step.
+ Since the crossing is located on the trajectory of the step, the module does not limit the step size.
+ */
+class TransmissiveLayer: public FresnelInterface {
+private:
+	Vector3d origin;
+	Vector3d normal;
+
+public:
+	/**
+	 @param origin	a point on the plane
+	 @param normal	normal vector of the plane, need not be normalized
+	 @param field	refractive index on both sides of the plane
+	 */
+	TransmissiveLayer(Vector3d origin, Vector3d normal,
+			ref_ptr<ScalarField> field, Polarization polarization = TE);
+	void process(Candidate *candidate) const;
+
+	/** Signed distance of a position to the plane, positive on the side of the normal */
+	double distance(const Vector3d &position) const;
+
+	void setOrigin(Vector3d origin);
+	void setNormal(Vector3d normal);
+
+	Vector3d getOrigin() const;
+	Vector3d getNormal() const;
+	std::string getDescription() const;
+};
+
+/**
+ @class TransmissiveSurface
+ @brief Interface between two media given by a surface, e.g. a TriangleMesh or a Heightmap, see FresnelInterface
+
+ The crossing is the first intersection of the straight segment from the previous to the current position
+ with the surface, found in logarithmic time with the acceleration structure of the surface.
+ For curved steps the crossing on the segment is close to the one on the trajectory as long as the step is short
+ compared to the curvature of the surface.
+ */
+class TransmissiveSurface: public FresnelInterface {
+private:
+	ref_ptr<Surface> surface;
+
+public:
+	TransmissiveSurface(ref_ptr<Surface> surface, ref_ptr<ScalarField> field,
+			Polarization polarization = TE);
+	void process(Candidate *candidate) const;
+	void setSurface(ref_ptr<Surface> surface);
+	ref_ptr<Surface> getSurface() const;
+	std::string getDescription() const;
+};
+
+} // namespace radiopropa
+
+#endif // CRPROPA_TRANSMISSIVELAYER_H
@@ -1,6 +1,15 @@
 /* 1. SWIG settings and workarounds */
 
-%module(directors="1", threads="0", allprotected="1") radiopropa
+%module(directors="1", threads="1", allprotected="1") radiopropa
+
+/*
+ Thread support: director upcalls (Python implementations of Module, Observer,
+ ObserverFeature, ScalarField, ...) acquire the GIL, so that they can be called
+ from the OpenMP threads. The GIL is kept by default and only released in the
+ long running native calls (%threadallow in 2_headers.i), which lets pure C++
+ module lists run on all cores when started from Python.
+*/
+%nothreadallow;
 
 %feature("director:except") {
     if( $error != NULL ) {
@@ -82,3 +91,16 @@ class StopIterator {};
 
 };
 
+/* Include and initialize the numpy array interface, if available */
+
+#ifdef WITHNUMPY
+%{
+  #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+  #include "numpy/arrayobject.h"
+  #include "numpy/ufuncobject.h"
+%}
+%init %{
+import_array();
+import_ufunc();
+%}
+#endif
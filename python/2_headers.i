@@ -51,6 +51,8 @@
 
 %feature("ref")   radiopropa::Referenced "$this->addReference();"
 %feature("unref") radiopropa::Referenced "$this->removeReference();"
+%ignore radiopropa::Referenced::dispose;
+%ignore radiopropa::Candidate::dispose;
 
 
 %include "radiopropa/Logging.h"
@@ -59,6 +61,9 @@
 %include "radiopropa/Units.h"
 %include "radiopropa/Common.h"
 %include "radiopropa/Cosmology.h"
+%ignore radiopropa::RandomStream::Scope;
+%ignore radiopropa::RandomStream::fillUniform;
+%ignore radiopropa::RandomStream::fillNormal;
 %include "radiopropa/Random.h"
 %include "radiopropa/ParticleState.h"
 %include "radiopropa/ParticleID.h"
@@ -67,8 +72,16 @@
 
 %import "radiopropa/Variant.h"
 
+%ignore radiopropa::findPropertyKey;
+%ignore radiopropa::PropertyMap::Entry;
+%ignore radiopropa::PropertyMap::const_iterator;
+%ignore radiopropa::PropertyMap::begin;
+%ignore radiopropa::PropertyMap::end;
+%include "radiopropa/PropertyMap.h"
+
 /* override Candidate::getProperty() */
 %ignore radiopropa::Candidate::getProperty(const std::string &) const;
+%ignore radiopropa::Candidate::getProperty(PropertyKey) const;
 
 %nothread; /* disable threading for extend*/
 %extend radiopropa::Candidate {
@@ -263,6 +276,7 @@
 
 %template(CandidateVector) std::vector< radiopropa::ref_ptr<radiopropa::Candidate> >;
 %template(CandidateRefPtr) radiopropa::ref_ptr<radiopropa::Candidate>;
+%template(CandidatePtrVector) std::vector< radiopropa::Candidate * >;
 %include "radiopropa/Candidate.h"
 
 
@@ -271,18 +285,24 @@
 
 %feature("director") radiopropa::Module;
 %feature("director") radiopropa::AbstractCondition;
+%ignore radiopropa::setPythonObjectCheck;
 %include "radiopropa/Module.h"
 
+%{
+/* Python implementations of modules, fields, observer and source features are directors, see ModuleList::setPythonModulePolicy */
+static bool isDirectorObject(const radiopropa::Referenced *object) {
+	return dynamic_cast<const Swig::Director *>(object) != 0;
+}
+%}
+%init %{
+	radiopropa::setPythonObjectCheck(isDirectorObject);
+%}
+
 %implicitconv radiopropa::ref_ptr<radiopropa::MagneticField>;
 %template(MagneticFieldRefPtr) radiopropa::ref_ptr<radiopropa::MagneticField>;
 %include "radiopropa/magneticField/MagneticField.h"
 
-%implicitconv radiopropa::ref_ptr<radiopropa::ScalarField>;
-%template(ScalarFieldRefPtr) radiopropa::ref_ptr<radiopropa::ScalarField>;
-%include "radiopropa/ScalarField.h"
-
 %include "radiopropa/Grid.h"
-%include "radiopropa/GridTools.h"
 
 %implicitconv radiopropa::ref_ptr<radiopropa::Grid<radiopropa::Vector3<float> > >;
 %template(VectorGridRefPtr) radiopropa::ref_ptr<radiopropa::Grid<radiopropa::Vector3<float> > >;
@@ -292,6 +312,40 @@
 %template(ScalarGridRefPtr) radiopropa::ref_ptr<radiopropa::Grid<float> >;
 %template(ScalarGrid) radiopropa::Grid<float>;
 
+%template(DoubleVector) std::vector<double>;
+%implicitconv radiopropa::ref_ptr<radiopropa::ScalarField>;
+%template(ScalarFieldRefPtr) radiopropa::ref_ptr<radiopropa::ScalarField>;
+%feature("director") radiopropa::ScalarField;
+%feature("nodirector") radiopropa::ScalarField::getValues;
+%feature("nodirector") radiopropa::ScalarField::getValuesAndGradients;
+%include "radiopropa/ScalarField.h"
+
+%template(ScalarFieldGridRefPtr) radiopropa::ref_ptr<radiopropa::ScalarFieldGrid>;
+%template(TabulatedDepthProfileRefPtr) radiopropa::ref_ptr<radiopropa::TabulatedDepthProfile>;
+%threadallow radiopropa::fromScalarField;
+%threadallow radiopropa::bakeScalarField;
+%threadallow radiopropa::bakeDepthProfile;
+%include "radiopropa/GridTools.h"
+
+%template(RaySolutionVector) std::vector< radiopropa::RaySolution >;
+%template(RaySolutionVectorVector) std::vector< std::vector< radiopropa::RaySolution > >;
+%template(Vector3dVector) std::vector< radiopropa::Vector3d >;
+%template(RaySolverRefPtr) radiopropa::ref_ptr<radiopropa::RaySolver>;
+%threadallow radiopropa::RaySolver::solve;
+%include "radiopropa/RaySolver.h"
+
+%implicitconv radiopropa::ref_ptr<radiopropa::Surface>;
+%template(SurfaceRefPtr) radiopropa::ref_ptr<radiopropa::Surface>;
+%template(HeightmapRefPtr) radiopropa::ref_ptr<radiopropa::Heightmap>;
+%include "radiopropa/Surface.h"
+
+%template(UnsignedIntVector) std::vector<unsigned int>;
+%template(TriangleMeshRefPtr) radiopropa::ref_ptr<radiopropa::TriangleMesh>;
+%include "radiopropa/TriangleMesh.h"
+
+%template(SceneRefPtr) radiopropa::ref_ptr<radiopropa::Scene>;
+%include "radiopropa/Scene.h"
+
 %include "radiopropa/EmissionMap.h"
 %implicitconv radiopropa::ref_ptr<radiopropa::EmissionMap>;
 %template(EmissionMapRefPtr) radiopropa::ref_ptr<radiopropa::EmissionMap>;
@@ -303,9 +357,94 @@
 
 %feature("director") radiopropa::Observer;
 %feature("director") radiopropa::ObserverFeature;
+/* Python features implement checkDetection, the crossing is reported by the C++ features */
+%feature("nodirector") radiopropa::ObserverFeature::checkCrossing;
+%ignore radiopropa::ObserverFeature::checkCrossing;
 %include "radiopropa/module/Observer.h"
 %include "radiopropa/module/SimplePropagation.h"
 %include "radiopropa/module/PropagationCK.h"
+%include "radiopropa/module/PropagationBatchCK.h"
+
+%feature("director") radiopropa::BatchModule;
+%ignore radiopropa::CandidateBlock::getPositions;
+%ignore radiopropa::CandidateBlock::getDirections;
+%ignore radiopropa::CandidateBlock::getAmplitudes;
+%ignore radiopropa::CandidateBlock::getStepSizes;
+%ignore radiopropa::CandidateBlock::getActive;
+%ignore radiopropa::CandidateBlock::getStorage;
+%include "radiopropa/module/BatchModule.h"
+
+/* NumPy views of the arrays of a CandidateBlock, the numpy array interface is included in 1_swig.i */
+#ifdef WITHNUMPY
+%{
+static void releaseCandidateBlockStorage(PyObject *capsule) {
+	const radiopropa::Referenced *storage = (const radiopropa::Referenced *) PyCapsule_GetPointer(capsule, "radiopropa.CandidateBlock");
+	storage->removeReference();
+}
+
+/* the view holds a reference to the arrays of the block, so that it stays valid after processBlock */
+static PyObject *candidateBlockView(const radiopropa::CandidateBlock *block, int ndim, npy_intp *dims, int type, void *data) {
+	PyObject *array = PyArray_SimpleNewFromData(ndim, dims, type, data);
+	if (!array)
+		return NULL;
+	const radiopropa::Referenced *storage = block->getStorage();
+	PyObject *base = PyCapsule_New((void *) storage, "radiopropa.CandidateBlock", releaseCandidateBlockStorage);
+	if (!base) {
+		Py_DECREF(array);
+		return NULL;
+	}
+	storage->addReference();
+	if (PyArray_SetBaseObject((PyArrayObject *) array, base) < 0) {
+		Py_DECREF(array);
+		return NULL;
+	}
+	return array;
+}
+%}
+%extend radiopropa::CandidateBlock {
+    PyObject *positions() {
+        npy_intp dims[2] = {(npy_intp) $self->size(), 3};
+        return candidateBlockView($self, 2, dims, NPY_DOUBLE, $self->getPositions());
+    }
+    PyObject *directions() {
+        npy_intp dims[2] = {(npy_intp) $self->size(), 3};
+        return candidateBlockView($self, 2, dims, NPY_DOUBLE, $self->getDirections());
+    }
+    PyObject *amplitudes() {
+        npy_intp dims[1] = {(npy_intp) $self->size()};
+        return candidateBlockView($self, 1, dims, NPY_DOUBLE, $self->getAmplitudes());
+    }
+    PyObject *stepSizes() {
+        npy_intp dims[1] = {(npy_intp) $self->size()};
+        return candidateBlockView($self, 1, dims, NPY_DOUBLE, $self->getStepSizes());
+    }
+    PyObject *active() {
+        npy_intp dims[1] = {(npy_intp) $self->size()};
+        return candidateBlockView($self, 1, dims, NPY_BOOL, $self->getActive());
+    }
+};
+%extend radiopropa::RandomStream {
+    PyObject *uniforms(size_t count) {
+        npy_intp dims[1] = {(npy_intp) count};
+        PyObject *array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+        $self->fillUniform((double *) PyArray_DATA((PyArrayObject *) array), count);
+        return array;
+    }
+    PyObject *normals(size_t count, double mean = 0.0, double sigma = 1.0) {
+        npy_intp dims[1] = {(npy_intp) count};
+        PyObject *array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+        $self->fillNormal((double *) PyArray_DATA((PyArrayObject *) array), count, mean, sigma);
+        return array;
+    }
+};
+#endif
+%include "radiopropa/module/PropagationRK.h"
+%template(PropagationRKCashKarp) radiopropa::PropagationRK<radiopropa::CashKarpTableau>;
+%template(PropagationRKDormandPrince) radiopropa::PropagationRK<radiopropa::DormandPrinceTableau>;
+%template(PropagationRKBogackiShampine) radiopropa::PropagationRK<radiopropa::BogackiShampineTableau>;
+%template(PropagationRKFehlberg78) radiopropa::PropagationRK<radiopropa::Fehlberg78Tableau>;
+%include "radiopropa/module/PropagationStratified.h"
+%include "radiopropa/module/TransmissiveLayer.h"
 
 %ignore radiopropa::Output::enableProperty(const std::string &property, const Variant& defaultValue, const std::string &comment = "");
 %extend radiopropa::Output{
@@ -438,6 +577,8 @@ class ModuleListIterator {
 };
 
 %template(ModuleListRefPtr) radiopropa::ref_ptr<radiopropa::ModuleList>;
+%threadallow radiopropa::ModuleList::run;
+%threadallow radiopropa::ModuleList::runBatch;
 %include "radiopropa/ModuleList.h"
 
 %template(ParticleCollectorRefPtr) radiopropa::ref_ptr<radiopropa::ParticleCollector>;
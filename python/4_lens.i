@@ -1,21 +1,7 @@
 /* 4. Magnetic Lens */
 
+/* the numpy array interface is included and initialized in 1_swig.i */
 #ifdef WITHNUMPY
-%{
-/* Include numpy array interface, if available */
-  #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
-  #include "numpy/arrayobject.h"
-  #include "numpy/ufuncobject.h"
-%}
-#endif
-
-/* Initialize numpy array interface, if available */
-#ifdef WITHNUMPY
-%init %{
-import_array();
-import_ufunc();
-%}
-
 %pythoncode %{
 import numpy
 __WITHNUMPY = True
@@ -33,7 +19,6 @@ __WITHNUMPY = False
 %include typemaps.i
 
 %template(IntVector) std::vector<int>;
-%template(DoubleVector) std::vector<double>;
 
 %{
 #include "radiopropa/magneticLens/ModelMatrix.h"
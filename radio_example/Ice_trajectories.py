@@ -1,25 +1,6 @@
 import radiopropa
 import numpy as np
 
-
-class ObserverZ(radiopropa.ObserverFeature):
-    """
-    An observer plane parallel to the xy plane in depth z.
-    """
-    def __init__(self, Z):
-        radiopropa.ObserverFeature.__init__(self)
-        self.__Z = Z
-
-    def checkDetection(self, candidate):
-        cx = candidate.current.getPosition().getZ() - self.__Z
-        px = candidate.previous.getPosition().getZ() - self.__Z
-
-        if np.sign(cx) == np.sign(px):
-            return radiopropa.NOTHING
-        else:
-            return radiopropa.DETECTED
-
-
 iceModel = radiopropa.GorhamIceModel()
 
 if __name__ == "__main__":
@@ -29,13 +10,13 @@ if __name__ == "__main__":
 
     # Observer to stop imulation at =0m and z=300m
     obs = radiopropa.Observer()
-    obsz = ObserverZ(0.0)
+    obsz = radiopropa.ObserverPlane(radiopropa.Vector3d(0, 0, 0), radiopropa.Vector3d(0, 0, 1))
     obs.add(obsz)
     obs.setDeactivateOnDetection(True)
     sim.add(obs)
 
     obs2 = radiopropa.Observer()
-    obsz2 = ObserverZ(-300.0)
+    obsz2 = radiopropa.ObserverPlane(radiopropa.Vector3d(0, 0, -300), radiopropa.Vector3d(0, 0, 1))
     obs.add(obsz2)
     obs2.setDeactivateOnDetection(True)
     sim.add(obs2)
@@ -7,38 +7,56 @@
 namespace radiopropa {
 
 Candidate::Candidate(int id, double E, Vector3d pos, Vector3d dir, double z, double weight) :
-		trajectoryLength(0), weight(1), currentStep(0), nextStep(0), active(true), parent(0) {
-	ParticleState state(id, E, pos, dir);
-	source = state;
-	created = state;
-	previous = state;
-	current = state;
+		current(id, E, pos, dir), previous(current), trajectoryLength(0), currentStep(0), nextStep(0), weight(1), active(true), stepDerivatives(false), pooled(false),
+		cold(new Cold(current)), source(cold->source), created(cold->created), secondaries(cold->secondaries), properties(cold->properties), parent(0) {
+	assignSerialNumber();
+}
 
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
-#elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
-#else
-		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
-#endif
+Candidate::Candidate(const ParticleState &state) :
+		current(state), previous(state), trajectoryLength(0), currentStep(0), nextStep(0), weight(1), active(true), stepDerivatives(false), pooled(false),
+		cold(new Cold(state)), source(cold->source), created(cold->created), secondaries(cold->secondaries), properties(cold->properties), parent(0) {
+	assignSerialNumber();
+}
 
+Candidate::Candidate(const Candidate &c) :
+		Referenced(c), current(c.current), previous(c.previous), trajectoryLength(c.trajectoryLength), currentStep(c.currentStep), nextStep(c.nextStep),
+		previousDerivative(c.previousDerivative), currentDerivative(c.currentDerivative), weight(c.weight), active(c.active), stepDerivatives(c.stepDerivatives), pooled(false),
+		cold(new Cold(*c.cold)), source(cold->source), created(cold->created), secondaries(cold->secondaries), properties(cold->properties), parent(c.parent) {
 }
 
-Candidate::Candidate(const ParticleState &state) :
-		source(state), created(state), current(state), previous(state), trajectoryLength(0), currentStep(0), nextStep(0), active(true), parent(0) {
+Candidate &Candidate::operator=(const Candidate &c) {
+	if (this == &c)
+		return *this;
+	current = c.current;
+	previous = c.previous;
+	trajectoryLength = c.trajectoryLength;
+	currentStep = c.currentStep;
+	nextStep = c.nextStep;
+	previousDerivative = c.previousDerivative;
+	currentDerivative = c.currentDerivative;
+	weight = c.weight;
+	active = c.active;
+	stepDerivatives = c.stepDerivatives;
+	*cold = *c.cold;
+	parent = c.parent;
+	return *this;
+}
+
+Candidate::~Candidate() {
+	delete cold;
+}
 
+void Candidate::assignSerialNumber() {
 #if defined(OPENMP_3_1)
 		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
+		{cold->serialNumber = nextSerialNumber++;}
 #elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
+		{cold->serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
 #else
 		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
+		{cold->serialNumber = nextSerialNumber++;}
 #endif
-
+	cold->random.seed(RandomStream::getRunSeed(), cold->serialNumber);
 }
 
 bool Candidate::isActive() const {
@@ -76,6 +94,61 @@ void Candidate::setWeight(double w) {
 void Candidate::setCurrentStep(double lstep) {
 	currentStep = lstep;
 	trajectoryLength += lstep;
+	stepDerivatives = false;
+}
+
+void Candidate::setStepDerivatives(const Vector3d &p, const Vector3d &c) {
+	previousDerivative = p;
+	currentDerivative = c;
+	stepDerivatives = true;
+}
+
+bool Candidate::hasStepDerivatives() const {
+	return stepDerivatives;
+}
+
+Vector3d Candidate::getInterpolatedPosition(double t) const {
+	const Vector3d &x0 = previous.getPosition();
+	const Vector3d &x1 = current.getPosition();
+	if (!stepDerivatives)
+		return x0 + (x1 - x0) * t;
+
+	// cubic Hermite basis
+	double t2 = t * t, t3 = t2 * t;
+	double h = currentStep;
+	return x0 * (2 * t3 - 3 * t2 + 1) + previousDerivative * (h * (t3 - 2 * t2 + t))
+			+ x1 * (-2 * t3 + 3 * t2) + currentDerivative * (h * (t3 - t2));
+}
+
+Vector3d Candidate::getInterpolatedDirection(double t) const {
+	if (!stepDerivatives || (currentStep == 0))
+		return (previous.getDirection() * (1 - t) + current.getDirection() * t).getUnitVector();
+
+	// derivative of the cubic Hermite interpolant
+	double t2 = t * t;
+	const Vector3d &x0 = previous.getPosition();
+	const Vector3d &x1 = current.getPosition();
+	Vector3d d = (x1 - x0) * (-6 * t2 + 6 * t) / currentStep
+			+ previousDerivative * (3 * t2 - 4 * t + 1)
+			+ currentDerivative * (3 * t2 - 2 * t);
+	return d.getUnitVector();
+}
+
+void Candidate::truncateStep(double t) {
+	Vector3d position = getInterpolatedPosition(t);
+	Vector3d direction = getInterpolatedDirection(t);
+	if (stepDerivatives && (currentStep != 0)) {
+		// the restriction of the cubic to [0, t] has the same Hermite form
+		double t2 = t * t;
+		currentDerivative = (current.getPosition() - previous.getPosition())
+				* (-6 * t2 + 6 * t) / currentStep
+				+ previousDerivative * (3 * t2 - 4 * t + 1)
+				+ currentDerivative * (3 * t2 - 2 * t);
+	}
+	current.setPosition(position);
+	current.setDirection(direction);
+	trajectoryLength -= (1 - t) * currentStep;
+	currentStep *= t;
 }
 
 void Candidate::setNextStep(double step) {
@@ -86,38 +159,53 @@ void Candidate::limitNextStep(double step) {
 	nextStep = std::min(nextStep, step);
 }
 
+void Candidate::setProperty(PropertyKey key, const Variant &value) {
+	properties.set(key, value);
+}
+
+const Variant &Candidate::getProperty(PropertyKey key) const {
+	const Variant *value = properties.find(key);
+	if (!value)
+		throw std::runtime_error("Unknown candidate property: " + propertyName(key));
+	return *value;
+}
+
+bool Candidate::removeProperty(PropertyKey key) {
+	return properties.erase(key);
+}
+
+bool Candidate::hasProperty(PropertyKey key) const {
+	return properties.find(key) != 0;
+}
+
 void Candidate::setProperty(const std::string &name, const Variant &value) {
-	properties[name] = value;
+	setProperty(propertyKey(name), value);
 }
 
 const Variant &Candidate::getProperty(const std::string &name) const {
-	PropertyMap::const_iterator i = properties.find(name);
-	if (i == properties.end())
+	PropertyKey key;
+	if (!findPropertyKey(name, key))
 		throw std::runtime_error("Unknown candidate property: " + name);
-	return i->second;
+	return getProperty(key);
 }
 
-bool Candidate::removeProperty(const std::string& name) {
-	PropertyMap::iterator i = properties.find(name);
-	if (i == properties.end())
-		return false;
-	properties.erase(i);
-	return true;
+bool Candidate::removeProperty(const std::string &name) {
+	PropertyKey key;
+	return findPropertyKey(name, key) && removeProperty(key);
 }
 
 bool Candidate::hasProperty(const std::string &name) const {
-	PropertyMap::const_iterator i = properties.find(name);
-	if (i == properties.end())
-		return false;
-	return true;
+	PropertyKey key;
+	return findPropertyKey(name, key) && hasProperty(key);
 }
 
 void Candidate::addSecondary(Candidate *c) {
+	c->cold->random = cold->random.split(secondaries.size());
 	secondaries.push_back(c);
 }
 
 void Candidate::addSecondary(int id, double frequency, double weight) {
-	ref_ptr<Candidate> secondary = new Candidate;
+	ref_ptr<Candidate> secondary = CandidatePool::acquire();
 	secondary->setTrajectoryLength(trajectoryLength);
 	secondary->setWeight(weight);
 	secondary->source = source;
@@ -127,11 +215,12 @@ void Candidate::addSecondary(int id, double frequency, double weight) {
 	secondary->current.setId(id);
 	secondary->current.setFrequency(frequency);
 	secondary->parent = this;
+	secondary->cold->random = cold->random.split(secondaries.size());
 	secondaries.push_back(secondary);
 }
 
 void Candidate::addSecondary(int id, double frequency, Vector3d position, double weight) {
-	ref_ptr<Candidate> secondary = new Candidate;
+	ref_ptr<Candidate> secondary = CandidatePool::acquire();
 	secondary->setTrajectoryLength(trajectoryLength - (current.getPosition() - position).getR() );
 	secondary->setWeight(weight);
 	secondary->source = source;
@@ -142,6 +231,7 @@ void Candidate::addSecondary(int id, double frequency, Vector3d position, double
 	secondary->current.setFrequency(frequency);
 	secondary->current.setPosition(position);
 	secondary->parent = this;
+	secondary->cold->random = cold->random.split(secondaries.size());
 	secondaries.push_back(secondary);
 }
 
@@ -157,7 +247,7 @@ std::string Candidate::getDescription() const {
 }
 
 ref_ptr<Candidate> Candidate::clone(bool recursive) const {
-	ref_ptr<Candidate> cloned = new Candidate;
+	ref_ptr<Candidate> cloned = CandidatePool::acquire();
 	cloned->source = source;
 	cloned->created = created;
 	cloned->current = current;
@@ -169,6 +259,9 @@ ref_ptr<Candidate> Candidate::clone(bool recursive) const {
 	cloned->trajectoryLength = trajectoryLength;
 	cloned->currentStep = currentStep;
 	cloned->nextStep = nextStep;
+	cloned->stepDerivatives = stepDerivatives;
+	cloned->previousDerivative = previousDerivative;
+	cloned->currentDerivative = currentDerivative;
 	if (recursive) {
 		cloned->secondaries.reserve(secondaries.size());
 		for (size_t i = 0; i < secondaries.size(); i++) {
@@ -181,25 +274,34 @@ ref_ptr<Candidate> Candidate::clone(bool recursive) const {
 }
 
 uint64_t Candidate::getSerialNumber() const {
-	return serialNumber;
+	return cold->serialNumber;
 }
 
 void Candidate::setSerialNumber(const uint64_t snr) {
-	serialNumber = snr;
+	cold->serialNumber = snr;
+	cold->random.seed(RandomStream::getRunSeed(), cold->serialNumber);
+}
+
+RandomStream &Candidate::getRandomStream() {
+	return cold->random;
+}
+
+void Candidate::setRandomStream(const RandomStream &stream) {
+	cold->random = stream;
 }
 
 uint64_t Candidate::getSourceSerialNumber() const {
 	if (parent)
 		return parent->getSourceSerialNumber();
 	else
-		return serialNumber;
+		return cold->serialNumber;
 }
 
 uint64_t Candidate::getCreatedSerialNumber() const {
 	if (parent)
 		return parent->getSerialNumber();
 	else
-		return serialNumber;
+		return cold->serialNumber;
 }
 
 void Candidate::setNextSerialNumber(uint64_t snr) {
@@ -218,4 +320,128 @@ void Candidate::restart() {
 	current = source;
 }
 
+void Candidate::reset(const ParticleState &state) {
+	source = state;
+	created = state;
+	current = state;
+	previous = state;
+	secondaries.clear();
+	properties.clear();
+	parent = 0;
+	active = true;
+	weight = 1;
+	trajectoryLength = 0;
+	currentStep = 0;
+	nextStep = 0;
+	stepDerivatives = false;
+	assignSerialNumber();
+}
+
+void Candidate::dispose() const {
+	if (pooled)
+		CandidatePool::recycle(const_cast<Candidate *>(this));
+	else
+		delete this;
+}
+
+// CandidatePool --------------------------------------------------------------
+namespace {
+
+struct FreeList {
+	std::vector<Candidate *> candidates;
+	size_t allocations;
+	size_t reuses;
+	FreeList() :
+			allocations(0), reuses(0) {
+	}
+};
+
+size_t poolCapacity = 1024;
+
+// free lists of all threads, for the statistics
+std::vector<FreeList *> freeLists;
+
+FreeList *threadFreeList = 0;
+#pragma omp threadprivate(threadFreeList)
+
+FreeList &getFreeList() {
+	if (!threadFreeList) {
+		threadFreeList = new FreeList();
+#pragma omp critical(CandidatePoolFreeLists)
+		freeLists.push_back(threadFreeList);
+	}
+	return *threadFreeList;
+}
+
+} // namespace
+
+ref_ptr<Candidate> CandidatePool::acquire(const ParticleState &state) {
+	FreeList &list = getFreeList();
+	if (list.candidates.empty()) {
+		list.allocations++;
+		Candidate *candidate = new Candidate(state);
+		candidate->pooled = true;
+		return candidate;
+	}
+	Candidate *candidate = list.candidates.back();
+	list.candidates.pop_back();
+	list.reuses++;
+	candidate->reset(state);
+	return candidate;
+}
+
+void CandidatePool::recycle(Candidate *candidate) {
+	// release the secondaries first, they may be recycled themselves
+	candidate->secondaries.clear();
+	candidate->properties.clear();
+
+	FreeList &list = getFreeList();
+	if (list.candidates.size() >= poolCapacity) {
+		delete candidate;
+		return;
+	}
+	if (list.candidates.capacity() < poolCapacity)
+		list.candidates.reserve(poolCapacity);
+	list.candidates.push_back(candidate);
+}
+
+void CandidatePool::setCapacity(size_t capacity) {
+	poolCapacity = capacity;
+}
+
+size_t CandidatePool::getCapacity() {
+	return poolCapacity;
+}
+
+void CandidatePool::clear() {
+	FreeList &list = getFreeList();
+	for (size_t i = 0; i < list.candidates.size(); i++)
+		delete list.candidates[i];
+	list.candidates.clear();
+}
+
+size_t CandidatePool::getAllocations() {
+	size_t n = 0;
+#pragma omp critical(CandidatePoolFreeLists)
+	for (size_t i = 0; i < freeLists.size(); i++)
+		n += freeLists[i]->allocations;
+	return n;
+}
+
+size_t CandidatePool::getReuses() {
+	size_t n = 0;
+#pragma omp critical(CandidatePoolFreeLists)
+	for (size_t i = 0; i < freeLists.size(); i++)
+		n += freeLists[i]->reuses;
+	return n;
+}
+
+void CandidatePool::resetStatistics() {
+#pragma omp critical(CandidatePoolFreeLists)
+	for (size_t i = 0; i < freeLists.size(); i++) {
+		freeLists[i]->allocations = 0;
+		freeLists[i]->reuses = 0;
+	}
+}
+
 } // namespace radiopropa
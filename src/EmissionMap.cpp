@@ -30,7 +30,7 @@ Vector3d CylindricalProjectionMap::drawDirection() const {
 	if (dirty)
 		updateCdf();
 
-	size_t bin = Random::instance().randBin(cdf);
+	size_t bin = RandomStream::instance().randBin(cdf);
 
 	return directionFromBin(bin);
 }
@@ -90,8 +90,8 @@ Vector3d CylindricalProjectionMap::directionFromBin(size_t bin) const {
 	double iTheta = bin / nPhi;
 
 	// any where in the bin
-	iPhi += Random::instance().rand();
-	iTheta += Random::instance().rand();
+	iPhi += RandomStream::instance().rand();
+	iTheta += RandomStream::instance().rand();
 
 	// cylindrical Coordinates
 	double phi = iPhi * sPhi;
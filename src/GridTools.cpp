@@ -1,9 +1,14 @@
 #include "radiopropa/GridTools.h"
 #include "radiopropa/Random.h"
+#include "radiopropa/Units.h"
 #include "radiopropa/magneticField/MagneticField.h"
 
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
+#include <limits>
 #include <sstream>
+#include <stdint.h>
 
 namespace radiopropa {
 
@@ -294,6 +299,152 @@ void fromMagneticFieldStrength(ref_ptr<ScalarGrid> grid, ref_ptr<MagneticField>
 	}
 }
 
+/*
+ Evaluate a scalar field at the cell centers origin + (i + 0.5) * spacing.
+ The z-index changes fastest in the grid, so every (x, y) column is contiguous
+ and is evaluated with one call to getValues.
+ */
+static void sampleColumns(std::vector<float> &values, ref_ptr<ScalarField> field,
+		Vector3d origin, Vector3d spacing, size_t Nx, size_t Ny, size_t Nz,
+		bool parallel) {
+#pragma omp parallel for schedule(dynamic, 1) if (parallel)
+	for (size_t column = 0; column < Nx * Ny; column++) {
+		std::vector<double> x(Nz), y(Nz), z(Nz), v(Nz);
+		for (size_t iz = 0; iz < Nz; iz++) {
+			x[iz] = origin.x + ((column / Ny) + 0.5) * spacing.x;
+			y[iz] = origin.y + ((column % Ny) + 0.5) * spacing.y;
+			z[iz] = origin.z + (iz + 0.5) * spacing.z;
+		}
+		field->getValues(Nz, &x[0], &y[0], &z[0], &v[0]);
+		for (size_t iz = 0; iz < Nz; iz++)
+			values[column * Nz + iz] = v[iz];
+	}
+}
+
+void fromScalarField(ref_ptr<ScalarGrid> grid, ref_ptr<ScalarField> field,
+		bool parallel) {
+	sampleColumns(grid->getGrid(), field, grid->getOrigin(),
+			Vector3d(grid->getSpacing()), grid->getNx(), grid->getNy(),
+			grid->getNz(), parallel);
+}
+
+ref_ptr<ScalarFieldGrid> bakeScalarField(ref_ptr<ScalarField> field,
+		Vector3d origin, Vector3d extent, size_t Nx, size_t Ny, size_t Nz,
+		bool parallel) {
+	if ((Nx == 0) or (Ny == 0) or (Nz == 0))
+		throw std::runtime_error("bakeScalarField: number of samples = 0");
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(origin, Nx, Ny, Nz, 1.);
+	ref_ptr<ScalarFieldGrid> baked = new ScalarFieldGrid(grid, origin, extent);
+	sampleColumns(grid->getGrid(), field, origin, extent / Vector3d(Nx, Ny, Nz),
+			Nx, Ny, Nz, parallel);
+	return baked;
+}
+
+ref_ptr<TabulatedDepthProfile> bakeDepthProfile(ref_ptr<ScalarField> field,
+		double zMin, double zMax, size_t samples, Vector3d position,
+		bool parallel) {
+	if (samples < 2)
+		throw std::runtime_error("bakeDepthProfile: less than 2 samples");
+	if (!(zMax > zMin))
+		throw std::runtime_error("bakeDepthProfile: zMax <= zMin");
+	std::vector<double> z(samples), n(samples);
+
+#pragma omp parallel for schedule(static) if (parallel)
+	for (size_t i = 0; i < samples; i++) {
+		Vector3d p = position;
+		p.z = zMin + (zMax - zMin) * i / (samples - 1);
+		z[i] = p.z;
+		n[i] = field->getValue(p);
+	}
+	return new TabulatedDepthProfile(z, n);
+}
+
+// identifies the binary files written by dumpScalarFieldGrid
+static const char scalarFieldGridTag[8] = {'R', 'P', 'S', 'F', 'G', 'R', 'D', '1'};
+
+void dumpScalarFieldGrid(ref_ptr<ScalarFieldGrid> field, std::string filename) {
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout) {
+		std::stringstream ss;
+		ss << "dump ScalarFieldGrid: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	ref_ptr<ScalarGrid> grid = field->getGrid();
+	uint64_t N[3] = {grid->getNx(), grid->getNy(), grid->getNz()};
+	Vector3d origin = field->getOrigin();
+	Vector3d extent = field->getExtent();
+	double volume[6] = {origin.x, origin.y, origin.z, extent.x, extent.y, extent.z};
+	fout.write(scalarFieldGridTag, sizeof(scalarFieldGridTag));
+	fout.write((char*) N, sizeof(N));
+	fout.write((char*) volume, sizeof(volume));
+	fout.write((char*) &(grid->getGrid()[0]), sizeof(float) * N[0] * N[1] * N[2]);
+	fout.close();
+}
+
+ref_ptr<ScalarFieldGrid> loadScalarFieldGrid(std::string filename) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin) {
+		std::stringstream ss;
+		ss << "load ScalarFieldGrid: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	char tag[sizeof(scalarFieldGridTag)];
+	uint64_t N[3];
+	double volume[6];
+	fin.read(tag, sizeof(tag));
+	fin.read((char*) N, sizeof(N));
+	fin.read((char*) volume, sizeof(volume));
+	if (!fin or !std::equal(tag, tag + sizeof(tag), scalarFieldGridTag))
+		throw std::runtime_error("loadScalarFieldGrid: not a ScalarFieldGrid file");
+
+	Vector3d origin(volume[0], volume[1], volume[2]);
+	Vector3d extent(volume[3], volume[4], volume[5]);
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(origin, N[0], N[1], N[2], 1.);
+	fin.read((char*) &(grid->getGrid()[0]), sizeof(float) * N[0] * N[1] * N[2]);
+	if (!fin)
+		throw std::runtime_error("loadScalarFieldGrid: file and grid size do not match");
+	fin.close();
+	return new ScalarFieldGrid(grid, origin, extent);
+}
+
+void dumpDepthProfile(ref_ptr<TabulatedDepthProfile> profile,
+		std::string filename) {
+	std::ofstream fout(filename.c_str());
+	if (!fout) {
+		std::stringstream ss;
+		ss << "dump TabulatedDepthProfile: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	const std::vector<double> &z = profile->getDepths();
+	const std::vector<double> &n = profile->getIndices();
+	fout << "# z [m]\tn\n";
+	fout << std::setprecision(17);
+	for (size_t i = 0; i < z.size(); i++)
+		fout << z[i] / meter << "\t" << n[i] << "\n";
+	fout.close();
+}
+
+ref_ptr<TabulatedDepthProfile> loadDepthProfile(std::string filename) {
+	std::ifstream fin(filename.c_str());
+	if (!fin) {
+		std::stringstream ss;
+		ss << "load TabulatedDepthProfile: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	// skip header lines
+	while (fin.peek() == '#')
+		fin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+	std::vector<double> z, n;
+	double zi, ni;
+	while (fin >> zi >> ni) {
+		z.push_back(zi * meter);
+		n.push_back(ni);
+	}
+	fin.close();
+	return new TabulatedDepthProfile(z, n);
+}
+
 double turbulentCorrelationLength(double lMin, double lMax, double alpha) {
 	double r = lMin / lMax;
 	double a = -alpha - 2;
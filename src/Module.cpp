@@ -17,9 +17,33 @@ void Module::setDescription(const std::string &d) {
 	description = d;
 }
 
+void Module::processBatch(const std::vector<Candidate *> &candidates) const {
+	for (size_t i = 0; i < candidates.size(); i++)
+		process(candidates[i]);
+}
+
+bool Module::usesPythonObjects() const {
+	return false;
+}
+
+static bool (*pythonObjectCheck)(const Referenced *object) = 0;
+
+bool isPythonObject(const Referenced *object) {
+	return object && pythonObjectCheck && pythonObjectCheck(object);
+}
+
+void setPythonObjectCheck(bool (*check)(const Referenced *object)) {
+	pythonObjectCheck = check;
+}
+
+bool isPythonModule(const Module *module) {
+	return module && (isPythonObject(module) || module->usesPythonObjects());
+}
+
 AbstractCondition::AbstractCondition() :
 		makeRejectedInactive(true), makeAcceptedInactive(false), rejectFlagKey(
-				"Rejected") {
+				"Rejected"), rejectFlagProperty(propertyKey("Rejected")),
+				acceptFlagProperty(propertyKey("")) {
 
 }
 
@@ -31,7 +55,7 @@ void AbstractCondition::reject(Candidate *candidate) const {
 		rejectAction->process(candidate);
 
 	if (!rejectFlagKey.empty())
-		candidate->setProperty(rejectFlagKey, rejectFlagValue);
+		candidate->setProperty(rejectFlagProperty, rejectFlagValue);
 
 	if (makeRejectedInactive)
 		candidate->setActive(false);
@@ -45,7 +69,7 @@ void AbstractCondition::accept(Candidate *candidate) const {
 		acceptAction->process(candidate);
 
 	if (!acceptFlagKey.empty())
-		candidate->setProperty(acceptFlagKey, acceptFlagValue);
+		candidate->setProperty(acceptFlagProperty, acceptFlagValue);
 
 	if (makeAcceptedInactive)
 		candidate->setActive(false);
@@ -69,12 +93,18 @@ void AbstractCondition::onAccept(Module *action) {
 
 void AbstractCondition::setRejectFlag(std::string key, std::string value) {
 	rejectFlagKey = key;
+	rejectFlagProperty = propertyKey(key);
 	rejectFlagValue = value;
 }
 
 void AbstractCondition::setAcceptFlag(std::string key, std::string value) {
 	acceptFlagKey = key;
+	acceptFlagProperty = propertyKey(key);
 	acceptFlagValue = value;
 }
 
+bool AbstractCondition::usesPythonObjects() const {
+	return isPythonModule(rejectAction) || isPythonModule(acceptAction);
+}
+
 } // namespace radiopropa
@@ -6,6 +6,8 @@
 #endif
 
 #include <algorithm>
+#include <ctime>
+#include <stdexcept>
 #include <signal.h>
 #ifndef sighandler_t
 typedef void (*sighandler_t)(int);
@@ -21,7 +23,9 @@ void g_cancel_signal_callback(int sig) {
 	g_cancel_signal_flag = true;
 }
 
-ModuleList::ModuleList() : showProgress(false) {
+ModuleList::ModuleList() :
+		showProgress(false), schedule(DynamicSchedule), chunkSize(1),
+		parallelSecondaries(false), pythonModulePolicy(PythonSerial) {
 }
 
 ModuleList::~ModuleList() {
@@ -31,6 +35,268 @@ void ModuleList::setShowProgress(bool show) {
 	showProgress = show;
 }
 
+void ModuleList::setSchedule(Schedule s, std::size_t c) {
+	if (c == 0)
+		throw std::runtime_error("ModuleList::setSchedule: chunkSize == 0");
+	schedule = s;
+	chunkSize = c;
+}
+
+ModuleList::Schedule ModuleList::getSchedule() const {
+	return schedule;
+}
+
+std::size_t ModuleList::getChunkSize() const {
+	return chunkSize;
+}
+
+std::vector<double> ModuleList::getThreadBusyTimes() const {
+	return busyTimes;
+}
+
+void ModuleList::setParallelSecondaries(bool parallel) {
+	parallelSecondaries = parallel;
+}
+
+bool ModuleList::getParallelSecondaries() const {
+	return parallelSecondaries;
+}
+
+void ModuleList::setPythonModulePolicy(PythonModulePolicy policy) {
+	pythonModulePolicy = policy;
+}
+
+ModuleList::PythonModulePolicy ModuleList::getPythonModulePolicy() const {
+	return pythonModulePolicy;
+}
+
+bool ModuleList::hasPythonModules() const {
+	module_list_t::const_iterator m;
+	for (m = modules.begin(); m != modules.end(); m++)
+		if (isPythonModule(*m))
+			return true;
+	return false;
+}
+
+bool ModuleList::usesPythonObjects() const {
+	return hasPythonModules();
+}
+
+// number of threads of a parallel run, following the PythonModulePolicy
+int ModuleList::getNumberOfThreads(const SourceInterface *source) const {
+#if _OPENMP
+	int nThreads = omp_get_max_threads();
+#else
+	int nThreads = 1;
+#endif
+	bool python = hasPythonModules()
+			|| (source && (isPythonObject(source) || source->usesPythonObjects()));
+	if ((nThreads == 1) || (pythonModulePolicy == PythonParallel) || !python)
+		return nThreads;
+	if (pythonModulePolicy == PythonFail)
+		throw std::runtime_error("ModuleList: parallel run with Python modules, see ModuleList::setPythonModulePolicy");
+	return 1;
+}
+
+namespace {
+
+double wallTime() {
+#if _OPENMP
+	return omp_get_wtime();
+#else
+	return double(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+#if _OPENMP
+// share of the candidates of one thread, other threads steal from its end
+struct WorkRange {
+	size_t begin, end;
+	omp_lock_t lock;
+};
+#endif
+
+// propagates the i-th candidate of a vector
+class CandidateVectorTask {
+	ModuleList &modules;
+	ModuleList::candidate_vector_t &candidates;
+	bool recursive;
+	ProgressBar *progressbar;
+public:
+	CandidateVectorTask(ModuleList &modules,
+			ModuleList::candidate_vector_t &candidates, bool recursive,
+			ProgressBar *progressbar) :
+			modules(modules), candidates(candidates), recursive(recursive),
+			progressbar(progressbar) {
+	}
+	void operator()(size_t i) {
+		if (g_cancel_signal_flag)
+			return;
+
+		try {
+			modules.run(candidates[i], recursive);
+		} catch (std::exception &e) {
+			std::cerr << "Exception in radiopropa::ModuleList::run: " << std::endl;
+			std::cerr << e.what() << std::endl;
+		}
+
+		if (progressbar)
+#pragma omp critical(progressbarUpdate)
+			progressbar->update();
+	}
+};
+
+// propagates a candidate drawn from a source
+// candidate i gets the serial number firstSerial + i and is drawn from the random stream of that number,
+// independent of the thread that runs the task
+class SourceTask {
+	ModuleList &modules;
+	SourceInterface *source;
+	bool recursive;
+	ProgressBar *progressbar;
+	uint64_t firstSerial;
+public:
+	SourceTask(ModuleList &modules, SourceInterface *source, bool recursive,
+			ProgressBar *progressbar, uint64_t firstSerial) :
+			modules(modules), source(source), recursive(recursive),
+			progressbar(progressbar), firstSerial(firstSerial) {
+	}
+	void operator()(size_t i) {
+		if (g_cancel_signal_flag)
+			return;
+
+		ref_ptr<Candidate> candidate;
+
+		try {
+			RandomStream random(RandomStream::getRunSeed(), firstSerial + i);
+			RandomStream::Scope scope(random);
+			candidate = source->getCandidate();
+			if (candidate.valid()) {
+				candidate->setSerialNumber(firstSerial + i);
+				candidate->setRandomStream(random);
+			}
+		} catch (std::exception &e) {
+			std::cerr << "Exception in radiopropa::ModuleList::run: source->getCandidate" << std::endl;
+			std::cerr << e.what() << std::endl;
+			g_cancel_signal_flag = true;
+		}
+
+		if (candidate.valid()) {
+			try {
+				modules.run(candidate, recursive);
+			} catch (std::exception &e) {
+				std::cerr << "Exception in radiopropa::ModuleList::run: " << std::endl;
+				std::cerr << e.what() << std::endl;
+				g_cancel_signal_flag = true;
+			}
+		}
+
+		if (progressbar)
+#pragma omp critical(progressbarUpdate)
+			progressbar->update();
+	}
+};
+
+} // namespace
+
+template<typename Task>
+void ModuleList::runScheduled(size_t count, int nThreads, Task &task) {
+#if _OPENMP
+	busyTimes.assign(nThreads, 0);
+
+	if (schedule != WorkStealingSchedule) {
+		omp_sched_t kind = omp_sched_dynamic;
+		if (schedule == StaticSchedule)
+			kind = omp_sched_static;
+		else if (schedule == GuidedSchedule)
+			kind = omp_sched_guided;
+		omp_set_schedule(kind, int(chunkSize));
+
+#pragma omp parallel num_threads(nThreads)
+		{
+			double busy = 0;
+#pragma omp for schedule(runtime)
+			for (size_t i = 0; i < count; i++) {
+				double start = wallTime();
+				task(i);
+				busy += wallTime() - start;
+			}
+			busyTimes[omp_get_thread_num()] = busy;
+		}
+		return;
+	}
+
+	std::vector<WorkRange> ranges;
+#pragma omp parallel num_threads(nThreads)
+	{
+		int teamSize = omp_get_num_threads();
+		int id = omp_get_thread_num();
+#pragma omp single
+		{
+			// contiguous shares, so that a thread works on neighboring candidates while it is not stealing
+			ranges.resize(teamSize);
+			for (int t = 0; t < teamSize; t++) {
+				ranges[t].begin = count * t / teamSize;
+				ranges[t].end = count * (t + 1) / teamSize;
+				omp_init_lock(&ranges[t].lock);
+			}
+		}
+
+		double busy = 0;
+		WorkRange &own = ranges[id];
+		while (true) {
+			// next chunk from the front of the own share
+			omp_set_lock(&own.lock);
+			size_t first = own.begin;
+			size_t last = std::min(own.end, first + chunkSize);
+			own.begin = last;
+			omp_unset_lock(&own.lock);
+
+			if (first < last) {
+				double start = wallTime();
+				for (size_t i = first; i < last; i++)
+					task(i);
+				busy += wallTime() - start;
+				continue;
+			}
+
+			// steal the upper half of the remaining share of the next thread with work
+			// (only one lock is held at a time, the empty own share is not a target in the meantime)
+			bool stolen = false;
+			for (int k = 1; (k < teamSize) && !stolen; k++) {
+				WorkRange &victim = ranges[(id + k) % teamSize];
+				omp_set_lock(&victim.lock);
+				if (victim.begin < victim.end) {
+					first = victim.begin + (victim.end - victim.begin) / 2;
+					last = victim.end;
+					victim.end = first;
+					stolen = true;
+				}
+				omp_unset_lock(&victim.lock);
+			}
+			if (!stolen)
+				break;
+			omp_set_lock(&own.lock);
+			own.begin = first;
+			own.end = last;
+			omp_unset_lock(&own.lock);
+		}
+		busyTimes[id] = busy;
+
+#pragma omp barrier
+#pragma omp single
+		for (int t = 0; t < teamSize; t++)
+			omp_destroy_lock(&ranges[t].lock);
+	}
+#else
+	busyTimes.assign(1, 0);
+	double start = wallTime();
+	for (size_t i = 0; i < count; i++)
+		task(i);
+	busyTimes[0] = wallTime() - start;
+#endif
+}
+
 void ModuleList::add(Module *module) {
 	modules.push_back(module);
 }
@@ -62,7 +328,15 @@ void ModuleList::process(ref_ptr<Candidate> candidate) const {
 	process((Candidate*) candidate);
 }
 
+void ModuleList::processBatch(const std::vector<Candidate *> &candidates) const {
+	module_list_t::const_iterator m;
+	for (m = modules.begin(); m != modules.end(); m++)
+		(*m)->processBatch(candidates);
+}
+
 void ModuleList::run(Candidate* candidate, bool recursive, bool secondariesFirst) {
+	RandomStream::Scope scope(candidate->getRandomStream());
+
 	// propagate primary candidate until finished
 	while (candidate->isActive() && !g_cancel_signal_flag) {
 		process(candidate);
@@ -78,12 +352,51 @@ void ModuleList::run(Candidate* candidate, bool recursive, bool secondariesFirst
 	}
 
 	// propagate secondaries after completing primary
-	if (recursive and not secondariesFirst) {
-		for (size_t i = 0; i < candidate->secondaries.size(); i++) {
-			if (g_cancel_signal_flag)
-				break;
-			run(candidate->secondaries[i], recursive, secondariesFirst);
+	if (recursive and not secondariesFirst)
+		runSecondaries(candidate);
+}
+
+void ModuleList::runSecondaries(Candidate *candidate) {
+	size_t count = candidate->secondaries.size();
+	if (count == 0)
+		return;
+
+#if _OPENMP
+	if (parallelSecondaries && !omp_in_parallel() && (omp_get_max_threads() > 1)
+			&& ((pythonModulePolicy == PythonParallel) || !hasPythonModules())) {
+		// start a team whose threads all take part in the tree of secondaries
+#pragma omp parallel
+#pragma omp single
+		runSecondaries(candidate);
+		return;
+	}
+
+	if (parallelSecondaries && omp_in_parallel()) {
+		// one task per secondary, idle threads of the team pick them up
+		for (size_t i = 0; i < count; i++) {
+			ref_ptr<Candidate> secondary = candidate->secondaries[i];
+#pragma omp task firstprivate(secondary)
+			{
+				if (!g_cancel_signal_flag) {
+					try {
+						run(secondary, true, false);
+					} catch (std::exception &e) {
+						std::cerr << "Exception in radiopropa::ModuleList::run: " << std::endl;
+						std::cerr << e.what() << std::endl;
+					}
+				}
+			}
 		}
+		// each task waits for its own children, so the whole tree is finished here
+#pragma omp taskwait
+		return;
+	}
+#endif
+
+	for (size_t i = 0; i < count; i++) {
+		if (g_cancel_signal_flag)
+			break;
+		run(candidate->secondaries[i], true, false);
 	}
 }
 
@@ -94,8 +407,9 @@ void ModuleList::run(ref_ptr<Candidate> candidate, bool recursive, bool secondar
 void ModuleList::run(candidate_vector_t &candidates, bool recursive, bool secondariesFirst) {
 	size_t count = candidates.size();
 
+	int nThreads = getNumberOfThreads();
 #if _OPENMP
-	std::cout << "radiopropa::ModuleList: Number of Threads: " << omp_get_max_threads() << std::endl;
+	std::cout << "radiopropa::ModuleList: Number of Threads: " << nThreads << std::endl;
 #endif
 
 	ProgressBar progressbar(count);
@@ -110,22 +424,9 @@ void ModuleList::run(candidate_vector_t &candidates, bool recursive, bool second
 	sighandler_t old_sigterm_handler = ::signal(SIGTERM,
 			g_cancel_signal_callback);
 
-#pragma omp parallel for schedule(static, 1000)
-	for (size_t i = 0; i < count; i++) {
-		if (g_cancel_signal_flag)
-			continue;
-
-		try {
-			run(candidates[i], recursive);
-		} catch (std::exception &e) {
-			std::cerr << "Exception in radiopropa::ModuleList::run: " << std::endl;
-			std::cerr << e.what() << std::endl;
-		}
-
-		if (showProgress)
-#pragma omp critical(progressbarUpdate)
-			progressbar.update();
-	}
+	CandidateVectorTask task(*this, candidates, recursive,
+			showProgress ? &progressbar : 0);
+	runScheduled(count, nThreads, task);
 
 	::signal(SIGINT, old_sigint_handler);
 	::signal(SIGTERM, old_sigterm_handler);
@@ -133,8 +434,9 @@ void ModuleList::run(candidate_vector_t &candidates, bool recursive, bool second
 
 void ModuleList::run(SourceInterface *source, size_t count, bool recursive, bool secondariesFirst) {
 
+	int nThreads = getNumberOfThreads(source);
 #if _OPENMP
-	std::cout << "radiopropa::ModuleList: Number of Threads: " << omp_get_max_threads() << std::endl;
+	std::cout << "radiopropa::ModuleList: Number of Threads: " << nThreads << std::endl;
 #endif
 
 	ProgressBar progressbar(count);
@@ -147,37 +449,83 @@ void ModuleList::run(SourceInterface *source, size_t count, bool recursive, bool
 	sighandler_t old_signal_handler = ::signal(SIGINT,
 			g_cancel_signal_callback);
 
-#pragma omp parallel for schedule(static, 1000)
-	for (size_t i = 0; i < count; i++) {
+	// reserve the serial numbers of the candidates
+	uint64_t firstSerial = Candidate::getNextSerialNumber();
+	Candidate::setNextSerialNumber(firstSerial + count);
+
+	SourceTask task(*this, source, recursive, showProgress ? &progressbar : 0,
+			firstSerial);
+	runScheduled(count, nThreads, task);
+
+	::signal(SIGINT, old_signal_handler);
+}
+
+void ModuleList::runBatch(candidate_vector_t &candidates, size_t batchSize, bool recursive) {
+	if (batchSize == 0)
+		throw std::runtime_error("ModuleList::runBatch: batchSize == 0");
+
+	size_t count = candidates.size();
+	size_t nBatches = (count + batchSize - 1) / batchSize;
+
+	int nThreads = getNumberOfThreads();
+#if _OPENMP
+	std::cout << "radiopropa::ModuleList: Number of Threads: " << nThreads << std::endl;
+#endif
+
+	ProgressBar progressbar(count);
+
+	if (showProgress) {
+		progressbar.start("Run ModuleList");
+	}
+
+	g_cancel_signal_flag = false;
+	sighandler_t old_sigint_handler = ::signal(SIGINT,
+			g_cancel_signal_callback);
+	sighandler_t old_sigterm_handler = ::signal(SIGTERM,
+			g_cancel_signal_callback);
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nThreads)
+	for (size_t b = 0; b < nBatches; b++) {
 		if (g_cancel_signal_flag)
 			continue;
 
-		ref_ptr<Candidate> candidate;
+		size_t first = b * batchSize;
+		size_t last = std::min(count, first + batchSize);
+
+		std::vector<Candidate *> active;
+		active.reserve(last - first);
+		for (size_t i = first; i < last; i++)
+			if (candidates[i]->isActive())
+				active.push_back(candidates[i]);
 
 		try {
-			candidate = source->getCandidate();
-		} catch (std::exception &e) {
-			std::cerr << "Exception in radiopropa::ModuleList::run: source->getCandidate" << std::endl;
-			std::cerr << e.what() << std::endl;
-			g_cancel_signal_flag = true;
-		}
+			// step all active candidates of the block, then drop the finished ones
+			while (!active.empty() && !g_cancel_signal_flag) {
+				processBatch(active);
+				size_t n = 0;
+				for (size_t i = 0; i < active.size(); i++)
+					if (active[i]->isActive())
+						active[n++] = active[i];
+				active.resize(n);
+			}
 
-		if (candidate.valid()) {
-			try {
-				run(candidate, recursive);
-			} catch (std::exception &e) {
-				std::cerr << "Exception in radiopropa::ModuleList::run: " << std::endl;
-				std::cerr << e.what() << std::endl;
-				g_cancel_signal_flag = true;
+			if (recursive) {
+				for (size_t i = first; i < last; i++)
+					runSecondaries(candidates[i]);
 			}
+		} catch (std::exception &e) {
+			std::cerr << "Exception in radiopropa::ModuleList::runBatch: " << std::endl;
+			std::cerr << e.what() << std::endl;
 		}
 
 		if (showProgress)
 #pragma omp critical(progressbarUpdate)
-			progressbar.update();
+			for (size_t i = first; i < last; i++)
+				progressbar.update();
 	}
 
-	::signal(SIGINT, old_signal_handler);
+	::signal(SIGINT, old_sigint_handler);
+	::signal(SIGTERM, old_sigterm_handler);
 }
 
 ModuleList::iterator ModuleList::begin() {
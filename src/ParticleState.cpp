@@ -52,21 +52,11 @@ double ParticleState::getFrequency() const {
 }
 
 double ParticleState::getRigidity() const {
-	return fabs(frequency / charge);
+	return fabs(frequency / getCharge());
 }
 
 void ParticleState::setId(int newId) {
 	id = newId;
-	if (isNucleus(id)) {
-		pmass = nuclearMass(id);
-		charge = chargeNumber(id) * eplus;
-		if (id < 0)
-			charge *= -1; // anti-nucleus
-	} else {
-		if (abs(id) == 11)
-			pmass = mass_electron;
-		charge = HepPID::charge(id) * eplus;
-	}
 }
 
 int ParticleState::getId() const {
@@ -74,20 +64,28 @@ int ParticleState::getId() const {
 }
 
 double ParticleState::getMass() const {
-	return pmass;
+	if (isNucleus(id))
+		return nuclearMass(id);
+	if (abs(id) == 11)
+		return mass_electron;
+	return 0;
 }
 
 double ParticleState::getCharge() const {
-	return charge;
+	if (isNucleus(id)) {
+		double charge = chargeNumber(id) * eplus;
+		return (id < 0) ? -charge : charge; // anti-nucleus
+	}
+	return HepPID::charge(id) * eplus;
 }
 
 double ParticleState::getLorentzFactor() const {
-	return frequency / (pmass * c_squared);
+	return frequency / (getMass() * c_squared);
 }
 
 void ParticleState::setLorentzFactor(double lf) {
 	lf = std::max(0., lf); // prevent negative Lorentz factors
-	frequency = lf * pmass * c_squared;
+	frequency = lf * getMass() * c_squared;
 }
 
 Vector3d ParticleState::getVelocity() const {
@@ -0,0 +1,209 @@
+#include "radiopropa/PropertyMap.h"
+
+#include <deque>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+namespace radiopropa {
+
+namespace {
+
+// names by key in a deque, which keeps the references returned by propertyName valid
+struct PropertyRegistry {
+	std::map<std::string, PropertyKey> keys;
+	std::deque<std::string> names;
+};
+
+PropertyRegistry &registry() {
+	static PropertyRegistry r;
+	return r;
+}
+
+// number of registered names, written under the lock and read without it
+size_t registeredNames = 0;
+
+size_t getRegisteredNames() {
+#if defined(__GNUC__)
+	return __sync_add_and_fetch(&registeredNames, 0);
+#else
+	size_t n;
+#pragma omp critical(PropertyRegistry)
+	n = registeredNames;
+	return n;
+#endif
+}
+
+// keys and names of the first synced names of the registry, copied by each thread
+struct KeyCache {
+	std::map<std::string, PropertyKey> keys;
+	std::vector<const std::string *> names; /*< the registered names, which stay valid in the deque */
+	size_t synced;
+	KeyCache() :
+			synced(0) {
+	}
+};
+
+KeyCache *threadKeyCache = 0;
+#pragma omp threadprivate(threadKeyCache)
+
+KeyCache &getKeyCache() {
+	if (!threadKeyCache)
+		threadKeyCache = new KeyCache();
+	return *threadKeyCache;
+}
+
+// copy the names registered since the last sync into the cache, must be called under the lock
+void sync(KeyCache &cache) {
+	PropertyRegistry &r = registry();
+	for (size_t i = cache.synced; i < r.names.size(); i++) {
+		cache.keys[r.names[i]] = i;
+		cache.names.push_back(&r.names[i]);
+	}
+	cache.synced = r.names.size();
+}
+
+} // namespace
+
+bool findPropertyKey(const std::string &name, PropertyKey &key) {
+	KeyCache &cache = getKeyCache();
+	std::map<std::string, PropertyKey>::const_iterator i = cache.keys.find(name);
+	if ((i == cache.keys.end()) && (cache.synced < getRegisteredNames())) {
+#pragma omp critical(PropertyRegistry)
+		sync(cache);
+		i = cache.keys.find(name);
+	}
+	if (i == cache.keys.end())
+		return false;
+	key = i->second;
+	return true;
+}
+
+PropertyKey propertyKey(const std::string &name) {
+	PropertyKey key;
+	if (findPropertyKey(name, key))
+		return key;
+#pragma omp critical(PropertyRegistry)
+	{
+		PropertyRegistry &r = registry();
+		std::map<std::string, PropertyKey>::const_iterator i = r.keys.find(name);
+		if (i == r.keys.end()) {
+			key = r.names.size();
+			r.keys[name] = key;
+			r.names.push_back(name);
+#if defined(__GNUC__)
+			__sync_lock_test_and_set(&registeredNames, r.names.size());
+#else
+			registeredNames = r.names.size();
+#endif
+		} else {
+			key = i->second;
+		}
+		sync(getKeyCache());
+	}
+	return key;
+}
+
+const std::string &propertyName(PropertyKey key) {
+	KeyCache &cache = getKeyCache();
+	if ((key >= cache.synced) && (cache.synced < getRegisteredNames())) {
+#pragma omp critical(PropertyRegistry)
+		sync(cache);
+	}
+	if (key >= cache.synced)
+		throw std::runtime_error("Unknown property key");
+	return *cache.names[key];
+}
+
+PropertyMap::PropertyMap() :
+		count(0) {
+}
+
+PropertyMap::const_iterator PropertyMap::begin() const {
+	return const_iterator(this, 0);
+}
+
+PropertyMap::const_iterator PropertyMap::end() const {
+	return const_iterator(this, size());
+}
+
+size_t PropertyMap::size() const {
+	return count + overflow.size();
+}
+
+bool PropertyMap::empty() const {
+	return size() == 0;
+}
+
+PropertyKey PropertyMap::getKey(size_t i) const {
+	return (i < count) ? keys[i] : overflow.at(i - count).first;
+}
+
+const Variant &PropertyMap::getValue(size_t i) const {
+	return (i < count) ? values[i] : overflow.at(i - count).second;
+}
+
+const Variant *PropertyMap::find(PropertyKey key) const {
+	for (size_t i = 0; i < count; i++)
+		if (keys[i] == key)
+			return &values[i];
+	for (size_t i = 0; i < overflow.size(); i++)
+		if (overflow[i].first == key)
+			return &overflow[i].second;
+	return 0;
+}
+
+Variant *PropertyMap::find(PropertyKey key) {
+	return const_cast<Variant *>(static_cast<const PropertyMap *>(this)->find(key));
+}
+
+void PropertyMap::set(PropertyKey key, const Variant &value) {
+	Variant *v = find(key);
+	if (v) {
+		*v = value;
+	} else if (count < slots) {
+		keys[count] = key;
+		values[count] = value;
+		count++;
+	} else {
+		overflow.push_back(std::make_pair(key, value));
+	}
+}
+
+bool PropertyMap::erase(PropertyKey key) {
+	for (size_t i = 0; i < overflow.size(); i++) {
+		if (overflow[i].first == key) {
+			overflow[i] = overflow.back();
+			overflow.pop_back();
+			return true;
+		}
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (keys[i] != key)
+			continue;
+		// fill the slot with the last slot, or with an overflowing property
+		count--;
+		if (i != count) {
+			keys[i] = keys[count];
+			values[i] = values[count];
+		}
+		values[count].clear();
+		if (!overflow.empty()) {
+			keys[count] = overflow.back().first;
+			values[count] = overflow.back().second;
+			overflow.pop_back();
+			count++;
+		}
+		return true;
+	}
+	return false;
+}
+
+void PropertyMap::clear() {
+	for (size_t i = 0; i < count; i++)
+		values[i].clear();
+	count = 0;
+	overflow.clear();
+}
+
+} // namespace radiopropa
@@ -63,6 +63,71 @@
 
 namespace radiopropa {
 
+// distributions shared by Random and RandomStream, drawing from rand() of the generator
+namespace {
+
+template<typename Generator, typename T>
+size_t drawBin(Generator &random, const std::vector<T> &cdf) {
+	typename std::vector<T>::const_iterator it = std::lower_bound(cdf.begin(),
+			cdf.end(), random.rand() * cdf.back());
+	return it - cdf.begin();
+}
+
+template<typename Generator>
+Vector3d drawVector(Generator &random) {
+	double z = random.randUniform(-1.0, 1.0);
+	double t = random.randUniform(-1.0 * M_PI, M_PI);
+	double r = sqrt(1 - z * z);
+	return Vector3d(r * cos(t), r * sin(t), z);
+}
+
+template<typename Generator>
+Vector3d drawVectorAroundMean(Generator &random, const Vector3d &meanDirection,
+		double angle) {
+	Vector3d axis = meanDirection.cross(random.randVector());
+	Vector3d v = meanDirection;
+	return v.getRotated(axis, angle);
+}
+
+template<typename Generator>
+Vector3d drawConeVector(Generator &random, const Vector3d &meanDirection,
+		double angularRadius) {
+	double theta = 2 * M_PI;
+	while (theta > angularRadius)
+		theta = acos(2 * random.rand() - 1);
+	return random.randVectorAroundMean(meanDirection, theta);
+}
+
+template<typename Generator>
+double drawPowerLaw(Generator &random, double index, double min, double max) {
+	if ((min < 0) || (max < min)) {
+		throw std::runtime_error(
+				"Power law distribution only possible for 0 <= min <= max");
+	}
+	//check for index -1!
+	if ((std::abs(index + 1.0)) < std::numeric_limits<double>::epsilon()) {
+		double part1 = log(max);
+		double part2 = log(min);
+		return exp((part1 - part2) * random.rand() + part2);
+	} else {
+		double part1 = pow(max, index + 1);
+		double part2 = pow(min, index + 1);
+		double ex = 1 / (index + 1);
+		return pow((part1 - part2) * random.rand() + part2, ex);
+	}
+}
+
+template<typename Generator>
+double drawExponential(Generator &random) {
+	double dum;
+	do {
+		dum = random.rand();
+	} while (dum < std::numeric_limits<double>::epsilon());
+	return -1.0 * log(dum);
+}
+
+} // namespace
+
 Random::Random(const uint32& oneSeed) {
 	seed(oneSeed);
 }
@@ -125,29 +190,20 @@ double Random::randFisher(double kappa) {
 }
 
 size_t Random::randBin(const std::vector<float> &cdf) {
-	std::vector<float>::const_iterator it = std::lower_bound(cdf.begin(),
-			cdf.end(), rand() * cdf.back());
-	return it - cdf.begin();
+	return drawBin(*this, cdf);
 }
 
 size_t Random::randBin(const std::vector<double> &cdf) {
-	std::vector<double>::const_iterator it = std::lower_bound(cdf.begin(),
-			cdf.end(), rand() * cdf.back());
-	return it - cdf.begin();
+	return drawBin(*this, cdf);
 }
 
 Vector3d Random::randVector() {
-	double z = randUniform(-1.0, 1.0);
-	double t = randUniform(-1.0 * M_PI, M_PI);
-	double r = sqrt(1 - z * z);
-	return Vector3d(r * cos(t), r * sin(t), z);
+	return drawVector(*this);
 }
 
 Vector3d Random::randVectorAroundMean(const Vector3d &meanDirection,
 		double angle) {
-	Vector3d axis = meanDirection.cross(randVector());
-	Vector3d v = meanDirection;
-	return v.getRotated(axis, angle);
+	return drawVectorAroundMean(*this, meanDirection, angle);
 }
 
 Vector3d Random::randFisherVector(const Vector3d &meanDirection, double kappa) {
@@ -156,10 +212,7 @@ Vector3d Random::randFisherVector(const Vector3d &meanDirection, double kappa) {
 
 Vector3d Random::randConeVector(const Vector3d &meanDirection,
 		double angularRadius) {
-	double theta = 2 * M_PI;
-	while (theta > angularRadius)
-		theta = acos(2 * rand() - 1);
-	return randVectorAroundMean(meanDirection, theta);
+	return drawConeVector(*this, meanDirection, angularRadius);
 }
 
 Vector3d Random::randomInterpolatedPosition(const Vector3d &a, const Vector3d &b) {
@@ -167,21 +220,7 @@ Vector3d Random::randomInterpolatedPosition(const Vector3d &a, const Vector3d &b
 }
 
 double Random::randPowerLaw(double index, double min, double max) {
-	if ((min < 0) || (max < min)) {
-		throw std::runtime_error(
-				"Power law distribution only possible for 0 <= min <= max");
-	}
-	//check for index -1!
-	if ((std::abs(index + 1.0)) < std::numeric_limits<double>::epsilon()) {
-		double part1 = log(max);
-		double part2 = log(min);
-		return exp((part1 - part2) * rand() + part2);
-	} else {
-		double part1 = pow(max, index + 1);
-		double part2 = pow(min, index + 1);
-		double ex = 1 / (index + 1);
-		return pow((part1 - part2) * rand() + part2, ex);
-	}
+	return drawPowerLaw(*this, index, min, max);
 }
 
 double Random::randBrokenPowerLaw(double index1, double index2,
@@ -219,11 +258,7 @@ double Random::randBrokenPowerLaw(double index1, double index2,
 }
 
 double Random::randExponential() {
-	double dum;
-	do {
-		dum = rand();
-	} while (dum < std::numeric_limits<double>::epsilon());
-	return -1.0 * log(dum);
+	return drawExponential(*this);
 }
 
 Random::uint32 Random::randInt() {
@@ -284,9 +319,15 @@ uint64_t Random::randInt64(const uint64_t &n)
 
 
 
+// true for the generator returned by instance() on the master thread
+static bool isMasterInstance(const Random *random);
+
 void Random::seed(const uint32 oneSeed) {
 	initialize(oneSeed);
 	reload();
+	// the generator of the master thread keeps seeding the sources, which draw from RandomStream
+	if (isMasterInstance(this))
+		RandomStream::setRunSeed(oneSeed);
 }
 
 void Random::seed(uint32 * const bigSeed, const uint32 seedLength) {
@@ -424,42 +465,313 @@ std::istream& operator>>(std::istream& is, Random& mtrand) {
 
 #ifdef _OPENMP
 #include <omp.h>
-#include <stdexcept>
 
-// see http://stackoverflow.com/questions/8051108/using-the-openmp-threadprivate-directive-on-static-instances-of-c-stl-types
-const static int MAX_THREAD = 256;
+// the generators are allocated per thread on first use, so that the number of threads is not limited
+static Random *threadRandom = 0;
+#pragma omp threadprivate(threadRandom)
 
-struct RANDOM_TLS_ITEM {
-	Random r;
-	char padding[(sizeof(Random) / 64 + 1) * 64 - sizeof(Random)];
-};
-
-#ifdef _MSC_VER
-__declspec(align(64)) static RANDOM_TLS_ITEM _tls[MAX_THREAD];
-#else
-__attribute__ ((aligned(64))) static RANDOM_TLS_ITEM _tls[MAX_THREAD];
-#endif
+// generators of all threads with the thread number they were created for, seeded by seedThreads
+static std::vector<std::pair<int, Random *> > threadRandoms;
+static bool threadsSeeded = false;
+static Random::uint32 threadSeed = 0;
 
 Random &Random::instance() {
-	int i = omp_get_thread_num();
-	if (i >= MAX_THREAD)
-	throw std::runtime_error("radiopropa::Random: more than MAX_THREAD threads!");
-	return _tls[i].r;
+	if (!threadRandom) {
+		int i = omp_get_thread_num();
+#pragma omp critical(RandomThreads)
+		{
+			threadRandom = threadsSeeded ? new Random(threadSeed + i) : new Random();
+			threadRandoms.push_back(std::make_pair(i, threadRandom));
+		}
+	}
+	return *threadRandom;
+}
+
+static bool isMasterInstance(const Random *random) {
+	return (random == threadRandom) && (omp_get_thread_num() == 0);
 }
 
 void Random::seedThreads(const uint32 oneSeed) {
-	for(size_t i = 0; i < MAX_THREAD; ++i)
-	_tls[i].r.seed(oneSeed + i);
+#pragma omp critical(RandomThreads)
+	{
+		threadsSeeded = true;
+		threadSeed = oneSeed;
+		for (size_t i = 0; i < threadRandoms.size(); ++i)
+			threadRandoms[i].second->seed(oneSeed + threadRandoms[i].first);
+	}
+	RandomStream::setRunSeed(oneSeed);
 }
 #else
 static Random _random;
 Random &Random::instance() {
 	return _random;
 }
+static bool isMasterInstance(const Random *random) {
+	return random == &_random;
+}
 void Random::seedThreads(const uint32 oneSeed) {
 	_random.seed(oneSeed);
+	RandomStream::setRunSeed(oneSeed);
 }
 #endif
 
+// RandomStream ---------------------------------------------------------------
+namespace {
+
+const uint32_t philoxM0 = 0xD2511F53;
+const uint32_t philoxM1 = 0xCD9E8D57;
+const uint32_t philoxW0 = 0x9E3779B9; // golden ratio
+const uint32_t philoxW1 = 0xBB67AE85; // sqrt(3) - 1
+
+// ten rounds of Philox4x32 on n blocks, stored as structure of arrays so that the inner loop is vectorized
+inline void philox(uint32_t *c0, uint32_t *c1, uint32_t *c2, uint32_t *c3,
+		size_t n, uint64_t key) {
+	uint32_t k0 = uint32_t(key);
+	uint32_t k1 = uint32_t(key >> 32);
+	for (int round = 0; round < 10; round++) {
+		for (size_t j = 0; j < n; j++) {
+			uint64_t p0 = uint64_t(philoxM0) * c0[j];
+			uint64_t p1 = uint64_t(philoxM1) * c2[j];
+			uint32_t x0 = uint32_t(p1 >> 32) ^ c1[j] ^ k0;
+			uint32_t x2 = uint32_t(p0 >> 32) ^ c3[j] ^ k1;
+			c0[j] = x0;
+			c1[j] = uint32_t(p1);
+			c2[j] = x2;
+			c3[j] = uint32_t(p0);
+		}
+		k0 += philoxW0;
+		k1 += philoxW1;
+	}
+}
+
+// splitmix64 finalizer
+inline uint64_t mix(uint64_t z) {
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+const double twoPow32Inv = 1.0 / 4294967296.0;
+const size_t fillBlocks = 16; // blocks per call of philox in fillUniform
+
+// from /dev/urandom if available, else from time() and clock(), so that runs differ unless seeded
+uint64_t entropySeed() {
+	Random random;
+	return random.randInt64();
+}
+
+uint64_t runSeed = entropySeed();
+unsigned int runSeedGeneration = 1;
+
+} // namespace
+
+// stream made current by a Scope, and the stream of the thread used otherwise
+static RandomStream *currentStream = 0;
+static RandomStream *threadStream = 0;
+static unsigned int threadStreamGeneration = 0;
+#ifdef _OPENMP
+#pragma omp threadprivate(currentStream, threadStream, threadStreamGeneration)
+#endif
+
+RandomStream::RandomStream(uint64_t seed, uint64_t stream, uint64_t counter) {
+	this->seed(seed, stream, counter);
+}
+
+void RandomStream::seed(uint64_t seed, uint64_t stream, uint64_t counter) {
+	this->key = seed;
+	this->stream = stream;
+	setCounter(counter);
+}
+
+uint64_t RandomStream::getSeed() const {
+	return key;
+}
+
+uint64_t RandomStream::getStream() const {
+	return stream;
+}
+
+uint64_t RandomStream::getCounter() const {
+	return counter;
+}
+
+void RandomStream::setCounter(uint64_t counter) {
+	this->counter = counter;
+	if (counter & 3)
+		generate();
+}
+
+RandomStream RandomStream::split(uint64_t i) const {
+	return RandomStream(key, mix(mix(stream) + i + 1));
+}
+
+void RandomStream::generate() {
+	uint64_t block = counter >> 2;
+	buffer[0] = uint32_t(block);
+	buffer[1] = uint32_t(block >> 32);
+	buffer[2] = uint32_t(stream);
+	buffer[3] = uint32_t(stream >> 32);
+	philox(buffer, buffer + 1, buffer + 2, buffer + 3, 1, key);
+}
+
+uint32_t RandomStream::randInt() {
+	if ((counter & 3) == 0)
+		generate();
+	return buffer[counter++ & 3];
+}
+
+uint32_t RandomStream::randInt(uint32_t n) {
+	uint32_t used = n;
+	used |= used >> 1;
+	used |= used >> 2;
+	used |= used >> 4;
+	used |= used >> 8;
+	used |= used >> 16;
+
+	uint32_t i;
+	do
+		i = randInt() & used;
+	while (i > n);
+	return i;
+}
+
+double RandomStream::rand() {
+	return randInt() * twoPow32Inv;
+}
+
+double RandomStream::randDblExc() {
+	return (randInt() + 0.5) * twoPow32Inv;
+}
+
+double RandomStream::randNorm(double mean, double variance) {
+	double r = sqrt(-2.0 * log(1.0 - rand())) * variance;
+	double phi = 2.0 * M_PI * rand();
+	return mean + r * cos(phi);
+}
+
+double RandomStream::randUniform(double min, double max) {
+	return min + (max - min) * rand();
+}
+
+double RandomStream::randExponential() {
+	return drawExponential(*this);
+}
+
+double RandomStream::randPowerLaw(double index, double min, double max) {
+	return drawPowerLaw(*this, index, min, max);
+}
+
+size_t RandomStream::randBin(const std::vector<float> &cdf) {
+	return drawBin(*this, cdf);
+}
+
+size_t RandomStream::randBin(const std::vector<double> &cdf) {
+	return drawBin(*this, cdf);
+}
+
+Vector3d RandomStream::randVector() {
+	return drawVector(*this);
+}
+
+Vector3d RandomStream::randVectorAroundMean(const Vector3d &meanDirection,
+		double angle) {
+	return drawVectorAroundMean(*this, meanDirection, angle);
+}
+
+Vector3d RandomStream::randConeVector(const Vector3d &meanDirection,
+		double angularRadius) {
+	return drawConeVector(*this, meanDirection, angularRadius);
+}
+
+Vector3d RandomStream::randomInterpolatedPosition(const Vector3d &a,
+		const Vector3d &b) {
+	return a + rand() * (b - a);
+}
+
+void RandomStream::fillUniform(double *values, size_t count) {
+	size_t i = 0;
+
+	// rest of the current block
+	while ((i < count) && (counter & 3))
+		values[i++] = rand();
+
+	// whole blocks
+	uint32_t c0[fillBlocks], c1[fillBlocks], c2[fillBlocks], c3[fillBlocks];
+	while (count - i >= 4) {
+		size_t n = std::min(fillBlocks, (count - i) / 4);
+		uint64_t block = counter >> 2;
+		for (size_t j = 0; j < n; j++) {
+			c0[j] = uint32_t(block + j);
+			c1[j] = uint32_t((block + j) >> 32);
+			c2[j] = uint32_t(stream);
+			c3[j] = uint32_t(stream >> 32);
+		}
+		philox(c0, c1, c2, c3, n, key);
+		for (size_t j = 0; j < n; j++) {
+			values[i + 4 * j] = c0[j] * twoPow32Inv;
+			values[i + 4 * j + 1] = c1[j] * twoPow32Inv;
+			values[i + 4 * j + 2] = c2[j] * twoPow32Inv;
+			values[i + 4 * j + 3] = c3[j] * twoPow32Inv;
+		}
+		i += 4 * n;
+		counter += 4 * n;
+	}
+
+	// start of the next block
+	while (i < count)
+		values[i++] = rand();
+}
+
+void RandomStream::fillNormal(double *values, size_t count, double mean,
+		double sigma) {
+	size_t pairs = count / 2;
+	fillUniform(values, 2 * pairs);
+	for (size_t i = 0; i < pairs; i++) {
+		double r = sqrt(-2.0 * log(1.0 - values[2 * i])) * sigma;
+		double phi = 2.0 * M_PI * values[2 * i + 1];
+		values[2 * i] = mean + r * cos(phi);
+		values[2 * i + 1] = mean + r * sin(phi);
+	}
+	if (count & 1)
+		values[count - 1] = randNorm(mean, sigma);
+}
+
+void RandomStream::setRunSeed(uint64_t seed) {
+	runSeed = seed;
+	runSeedGeneration++;
+}
+
+uint64_t RandomStream::getRunSeed() {
+	return runSeed;
+}
+
+RandomStream &RandomStream::instance() {
+	if (currentStream)
+		return *currentStream;
+
+	// the thread streams restart when the run seed is set
+	if (threadStreamGeneration != runSeedGeneration) {
+		if (!threadStream)
+			threadStream = new RandomStream();
+#ifdef _OPENMP
+		uint64_t thread = omp_get_thread_num();
+#else
+		uint64_t thread = 0;
+#endif
+		threadStream->seed(runSeed, mix(~thread));
+		threadStreamGeneration = runSeedGeneration;
+	}
+	return *threadStream;
+}
+
+RandomStream::Scope::Scope(RandomStream &stream) :
+		previous(currentStream) {
+	currentStream = &stream;
+}
+
+RandomStream::Scope::~Scope() {
+	currentStream = previous;
+}
+
 } // namespace radiopropa
 
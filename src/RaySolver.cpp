@@ -0,0 +1,343 @@
+#include "radiopropa/RaySolver.h"
+#include "radiopropa/Common.h"
+#include "radiopropa/module/PropagationRK.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace radiopropa {
+
+static bool shorterPath(const RaySolution &a, const RaySolution &b) {
+	return a.pathLength < b.pathLength;
+}
+
+RaySolver::RaySolver(ref_ptr<ScalarField> field, double surface) :
+		field(field), surface(surface), reflective(true), samples(100),
+		tolerance(1e-10), accuracy(1e-6 * meter), maxSteps(100000) {
+}
+
+RaySolver::State RaySolver::dYdr(const State &y, const Vector3d &position,
+		double beta) const {
+	double n;
+	Vector3d gradient;
+	field->getValueAndGradient(position, n, gradient);
+	// dtau = dr / beta with ds = n^2 dtau, dz = p dtau and dp = n dn/dz dtau
+	return State(y.p / beta, n * gradient.z / beta, n * n / beta);
+}
+
+RaySolver::State RaySolver::tryStep(const State &y, double r, double h,
+		const Vector3d &start, const Vector3d &horizontal, double beta,
+		State &error) const {
+	typedef DormandPrinceTableau T;
+	State k[T::stages];
+	State out = y;
+	error = State(0, 0, 0);
+
+	for (int i = 0; i < T::stages; i++) {
+		State y_n = y;
+		double c = 0;
+		for (int j = 0; j < i; j++) {
+			c += T::a[i][j];
+			y_n.z += T::a[i][j] * h * k[j].z;
+			y_n.p += T::a[i][j] * h * k[j].p;
+			y_n.s += T::a[i][j] * h * k[j].s;
+		}
+		Vector3d position = start + horizontal * (r + c * h);
+		position.z = y_n.z;
+		k[i] = dYdr(y_n, position, beta);
+
+		double db = T::b[i] - T::bs[i];
+		out.z += T::b[i] * h * k[i].z;
+		out.p += T::b[i] * h * k[i].p;
+		out.s += T::b[i] * h * k[i].s;
+		error.z += db * h * k[i].z;
+		error.p += db * h * k[i].p;
+		error.s += db * h * k[i].s;
+	}
+	return out;
+}
+
+double RaySolver::verticalPathLength(const Vector3d &start, double z) const {
+	// Simpson's rule for the integral of n along the vertical
+	const int intervals = 1000;
+	double dz = (z - start.z) / intervals;
+	Vector3d position = start;
+	double sum = field->getValue(start);
+	for (int i = 1; i <= intervals; i++) {
+		position.z = start.z + i * dz;
+		double w = (i == intervals) ? 1 : ((i % 2) ? 4 : 2);
+		sum += w * field->getValue(position);
+	}
+	return fabs(sum * dz / 3);
+}
+
+bool RaySolver::trace(const Vector3d &start, const Vector3d &horizontal,
+		double distance, double theta, State &state, int &reflections,
+		bool &turned) const {
+	return trace(start, horizontal, distance, theta,
+			reflective && (start.z <= surface), state, reflections, turned);
+}
+
+bool RaySolver::trace(const Vector3d &start, const Vector3d &horizontal,
+		double distance, double theta, bool reflect, State &state,
+		int &reflections, bool &turned) const {
+	double n = field->getValue(start);
+	double beta = n * sin(theta);
+	reflections = 0;
+	turned = false;
+	if (!(beta > 0))
+		return false;
+
+	State y(start.z, n * cos(theta), 0);
+	double r = 0;
+	double h = distance / 100;
+
+	for (size_t steps = 0; r < distance; steps++) {
+		if (steps >= maxSteps)
+			return false;
+
+		h = std::min(h, distance - r);
+		State error;
+		State yNew = tryStep(y, r, h, start, horizontal, beta, error);
+		if (!(std::isfinite(yNew.z) && std::isfinite(yNew.p)
+				&& std::isfinite(yNew.s)))
+			return false;
+
+		// ratio of absolute depth and slowness error and tolerance
+		double e = std::max(fabs(error.z) / meter, fabs(error.p)) / tolerance;
+		double factor = 0.95 * pow(e, -0.2);  // update step size to keep error close to tolerance
+		if (e > 1) {
+			h *= clip(factor, 0.1, 1.);
+			continue;
+		}
+
+		if (reflect && (yNew.z > surface)) {
+			// regula falsi on the step length for the surface crossing
+			double lo = 0, hi = h;
+			double flo = y.z - surface, fhi = yNew.z - surface;
+			double hHit = h;
+			State yHit = yNew;
+			for (int i = 0; i < 60; i++) {
+				hHit = lo - flo * (hi - lo) / (fhi - flo);
+				if (!(hHit > lo && hHit < hi))
+					hHit = 0.5 * (lo + hi);
+				yHit = tryStep(y, r, hHit, start, horizontal, beta, error);
+				double fm = yHit.z - surface;
+				if ((fabs(fm) < 1e-12 * (1 + fabs(surface))) || (hi - lo < 1e-12 * h))
+					break;
+				if (fm > 0) {
+					hi = hHit;
+					fhi = fm;
+				} else {
+					lo = hHit;
+					flo = fm;
+				}
+			}
+			y = yHit;
+			y.z = surface;
+			y.p = -fabs(y.p);
+			r += hHit;
+			reflections++;
+			continue;
+		}
+
+		if (y.p * yNew.p < 0)
+			turned = true;
+		y = yNew;
+		r += h;
+		h *= clip(factor, 1., 5.);
+	}
+
+	state = y;
+	return true;
+}
+
+std::vector<RaySolution> RaySolver::solve(const Vector3d &emitter,
+		const Vector3d &receiver) const {
+	std::vector<RaySolution> solutions;
+	Vector3d horizontal(receiver.x - emitter.x, receiver.y - emitter.y, 0);
+	double distance = horizontal.getR();
+
+	// a ray to or from above the surface passes through it instead of being reflected
+	bool reflect = reflective && (emitter.z <= surface) && (receiver.z <= surface);
+
+	// vertical rays, the direct one and the one reflected at the surface
+	if (distance < 1e-9 * meter) {
+		RaySolution direct;
+		bool up = receiver.z > emitter.z;
+		direct.launchAngle = up ? 0 : M_PI;
+		direct.launchDirection = Vector3d(0, 0, up ? 1 : -1);
+		direct.receiveDirection = direct.launchDirection;
+		direct.pathLength = verticalPathLength(emitter, receiver.z);
+		solutions.push_back(direct);
+
+		if (reflect && (emitter.z < surface) && (receiver.z < surface)) {
+			RaySolution reflected;
+			reflected.type = RaySolution::Reflected;
+			reflected.reflections = 1;
+			reflected.launchDirection = Vector3d(0, 0, 1);
+			reflected.receiveDirection = Vector3d(0, 0, -1);
+			Vector3d top = receiver;
+			top.z = surface;
+			reflected.pathLength = verticalPathLength(emitter, surface)
+					+ verticalPathLength(top, receiver.z);
+			solutions.push_back(reflected);
+		}
+		std::sort(solutions.begin(), solutions.end(), shorterPath);
+		return solutions;
+	}
+	horizontal /= distance;
+
+	// scan the launch angle for sign changes of the depth mismatch at the receiver
+	std::vector<double> theta(samples), mismatch(samples);
+	for (size_t i = 0; i < samples; i++) {
+		theta[i] = M_PI * (i + 0.5) / samples;
+		State state;
+		int reflections;
+		bool turned;
+		if (trace(emitter, horizontal, distance, theta[i], reflect, state,
+				reflections, turned))
+			mismatch[i] = state.z - receiver.z;
+		else
+			mismatch[i] = NAN;
+	}
+
+	for (size_t i = 0; i + 1 < samples; i++) {
+		double a = theta[i], b = theta[i + 1];
+		double fa = mismatch[i], fb = mismatch[i + 1];
+		if (!(std::isfinite(fa) && std::isfinite(fb)) || ((fa < 0) == (fb < 0)))
+			continue;
+
+		// Illinois variant of the secant method, keeps the root bracketed
+		double c = a, fc = fa;
+		State state;
+		int reflections = 0;
+		bool turned = false;
+		int side = 0;
+		for (int iteration = 0; iteration < 100; iteration++) {
+			c = (a * fb - b * fa) / (fb - fa);
+			if (!trace(emitter, horizontal, distance, c, reflect, state,
+					reflections, turned)) {
+				fc = NAN;
+				break;
+			}
+			fc = state.z - receiver.z;
+			if (fabs(fc) < accuracy)
+				break;
+			if ((fc < 0) == (fb < 0)) {
+				b = c;
+				fb = fc;
+				if (side == -1)
+					fa /= 2;
+				side = -1;
+			} else {
+				a = c;
+				fa = fc;
+				if (side == +1)
+					fb /= 2;
+				side = +1;
+			}
+			if (fabs(b - a) < 1e-15)
+				break;
+		}
+		if (!(fabs(fc) < accuracy))
+			continue;  // jump of the mismatch, not a root
+
+		double beta = field->getValue(emitter) * sin(c);
+
+		RaySolution solution;
+		solution.launchAngle = c;
+		solution.launchDirection = horizontal * sin(c) + Vector3d(0, 0, cos(c));
+		solution.receiveDirection = (horizontal * beta + Vector3d(0, 0, state.p)).getUnitVector();
+		solution.pathLength = state.s;
+		solution.reflections = reflections;
+		if (reflections > 0)
+			solution.type = RaySolution::Reflected;
+		else if (turned)
+			solution.type = RaySolution::Refracted;
+		solutions.push_back(solution);
+	}
+
+	std::sort(solutions.begin(), solutions.end(), shorterPath);
+	return solutions;
+}
+
+std::vector<std::vector<RaySolution> > RaySolver::solve(
+		const std::vector<Vector3d> &emitters,
+		const std::vector<Vector3d> &receivers) const {
+	if (emitters.size() != receivers.size())
+		throw std::runtime_error(
+				"RaySolver: number of emitters and receivers differ");
+
+	size_t count = emitters.size();
+	std::vector<std::vector<RaySolution> > solutions(count);
+
+#pragma omp parallel for schedule(dynamic, 1)
+	for (size_t i = 0; i < count; i++)
+		solutions[i] = solve(emitters[i], receivers[i]);
+
+	return solutions;
+}
+
+void RaySolver::setField(ref_ptr<ScalarField> f) {
+	field = f;
+}
+
+void RaySolver::setSurface(double z) {
+	surface = z;
+}
+
+void RaySolver::setReflectiveSurface(bool r) {
+	reflective = r;
+}
+
+void RaySolver::setSamples(size_t n) {
+	if (n < 2)
+		throw std::runtime_error("RaySolver: less than 2 samples");
+	samples = n;
+}
+
+void RaySolver::setTolerance(double tol) {
+	if ((tol > 1) or (tol <= 0))
+		throw std::runtime_error("RaySolver: target error not in range 0-1");
+	tolerance = tol;
+}
+
+void RaySolver::setAccuracy(double a) {
+	if (a <= 0)
+		throw std::runtime_error("RaySolver: accuracy <= 0");
+	accuracy = a;
+}
+
+void RaySolver::setMaximumSteps(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("RaySolver: maximum number of steps = 0");
+	maxSteps = n;
+}
+
+double RaySolver::getSurface() const {
+	return surface;
+}
+
+bool RaySolver::isReflectiveSurface() const {
+	return reflective;
+}
+
+size_t RaySolver::getSamples() const {
+	return samples;
+}
+
+double RaySolver::getTolerance() const {
+	return tolerance;
+}
+
+double RaySolver::getAccuracy() const {
+	return accuracy;
+}
+
+size_t RaySolver::getMaximumSteps() const {
+	return maxSteps;
+}
+
+} // namespace radiopropa
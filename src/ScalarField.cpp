@@ -1,7 +1,79 @@
 #include <radiopropa/ScalarField.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+
 namespace radiopropa {
 
+/*
+ Branch-free exponential (Cephes rational approximation, relative error
+ ~1e-16) that the compiler can vectorize when called in a loop over
+ arrays. Rounding and the 2^n scaling are done with bit manipulation so
+ that no library call ends up in the loop body.
+ */
+static inline double vectorizableExp(double x) {
+	const double log2e = 1.4426950408889634073599;
+	const double c1 = 6.93145751953125E-1;
+	const double c2 = 1.42860682030941723212E-6;
+	const double shifter = 6755399441055744.0; // 1.5 * 2^52, rounds to nearest integer
+
+	x = x < -708.39 ? -708.39 : x;
+	x = x > 709.78 ? 709.78 : x;
+
+	// x = n * ln2 + r with |r| <= ln2 / 2
+	double t = x * log2e + shifter;
+	double fn = t - shifter;
+	int64_t tBits;
+	std::memcpy(&tBits, &t, sizeof(t));
+	int64_t shifterBits;
+	std::memcpy(&shifterBits, &shifter, sizeof(shifter));
+	int64_t n = tBits - shifterBits;
+
+	double r = x - fn * c1 - fn * c2;
+	double rr = r * r;
+	double p = r * ((1.26177193074810590878E-4 * rr + 3.02994407707441961300E-2) * rr
+			+ 9.99999999999999999910E-1);
+	double q = ((3.00198505138664455042E-6 * rr + 2.52448340349684104192E-3) * rr
+			+ 2.27265548208155028766E-1) * rr + 2.00000000000000000009E0;
+	double e = 1. + 2. * p / (q - p);
+
+	// multiply by 2^n in two steps, 2^1024 at the upper clamp is not a double
+	int64_t n1 = n / 2;
+	int64_t scaleBits1 = (n1 + 1023) << 52;
+	int64_t scaleBits2 = (n - n1 + 1023) << 52;
+	double scale1, scale2;
+	std::memcpy(&scale1, &scaleBits1, sizeof(scale1));
+	std::memcpy(&scale2, &scaleBits2, sizeof(scale2));
+	return e * scale1 * scale2;
+}
+
+void ScalarField::getValueAndGradient(const Vector3d &position, double &value,
+		Vector3d &gradient) const {
+	value = getValue(position);
+	gradient = getGradient(position);
+}
+
+void ScalarField::getValues(size_t count, const double *x, const double *y,
+		const double *z, double *values) const {
+	for (size_t i = 0; i < count; i++)
+		values[i] = getValue(Vector3d(x[i], y[i], z[i]));
+}
+
+void ScalarField::getValuesAndGradients(size_t count, const double *x,
+		const double *y, const double *z, double *values, double *gx,
+		double *gy, double *gz) const {
+	for (size_t i = 0; i < count; i++) {
+		Vector3d gradient;
+		getValueAndGradient(Vector3d(x[i], y[i], z[i]), values[i], gradient);
+		gx[i] = gradient.x;
+		gy[i] = gradient.y;
+		gz[i] = gradient.z;
+	}
+}
+
 LinearIncrease::LinearIncrease(double _v0, const Vector3d &_g0) : v0(_v0), g0(_g0)
 {
 
@@ -24,6 +96,32 @@ Vector3d LinearIncrease::getGradient(const Vector3d &position) const
   return g0;
 };
 
+void LinearIncrease::getValueAndGradient(const Vector3d &position,
+		double &value, Vector3d &gradient) const
+{
+  value = (position.z <= 0) ? 1. : v0 * position.z;
+  gradient = g0;
+}
+
+void LinearIncrease::getValues(size_t count, const double *x, const double *y,
+		const double *z, double *values) const
+{
+  for (size_t i = 0; i < count; i++)
+    values[i] = (z[i] <= 0) ? 1. : v0 * z[i];
+}
+
+void LinearIncrease::getValuesAndGradients(size_t count, const double *x,
+		const double *y, const double *z, double *values, double *gx,
+		double *gy, double *gz) const
+{
+  getValues(count, x, y, z, values);
+  for (size_t i = 0; i < count; i++) {
+    gx[i] = g0.x;
+    gy[i] = g0.y;
+    gz[i] = g0.z;
+  }
+}
+
 
 
 GorhamIceModel::GorhamIceModel(double _a, double _b, double _c) : a(_a), b(_b), c(_c)
@@ -47,12 +145,50 @@ Vector3d GorhamIceModel::getGradient(const Vector3d &position) const
       return v;
 }
 
+void GorhamIceModel::getValueAndGradient(const Vector3d &position,
+		double &value, Vector3d &gradient) const
+{
+      double e = exp(-1.*c*position.z);
+      value = a + b * (1.0 - e);
+      gradient = Vector3d(0, 0, b * c * e);
+}
+
+void GorhamIceModel::getValues(size_t count, const double *x, const double *y,
+		const double *z, double *values) const
+{
+      for (size_t i = 0; i < count; i++)
+            values[i] = a + b * (1.0 - vectorizableExp(-1.*c*z[i]));
+}
+
+void GorhamIceModel::getValuesAndGradients(size_t count, const double *x,
+		const double *y, const double *z, double *values, double *gx,
+		double *gy, double *gz) const
+{
+      for (size_t i = 0; i < count; i++) {
+            double e = vectorizableExp(-1.*c*z[i]);
+            values[i] = a + b * (1.0 - e);
+            gx[i] = 0;
+            gy[i] = 0;
+            gz[i] = b * c * e;
+      }
+}
+
 
 
 n2linear::n2linear(double _n0, double _a) : n0(_n0), a(_a) { }
 
 n2linear::~n2linear() { };
 
+double n2linear::getN0() const
+{
+    return n0;
+}
+
+double n2linear::getA() const
+{
+    return a;
+}
+
 double n2linear::getValue(const Vector3d &position) const
 {
     return sqrt(n0*n0 + a * position.z);
@@ -63,5 +199,294 @@ Vector3d n2linear::getGradient(const Vector3d &position) const
 		return Vector3d(0,0,a/2. / getValue(position));
 }
 
+void n2linear::getValueAndGradient(const Vector3d &position, double &value,
+		Vector3d &gradient) const
+{
+    value = sqrt(n0*n0 + a * position.z);
+    gradient = Vector3d(0, 0, a/2. / value);
+}
+
+void n2linear::getValues(size_t count, const double *x, const double *y,
+		const double *z, double *values) const
+{
+    for (size_t i = 0; i < count; i++)
+        values[i] = sqrt(n0*n0 + a * z[i]);
+}
+
+void n2linear::getValuesAndGradients(size_t count, const double *x,
+		const double *y, const double *z, double *values, double *gx,
+		double *gy, double *gz) const
+{
+    for (size_t i = 0; i < count; i++) {
+        double n = sqrt(n0*n0 + a * z[i]);
+        values[i] = n;
+        gx[i] = 0;
+        gy[i] = 0;
+        gz[i] = a/2. / n;
+    }
+}
+
+/*
+ Lower and upper sample and the interpolation weight of the upper one along
+ one axis, with the derivative of the weight. Positions beyond the outermost
+ samples are clamped to them.
+ */
+static inline void clampedNeighbors(double x, double origin, double spacing,
+		size_t n, size_t &lo, size_t &hi, double &w, double &dw)
+{
+    double r = (x - origin) / spacing - 0.5;
+    if ((n < 2) || (r <= 0)) {
+        lo = hi = 0;
+        w = dw = 0;
+    } else if (r >= n - 1) {
+        lo = hi = n - 1;
+        w = dw = 0;
+    } else {
+        lo = size_t(r);
+        hi = lo + 1;
+        w = r - lo;
+        dw = 1. / spacing;
+    }
+}
+
+ScalarFieldGrid::ScalarFieldGrid(ref_ptr<ScalarGrid> grid)
+{
+    setGrid(grid);
+    setOrigin(grid->getOrigin());
+    setExtent(Vector3d(grid->getNx(), grid->getNy(), grid->getNz()) * grid->getSpacing());
+}
+
+ScalarFieldGrid::ScalarFieldGrid(ref_ptr<ScalarGrid> grid,
+		const Vector3d &origin, const Vector3d &extent)
+{
+    setGrid(grid);
+    setOrigin(origin);
+    setExtent(extent);
+}
+
+void ScalarFieldGrid::updateSpacing()
+{
+    spacing = Vector3d(extent.x / grid->getNx(), extent.y / grid->getNy(),
+            extent.z / grid->getNz());
+}
+
+void ScalarFieldGrid::setGrid(ref_ptr<ScalarGrid> g)
+{
+    if (!g.valid())
+        throw std::runtime_error("ScalarFieldGrid: invalid grid");
+    grid = g;
+    if (extent.x > 0)
+        updateSpacing();
+}
+
+ref_ptr<ScalarGrid> ScalarFieldGrid::getGrid()
+{
+    return grid;
+}
+
+void ScalarFieldGrid::setOrigin(const Vector3d &o)
+{
+    origin = o;
+}
+
+void ScalarFieldGrid::setExtent(const Vector3d &e)
+{
+    if ((e.x <= 0) || (e.y <= 0) || (e.z <= 0))
+        throw std::runtime_error("ScalarFieldGrid: extent <= 0");
+    extent = e;
+    updateSpacing();
+}
+
+Vector3d ScalarFieldGrid::getOrigin() const
+{
+    return origin;
+}
+
+Vector3d ScalarFieldGrid::getExtent() const
+{
+    return extent;
+}
+
+double ScalarFieldGrid::getValue(const Vector3d &position) const
+{
+    double value;
+    Vector3d gradient;
+    getValueAndGradient(position, value, gradient);
+    return value;
+}
+
+Vector3d ScalarFieldGrid::getGradient(const Vector3d &position) const
+{
+    double value;
+    Vector3d gradient;
+    getValueAndGradient(position, value, gradient);
+    return gradient;
+}
+
+void ScalarFieldGrid::getValueAndGradient(const Vector3d &position,
+		double &value, Vector3d &gradient) const
+{
+    size_t ix, iX, iy, iY, iz, iZ;
+    double fx, dx, fy, dy, fz, dz;
+    clampedNeighbors(position.x, origin.x, spacing.x, grid->getNx(), ix, iX, fx, dx);
+    clampedNeighbors(position.y, origin.y, spacing.y, grid->getNy(), iy, iY, fy, dy);
+    clampedNeighbors(position.z, origin.z, spacing.z, grid->getNz(), iz, iZ, fz, dz);
+    double fX = 1 - fx, fY = 1 - fy, fZ = 1 - fz;
+
+    const ScalarGrid &g = *grid;
+    double v000 = g.get(ix, iy, iz), v100 = g.get(iX, iy, iz);
+    double v010 = g.get(ix, iY, iz), v110 = g.get(iX, iY, iz);
+    double v001 = g.get(ix, iy, iZ), v101 = g.get(iX, iy, iZ);
+    double v011 = g.get(ix, iY, iZ), v111 = g.get(iX, iY, iZ);
+
+    // interpolate along x first, then y and z
+    double v00 = v000 * fX + v100 * fx, v10 = v010 * fX + v110 * fx;
+    double v01 = v001 * fX + v101 * fx, v11 = v011 * fX + v111 * fx;
+    double v0 = v00 * fY + v10 * fy, v1 = v01 * fY + v11 * fy;
+    value = v0 * fZ + v1 * fz;
+
+    // derivatives of the interpolation weights
+    double d00 = v100 - v000, d10 = v110 - v010, d01 = v101 - v001, d11 = v111 - v011;
+    gradient.x = dx * ((d00 * fY + d10 * fy) * fZ + (d01 * fY + d11 * fy) * fz);
+    gradient.y = dy * ((v10 - v00) * fZ + (v11 - v01) * fz);
+    gradient.z = dz * (v1 - v0);
+}
+
+TabulatedDepthProfile::TabulatedDepthProfile(const std::vector<double> &z_,
+		const std::vector<double> &n_) : z(z_), n(n_)
+{
+    size_t N = z.size();
+    if (n.size() != N)
+        throw std::runtime_error("TabulatedDepthProfile: number of depths and values differ");
+    if (N < 2)
+        throw std::runtime_error("TabulatedDepthProfile: less than 2 samples");
+
+    std::vector<double> h(N - 1), delta(N - 1);
+    double hMin = z[N - 1] - z[0];
+    for (size_t i = 0; i + 1 < N; i++) {
+        h[i] = z[i + 1] - z[i];
+        if (!(h[i] > 0))
+            throw std::runtime_error("TabulatedDepthProfile: depths not strictly increasing");
+        delta[i] = (n[i + 1] - n[i]) / h[i];
+        hMin = std::min(hMin, h[i]);
+    }
+
+    // slopes at the samples, weighted harmonic mean of the secants or zero at extrema
+    std::vector<double> m(N);
+    m[0] = delta[0];
+    m[N - 1] = delta[N - 2];
+    for (size_t i = 1; i + 1 < N; i++) {
+        if (delta[i - 1] * delta[i] <= 0)
+            m[i] = 0;
+        else
+            m[i] = 3 * (h[i - 1] + h[i]) / ((2 * h[i] + h[i - 1]) / delta[i - 1]
+                    + (h[i] + 2 * h[i - 1]) / delta[i]);
+    }
+
+    c1.resize(N - 1);
+    c2.resize(N - 1);
+    c3.resize(N - 1);
+    for (size_t i = 0; i + 1 < N; i++) {
+        c1[i] = m[i];
+        c2[i] = (3 * delta[i] - 2 * m[i] - m[i + 1]) / h[i];
+        c3[i] = (m[i] + m[i + 1] - 2 * delta[i]) / (h[i] * h[i]);
+    }
+
+    // uniform bins no wider than the closest samples hold at most one sample
+    double range = z[N - 1] - z[0];
+    size_t nBins = std::min((size_t)ceil(range / hMin), (size_t)1000000);
+    nBins = std::max(nBins, (size_t)1);
+    binOrigin = z[0];
+    binScale = nBins / range;
+    bins.resize(nBins);
+    size_t i = 0;
+    for (size_t b = 0; b < nBins; b++) {
+        double zb = binOrigin + b / binScale;
+        while ((i + 2 < N) && (zb >= z[i + 1]))
+            i++;
+        bins[b] = i;
+    }
+}
+
+const std::vector<double> &TabulatedDepthProfile::getDepths() const
+{
+    return z;
+}
+
+const std::vector<double> &TabulatedDepthProfile::getIndices() const
+{
+    return n;
+}
+
+size_t TabulatedDepthProfile::findInterval(double zi) const
+{
+    size_t b = std::min((size_t)((zi - binOrigin) * binScale), bins.size() - 1);
+    size_t i = bins[b];
+    while ((i + 2 < z.size()) && (zi >= z[i + 1]))
+        i++;
+    return i;
+}
+
+double TabulatedDepthProfile::getValue(const Vector3d &position) const
+{
+    double value;
+    getValues(1, &position.x, &position.y, &position.z, &value);
+    return value;
+}
+
+Vector3d TabulatedDepthProfile::getGradient(const Vector3d &position) const
+{
+    double value;
+    Vector3d gradient;
+    getValueAndGradient(position, value, gradient);
+    return gradient;
+}
+
+void TabulatedDepthProfile::getValueAndGradient(const Vector3d &position,
+		double &value, Vector3d &gradient) const
+{
+    double gx, gy, gz;
+    getValuesAndGradients(1, &position.x, &position.y, &position.z, &value,
+            &gx, &gy, &gz);
+    gradient = Vector3d(gx, gy, gz);
+}
+
+void TabulatedDepthProfile::getValues(size_t count, const double *x,
+		const double *y, const double *zs, double *values) const
+{
+    for (size_t k = 0; k < count; k++) {
+        if (zs[k] <= z.front()) {
+            values[k] = n.front();
+        } else if (zs[k] >= z.back()) {
+            values[k] = n.back();
+        } else {
+            size_t i = findInterval(zs[k]);
+            double t = zs[k] - z[i];
+            values[k] = n[i] + t * (c1[i] + t * (c2[i] + t * c3[i]));
+        }
+    }
+}
+
+void TabulatedDepthProfile::getValuesAndGradients(size_t count,
+		const double *x, const double *y, const double *zs, double *values,
+		double *gx, double *gy, double *gz) const
+{
+    for (size_t k = 0; k < count; k++) {
+        gx[k] = 0;
+        gy[k] = 0;
+        if (zs[k] <= z.front()) {
+            values[k] = n.front();
+            gz[k] = 0;
+        } else if (zs[k] >= z.back()) {
+            values[k] = n.back();
+            gz[k] = 0;
+        } else {
+            size_t i = findInterval(zs[k]);
+            double t = zs[k] - z[i];
+            values[k] = n[i] + t * (c1[i] + t * (c2[i] + t * c3[i]));
+            gz[k] = c1[i] + t * (2 * c2[i] + 3 * t * c3[i]);
+        }
+    }
+}
 
 } // namespace
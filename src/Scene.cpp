@@ -0,0 +1,284 @@
+#include "radiopropa/Scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace radiopropa {
+
+// maximum number of primitives in a leaf of the hierarchy
+static const unsigned int leafSize = 2;
+
+// distance of a position to a box, 0 inside
+static inline double boxDistance(const Vector3d &p, const Vector3d &lower,
+		const Vector3d &upper) {
+	Vector3d d = (lower - p).max(p - upper).max(Vector3d(0.));
+	return d.getR();
+}
+
+namespace {
+
+// orders primitives by the center of their bounding box along one axis
+class CenterLess {
+	const std::vector<Vector3d> &lowers, &uppers;
+	int axis;
+public:
+	CenterLess(const std::vector<Vector3d> &lowers,
+			const std::vector<Vector3d> &uppers, int axis) :
+			lowers(lowers), uppers(uppers), axis(axis) {
+	}
+	bool operator()(unsigned int a, unsigned int b) const {
+		return (lowers[a] + uppers[a]).getComponent(axis) < (lowers[b] + uppers[b]).getComponent(axis);
+	}
+};
+
+} // namespace
+
+Scene::Scene() :
+		built(1) {
+}
+
+size_t Scene::add(const Primitive &primitive, const Vector3d &lower,
+		const Vector3d &upper) {
+	size_t index = primitives.size();
+	primitives.push_back(primitive);
+	lowers.push_back(lower);
+	uppers.push_back(upper);
+	if (primitive.type == PlanePrimitive)
+		unbounded.push_back(index);
+	else
+		bounded.push_back(index);
+	built = 0;
+	return index;
+}
+
+size_t Scene::addPlane(Vector3d origin, Vector3d normal) {
+	if (normal.getR() == 0)
+		throw std::runtime_error("Scene: normal vector is zero");
+	Primitive p = { PlanePrimitive, origin, normal.getUnitVector(), Vector3d(0.), 0, 0 };
+	double infinity = std::numeric_limits<double>::infinity();
+	return add(p, Vector3d(-infinity), Vector3d(infinity));
+}
+
+size_t Scene::addSphere(Vector3d center, double radius) {
+	Primitive p = { SpherePrimitive, center, Vector3d(0.), Vector3d(0.), radius, 0 };
+	return add(p, center - Vector3d(radius), center + Vector3d(radius));
+}
+
+size_t Scene::addBox(Vector3d origin, Vector3d size) {
+	Primitive p = { BoxPrimitive, origin, size, Vector3d(0.), 0, 0 };
+	return add(p, origin.min(origin + size), origin.max(origin + size));
+}
+
+size_t Scene::addEllipsoid(Vector3d focalPoint1, Vector3d focalPoint2,
+		double majorAxis) {
+	Primitive p = { EllipsoidPrimitive, focalPoint1, focalPoint2, Vector3d(0.), majorAxis, 0 };
+	Vector3d center = (focalPoint1 + focalPoint2) / 2.;
+	return add(p, center - Vector3d(majorAxis / 2), center + Vector3d(majorAxis / 2));
+}
+
+size_t Scene::addCylinder(Vector3d origin, double height, double radius) {
+	Primitive p = { CylinderPrimitive, origin, Vector3d(0.), Vector3d(0.), radius, height };
+	Vector3d extent(radius, radius, height / 2);
+	return add(p, origin - extent, origin + extent);
+}
+
+size_t Scene::addDisc(Vector3d center, Vector3d normal, double radius) {
+	if (normal.getR() == 0)
+		throw std::runtime_error("Scene: normal vector is zero");
+	Primitive p = { DiscPrimitive, center, normal.getUnitVector(), Vector3d(0.), radius, 0 };
+	return add(p, center - Vector3d(radius), center + Vector3d(radius));
+}
+
+size_t Scene::addRectangle(Vector3d corner, Vector3d u, Vector3d v) {
+	if (fabs(u.dot(v)) > 1e-9 * u.getR() * v.getR())
+		throw std::runtime_error("Scene: edges of the rectangle are not perpendicular");
+	Primitive p = { RectanglePrimitive, corner, u, v, 0, 0 };
+	Vector3d far = corner + u + v;
+	return add(p, corner.min(far).min((corner + u).min(corner + v)),
+			corner.max(far).max((corner + u).max(corner + v)));
+}
+
+bool Scene::isBuilt() const {
+	// full barrier, so that a thread seeing the hierarchy built also sees its nodes
+#if defined(__GNUC__)
+	return __sync_add_and_fetch(const_cast<int *>(&built), 0) != 0;
+#else
+#pragma omp flush
+	return built != 0;
+#endif
+}
+
+void Scene::build() {
+	if (isBuilt())
+		return;
+	nodes.clear();
+	if (!bounded.empty())
+		buildNode(0, bounded.size());
+
+	// publish the nodes before the flag
+#if defined(__GNUC__)
+	__sync_synchronize();
+	__sync_lock_test_and_set(&built, 1);
+#else
+#pragma omp flush
+	built = 1;
+#endif
+}
+
+unsigned int Scene::buildNode(unsigned int first, unsigned int count) {
+	unsigned int index = nodes.size();
+	nodes.push_back(Node());
+
+	Vector3d lower(std::numeric_limits<double>::max());
+	Vector3d upper(-std::numeric_limits<double>::max());
+	Vector3d centerLower = lower, centerUpper = upper;
+	for (unsigned int i = first; i < first + count; i++) {
+		unsigned int j = bounded[i];
+		lower = lower.min(lowers[j]);
+		upper = upper.max(uppers[j]);
+		Vector3d center = (lowers[j] + uppers[j]) / 2.;
+		centerLower = centerLower.min(center);
+		centerUpper = centerUpper.max(center);
+	}
+	nodes[index].lower = lower;
+	nodes[index].upper = upper;
+
+	// split at the median center along the longest axis
+	Vector3d extent = centerUpper - centerLower;
+	int axis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+	if ((count <= leafSize) || (extent.getComponent(axis) == 0)) {
+		nodes[index].start = first;
+		nodes[index].count = count;
+		return index;
+	}
+	unsigned int half = count / 2;
+	std::nth_element(bounded.begin() + first, bounded.begin() + first + half,
+			bounded.begin() + first + count, CenterLess(lowers, uppers, axis));
+
+	buildNode(first, half);
+	unsigned int second = buildNode(first + half, count - half);
+	nodes[index].start = second;
+	nodes[index].count = 0;
+	return index;
+}
+
+double Scene::distanceTo(size_t i, const Vector3d &position) const {
+	const Primitive &p = primitives.at(i);
+	switch (p.type) {
+	case PlanePrimitive:
+		return fabs((position - p.a).dot(p.b));
+	case SpherePrimitive:
+		return fabs((position - p.a).getR() - p.r);
+	case BoxPrimitive: {
+		Vector3d lower = lowers[i], upper = uppers[i];
+		Vector3d inside = (position - lower).min(upper - position);
+		if (inside.min() > 0)
+			return inside.min();
+		return boxDistance(position, lower, upper);
+	}
+	case EllipsoidPrimitive:
+		return fabs(position.getDistanceTo(p.a) + position.getDistanceTo(p.b) - p.r) / 2;
+	case CylinderPrimitive: {
+		Vector3d d = position - p.a;
+		double dr = sqrt(d.x * d.x + d.y * d.y) - p.r;
+		double dz = fabs(d.z) - p.s / 2;
+		if ((dr < 0) && (dz < 0))
+			return std::min(-dr, -dz);
+		dr = std::max(dr, 0.);
+		dz = std::max(dz, 0.);
+		return sqrt(dr * dr + dz * dz);
+	}
+	case DiscPrimitive: {
+		double dn = (position - p.a).dot(p.b);
+		double rho = sqrt(std::max((position - p.a).getR2() - dn * dn, 0.));
+		double dr = std::max(rho - p.r, 0.);
+		return sqrt(dn * dn + dr * dr);
+	}
+	case RectanglePrimitive: {
+		Vector3d r = position - p.a;
+		double lu = p.b.getR(), lv = p.c.getR();
+		double a = r.dot(p.b) / lu, b = r.dot(p.c) / lv;
+		double dn = r.dot(p.b.cross(p.c).getUnitVector());
+		double da = std::max(std::max(-a, a - lu), 0.);
+		double db = std::max(std::max(-b, b - lv), 0.);
+		return sqrt(dn * dn + da * da + db * db);
+	}
+	}
+	return std::numeric_limits<double>::infinity();
+}
+
+double Scene::distance(const Vector3d &position, size_t &primitive) const {
+	if (!isBuilt()) {
+		// first query after primitives were added, threads wait for the one building the hierarchy,
+		// build checks the flag again inside the critical section
+#pragma omp critical(Scene)
+		const_cast<Scene *>(this)->build();
+	}
+
+	double best = std::numeric_limits<double>::infinity();
+	primitive = primitives.size();
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		double d = distanceTo(unbounded[i], position);
+		if (d < best) {
+			best = d;
+			primitive = unbounded[i];
+		}
+	}
+	if (nodes.empty())
+		return best;
+
+	// nodes whose bounding box is farther than the best distance cannot contain a nearer surface
+	unsigned int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node &node = nodes[stack[--top]];
+		if (boxDistance(position, node.lower, node.upper) >= best)
+			continue;
+
+		if (node.count == 0) {
+			// visit the nearer child first
+			unsigned int first = &node - &nodes[0] + 1, second = node.start;
+			if (boxDistance(position, nodes[first].lower, nodes[first].upper)
+					< boxDistance(position, nodes[second].lower, nodes[second].upper))
+				std::swap(first, second);
+			stack[top++] = first;
+			stack[top++] = second;
+			continue;
+		}
+
+		for (unsigned int i = node.start; i < node.start + node.count; i++) {
+			double d = distanceTo(bounded[i], position);
+			if (d < best) {
+				best = d;
+				primitive = bounded[i];
+			}
+		}
+	}
+	return best;
+}
+
+double Scene::distance(const Vector3d &position) const {
+	size_t primitive;
+	return distance(position, primitive);
+}
+
+size_t Scene::getNumberOfPrimitives() const {
+	return primitives.size();
+}
+
+Scene::Type Scene::getType(size_t primitive) const {
+	return primitives.at(primitive).type;
+}
+
+std::string Scene::getDescription() const {
+	std::stringstream s;
+	s << "Scene: " << primitives.size() << " primitives, ";
+	s << unbounded.size() << " unbounded";
+	return s.str();
+}
+
+} // namespace radiopropa
@@ -1,4 +1,5 @@
 #include "radiopropa/Source.h"
+#include "radiopropa/Module.h"
 #include "radiopropa/Random.h"
 #include "radiopropa/Cosmology.h"
 #include "radiopropa/Common.h"
@@ -14,13 +15,17 @@
 
 namespace radiopropa {
 
+bool SourceInterface::usesPythonObjects() const {
+	return false;
+}
+
 // Source ---------------------------------------------------------------------
 void Source::add(SourceFeature* property) {
 	features.push_back(property);
 }
 
 ref_ptr<Candidate> Source::getCandidate() const {
-	ref_ptr<Candidate> candidate = new Candidate();
+	ref_ptr<Candidate> candidate = CandidatePool::acquire();
 	for (int i = 0; i < features.size(); i++)
 		(*features[i]).prepareCandidate(*candidate);
 	return candidate;
@@ -34,6 +39,13 @@ std::string Source::getDescription() const {
 	return ss.str();
 }
 
+bool Source::usesPythonObjects() const {
+	for (size_t i = 0; i < features.size(); i++)
+		if (isPythonObject(features[i]))
+			return true;
+	return false;
+}
+
 // SourceList------------------------------------------------------------------
 void SourceList::add(Source* source, double weight) {
 	sources.push_back(source);
@@ -45,7 +57,7 @@ void SourceList::add(Source* source, double weight) {
 ref_ptr<Candidate> SourceList::getCandidate() const {
 	if (sources.size() == 0)
 		throw std::runtime_error("SourceList: no sources set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = RandomStream::instance().randBin(cdf);
 	return (sources[i])->getCandidate();
 }
 
@@ -57,6 +69,13 @@ std::string SourceList::getDescription() const {
 	return ss.str();
 }
 
+bool SourceList::usesPythonObjects() const {
+	for (size_t i = 0; i < sources.size(); i++)
+		if (isPythonObject(sources[i]) || sources[i]->usesPythonObjects())
+			return true;
+	return false;
+}
+
 // SourceFeature---------------------------------------------------------------
 void SourceFeature::prepareCandidate(Candidate& candidate) const {
 	ParticleState &source = candidate.source;
@@ -102,7 +121,7 @@ void SourceMultipleParticleTypes::add(int id, double a) {
 void SourceMultipleParticleTypes::prepareParticle(ParticleState& particle) const {
 	if (particleTypes.size() == 0)
 		throw std::runtime_error("SourceMultipleParticleTypes: no nuclei set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = RandomStream::instance().randBin(cdf);
 	particle.setId(particleTypes[i]);
 }
 
@@ -164,7 +183,7 @@ void SourceComposition::prepareParticle(ParticleState& particle) const {
 	if (nuclei.size() == 0)
 		throw std::runtime_error("SourceComposition: No source isotope set");
 
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 
 	// draw random particle type
 	size_t i = random.randBin(cdf);
@@ -222,7 +241,7 @@ void SourceMultiplePositions::add(Vector3d pos, double weight) {
 void SourceMultiplePositions::prepareParticle(ParticleState& particle) const {
 	if (positions.size() == 0)
 		throw std::runtime_error("SourceMultiplePositions: no position set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = RandomStream::instance().randBin(cdf);
 	particle.setPosition(positions[i]);
 }
 
@@ -241,7 +260,7 @@ SourceUniformSphere::SourceUniformSphere(Vector3d center, double radius) :
 }
 
 void SourceUniformSphere::prepareParticle(ParticleState& particle) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	double r = pow(random.rand(), 1. / 3.) * radius;
 	particle.setPosition(center + random.randVector() * r);
 }
@@ -261,7 +280,7 @@ SourceUniformShell::SourceUniformShell(Vector3d center, double radius) :
 }
 
 void SourceUniformShell::prepareParticle(ParticleState& particle) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	particle.setPosition(center + random.randVector() * radius);
 }
 
@@ -280,7 +299,7 @@ SourceUniformBox::SourceUniformBox(Vector3d origin, Vector3d size) :
 }
 
 void SourceUniformBox::prepareParticle(ParticleState& particle) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	Vector3d pos(random.rand(), random.rand(), random.rand());
 	particle.setPosition(pos * size + origin);
 }
@@ -299,7 +318,7 @@ SourceUniformCylinder::SourceUniformCylinder(Vector3d origin, double height, dou
 }
 
 void SourceUniformCylinder::prepareParticle(ParticleState& particle) const {
-  Random &random = Random::instance();
+  RandomStream &random = RandomStream::instance();
   double phi = 2*M_PI*random.rand();
   double RandRadius = radius*pow(random.rand(), 1. / 2.);
   Vector3d pos(cos(phi)*RandRadius, sin(phi)*RandRadius, (-0.5+random.rand())*height);
@@ -333,7 +352,7 @@ SourceSNRDistribution::SourceSNRDistribution(double R_earth, double beta, double
 }
 
 void SourceSNRDistribution::prepareParticle(ParticleState& particle) const {
-  	Random &random = Random::instance();
+  	RandomStream &random = RandomStream::instance();
 	double RPos;
 	while (true){
 		RPos = random.rand()*R_max;
@@ -440,7 +459,7 @@ SourcePulsarDistribution::SourcePulsarDistribution(double R_earth, double beta,
 }
 
 void SourcePulsarDistribution::prepareParticle(ParticleState& particle) const {
-  	Random &random = Random::instance();
+  	RandomStream &random = RandomStream::instance();
 	double Rtilde;
 	while (true){
 		Rtilde = random.rand()*R_max;
@@ -498,12 +517,12 @@ double SourcePulsarDistribution::f_theta(int i, double r) const {
 }
 
 double SourcePulsarDistribution::blur_r(double r_tilde) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	return random.randNorm(r_tilde, r_blur*r_tilde);
 }
 
 double SourcePulsarDistribution::blur_theta(double theta_tilde, double r_tilde) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	double theta_corr = (random.rand()-0.5)*2*M_PI;
 	double tau = theta_corr*exp(-theta_blur*r_tilde);
 	return theta_tilde + tau;
@@ -589,7 +608,7 @@ SourceUniform1D::SourceUniform1D(double minD, double maxD, bool withCosmology) {
 }
 
 void SourceUniform1D::prepareParticle(ParticleState& particle) const {
-	Random& random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	double d = random.rand() * (maxD - minD) + minD;
 	if (withCosmology)
 		d = lightTravel2ComovingDistance(d);
@@ -622,7 +641,7 @@ SourceDensityGrid::SourceDensityGrid(ref_ptr<ScalarGrid> grid) :
 }
 
 void SourceDensityGrid::prepareParticle(ParticleState& particle) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 
 	// draw random bin
 	size_t i = random.randBin(grid->getGrid());
@@ -658,7 +677,7 @@ SourceDensityGrid1D::SourceDensityGrid1D(ref_ptr<ScalarGrid> grid) :
 }
 
 void SourceDensityGrid1D::prepareParticle(ParticleState& particle) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 
 	// draw random bin
 	size_t i = random.randBin(grid->getGrid());
@@ -681,7 +700,7 @@ SourceIsotropicEmission::SourceIsotropicEmission() {
 }
 
 void SourceIsotropicEmission::prepareParticle(ParticleState& particle) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	particle.setDirection(random.randVector());
 }
 
@@ -732,7 +751,7 @@ SourceEmissionCone::SourceEmissionCone(Vector3d direction, double aperture) :
 }
 
 void SourceEmissionCone::prepareParticle(ParticleState& particle) const {
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 	particle.setDirection(random.randConeVector(direction, aperture));
 }
 
@@ -839,7 +858,7 @@ void SourceGenericComposition::prepareParticle(ParticleState& particle) const {
 	if (nuclei.size() == 0)
 		throw std::runtime_error("SourceComposition: No source isotope set");
 
-	Random &random = Random::instance();
+	RandomStream &random = RandomStream::instance();
 
 
 	// draw random particle type
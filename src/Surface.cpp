@@ -0,0 +1,278 @@
+#include "radiopropa/Surface.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace radiopropa {
+
+// tolerance of the barycentric coordinates
+static const double edgeTolerance = 1e-10;
+
+bool Surface::intersectTriangle(const Vector3d &a, const Vector3d &d,
+		const Vector3d &v0, const Vector3d &e1, const Vector3d &e2,
+		double tMax, double &t) {
+	Vector3d p = d.cross(e2);
+	double det = e1.dot(p);
+	if (det == 0)
+		return false;
+	double invDet = 1. / det;
+	Vector3d s = a - v0;
+	double u = s.dot(p) * invDet;
+	if ((u < -edgeTolerance) || (u > 1 + edgeTolerance))
+		return false;
+	Vector3d q = s.cross(e1);
+	double v = d.dot(q) * invDet;
+	if ((v < -edgeTolerance) || (u + v > 1 + edgeTolerance))
+		return false;
+	double ti = e2.dot(q) * invDet;
+	if ((ti < 0) || (ti > tMax))
+		return false;
+	t = ti;
+	return true;
+}
+
+// Heightmap ------------------------------------------------------------------
+Heightmap::Heightmap(ref_ptr<ScalarGrid> grid) :
+		origin(grid->getOrigin()), Nx(grid->getNx()), Ny(grid->getNy()),
+		spacing(grid->getSpacing()), mapping(0), mappingSize(0) {
+	if (grid->getNz() != 1)
+		throw std::runtime_error("Heightmap: grid with Nz != 1");
+	if ((Nx < 2) || (Ny < 2))
+		throw std::runtime_error("Heightmap: less than 2 x 2 samples");
+	heights = grid->getGrid();
+	data = &heights[0];
+	buildPyramid();
+}
+
+Heightmap::Heightmap(std::string filename, Vector3d origin, size_t Nx,
+		size_t Ny, double spacing) :
+		origin(origin), Nx(Nx), Ny(Ny), spacing(spacing), mapping(0),
+		mappingSize(0) {
+	if ((Nx < 2) || (Ny < 2))
+		throw std::runtime_error("Heightmap: less than 2 x 2 samples");
+	size_t size = Nx * Ny * sizeof(float);
+
+#ifndef _WIN32
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::stringstream ss;
+		ss << "Heightmap: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	struct stat status;
+	if ((fstat(fd, &status) != 0) || (size_t(status.st_size) != size)) {
+		close(fd);
+		throw std::runtime_error("Heightmap: file and raster size do not match");
+	}
+	mapping = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		mapping = 0;
+		throw std::runtime_error("Heightmap: memory mapping of " + filename + " failed");
+	}
+	mappingSize = size;
+	data = (const float*) mapping;
+#else
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin) {
+		std::stringstream ss;
+		ss << "Heightmap: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	fin.seekg(0, fin.end);
+	if (size_t(fin.tellg()) != size)
+		throw std::runtime_error("Heightmap: file and raster size do not match");
+	fin.seekg(0, fin.beg);
+	heights.resize(Nx * Ny);
+	fin.read((char*) &heights[0], size);
+	data = &heights[0];
+#endif
+
+	buildPyramid();
+}
+
+Heightmap::~Heightmap() {
+#ifndef _WIN32
+	if (mapping)
+		munmap(mapping, mappingSize);
+#endif
+}
+
+void Heightmap::buildPyramid() {
+	// blocks of 2 x 2 cells from the samples, then 2 x 2 blocks of the level below
+	size_t nx = Nx - 1, ny = Ny - 1;
+	pyramid.clear();
+	pyramidNx.clear();
+	pyramidNy.clear();
+	while ((nx > 1) || (ny > 1)) {
+		size_t mx = (nx + 1) / 2, my = (ny + 1) / 2;
+		std::vector<float> level(2 * mx * my);
+		for (size_t i = 0; i < mx; i++) {
+			for (size_t j = 0; j < my; j++) {
+				float lower, upper;
+				cellRange(pyramid.size(), 2 * i, 2 * j, lower, upper);
+				for (size_t k = 1; k < 4; k++) {
+					size_t ci = 2 * i + k / 2, cj = 2 * j + k % 2;
+					if ((ci >= nx) || (cj >= ny))
+						continue;
+					float l, u;
+					cellRange(pyramid.size(), ci, cj, l, u);
+					lower = std::min(lower, l);
+					upper = std::max(upper, u);
+				}
+				level[2 * (i * my + j)] = lower;
+				level[2 * (i * my + j) + 1] = upper;
+			}
+		}
+		pyramid.push_back(level);
+		pyramidNx.push_back(mx);
+		pyramidNy.push_back(my);
+		nx = mx;
+		ny = my;
+	}
+}
+
+void Heightmap::cellRange(size_t level, size_t i, size_t j, float &lower,
+		float &upper) const {
+	if (level == 0) {
+		// single cell, from its four corners
+		float h00 = data[i * Ny + j], h01 = data[i * Ny + j + 1];
+		float h10 = data[(i + 1) * Ny + j], h11 = data[(i + 1) * Ny + j + 1];
+		lower = std::min(std::min(h00, h01), std::min(h10, h11));
+		upper = std::max(std::max(h00, h01), std::max(h10, h11));
+	} else {
+		const float *range = &pyramid[level - 1][2 * (i * pyramidNy[level - 1] + j)];
+		lower = range[0];
+		upper = range[1];
+	}
+}
+
+bool Heightmap::intersectCell(size_t i, size_t j, const Vector3d &a,
+		const Vector3d &d, double &t, Vector3d &normal, size_t &element) const {
+	double x = origin.x + (i + 0.5) * spacing, y = origin.y + (j + 0.5) * spacing;
+	Vector3d p00(x, y, data[i * Ny + j]);
+	Vector3d p10(x + spacing, y, data[(i + 1) * Ny + j]);
+	Vector3d p01(x, y + spacing, data[i * Ny + j + 1]);
+	Vector3d p11(x + spacing, y + spacing, data[(i + 1) * Ny + j + 1]);
+
+	// two triangles split along the diagonal p00 - p11, counter-clockwise seen from above
+	Vector3d e[2][2] = { { p10 - p00, p11 - p00 }, { p11 - p00, p01 - p00 } };
+	bool hit = false;
+	for (int k = 0; k < 2; k++) {
+		if (intersectTriangle(a, d, p00, e[k][0], e[k][1], t, t)) {
+			normal = e[k][0].cross(e[k][1]).getUnitVector();
+			element = 2 * (i * (Ny - 1) + j) + k;
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+bool Heightmap::intersect(const Vector3d &a, const Vector3d &b, double &t,
+		Vector3d &normal, size_t &element) const {
+	Vector3d d = b - a;
+	Vector3d inverse(1. / d.x, 1. / d.y, 1. / d.z);
+	double tBest = 1;
+	bool hit = false;
+
+	// visit the nearer children last, so that they are taken from the stack first
+	size_t nearI = (d.x < 0) ? 1 : 0, nearJ = (d.y < 0) ? 1 : 0;
+	size_t order[4][2] = { { 1 - nearI, 1 - nearJ }, { 1 - nearI, nearJ },
+			{ nearI, 1 - nearJ }, { nearI, nearJ } };
+
+	struct Block {
+		size_t level, i, j;
+	};
+	Block stack[4 * 64];
+	int top = 0;
+	Block root = { pyramid.size(), 0, 0 };
+	stack[top++] = root;
+	while (top > 0) {
+		Block block = stack[--top];
+		size_t size = size_t(1) << block.level;
+		size_t i0 = block.i * size, j0 = block.j * size;
+		size_t i1 = std::min(i0 + size, Nx - 1), j1 = std::min(j0 + size, Ny - 1);
+		float lower, upper;
+		cellRange(block.level, block.i, block.j, lower, upper);
+
+		// slab test of the segment against the bounding box of the block
+		Vector3d boxLower(origin.x + (i0 + 0.5) * spacing, origin.y + (j0 + 0.5) * spacing, lower);
+		Vector3d boxUpper(origin.x + (i1 + 0.5) * spacing, origin.y + (j1 + 0.5) * spacing, upper);
+		Vector3d t0 = (boxLower - a) * inverse;
+		Vector3d t1 = (boxUpper - a) * inverse;
+		double tEnter = std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)), std::max(std::min(t0.z, t1.z), 0.));
+		double tExit = std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::min(std::max(t0.z, t1.z), tBest));
+		if (tEnter > tExit)
+			continue;
+
+		if (block.level == 0) {
+			if (intersectCell(block.i, block.j, a, d, tBest, normal, element))
+				hit = true;
+			continue;
+		}
+
+		for (int k = 0; k < 4; k++) {
+			Block child = { block.level - 1, 2 * block.i + order[k][0], 2 * block.j + order[k][1] };
+			if (((child.i << child.level) < Nx - 1) && ((child.j << child.level) < Ny - 1))
+				stack[top++] = child;
+		}
+	}
+
+	if (hit)
+		t = tBest;
+	return hit;
+}
+
+double Heightmap::getHeight(double x, double y) const {
+	double rx = std::min(std::max((x - origin.x) / spacing - 0.5, 0.), double(Nx - 1));
+	double ry = std::min(std::max((y - origin.y) / spacing - 0.5, 0.), double(Ny - 1));
+	size_t i = std::min(size_t(rx), Nx - 2), j = std::min(size_t(ry), Ny - 2);
+	double fx = rx - i, fy = ry - j;
+	double h00 = data[i * Ny + j], h01 = data[i * Ny + j + 1];
+	double h10 = data[(i + 1) * Ny + j], h11 = data[(i + 1) * Ny + j + 1];
+	if (fx >= fy)
+		return h00 + fx * (h10 - h00) + fy * (h11 - h10);
+	return h00 + fy * (h01 - h00) + fx * (h11 - h01);
+}
+
+float Heightmap::getSample(size_t ix, size_t iy) const {
+	return data[ix * Ny + iy];
+}
+
+Vector3d Heightmap::getOrigin() const {
+	return origin;
+}
+
+size_t Heightmap::getNx() const {
+	return Nx;
+}
+
+size_t Heightmap::getNy() const {
+	return Ny;
+}
+
+double Heightmap::getSpacing() const {
+	return spacing;
+}
+
+bool Heightmap::isMemoryMapped() const {
+	return mapping != 0;
+}
+
+std::string Heightmap::getDescription() const {
+	std::stringstream s;
+	s << "Heightmap: " << Nx << " x " << Ny << " samples";
+	return s.str();
+}
+
+} // namespace radiopropa
@@ -0,0 +1,290 @@
+#include "radiopropa/TriangleMesh.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace radiopropa {
+
+// maximum number of triangles in a leaf of the hierarchy
+static const unsigned int leafSize = 4;
+
+namespace {
+
+// orders triangles by the coordinate of their center along one axis
+class CenterLess {
+	const std::vector<Vector3d> &centers;
+	int axis;
+public:
+	CenterLess(const std::vector<Vector3d> &centers, int axis) :
+			centers(centers), axis(axis) {
+	}
+	bool operator()(unsigned int a, unsigned int b) const {
+		return centers[a].getComponent(axis) < centers[b].getComponent(axis);
+	}
+};
+
+} // namespace
+
+TriangleMesh::TriangleMesh(const std::vector<Vector3d> &vertices,
+		const std::vector<unsigned int> &indices) :
+		vertices(vertices), indices(indices) {
+	if (indices.size() % 3 != 0)
+		throw std::runtime_error("TriangleMesh: number of indices not a multiple of 3");
+	if (indices.empty())
+		throw std::runtime_error("TriangleMesh: no triangles");
+	for (size_t i = 0; i < indices.size(); i++)
+		if (indices[i] >= vertices.size())
+			throw std::runtime_error("TriangleMesh: vertex index out of range");
+	build();
+}
+
+void TriangleMesh::build() {
+	size_t count = indices.size() / 3;
+	std::vector<unsigned int> order(count);
+	std::vector<Vector3d> centers(count);
+	for (size_t i = 0; i < count; i++) {
+		order[i] = i;
+		centers[i] = (vertices[indices[3 * i]] + vertices[indices[3 * i + 1]]
+				+ vertices[indices[3 * i + 2]]) / 3.;
+	}
+
+	nodes.clear();
+	nodes.reserve(2 * count / leafSize + 1);
+	buildNode(order, centers, 0, count);
+
+	// store the triangles in the order of the leaves
+	std::vector<unsigned int> sorted(indices.size());
+	triangleIds.resize(count);
+	edges.resize(2 * count);
+	for (size_t i = 0; i < count; i++) {
+		unsigned int j = order[i];
+		for (int k = 0; k < 3; k++)
+			sorted[3 * i + k] = indices[3 * j + k];
+		triangleIds[i] = j;
+		const Vector3d &v0 = vertices[sorted[3 * i]];
+		edges[2 * i] = vertices[sorted[3 * i + 1]] - v0;
+		edges[2 * i + 1] = vertices[sorted[3 * i + 2]] - v0;
+	}
+	indices.swap(sorted);
+}
+
+unsigned int TriangleMesh::buildNode(std::vector<unsigned int> &order,
+		const std::vector<Vector3d> &centers, unsigned int first,
+		unsigned int count) {
+	unsigned int index = nodes.size();
+	nodes.push_back(Node());
+
+	Vector3d lower(std::numeric_limits<double>::max());
+	Vector3d upper(-std::numeric_limits<double>::max());
+	Vector3d centerLower = lower, centerUpper = upper;
+	for (unsigned int i = first; i < first + count; i++) {
+		unsigned int j = order[i];
+		for (int k = 0; k < 3; k++) {
+			const Vector3d &v = vertices[indices[3 * j + k]];
+			lower = lower.min(v);
+			upper = upper.max(v);
+		}
+		centerLower = centerLower.min(centers[j]);
+		centerUpper = centerUpper.max(centers[j]);
+	}
+	nodes[index].lower = lower;
+	nodes[index].upper = upper;
+
+	// split at the median center along the longest axis
+	Vector3d extent = centerUpper - centerLower;
+	int axis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+	if ((count <= leafSize) || (extent.getComponent(axis) == 0)) {
+		nodes[index].start = first;
+		nodes[index].count = count;
+		return index;
+	}
+	unsigned int half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half,
+			order.begin() + first + count, CenterLess(centers, axis));
+
+	buildNode(order, centers, first, half);
+	unsigned int second = buildNode(order, centers, first + half, count - half);
+	nodes[index].start = second;
+	nodes[index].count = 0;
+	return index;
+}
+
+bool TriangleMesh::intersect(const Vector3d &a, const Vector3d &b, double &t,
+		Vector3d &normal, size_t &triangle) const {
+	Vector3d d = b - a;
+	Vector3d inverse(1. / d.x, 1. / d.y, 1. / d.z);
+	double tBest = 1;
+	bool hit = false;
+	size_t best = 0;
+
+	unsigned int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node &node = nodes[stack[--top]];
+
+		// slab test of the segment against the bounding box
+		Vector3d t0 = (node.lower - a) * inverse;
+		Vector3d t1 = (node.upper - a) * inverse;
+		double tEnter = std::max(std::max(std::min(t0.x, t1.x), std::min(t0.y, t1.y)), std::max(std::min(t0.z, t1.z), 0.));
+		double tExit = std::min(std::min(std::max(t0.x, t1.x), std::max(t0.y, t1.y)), std::min(std::max(t0.z, t1.z), tBest));
+		if (tEnter > tExit)
+			continue;
+
+		if (node.count == 0) {
+			stack[top++] = node.start;
+			stack[top++] = &node - &nodes[0] + 1;
+			continue;
+		}
+
+		for (unsigned int i = node.start; i < node.start + node.count; i++) {
+			if (intersectTriangle(a, d, vertices[indices[3 * i]], edges[2 * i],
+					edges[2 * i + 1], tBest, tBest)) {
+				best = i;
+				hit = true;
+			}
+		}
+	}
+
+	if (hit) {
+		t = tBest;
+		normal = edges[2 * best].cross(edges[2 * best + 1]).getUnitVector();
+		triangle = triangleIds[best];
+	}
+	return hit;
+}
+
+size_t TriangleMesh::getNumberOfTriangles() const {
+	return triangleIds.size();
+}
+
+size_t TriangleMesh::getNumberOfVertices() const {
+	return vertices.size();
+}
+
+size_t TriangleMesh::getNumberOfNodes() const {
+	return nodes.size();
+}
+
+std::string TriangleMesh::getDescription() const {
+	std::stringstream s;
+	s << "TriangleMesh: " << getNumberOfTriangles() << " triangles";
+	return s.str();
+}
+
+Vector3d TriangleMesh::getLowerCorner() const {
+	return nodes[0].lower;
+}
+
+Vector3d TriangleMesh::getUpperCorner() const {
+	return nodes[0].upper;
+}
+
+static std::string readFile(const std::string &filename) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin) {
+		std::stringstream ss;
+		ss << "loadTriangleMesh: " << filename << " not found";
+		throw std::runtime_error(ss.str());
+	}
+	fin.seekg(0, fin.end);
+	std::string content(fin.tellg(), '\0');
+	fin.seekg(0, fin.beg);
+	if (!content.empty())
+		fin.read(&content[0], content.size());
+	return content;
+}
+
+static ref_ptr<TriangleMesh> loadOBJ(const std::string &filename, double c) {
+	std::string content = readFile(filename);
+	std::vector<Vector3d> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<long> face;
+
+	// parse in place with strtod / strtol, which is much faster than streams
+	const char *p = content.c_str();
+	const char *end = p + content.size();
+	while (p < end) {
+		while ((p < end) && ((*p == ' ') || (*p == '\t')))
+			p++;
+		if ((p + 1 < end) && (p[0] == 'v') && ((p[1] == ' ') || (p[1] == '\t'))) {
+			char *next;
+			double x = strtod(p + 1, &next);
+			double y = strtod(next, &next);
+			double z = strtod(next, &next);
+			vertices.push_back(Vector3d(x, y, z) * c);
+			p = next;
+		} else if ((p + 1 < end) && (p[0] == 'f') && ((p[1] == ' ') || (p[1] == '\t'))) {
+			face.clear();
+			p++;
+			while ((p < end) && (*p != '\n') && (*p != '\r')) {
+				char *next;
+				long i = strtol(p, &next, 10);
+				if (next == p) {
+					p++;
+					continue;
+				}
+				// relative indices count back from the last vertex
+				face.push_back((i < 0) ? long(vertices.size()) + i : i - 1);
+				p = next;
+				// skip texture and normal indices
+				while ((p < end) && (*p != ' ') && (*p != '\t') && (*p != '\n') && (*p != '\r'))
+					p++;
+			}
+			for (size_t k = 0; k < face.size(); k++)
+				if ((face[k] < 0) || (face[k] >= long(vertices.size())))
+					throw std::runtime_error("loadTriangleMesh: vertex index out of range in " + filename);
+			for (size_t k = 2; k < face.size(); k++) {
+				indices.push_back(face[0]);
+				indices.push_back(face[k - 1]);
+				indices.push_back(face[k]);
+			}
+		}
+		while ((p < end) && (*p != '\n'))
+			p++;
+		p++;
+	}
+	return new TriangleMesh(vertices, indices);
+}
+
+static ref_ptr<TriangleMesh> loadSTL(const std::string &filename, double c) {
+	std::string content = readFile(filename);
+	if (content.size() < 84)
+		throw std::runtime_error("loadTriangleMesh: " + filename + " is not a binary STL file");
+	uint32_t count;
+	memcpy(&count, &content[80], sizeof(count));
+	if (content.size() < 84 + 50 * size_t(count))
+		throw std::runtime_error("loadTriangleMesh: " + filename + " is not a binary STL file");
+
+	// 80 byte header, number of triangles and per triangle the normal, three corners and 2 bytes
+	std::vector<Vector3d> vertices(3 * size_t(count));
+	std::vector<unsigned int> indices(3 * size_t(count));
+	for (size_t i = 0; i < count; i++) {
+		float v[9];
+		memcpy(v, &content[84 + 50 * i + 12], sizeof(v));
+		for (int k = 0; k < 3; k++) {
+			vertices[3 * i + k] = Vector3d(v[3 * k], v[3 * k + 1], v[3 * k + 2]) * c;
+			indices[3 * i + k] = 3 * i + k;
+		}
+	}
+	return new TriangleMesh(vertices, indices);
+}
+
+ref_ptr<TriangleMesh> loadTriangleMesh(std::string filename, double c) {
+	std::string extension = filename.substr(filename.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == "obj")
+		return loadOBJ(filename, c);
+	if (extension == "stl")
+		return loadSTL(filename, c);
+	throw std::runtime_error("loadTriangleMesh: unknown file type of " + filename);
+}
+
+} // namespace radiopropa
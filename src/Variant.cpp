@@ -11,7 +11,7 @@ namespace radiopropa
 {
 
 Variant::Variant() :
-		type(TYPE_NONE)
+		type(TYPE_NONE), smallString(false)
 {
 }
 
@@ -21,28 +21,66 @@ Variant::~Variant()
 }
 
 Variant::Variant(const Variant& a) :
-		type(TYPE_NONE)
+		type(TYPE_NONE), smallString(false)
 {
 	copy(a);
 }
 
-Variant::Variant(const char *s)
+Variant::Variant(const std::string &a) :
+		type(TYPE_NONE), smallString(false)
 {
-	data._String = new std::string(s);
+	assignString(a.data(), a.size());
+}
+
+Variant::Variant(const char *s) :
+		type(TYPE_NONE), smallString(false)
+{
+	assignString(s, std::strlen(s));
+}
+
+void Variant::assignString(const char *s, size_t n)
+{
+	if ((type == TYPE_STRING) && !smallString && (n > smallStringSize))
+	{
+		// reuse the heap string
+		data._String->assign(s, n);
+		return;
+	}
+	if (n <= smallStringSize)
+	{
+		// through a copy, s may point into this variant
+		char small[smallStringSize + 2];
+		std::memcpy(small, s, n);
+		clear();
+		std::memcpy(data._Small, small, n);
+		data._Small[n] = 0;
+		data._Small[smallStringSize + 1] = char(n);
+		smallString = true;
+	}
+	else
+	{
+		std::string *str = new std::string(s, n);
+		clear();
+		data._String = str;
+		smallString = false;
+	}
 	type = TYPE_STRING;
 }
 
+bool Variant::operator ==(const std::string &a) const
+{
+	check(TYPE_STRING);
+	return (a.size() == stringSize())
+			&& (std::memcmp(a.data(), stringData(), a.size()) == 0);
+}
+
 
 void Variant::clear()
 {
-	if (type == TYPE_STRING)
+	if ((type == TYPE_STRING) && !smallString)
 	{
-		if(data._String)
-		{
-			delete data._String;
-			data._String = NULL;
-		}
-
+		delete data._String;
+		data._String = NULL;
 	}
 
 	type = TYPE_NONE;
@@ -62,7 +100,7 @@ void Variant::check(const Type t)
 		switch (t)
 		{
 		case TYPE_STRING:
-			data._String = new std::string;
+			smallString = true;
 			break;
 		default:
 			break;
@@ -134,7 +172,7 @@ const std::type_info& Variant::getTypeInfo() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		const std::type_info &ti = typeid(*data._String);
+		const std::type_info &ti = typeid(std::string);
 		return ti;
 	}
 	else
@@ -315,7 +353,8 @@ bool Variant::operator ==(const Variant &a) const
 	}
 	else if (type == TYPE_STRING)
 	{
-		return (*data._String == *a.data._String);
+		return (stringSize() == a.stringSize())
+				&& (std::memcmp(stringData(), a.stringData(), stringSize()) == 0);
 	}
 	else
 	{
@@ -326,7 +365,7 @@ bool Variant::operator ==(const Variant &a) const
 std::string Variant::toString() const
 {
 	if (type == TYPE_STRING)
-		return *data._String;
+		return std::string(stringData(), stringSize());
 
 	std::stringstream sstr;
 	if (type == TYPE_BOOL)
@@ -501,7 +540,8 @@ bool Variant::operator !=(const Variant &a) const
 	case TYPE_DOUBLE:
 		return (data._Double == a.data._Double);
 	case TYPE_STRING:
-		return (*data._String == *a.data._String);
+		return (stringSize() == a.stringSize())
+				&& (std::memcmp(stringData(), a.stringData(), stringSize()) == 0);
 	default:
 		throw std::runtime_error("compare operator not implemented");
 	}
@@ -557,7 +597,7 @@ void Variant::copy(const Variant &a)
 	}
 	else if (t == TYPE_STRING)
 	{
-		operator =(*a.data._String);
+		assignString(a.stringData(), a.stringSize());
 	}
 	else
 	{
@@ -598,7 +638,7 @@ bool Variant::toBool() const
 		break;
 	case TYPE_STRING:
 	{
-		std::string upperstr(*data._String);
+		std::string upperstr(stringData(), stringSize());
 		std::transform(upperstr.begin(), upperstr.end(), upperstr.begin(),
 				(int(*)(int))toupper);if
 (		upperstr == "YES")
@@ -652,7 +692,7 @@ to Variant::fun() const { \
 	INT_CASE(Double, TYPE_DOUBLE, to_type, to) \
 	case Variant::TYPE_STRING: \
 		{ \
-		long l = atol(data._String->c_str()); \
+		long l = atol(stringData()); \
 		if (l < std::numeric_limits<to>::min() || l > std::numeric_limits<to>::max()) \
 			throw bad_conversion(type, to_type); \
 		else \
@@ -767,7 +807,7 @@ float Variant::toFloat() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		return static_cast<float>(std::atof(data._String->c_str()));
+		return static_cast<float>(std::atof(stringData()));
 	}
 	else if (type == TYPE_BOOL)
 	{
@@ -823,7 +863,7 @@ double Variant::toDouble() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		return std::atof(data._String->c_str());
+		return std::atof(stringData());
 	}
 	else if (type == TYPE_BOOL)
 	{
@@ -836,68 +876,19 @@ double Variant::toDouble() const
 }
 
 
-#define MEMCPYRET(VAR) \
-	memcpy(buffer, &VAR, sizeof( VAR) );\
-  return sizeof( VAR );
-
-size_t Variant::copyToBuffer(void* buffer)
+size_t Variant::copyToBuffer(void* buffer) const
 {
-  if (type == TYPE_CHAR)
-	{
-		MEMCPYRET( data._Char )
-	}
-	else if (type == TYPE_UCHAR)
-	{
-		MEMCPYRET( data._UChar )
-	}
-	else if (type == TYPE_INT16)
-	{
-		MEMCPYRET(data._Int16);
-	}
-	else if (type == TYPE_UINT16)
-	{
-		MEMCPYRET(data._UInt16);
-	}
-	else if (type == TYPE_INT32)
-	{
-		MEMCPYRET(data._Int32);
-	}
-	else if (type == TYPE_UINT32)
-	{
-		MEMCPYRET(data._UInt32);
-	}
-	else if (type == TYPE_INT64)
-	{
-		MEMCPYRET(data._Int64);
-	}
-	else if (type == TYPE_UINT64)
-	{
-		MEMCPYRET(data._UInt64);
-	}
-	else if (type == TYPE_FLOAT)
-	{
-		MEMCPYRET(data._Float);
-	}
-	else if (type == TYPE_DOUBLE)
-	{
-		MEMCPYRET(data._Double);
-	}
-	else if (type == TYPE_STRING)
+	if (type == TYPE_STRING)
 	{
-		size_t len = data._String->size();
-		memcpy(buffer, data._String->c_str(), len);
+		size_t len = stringSize();
+		memcpy(buffer, stringData(), len);
 		return len;
 	}
-	else if (type == TYPE_BOOL)
-	{
-		MEMCPYRET(data._Bool);
-	}
-	else if (type == TYPE_NONE)
-	{
-		return 0;
-	}
-	throw std::runtime_error("This is serious: Type not handled in copyToBuffer()!");
-};
+	// all other types are stored at the beginning of the union
+	size_t len = getSize();
+	memcpy(buffer, &data, len);
+	return len;
+}
 
 size_t Variant::getSize() const
 {
@@ -943,8 +934,7 @@ size_t Variant::getSize() const
 	}
 	else if (type == TYPE_STRING)
 	{
-		size_t len = strlen(data._String->c_str()+1);
-		return len;
+		return stringSize();
 	}
 	else if (type == TYPE_BOOL)
 	{
@@ -0,0 +1,125 @@
+#include "radiopropa/module/BatchModule.h"
+
+namespace radiopropa {
+
+CandidateBlock::CandidateBlock() :
+		storage(new Storage()) {
+}
+
+void CandidateBlock::load(const std::vector<Candidate *> &candidates) {
+	// the arrays are still viewed from a previous block (e.g. by a NumPy view kept in Python)
+	if (storage->getReferenceCount() > 1)
+		storage = new Storage();
+
+	std::vector<double> &positions = storage->positions;
+	std::vector<double> &directions = storage->directions;
+	std::vector<double> &amplitudes = storage->amplitudes;
+	std::vector<double> &stepSizes = storage->stepSizes;
+	std::vector<unsigned char> &active = storage->active;
+	size_t n = candidates.size();
+	positions.resize(3 * n);
+	directions.resize(3 * n);
+	amplitudes.resize(n);
+	stepSizes.resize(n);
+	active.resize(n);
+
+	for (size_t i = 0; i < n; i++) {
+		const Candidate *c = candidates[i];
+		const Vector3d &x = c->current.getPosition();
+		const Vector3d &u = c->current.getDirection();
+		positions[3 * i] = x.x;
+		positions[3 * i + 1] = x.y;
+		positions[3 * i + 2] = x.z;
+		directions[3 * i] = u.x;
+		directions[3 * i + 1] = u.y;
+		directions[3 * i + 2] = u.z;
+		amplitudes[i] = c->current.getAmplitude();
+		stepSizes[i] = c->getCurrentStep();
+		active[i] = c->isActive();
+	}
+}
+
+void CandidateBlock::store(const std::vector<Candidate *> &candidates) const {
+	const std::vector<double> &directions = storage->directions;
+	const std::vector<double> &amplitudes = storage->amplitudes;
+	const std::vector<unsigned char> &active = storage->active;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		Candidate *c = candidates[i];
+		c->current.setDirection(Vector3d(directions[3 * i],
+				directions[3 * i + 1], directions[3 * i + 2]));
+		c->current.setAmplitude(amplitudes[i]);
+		if (!active[i])
+			c->setActive(false);
+	}
+}
+
+size_t CandidateBlock::size() const {
+	return storage->amplitudes.size();
+}
+
+double *CandidateBlock::getPositions() {
+	return storage->positions.empty() ? 0 : &storage->positions[0];
+}
+
+double *CandidateBlock::getDirections() {
+	return storage->directions.empty() ? 0 : &storage->directions[0];
+}
+
+double *CandidateBlock::getAmplitudes() {
+	return storage->amplitudes.empty() ? 0 : &storage->amplitudes[0];
+}
+
+double *CandidateBlock::getStepSizes() {
+	return storage->stepSizes.empty() ? 0 : &storage->stepSizes[0];
+}
+
+unsigned char *CandidateBlock::getActive() {
+	return storage->active.empty() ? 0 : &storage->active[0];
+}
+
+const Referenced *CandidateBlock::getStorage() const {
+	return storage;
+}
+
+namespace {
+
+// block of the thread, reused from step to step, 0 while it is in use
+CandidateBlock *freeBlock = 0;
+#pragma omp threadprivate(freeBlock)
+
+// takes the block of the thread, nested calls (a processBlock running another BatchModule) get their own
+class ThreadBlock {
+	CandidateBlock *block;
+public:
+	ThreadBlock() :
+			block(freeBlock ? freeBlock : new CandidateBlock()) {
+		freeBlock = 0;
+	}
+	~ThreadBlock() {
+		if (freeBlock)
+			delete block;
+		else
+			freeBlock = block;
+	}
+	CandidateBlock &get() {
+		return *block;
+	}
+};
+
+} // namespace
+
+void BatchModule::process(Candidate *candidate) const {
+	processBatch(std::vector<Candidate *>(1, candidate));
+}
+
+void BatchModule::processBatch(const std::vector<Candidate *> &candidates) const {
+	if (candidates.empty())
+		return;
+	ThreadBlock threadBlock;
+	CandidateBlock &block = threadBlock.get();
+	block.load(candidates);
+	processBlock(block);
+	block.store(candidates);
+}
+
+} // namespace radiopropa
@@ -1,10 +1,80 @@
 #include "radiopropa/module/Boundary.h"
+#include "radiopropa/Common.h"
 #include "radiopropa/Units.h"
 
+#include <algorithm>
+#include <cmath>
 #include <sstream>
 
 namespace radiopropa {
 
+namespace {
+
+// Signed distances to the boundaries, negative inside
+
+class CubeDistance {
+	Vector3d origin;
+	double size;
+public:
+	CubeDistance(const Vector3d &origin, double size) :
+			origin(origin), size(size) {
+	}
+	double operator()(const Vector3d &position) const {
+		Vector3d r = position - origin;
+		return std::max(-r.min(), r.max() - size);
+	}
+};
+
+class SphereDistance {
+	Vector3d center;
+	double radius;
+public:
+	SphereDistance(const Vector3d &center, double radius) :
+			center(center), radius(radius) {
+	}
+	double operator()(const Vector3d &position) const {
+		return (position - center).getR() - radius;
+	}
+};
+
+class EllipsoidDistance {
+	Vector3d focalPoint1, focalPoint2;
+	double majorAxis;
+public:
+	EllipsoidDistance(const Vector3d &f1, const Vector3d &f2, double a) :
+			focalPoint1(f1), focalPoint2(f2), majorAxis(a) {
+	}
+	double operator()(const Vector3d &position) const {
+		return position.getDistanceTo(focalPoint1)
+				+ position.getDistanceTo(focalPoint2) - majorAxis;
+	}
+};
+
+class CylinderDistance {
+	Vector3d origin;
+	double height, radius;
+public:
+	CylinderDistance(const Vector3d &origin, double height, double radius) :
+			origin(origin), height(height), radius(radius) {
+	}
+	double operator()(const Vector3d &position) const {
+		Vector3d d = position - origin;
+		return std::max(sqrt(d.x * d.x + d.y * d.y) - radius,
+				fabs(d.z) - height / 2.);
+	}
+};
+
+// Move a candidate that just left the boundary back to the interpolated crossing
+template<typename Distance>
+void truncateAtExit(Candidate *c, const Distance &distance) {
+	double fPrevious = distance(c->previous.getPosition());
+	double fCurrent = distance(c->current.getPosition());
+	if ((fPrevious < 0) && (fCurrent >= 0))
+		c->truncateStep(c->locateCrossing(distance, fPrevious, fCurrent));
+}
+
+} // namespace
+
 PeriodicBox::PeriodicBox() :
 		origin(Vector3d(0, 0, 0)), size(Vector3d(0, 0, 0)) {
 }
@@ -109,12 +179,50 @@ std::string ReflectiveBox::getDescription() const {
 	return s.str();
 }
 
+// ReflectiveSurface ----------------------------------------------------------
+ReflectiveSurface::ReflectiveSurface(ref_ptr<Surface> surface) :
+		surface(surface) {
+}
+
+void ReflectiveSurface::process(Candidate *c) const {
+	Vector3d a = c->previous.getPosition();
+	Vector3d b = c->current.getPosition();
+	double length = (b - a).getR();
+	if (length <= surfaceEpsilon)
+		return;
+
+	Vector3d start = a + (b - a) * (surfaceEpsilon / length);
+	double t;
+	Vector3d normal;
+	size_t element;
+	if (!surface->intersect(start, b, t, normal, element))
+		return;
+
+	Vector3d position = start + (b - start) * t;
+	c->truncateStep((position - a).getR() / length);
+	c->current.setPosition(position);
+	Vector3d direction = c->current.getDirection();
+	c->current.setDirection(direction - normal * (2 * direction.dot(normal)));
+}
+
+void ReflectiveSurface::setSurface(ref_ptr<Surface> s) {
+	surface = s;
+}
+
+ref_ptr<Surface> ReflectiveSurface::getSurface() const {
+	return surface;
+}
+
+std::string ReflectiveSurface::getDescription() const {
+	return "ReflectiveSurface, " + surface->getDescription();
+}
+
 CubicBoundary::CubicBoundary() :
-		origin(Vector3d(0, 0, 0)), size(0), limitStep(true), margin(0.1 * kpc) {
+		origin(Vector3d(0, 0, 0)), size(0), limitStep(false), margin(0.1 * kpc) {
 }
 
 CubicBoundary::CubicBoundary(Vector3d o, double s) :
-		origin(o), size(s), limitStep(true), margin(0.1 * kpc) {
+		origin(o), size(s), limitStep(false), margin(0.1 * kpc) {
 }
 
 void CubicBoundary::process(Candidate *c) const {
@@ -122,6 +230,7 @@ void CubicBoundary::process(Candidate *c) const {
 	double lo = r.min();
 	double hi = r.max();
 	if ((lo <= 0) or (hi >= size)) {
+		truncateAtExit(c, CubeDistance(origin, size));
 		reject(c);
 	}
 	if (limitStep) {
@@ -143,6 +252,10 @@ void CubicBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
 
+void CubicBoundary::addToScene(Scene &scene) const {
+	scene.addBox(origin, Vector3d(size));
+}
+
 std::string CubicBoundary::getDescription() const {
 	std::stringstream s;
 	s << "Cubic Boundary: origin " << origin / Mpc << " Mpc, ";
@@ -155,16 +268,17 @@ std::string CubicBoundary::getDescription() const {
 }
 
 SphericalBoundary::SphericalBoundary() :
-		center(Vector3d(0, 0, 0)), radius(0), limitStep(true), margin(0.1 * kpc) {
+		center(Vector3d(0, 0, 0)), radius(0), limitStep(false), margin(0.1 * kpc) {
 }
 
 SphericalBoundary::SphericalBoundary(Vector3d c, double r) :
-		center(c), radius(r), limitStep(true), margin(0.1 * kpc) {
+		center(c), radius(r), limitStep(false), margin(0.1 * kpc) {
 }
 
 void SphericalBoundary::process(Candidate *c) const {
 	double d = (c->current.getPosition() - center).getR();
 	if (d >= radius) {
+		truncateAtExit(c, SphereDistance(center, radius));
 		reject(c);
 	}
 	if (limitStep)
@@ -184,6 +298,10 @@ void SphericalBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
 
+void SphericalBoundary::addToScene(Scene &scene) const {
+	scene.addSphere(center, radius);
+}
+
 std::string SphericalBoundary::getDescription() const {
 	std::stringstream s;
 	s << "Spherical Boundary: radius " << radius / Mpc << " Mpc, ";
@@ -197,11 +315,11 @@ std::string SphericalBoundary::getDescription() const {
 
 EllipsoidalBoundary::EllipsoidalBoundary() :
 		focalPoint1(Vector3d(0, 0, 0)), focalPoint2(Vector3d(0, 0, 0)),
-		majorAxis(0), limitStep(true), margin(0.1 * kpc) {
+		majorAxis(0), limitStep(false), margin(0.1 * kpc) {
 }
 
 EllipsoidalBoundary::EllipsoidalBoundary(Vector3d f1, Vector3d f2, double a) :
-		focalPoint1(f1), focalPoint2(f2), majorAxis(a), limitStep(true),
+		focalPoint1(f1), focalPoint2(f2), majorAxis(a), limitStep(false),
 		margin(0.1 * kpc) {
 }
 
@@ -209,6 +327,7 @@ void EllipsoidalBoundary::process(Candidate *c) const {
 	Vector3d pos = c->current.getPosition();
 	double d = pos.getDistanceTo(focalPoint1) + pos.getDistanceTo(focalPoint2);
 	if (d >= majorAxis) {
+		truncateAtExit(c, EllipsoidDistance(focalPoint1, focalPoint2, majorAxis));
 		reject(c);
 	}
 	if (limitStep)
@@ -229,6 +348,10 @@ void EllipsoidalBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
 
+void EllipsoidalBoundary::addToScene(Scene &scene) const {
+	scene.addEllipsoid(focalPoint1, focalPoint2, majorAxis);
+}
+
 std::string EllipsoidalBoundary::getDescription() const {
 	std::stringstream s;
 	s << "Ellipsoidal Boundary: F1 = " << focalPoint1 / Mpc << " Mpc, ";
@@ -259,6 +382,7 @@ void CylindricalBoundary::process(Candidate *c) const {
 	  }
 	  return;
 	}
+	truncateAtExit(c, CylinderDistance(origin, height, radius));
 	reject(c);
 }
 
@@ -278,6 +402,10 @@ void CylindricalBoundary::setMargin(double m) {
         margin = m;
 }
 
+void CylindricalBoundary::addToScene(Scene &scene) const {
+	scene.addCylinder(origin, height, radius);
+}
+
 
 std::string CylindricalBoundary::getDescription() const {
 	std::stringstream s;
@@ -291,4 +419,38 @@ std::string CylindricalBoundary::getDescription() const {
 	return s.str();
 }
 
+// SceneStepLimiter -----------------------------------------------------------
+SceneStepLimiter::SceneStepLimiter(ref_ptr<Scene> scene, double margin) :
+		scene(scene), margin(margin) {
+	scene->build();
+}
+
+void SceneStepLimiter::process(Candidate *c) const {
+	c->limitNextStep(scene->distance(c->current.getPosition()) + margin);
+}
+
+void SceneStepLimiter::setScene(ref_ptr<Scene> s) {
+	scene = s;
+	scene->build();
+}
+
+void SceneStepLimiter::setMargin(double m) {
+	margin = m;
+}
+
+ref_ptr<Scene> SceneStepLimiter::getScene() const {
+	return scene;
+}
+
+double SceneStepLimiter::getMargin() const {
+	return margin;
+}
+
+std::string SceneStepLimiter::getDescription() const {
+	std::stringstream s;
+	s << "SceneStepLimiter: " << scene->getDescription() << ", ";
+	s << "margin = " << margin / meter << " m";
+	return s.str();
+}
+
 } // namespace radiopropa
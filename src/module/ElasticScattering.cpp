@@ -102,7 +102,7 @@ void ElasticScattering::process(Candidate *candidate) const {
 		rate *= pow(1 + z, 2) * photonFieldScaling(photonField, z);  // cosmological scaling
 
 		// check for interaction
-		Random &random = Random::instance();
+		RandomStream &random = RandomStream::instance();
 		double randDist = -log(random.rand()) / rate;
 		if (step < randDist)
 			return;
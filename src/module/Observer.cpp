@@ -1,15 +1,20 @@
 #include "radiopropa/module/Observer.h"
+#include "radiopropa/Common.h"
 #include "radiopropa/Units.h"
 #include "radiopropa/ParticleID.h"
 #include "radiopropa/Cosmology.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 
 namespace radiopropa {
 
 // Observer -------------------------------------------------------------------
 Observer::Observer() :
-		makeInactive(true), clone(false) {
+		flagProperty(propertyKey("")), clone(false), makeInactive(true) {
 }
 
 void Observer::add(ObserverFeature *feature) {
@@ -24,15 +29,24 @@ void Observer::onDetection(Module *action, bool clone_) {
 void Observer::process(Candidate *candidate) const {
 	// loop over all features and have them check the particle
 	DetectionState state = NOTHING;
+	double fraction = 1;
 	for (int i = 0; i < features.size(); i++) {
-		DetectionState s = features[i]->checkDetection(candidate);
+		double f = 1;
+		DetectionState s = features[i]->checkCrossing(candidate, f);
 		if (s == VETO)
 			state = VETO;
-		else if ((s == DETECTED) && (state != VETO))
-			state = DETECTED;
+		else if (s == DETECTED) {
+			if (state != VETO)
+				state = DETECTED;
+			fraction = std::min(fraction, f);
+		}
 	}
 
 	if (state == DETECTED) {
+		// report the detection at the earliest crossing within the step
+		if (fraction < 1)
+			candidate->truncateStep(fraction);
+
 		for (int i = 0; i < features.size(); i++) {
 			features[i]->onDetection(candidate);
 		}
@@ -45,7 +59,7 @@ void Observer::process(Candidate *candidate) const {
 		}
 
 		if (!flagKey.empty())
-			candidate->setProperty(flagKey, flagValue);
+			candidate->setProperty(flagProperty, flagValue);
 
 		if (makeInactive)
 			candidate->setActive(false);
@@ -54,6 +68,7 @@ void Observer::process(Candidate *candidate) const {
 
 void Observer::setFlag(std::string key, std::string value) {
 	flagKey = key;
+	flagProperty = propertyKey(key);
 	flagValue = value;
 }
 
@@ -70,18 +85,39 @@ std::string Observer::getDescription() const {
 	return ss.str();
 }
 
+bool Observer::usesPythonObjects() const {
+	for (size_t i = 0; i < features.size(); i++)
+		if (isPythonObject(features[i]))
+			return true;
+	return isPythonModule(detectionAction);
+}
+
 void Observer::setDeactivateOnDetection(bool deactivate) {
 	makeInactive = deactivate;
 }
 
+void Observer::addToScene(Scene &scene) const {
+	for (size_t i = 0; i < features.size(); i++)
+		features[i]->addToScene(scene);
+}
+
 // ObserverFeature ------------------------------------------------------------
 DetectionState ObserverFeature::checkDetection(Candidate *candidate) const {
 	return NOTHING;
 }
 
+DetectionState ObserverFeature::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
+	return checkDetection(candidate);
+}
+
 void ObserverFeature::onDetection(Candidate *candidate) const {
 }
 
+void ObserverFeature::addToScene(Scene &/*scene*/) const {
+}
+
 std::string ObserverFeature::getDescription() const {
 	return description;
 }
@@ -95,30 +131,108 @@ std::string ObserverDetectAll::getDescription() const {
 	return description;
 }
 
+// Parameter ti in [0, t] of the entry of the segment a + ti * d into a sphere, for segments starting outside of it
+static bool sphereEntry(const Vector3d &a, const Vector3d &d,
+		const Vector3d &center, double radius, double &t) {
+	Vector3d m = a - center;
+	double dd = d.getR2();
+	if ((dd == 0) || (m.getR() <= radius + surfaceEpsilon))
+		return false;
+	double b = m.dot(d);
+	double discriminant = b * b - dd * (m.getR2() - radius * radius);
+	if (discriminant < 0)
+		return false;
+	double ti = (-b - sqrt(discriminant)) / dd;
+	if ((ti < 0) || (ti > t))
+		return false;
+	t = ti;
+	return true;
+}
+
+namespace {
+
+// Distance of a position to a sphere surface, negative inside
+class SphereDistance {
+	Vector3d center;
+	double radius;
+public:
+	SphereDistance(const Vector3d &center, double radius) :
+			center(center), radius(radius) {
+	}
+	double operator()(const Vector3d &position) const {
+		return (position - center).getR() - radius;
+	}
+};
+
+// x coordinate of a position
+class XCoordinate {
+public:
+	double operator()(const Vector3d &position) const {
+		return position.x;
+	}
+};
+
+// orders receivers by one coordinate
+class PositionLess {
+	const std::vector<Vector3d> &positions;
+	int axis;
+public:
+	PositionLess(const std::vector<Vector3d> &positions, int axis) :
+			positions(positions), axis(axis) {
+	}
+	bool operator()(unsigned int a, unsigned int b) const {
+		return positions[a].getComponent(axis) < positions[b].getComponent(axis);
+	}
+};
+
+// signed distance of a position to an observer plane
+class PlaneDistance {
+	const ObserverPlane &plane;
+public:
+	PlaneDistance(const ObserverPlane &plane) :
+			plane(plane) {
+	}
+	double operator()(const Vector3d &position) const {
+		return plane.distance(position);
+	}
+};
+
+} // namespace
+
 // ObserverSmallSphere --------------------------------------------------------
 ObserverSmallSphere::ObserverSmallSphere(Vector3d center, double radius) :
 		center(center), radius(radius) {
 }
 
 DetectionState ObserverSmallSphere::checkDetection(Candidate *candidate) const {
-	// current distance to observer sphere center
-	double d = (candidate->current.getPosition() - center).getR();
-
-	// conservatively limit next step to prevent overshooting
-	candidate->limitNextStep(sqrt(fabs(d*d - radius*radius)));
-
-	// no detection if outside of observer sphere
-	if (d > radius)
-		return NOTHING;
+	double fraction;
+	return checkCrossing(candidate, fraction);
+}
 
-	// previous distance to observer sphere center
-	double dprev = (candidate->previous.getPosition() - center).getR();
+DetectionState ObserverSmallSphere::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
+	const Vector3d &a = candidate->previous.getPosition();
+	const Vector3d &b = candidate->current.getPosition();
 
 	// if particle was inside of sphere in previous step it has already been detected
+	double dprev = (a - center).getR();
 	if (dprev <= radius)
 		return NOTHING;
 
-	// else detection
+	// steps ending inside are detected at the interpolated crossing of the sphere surface
+	double d = (b - center).getR();
+	if (d <= radius) {
+		SphereDistance f(center, radius);
+		fraction = candidate->locateCrossing(f, dprev - radius, d - radius);
+		return DETECTED;
+	}
+
+	// steps passing through the sphere are detected at the entry of the segment
+	double t = 1;
+	if (!sphereEntry(a, b - a, center, radius, t))
+		return NOTHING;
+	fraction = t;
 	return DETECTED;
 }
 
@@ -130,6 +244,10 @@ void ObserverSmallSphere::setRadius(float radius) {
 	this->radius = radius;
 }
 
+void ObserverSmallSphere::addToScene(Scene &scene) const {
+	scene.addSphere(center, radius);
+}
+
 std::string ObserverSmallSphere::getDescription() const {
 	std::stringstream ss;
 	ss << "ObserverSmallSphere: ";
@@ -147,21 +265,34 @@ ObserverTracking::ObserverTracking(Vector3d center, double radius, double stepSi
 }
 
 DetectionState ObserverTracking::checkDetection(Candidate *candidate) const {
-	// current distance to observer sphere center
-	double d = (candidate->current.getPosition() - center).getR();
+	double fraction;
+	return checkCrossing(candidate, fraction);
+}
+
+DetectionState ObserverTracking::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
+	const Vector3d &a = candidate->previous.getPosition();
+	const Vector3d &b = candidate->current.getPosition();
+	double d = (b - center).getR();
+	double dprev = (a - center).getR();
 
-	// no detection if outside of observer sphere
 	if (d > radius) {
-		// conservatively limit next step to prevent overshooting
-		candidate->limitNextStep(fabs(d - radius));
+		// steps passing through the sphere start tracking at the entry of the segment
+		double t = 1;
+		if (!sphereEntry(a, b - a, center, radius, t))
+			return NOTHING;
+		fraction = t;
+	} else if (dprev > radius) {
+		// start tracking at the interpolated crossing of the sphere surface
+		SphereDistance f(center, radius);
+		fraction = candidate->locateCrossing(f, dprev - radius, d - radius);
+	}
 
-		return NOTHING;
-	} else {
-		// limit next step
-		candidate->limitNextStep(stepSize);
+	// limit next step
+	candidate->limitNextStep(stepSize);
 
-		return DETECTED;
-	}
+	return DETECTED;
 }
 
 std::string ObserverTracking::getDescription() const {
@@ -179,12 +310,16 @@ ObserverLargeSphere::ObserverLargeSphere(Vector3d center, double radius) :
 }
 
 DetectionState ObserverLargeSphere::checkDetection(Candidate *candidate) const {
+	double fraction;
+	return checkCrossing(candidate, fraction);
+}
+
+DetectionState ObserverLargeSphere::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
 	// current distance to observer sphere center
 	double d = (candidate->current.getPosition() - center).getR();
 
-	// conservatively limit next step size to prevent overshooting
-	candidate->limitNextStep(fabs(radius - d));
-
 	// no detection if inside observer sphere
 	if (d < radius)
 		return NOTHING;
@@ -196,10 +331,16 @@ DetectionState ObserverLargeSphere::checkDetection(Candidate *candidate) const {
 	if (dprev >= radius)
 		return NOTHING;
 
-	// else: detection
+	// else: detection at the interpolated crossing of the sphere surface
+	SphereDistance f(center, radius);
+	fraction = candidate->locateCrossing(f, dprev - radius, d - radius);
 	return DETECTED;
 }
 
+void ObserverLargeSphere::addToScene(Scene &scene) const {
+	scene.addSphere(center, radius);
+}
+
 std::string ObserverLargeSphere::getDescription() const {
 	std::stringstream ss;
 	ss << "ObserverLargeSphere: ";
@@ -210,11 +351,21 @@ std::string ObserverLargeSphere::getDescription() const {
 
 // ObserverPoint --------------------------------------------------------------
 DetectionState ObserverPoint::checkDetection(Candidate *candidate) const {
+	double fraction;
+	return checkCrossing(candidate, fraction);
+}
+
+DetectionState ObserverPoint::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
 	double x = candidate->current.getPosition().x;
-	if (x > 0) {
-		candidate->limitNextStep(x);
+	if (x > 0)
 		return NOTHING;
-	}
+
+	// detection at the interpolated crossing of x = 0
+	double xprev = candidate->previous.getPosition().x;
+	if (xprev > 0)
+		fraction = candidate->locateCrossing(XCoordinate(), xprev, x);
 	return DETECTED;
 }
 
@@ -222,6 +373,372 @@ std::string ObserverPoint::getDescription() const {
 	return "ObserverPoint: observer at x = 0";
 }
 
+// ObserverSurface ------------------------------------------------------------
+ObserverSurface::ObserverSurface(ref_ptr<Surface> surface) :
+		surface(surface) {
+}
+
+DetectionState ObserverSurface::checkDetection(Candidate *candidate) const {
+	double fraction;
+	return checkCrossing(candidate, fraction);
+}
+
+DetectionState ObserverSurface::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
+	Vector3d a = candidate->previous.getPosition();
+	Vector3d b = candidate->current.getPosition();
+	double length = (b - a).getR();
+	if (length <= surfaceEpsilon)
+		return NOTHING;
+
+	// skip the start of a step that begins on the surface after a previous detection
+	Vector3d start = a + (b - a) * (surfaceEpsilon / length);
+	double t;
+	Vector3d normal;
+	size_t element;
+	if (!surface->intersect(start, b, t, normal, element))
+		return NOTHING;
+
+	// detection at the intersection with the surface
+	Vector3d position = start + (b - start) * t;
+	fraction = (position - a).getR() / length;
+	return DETECTED;
+}
+
+std::string ObserverSurface::getDescription() const {
+	return "ObserverSurface, " + surface->getDescription();
+}
+
+// ObserverPlane --------------------------------------------------------------
+ObserverPlane::ObserverPlane(Vector3d origin, Vector3d normal) :
+		origin(origin), limitStep(false), minimumStep(1e-3 * meter) {
+	if (normal.getR() == 0)
+		throw std::runtime_error("ObserverPlane: normal vector is zero");
+	this->normal = normal.getUnitVector();
+}
+
+bool ObserverPlane::contains(const Vector3d &/*position*/) const {
+	return true;
+}
+
+double ObserverPlane::distance(const Vector3d &position) const {
+	return (position - origin).dot(normal);
+}
+
+double ObserverPlane::distanceToArea(const Vector3d &position) const {
+	return fabs(distance(position));
+}
+
+DetectionState ObserverPlane::checkDetection(Candidate *candidate) const {
+	double fraction;
+	return checkCrossing(candidate, fraction);
+}
+
+DetectionState ObserverPlane::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
+	DetectionState state = NOTHING;
+	Vector3d position = candidate->current.getPosition();
+	double d = distance(position);
+	double dPrevious = distance(candidate->previous.getPosition());
+
+	// crossing, unless the step started on the plane after a previous detection
+	if ((fabs(dPrevious) > surfaceEpsilon) && (((d < 0) != (dPrevious < 0)) || (d == 0))) {
+		double t = candidate->locateCrossing(PlaneDistance(*this), dPrevious, d);
+		Vector3d crossing = candidate->getInterpolatedPosition(t);
+		if (contains(crossing - normal * distance(crossing))) {
+			fraction = t;
+			position = crossing;
+			state = DETECTED;
+		}
+	}
+
+	// limit the step from the position the candidate continues from
+	if (limitStep)
+		candidate->limitNextStep(std::max(distanceToArea(position), minimumStep));
+	return state;
+}
+
+void ObserverPlane::setStepLimiting(bool limit, double minimum) {
+	limitStep = limit;
+	minimumStep = minimum;
+}
+
+void ObserverPlane::addToScene(Scene &scene) const {
+	scene.addPlane(origin, normal);
+}
+
+Vector3d ObserverPlane::getOrigin() const {
+	return origin;
+}
+
+Vector3d ObserverPlane::getNormal() const {
+	return normal;
+}
+
+std::string ObserverPlane::getDescription() const {
+	std::stringstream ss;
+	ss << "ObserverPlane: origin = " << origin / meter << " m, ";
+	ss << "normal = " << normal;
+	return ss.str();
+}
+
+// ObserverRectangle ----------------------------------------------------------
+ObserverRectangle::ObserverRectangle(Vector3d corner, Vector3d u, Vector3d v) :
+		ObserverPlane(corner, u.cross(v)), u(u), v(v) {
+	if (fabs(u.dot(v)) > 1e-9 * u.getR() * v.getR())
+		throw std::runtime_error("ObserverRectangle: edges are not perpendicular");
+}
+
+bool ObserverRectangle::contains(const Vector3d &position) const {
+	Vector3d r = position - origin;
+	double a = r.dot(u), b = r.dot(v);
+	return (a >= 0) && (a <= u.getR2()) && (b >= 0) && (b <= v.getR2());
+}
+
+double ObserverRectangle::distanceToArea(const Vector3d &position) const {
+	// distances to the plane and outside of the edges in the plane
+	Vector3d r = position - origin;
+	double a = r.dot(u) / u.getR(), b = r.dot(v) / v.getR();
+	double da = std::max(std::max(-a, a - u.getR()), 0.);
+	double db = std::max(std::max(-b, b - v.getR()), 0.);
+	double dn = distance(position);
+	return sqrt(dn * dn + da * da + db * db);
+}
+
+void ObserverRectangle::addToScene(Scene &scene) const {
+	scene.addRectangle(origin, u, v);
+}
+
+std::string ObserverRectangle::getDescription() const {
+	std::stringstream ss;
+	ss << "ObserverRectangle: corner = " << origin / meter << " m, ";
+	ss << "u = " << u / meter << " m, ";
+	ss << "v = " << v / meter << " m";
+	return ss.str();
+}
+
+// ObserverDisc ---------------------------------------------------------------
+ObserverDisc::ObserverDisc(Vector3d center, Vector3d normal, double radius) :
+		ObserverPlane(center, normal), radius(radius) {
+}
+
+bool ObserverDisc::contains(const Vector3d &position) const {
+	return (position - origin).getR2() <= radius * radius;
+}
+
+double ObserverDisc::distanceToArea(const Vector3d &position) const {
+	// distances to the plane and outside of the rim in the plane
+	double dn = distance(position);
+	double rho = sqrt(std::max((position - origin).getR2() - dn * dn, 0.));
+	double dr = std::max(rho - radius, 0.);
+	return sqrt(dn * dn + dr * dr);
+}
+
+void ObserverDisc::addToScene(Scene &scene) const {
+	scene.addDisc(origin, normal, radius);
+}
+
+std::string ObserverDisc::getDescription() const {
+	std::stringstream ss;
+	ss << "ObserverDisc: center = " << origin / meter << " m, ";
+	ss << "normal = " << normal << ", ";
+	ss << "radius = " << radius / meter << " m";
+	return ss.str();
+}
+
+// ObserverReceiverArray ------------------------------------------------------
+ObserverReceiverArray::ObserverReceiverArray(
+		const std::vector<Vector3d> &positions, double radius) :
+		positions(positions), radius(radius), limitStep(false),
+		minimumStep(1e-3 * meter) {
+	if (positions.empty())
+		throw std::runtime_error("ObserverReceiverArray: no receivers");
+	if (radius <= 0)
+		throw std::runtime_error("ObserverReceiverArray: radius <= 0");
+
+	std::vector<unsigned int> order(positions.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	axes.resize(positions.size());
+	build(order, 0, order.size());
+
+	tree.resize(positions.size());
+	ids.resize(positions.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		tree[i] = positions[order[i]];
+		ids[i] = order[i];
+	}
+}
+
+void ObserverReceiverArray::build(std::vector<unsigned int> &order,
+		size_t begin, size_t end) {
+	if (end - begin < 2)
+		return;
+
+	// split at the median along the axis of the largest extent
+	Vector3d lower = positions[order[begin]], upper = lower;
+	for (size_t i = begin + 1; i < end; i++) {
+		const Vector3d &p = positions[order[i]];
+		lower = Vector3d(std::min(lower.x, p.x), std::min(lower.y, p.y), std::min(lower.z, p.z));
+		upper = Vector3d(std::max(upper.x, p.x), std::max(upper.y, p.y), std::max(upper.z, p.z));
+	}
+	Vector3d extent = upper - lower;
+	int axis = 0;
+	if (extent.y > extent.x)
+		axis = 1;
+	if (extent.z > extent.getComponent(axis))
+		axis = 2;
+
+	size_t mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid,
+			order.begin() + end, PositionLess(positions, axis));
+	axes[mid] = axis;
+	build(order, begin, mid);
+	build(order, mid + 1, end);
+}
+
+void ObserverReceiverArray::findEntry(size_t begin, size_t end,
+		const Vector3d &a, const Vector3d &d, const Vector3d &lower,
+		const Vector3d &upper, double &t, size_t &receiver) const {
+	if (begin >= end)
+		return;
+	size_t mid = (begin + end) / 2;
+
+	// entry into the sphere, for segments starting outside of it
+	if (sphereEntry(a, d, tree[mid], radius, t))
+		receiver = mid;
+
+	// the left subtree lies below, the right one above the receiver along the axis
+	if (end - begin < 2)
+		return;
+	int axis = axes[mid];
+	double split = tree[mid].getComponent(axis);
+	if (lower.getComponent(axis) - radius <= split)
+		findEntry(begin, mid, a, d, lower, upper, t, receiver);
+	if (upper.getComponent(axis) + radius >= split)
+		findEntry(mid + 1, end, a, d, lower, upper, t, receiver);
+}
+
+void ObserverReceiverArray::findNearest(size_t begin, size_t end,
+		const Vector3d &position, double exclude, double &distance2,
+		size_t &receiver) const {
+	if (begin >= end)
+		return;
+	size_t mid = (begin + end) / 2;
+
+	// receivers closer than exclude are ignored
+	double r2 = (position - tree[mid]).getR2();
+	if ((r2 < distance2) && (sqrt(r2) > exclude)) {
+		distance2 = r2;
+		receiver = mid;
+	}
+
+	if (end - begin < 2)
+		return;
+	int axis = axes[mid];
+	double delta = position.getComponent(axis) - tree[mid].getComponent(axis);
+	size_t nearBegin = begin, nearEnd = mid, farBegin = mid + 1, farEnd = end;
+	if (delta > 0) {
+		std::swap(nearBegin, farBegin);
+		std::swap(nearEnd, farEnd);
+	}
+	findNearest(nearBegin, nearEnd, position, exclude, distance2, receiver);
+	if (delta * delta < distance2)
+		findNearest(farBegin, farEnd, position, exclude, distance2, receiver);
+}
+
+DetectionState ObserverReceiverArray::checkDetection(Candidate *candidate) const {
+	double fraction;
+	return checkCrossing(candidate, fraction);
+}
+
+DetectionState ObserverReceiverArray::checkCrossing(Candidate *candidate,
+		double &fraction) const {
+	fraction = 1;
+	DetectionState state = NOTHING;
+	Vector3d a = candidate->previous.getPosition();
+	Vector3d b = candidate->current.getPosition();
+	Vector3d position = b;
+
+	if (!(a == b)) {
+		Vector3d lower(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+		Vector3d upper(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+		double t = 1;
+		size_t receiver = tree.size();
+		findEntry(0, tree.size(), a, b - a, lower, upper, t, receiver);
+
+		if (receiver < tree.size()) {
+			// on the interpolated trajectory if the step ends inside, else on the segment
+			const Vector3d &center = tree[receiver];
+			double d = (b - center).getR() - radius;
+			if (d < 0) {
+				SphereDistance f(center, radius);
+				t = candidate->locateCrossing(f, (a - center).getR() - radius, d);
+			}
+			fraction = t;
+			position = candidate->getInterpolatedPosition(t);
+			state = DETECTED;
+		}
+	}
+
+	// limit the step from the position the candidate continues from
+	if (limitStep)
+		candidate->limitNextStep(std::max(distanceToNearest(position), minimumStep));
+	return state;
+}
+
+void ObserverReceiverArray::onDetection(Candidate *candidate) const {
+	// the receiver whose sphere the detection was reported on, if any
+	const Vector3d &position = candidate->current.getPosition();
+	double distance2 = std::numeric_limits<double>::infinity();
+	size_t receiver = tree.size();
+	findNearest(0, tree.size(), position, -1, distance2, receiver);
+	double tolerance = surfaceEpsilon + 1e-9 * candidate->getCurrentStep();
+	if ((receiver < tree.size()) && (fabs(sqrt(distance2) - radius) <= tolerance)) {
+		static const PropertyKey receiverIndex = propertyKey("ReceiverIndex");
+		candidate->setProperty(receiverIndex, Variant::fromUInt64(ids[receiver]));
+	}
+}
+
+double ObserverReceiverArray::distanceToNearest(const Vector3d &position) const {
+	double distance2 = std::numeric_limits<double>::infinity();
+	size_t receiver = tree.size();
+	// receivers whose sphere contains the position are ignored
+	findNearest(0, tree.size(), position, radius + surfaceEpsilon, distance2,
+			receiver);
+	return sqrt(distance2) - radius;
+}
+
+void ObserverReceiverArray::setStepLimiting(bool limit, double minimum) {
+	limitStep = limit;
+	minimumStep = minimum;
+}
+
+void ObserverReceiverArray::addToScene(Scene &scene) const {
+	for (size_t i = 0; i < positions.size(); i++)
+		scene.addSphere(positions[i], radius);
+}
+
+size_t ObserverReceiverArray::getNumberOfReceivers() const {
+	return positions.size();
+}
+
+Vector3d ObserverReceiverArray::getReceiver(size_t i) const {
+	return positions.at(i);
+}
+
+double ObserverReceiverArray::getRadius() const {
+	return radius;
+}
+
+std::string ObserverReceiverArray::getDescription() const {
+	std::stringstream ss;
+	ss << "ObserverReceiverArray: " << positions.size() << " receivers, ";
+	ss << "radius = " << radius / meter << " m";
+	return ss.str();
+}
 
 // ObserverInactiveVeto -------------------------------------------------------
 DetectionState ObserverInactiveVeto::checkDetection(Candidate *c) const {
@@ -295,7 +812,7 @@ DetectionState ObserverTimeEvolution::checkDetection(Candidate *c) const {
 		bool detected = false;
 		double length = c->getTrajectoryLength();
 		size_t index;
-		const std::string DI = "DetectionIndex";
+		static const PropertyKey DI = propertyKey("DetectionIndex");
 		std::string value;
 
 		// Load the last detection index
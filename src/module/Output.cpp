@@ -128,6 +128,7 @@ void Output::enableProperty(const std::string &property, const Variant &defaultV
 	modify();
 	Property prop;
 	prop.name = property;
+	prop.key = propertyKey(property);
 	prop.comment = comment;
 	prop.defaultValue = defaultValue;
 	properties.push_back(prop);
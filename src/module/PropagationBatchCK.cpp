@@ -0,0 +1,335 @@
+#include "radiopropa/module/PropagationBatchCK.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace radiopropa {
+
+// Cash-Karp coefficients
+static const double batch_ck_a[] = { 0., 0., 0., 0., 0., 0., 1. / 5., 0., 0.,
+		0., 0., 0., 3. / 40., 9. / 40., 0., 0., 0., 0., 3. / 10., -9. / 10.,
+		6. / 5., 0., 0., 0., -11. / 54., 5. / 2., -70. / 27., 35. / 27., 0.,
+		0., 1631. / 55296., 175. / 512., 575. / 13824., 44275. / 110592., 253.
+				/ 4096., 0. };
+
+static const double batch_ck_b[] = { 37. / 378., 0, 250. / 621., 125. / 594.,
+		0., 512. / 1771. };
+
+static const double batch_ck_bs[] = { 2825. / 27648., 0., 18575. / 48384.,
+		13525. / 55296., 277. / 14336., 1. / 4. };
+
+void PropagationBatchCK::Y::resize(size_t n) {
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+	ux.resize(n);
+	uy.resize(n);
+	uz.resize(n);
+}
+
+size_t PropagationBatchCK::Y::size() const {
+	return x.size();
+}
+
+std::vector<double> &PropagationBatchCK::Y::operator[](size_t i) {
+	switch (i) {
+	case 0: return x;
+	case 1: return y;
+	case 2: return z;
+	case 3: return ux;
+	case 4: return uy;
+	case 5: return uz;
+	}
+	throw std::out_of_range("PropagationBatchCK::Y: component index > 5");
+}
+
+const std::vector<double> &PropagationBatchCK::Y::operator[](size_t i) const {
+	return const_cast<Y &>(*this)[i];
+}
+
+void PropagationBatchCK::Workspace::resize(size_t count) {
+	for (size_t i = 0; i < 6; i++)
+		k[i].resize(count);
+	yn.resize(count);
+	n.resize(count);
+	gx.resize(count);
+	gy.resize(count);
+	gz.resize(count);
+}
+
+PropagationBatchCK::PropagationBatchCK(ref_ptr<ScalarField> field,
+		double tolerance, double minStep, double maxStep) :
+		minStep(0) {
+	setField(field);
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+}
+
+void PropagationBatchCK::dYdt(const Y &y, Y &dyds, size_t count,
+		Workspace &w) const {
+	// evaluate the field for all rays
+	field->getValuesAndGradients(count, &y.x[0], &y.y[0], &y.z[0], &w.n[0],
+			&w.gx[0], &w.gy[0], &w.gz[0]);
+
+	const double *ux = &y.ux[0], *uy = &y.uy[0], *uz = &y.uz[0];
+	const double *n = &w.n[0], *gx = &w.gx[0], *gy = &w.gy[0], *gz = &w.gz[0];
+	double *dx = &dyds.x[0], *dy = &dyds.y[0], *dz = &dyds.z[0];
+	double *dux = &dyds.ux[0], *duy = &dyds.uy[0], *duz = &dyds.uz[0];
+
+	// normalize direction vector to prevent numerical losses
+	for (size_t i = 0; i < count; i++) {
+		double invN = 1. / n[i];
+		double s = invN / std::sqrt(ux[i] * ux[i] + uy[i] * uy[i] + uz[i] * uz[i]);
+		dx[i] = ux[i] * s;
+		dy[i] = uy[i] * s;
+		dz[i] = uz[i] * s;
+		dux[i] = gx[i] * invN * invN;
+		duy[i] = gy[i] * invN * invN;
+		duz[i] = gz[i] * invN * invN;
+	}
+}
+
+void PropagationBatchCK::tryStep(const Y &y, Y &out, Y &error, const double *h,
+		size_t count, Workspace &w) const {
+	for (size_t c = 0; c < 6; c++) {
+		const double *y0 = &y[c][0];
+		double *o = &out[c][0], *e = &error[c][0];
+		for (size_t i = 0; i < count; i++) {
+			o[i] = y0[i];
+			e[i] = 0;
+		}
+	}
+
+	for (size_t s = 0; s < 6; s++) {
+		// intermediate phase-points y_n = y + h * sum_j a_sj * k_j
+		for (size_t c = 0; c < 6; c++) {
+			const double *y0 = &y[c][0];
+			double *yn = &w.yn[c][0];
+			for (size_t i = 0; i < count; i++)
+				yn[i] = y0[i];
+			for (size_t j = 0; j < s; j++) {
+				double a = batch_ck_a[s * 6 + j];
+				if (a == 0)
+					continue;
+				const double *kj = &w.k[j][c][0];
+				for (size_t i = 0; i < count; i++)
+					yn[i] += a * h[i] * kj[i];
+			}
+		}
+
+		// update k_s
+		dYdt(w.yn, w.k[s], count, w);
+
+		// accumulate the sum of b_s * k_s and the error estimate
+		double b = batch_ck_b[s];
+		double db = batch_ck_b[s] - batch_ck_bs[s];
+		for (size_t c = 0; c < 6; c++) {
+			const double *ks = &w.k[s][c][0];
+			double *o = &out[c][0], *e = &error[c][0];
+			for (size_t i = 0; i < count; i++) {
+				o[i] += b * h[i] * ks[i];
+				e[i] += db * h[i] * ks[i];
+			}
+		}
+	}
+}
+
+void PropagationBatchCK::process(Candidate *candidate) const {
+	std::vector<Candidate *> candidates(1, candidate);
+	processBatch(candidates);
+}
+
+namespace {
+
+// buffers of processBatch, kept per thread so that steady-state propagation does not allocate
+struct BatchBuffers {
+	PropagationBatchCK::Y yIn, yTry, yOut, yAcc, yErr, kIn;
+	PropagationBatchCK::Workspace w;
+	std::vector<double> step, newStep, h;
+	std::vector<size_t> pending;
+
+	void resize(size_t count) {
+		yIn.resize(count);
+		yTry.resize(count);
+		yOut.resize(count);
+		yAcc.resize(count);
+		yErr.resize(count);
+		kIn.resize(count);
+		w.resize(count);
+		step.resize(count);
+		newStep.resize(count);
+		h.resize(count);
+		pending.resize(count);
+	}
+};
+
+// owns the buffers of all threads and frees them at exit
+class BatchBuffersHolder {
+	std::vector<BatchBuffers *> buffers;
+public:
+	~BatchBuffersHolder() {
+		for (size_t i = 0; i < buffers.size(); i++)
+			delete buffers[i];
+	}
+
+	BatchBuffers *create() {
+		BatchBuffers *b = new BatchBuffers();
+#pragma omp critical(BatchBuffersHolder)
+		buffers.push_back(b);
+		return b;
+	}
+};
+
+BatchBuffers *threadBatchBuffers = 0;
+#pragma omp threadprivate(threadBatchBuffers)
+
+BatchBuffers &getBatchBuffers(size_t count) {
+	static BatchBuffersHolder holder;
+	if (!threadBatchBuffers)
+		threadBatchBuffers = holder.create();
+	threadBatchBuffers->resize(count);
+	return *threadBatchBuffers;
+}
+
+} // namespace
+
+void PropagationBatchCK::processBatch(
+		const std::vector<Candidate *> &candidates) const {
+	size_t count = candidates.size();
+	if (count == 0)
+		return;
+
+	BatchBuffers &buffers = getBatchBuffers(count);
+	Y &yIn = buffers.yIn, &yTry = buffers.yTry, &yOut = buffers.yOut;
+	Y &yAcc = buffers.yAcc, &yErr = buffers.yErr, &kIn = buffers.kIn;
+	Workspace &w = buffers.w;
+	std::vector<double> &step = buffers.step, &newStep = buffers.newStep,
+			&h = buffers.h;
+	std::vector<size_t> &pending = buffers.pending;
+
+	// save the new previous particle states and load the phase-points
+	for (size_t i = 0; i < count; i++) {
+		Candidate *candidate = candidates[i];
+		candidate->previous = candidate->current;
+		const Vector3d &x = candidate->current.getPosition();
+		const Vector3d &u = candidate->current.getDirection();
+		yIn.x[i] = x.x;
+		yIn.y[i] = x.y;
+		yIn.z[i] = x.z;
+		yIn.ux[i] = u.x;
+		yIn.uy[i] = u.y;
+		yIn.uz[i] = u.z;
+		step[i] = clip(candidate->getNextStep(), minStep, maxStep);
+		pending[i] = i;
+	}
+
+	// try performing steps until every ray reached the target error or the minimum step size
+	size_t nPending = count;
+	while (nPending > 0) {
+		for (size_t c = 0; c < 6; c++) {
+			const double *src = &yIn[c][0];
+			double *dst = &yTry[c][0];
+			for (size_t j = 0; j < nPending; j++)
+				dst[j] = src[pending[j]];
+		}
+		for (size_t j = 0; j < nPending; j++)
+			h[j] = step[pending[j]];
+
+		tryStep(yTry, yOut, yErr, &h[0], nPending, w);
+
+		size_t nRetry = 0;
+		for (size_t j = 0; j < nPending; j++) {
+			size_t i = pending[j];
+			double eu = std::sqrt(yErr.ux[j] * yErr.ux[j]
+					+ yErr.uy[j] * yErr.uy[j] + yErr.uz[j] * yErr.uz[j]);
+			double r = eu / tolerance;  // ratio of absolute direction error and tolerance
+			double s = step[i] * 0.95 * pow(r, -0.2);  // update step size to keep error close to tolerance
+			s = clip(s, 0.1 * step[i], 5 * step[i]);  // limit the step size change
+			s = clip(s, minStep, maxStep);
+
+			if ((r > 1) && (step[i] != minStep)) {
+				// mask the ray for another attempt with the reduced step
+				step[i] = s;
+				pending[nRetry++] = i;
+				continue;
+			}
+
+			newStep[i] = s;
+			for (size_t c = 0; c < 6; c++)
+				yAcc[c][i] = yOut[c][j];
+			// the first stage is dx/ds = u / n at the start of the step
+			for (size_t c = 0; c < 3; c++)
+				kIn[c][i] = w.k[0][c][j];
+		}
+		nPending = nRetry;
+	}
+
+	// refractive index at the end of the steps for the dense output
+	std::vector<double> &nOut = w.n;
+	field->getValues(count, &yAcc.x[0], &yAcc.y[0], &yAcc.z[0], &nOut[0]);
+
+	for (size_t i = 0; i < count; i++) {
+		Candidate *candidate = candidates[i];
+		Vector3d u1 = Vector3d(yAcc.ux[i], yAcc.uy[i], yAcc.uz[i]).getUnitVector();
+		candidate->current.setPosition(Vector3d(yAcc.x[i], yAcc.y[i], yAcc.z[i]));
+		candidate->current.setDirection(u1);
+		candidate->setCurrentStep(step[i]);
+		candidate->setNextStep(newStep[i]);
+		candidate->setStepDerivatives(Vector3d(kIn.x[i], kIn.y[i], kIn.z[i]),
+				u1 / nOut[i]);
+	}
+}
+
+void PropagationBatchCK::setField(ref_ptr<ScalarField> f) {
+	field = f;
+}
+
+void PropagationBatchCK::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationBatchCK: target error not in range 0-1");
+	tolerance = tol;
+}
+
+void PropagationBatchCK::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationBatchCK: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationBatchCK: minStep > maxStep");
+	minStep = min;
+}
+
+void PropagationBatchCK::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationBatchCK: maxStep < minStep");
+	maxStep = max;
+}
+
+double PropagationBatchCK::getTolerance() const {
+	return tolerance;
+}
+
+double PropagationBatchCK::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationBatchCK::getMaximumStep() const {
+	return maxStep;
+}
+
+bool PropagationBatchCK::usesPythonObjects() const {
+	return isPythonObject(field);
+}
+
+std::string PropagationBatchCK::getDescription() const {
+	std::stringstream s;
+	s << "Batched propagation in scalar fields using the Cash-Karp method.";
+	s << " Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / meter << " m";
+	s << ", Maximum Step: " << maxStep / meter << " m";
+	return s.str();
+}
+
+} // namespace radiopropa
@@ -20,10 +20,9 @@ const double cash_karp_b[] = { 37. / 378., 0, 250. / 621., 125. / 594., 0., 512.
 const double cash_karp_bs[] = { 2825. / 27648., 0., 18575. / 48384., 13525.
 		/ 55296., 277. / 14336., 1. / 4. };
 
-void PropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
-		ParticleState &particle, double z) const {
-	std::vector<Y> k;
-	k.reserve(6);
+PropagationCK::Y PropagationCK::tryStep(const Y &y, Y &out, Y &error,
+		double h, ParticleState &particle, double z) const {
+	Y k[6];
 
 	out = y;
 	error = Y(0);
@@ -41,14 +40,17 @@ void PropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
 		out += k[i] * b[i] * h;
 		error += k[i] * (b[i] - bs[i]) * h;
 	}
+	return k[0];
 }
 
 
 PropagationCK::Y PropagationCK::dYdt(const Y &y, ParticleState &p, double z) const {
 	// normalize direction vector to prevent numerical losses
-	double n = field->getValue(y.x);
+	double n;
+	Vector3d gradient;
+	field->getValueAndGradient(y.x, n, gradient);
 	Vector3d velocity = y.u.getUnitVector() * c_light / n;
-	Vector3d dudt =  field->getGradient(y.x) / n/n * c_light; 
+	Vector3d dudt = gradient / n/n * c_light;
 	return Y(velocity, dudt);
 }
 
@@ -74,7 +76,7 @@ void PropagationCK::process(Candidate *candidate) const {
 	double step = clip(candidate->getNextStep(), minStep, maxStep);
 
 	Y yIn(current.getPosition(), current.getDirection());
-	Y yOut, yErr;
+	Y yOut, yErr, kIn;
 	double newStep = step;
 	double r = 42;  // arbitrary value > 1
 	double z = 0; // RedShift to 0. 
@@ -82,7 +84,7 @@ void PropagationCK::process(Candidate *candidate) const {
 	// try performing step until the target error (tolerance) or the minimum step size has been reached
 	while (r > 1) {
 		step = newStep;
-		tryStep(yIn, yOut, yErr, step / c_light, current, z);
+		kIn = tryStep(yIn, yOut, yErr, step / c_light, current, z);
 
 		r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
 		newStep = step * 0.95 * pow(r, -0.2);  // update step size to keep error close to tolerance
@@ -97,6 +99,11 @@ void PropagationCK::process(Candidate *candidate) const {
 	current.setDirection(yOut.u.getUnitVector());
 	candidate->setCurrentStep(step);
 	candidate->setNextStep(newStep);
+
+	// derivatives dx/ds = u / n at both ends of the step for the dense output,
+	// the one at the start is the first stage
+	candidate->setStepDerivatives(kIn.x / c_light,
+			current.getDirection() / field->getValue(current.getPosition()));
 }
 
 void PropagationCK::setField(ref_ptr<ScalarField> f) {
@@ -136,6 +143,10 @@ double PropagationCK::getMaximumStep() const {
 	return maxStep;
 }
 
+bool PropagationCK::usesPythonObjects() const {
+	return isPythonObject(field);
+}
+
 std::string PropagationCK::getDescription() const {
 	std::stringstream s;
 	s << "Propagation in magnetic fields using the Cash-Karp method.";
@@ -0,0 +1,268 @@
+#include "radiopropa/module/PropagationRK.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace radiopropa {
+
+// Cash-Karp 5(4) -------------------------------------------------------------
+const double CashKarpTableau::a[6][6] = {
+		{ 0., 0., 0., 0., 0., 0. },
+		{ 1. / 5., 0., 0., 0., 0., 0. },
+		{ 3. / 40., 9. / 40., 0., 0., 0., 0. },
+		{ 3. / 10., -9. / 10., 6. / 5., 0., 0., 0. },
+		{ -11. / 54., 5. / 2., -70. / 27., 35. / 27., 0., 0. },
+		{ 1631. / 55296., 175. / 512., 575. / 13824., 44275. / 110592.,
+				253. / 4096., 0. } };
+const double CashKarpTableau::b[6] = { 37. / 378., 0., 250. / 621., 125. / 594.,
+		0., 512. / 1771. };
+const double CashKarpTableau::bs[6] = { 2825. / 27648., 0., 18575. / 48384.,
+		13525. / 55296., 277. / 14336., 1. / 4. };
+const char *CashKarpTableau::name = "Cash-Karp 5(4)";
+
+// Dormand-Prince 5(4) --------------------------------------------------------
+const double DormandPrinceTableau::a[7][7] = {
+		{ 0., 0., 0., 0., 0., 0., 0. },
+		{ 1. / 5., 0., 0., 0., 0., 0., 0. },
+		{ 3. / 40., 9. / 40., 0., 0., 0., 0., 0. },
+		{ 44. / 45., -56. / 15., 32. / 9., 0., 0., 0., 0. },
+		{ 19372. / 6561., -25360. / 2187., 64448. / 6561., -212. / 729., 0., 0.,
+				0. },
+		{ 9017. / 3168., -355. / 33., 46732. / 5247., 49. / 176.,
+				-5103. / 18656., 0., 0. },
+		{ 35. / 384., 0., 500. / 1113., 125. / 192., -2187. / 6784., 11. / 84.,
+				0. } };
+const double DormandPrinceTableau::b[7] = { 35. / 384., 0., 500. / 1113.,
+		125. / 192., -2187. / 6784., 11. / 84., 0. };
+const double DormandPrinceTableau::bs[7] = { 5179. / 57600., 0., 7571. / 16695.,
+		393. / 640., -92097. / 339200., 187. / 2100., 1. / 40. };
+const char *DormandPrinceTableau::name = "Dormand-Prince 5(4)";
+
+// Bogacki-Shampine 3(2) ------------------------------------------------------
+const double BogackiShampineTableau::a[4][4] = {
+		{ 0., 0., 0., 0. },
+		{ 1. / 2., 0., 0., 0. },
+		{ 0., 3. / 4., 0., 0. },
+		{ 2. / 9., 1. / 3., 4. / 9., 0. } };
+const double BogackiShampineTableau::b[4] = { 2. / 9., 1. / 3., 4. / 9., 0. };
+const double BogackiShampineTableau::bs[4] = { 7. / 24., 1. / 4., 1. / 3.,
+		1. / 8. };
+const char *BogackiShampineTableau::name = "Bogacki-Shampine 3(2)";
+
+// Runge-Kutta-Fehlberg 7(8) --------------------------------------------------
+const double Fehlberg78Tableau::a[13][13] = {
+		{ 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0. },
+		{ 2. / 27., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0. },
+		{ 1. / 36., 1. / 12., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0. },
+		{ 1. / 24., 0., 1. / 8., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0. },
+		{ 5. / 12., 0., -25. / 16., 25. / 16., 0., 0., 0., 0., 0., 0., 0., 0.,
+				0. },
+		{ 1. / 20., 0., 0., 1. / 4., 1. / 5., 0., 0., 0., 0., 0., 0., 0., 0. },
+		{ -25. / 108., 0., 0., 125. / 108., -65. / 27., 125. / 54., 0., 0., 0.,
+				0., 0., 0., 0. },
+		{ 31. / 300., 0., 0., 0., 61. / 225., -2. / 9., 13. / 900., 0., 0., 0.,
+				0., 0., 0. },
+		{ 2., 0., 0., -53. / 6., 704. / 45., -107. / 9., 67. / 90., 3., 0., 0.,
+				0., 0., 0. },
+		{ -91. / 108., 0., 0., 23. / 108., -976. / 135., 311. / 54., -19. / 60.,
+				17. / 6., -1. / 12., 0., 0., 0., 0. },
+		{ 2383. / 4100., 0., 0., -341. / 164., 4496. / 1025., -301. / 82.,
+				2133. / 4100., 45. / 82., 45. / 164., 18. / 41., 0., 0., 0. },
+		{ 3. / 205., 0., 0., 0., 0., -6. / 41., -3. / 205., -3. / 41., 3. / 41.,
+				6. / 41., 0., 0., 0. },
+		{ -1777. / 4100., 0., 0., -341. / 164., 4496. / 1025., -289. / 82.,
+				2193. / 4100., 51. / 82., 33. / 164., 12. / 41., 0., 1., 0. } };
+const double Fehlberg78Tableau::b[13] = { 41. / 840., 0., 0., 0., 0., 34. / 105.,
+		9. / 35., 9. / 35., 9. / 280., 9. / 280., 41. / 840., 0., 0. };
+const double Fehlberg78Tableau::bs[13] = { 0., 0., 0., 0., 0., 34. / 105.,
+		9. / 35., 9. / 35., 9. / 280., 9. / 280., 0., 41. / 840., 41. / 840. };
+const char *Fehlberg78Tableau::name = "Runge-Kutta-Fehlberg 7(8)";
+
+// Last stage of the most recent accepted step of the current thread. The
+// derivative only depends on the phase-point and the field, so it can be
+// reused by any candidate starting from exactly this phase-point.
+struct FsalStage {
+	const ScalarField *field;
+	PropagationCK::Y y;
+	PropagationCK::Y k;
+	FsalStage() : field(0) {
+	}
+};
+
+// allocated on the first step of each thread
+static FsalStage *threadFsalStage = 0;
+#pragma omp threadprivate(threadFsalStage)
+
+static FsalStage &fsalStage() {
+	if (!threadFsalStage)
+		threadFsalStage = new FsalStage();
+	return *threadFsalStage;
+}
+
+template<typename Tableau>
+PropagationRK<Tableau>::PropagationRK(ref_ptr<ScalarField> field,
+		double tolerance, double minStep, double maxStep) :
+		minStep(0) {
+	setField(field);
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+}
+
+template<typename Tableau>
+typename PropagationRK<Tableau>::Y PropagationRK<Tableau>::dYdt(
+		const Y &y) const {
+	double n;
+	Vector3d gradient;
+	field->getValueAndGradient(y.x, n, gradient);
+	// normalize direction vector to prevent numerical losses
+	return Y(y.u.getUnitVector() / n, gradient / (n * n));
+}
+
+template<typename Tableau>
+void PropagationRK<Tableau>::tryStep(const Y &y, Y &out, Y &error, double h,
+		Y *k) const {
+	out = y;
+	error = Y(0);
+
+	for (int i = 0; i < Tableau::stages; i++) {
+		if (i > 0) {
+			Y y_n = y;
+			for (int j = 0; j < i; j++)
+				if (Tableau::a[i][j] != 0)
+					y_n += k[j] * (Tableau::a[i][j] * h);
+			k[i] = dYdt(y_n);
+		}
+
+		if (Tableau::b[i] != 0)
+			out += k[i] * (Tableau::b[i] * h);
+		if (Tableau::b[i] != Tableau::bs[i])
+			error += k[i] * ((Tableau::b[i] - Tableau::bs[i]) * h);
+	}
+}
+
+template<typename Tableau>
+void PropagationRK<Tableau>::process(Candidate *candidate) const {
+	// save the new previous particle state
+	ParticleState &current = candidate->current;
+	candidate->previous = current;
+
+	double step = clip(candidate->getNextStep(), minStep, maxStep);
+
+	Y yIn(current.getPosition(), current.getDirection());
+	Y yOut, yErr;
+	Y k[Tableau::stages];
+
+	// the first stage does not depend on the step size and is shared by all attempts
+	FsalStage &fsal = fsalStage();
+	if (Tableau::fsal && (fsal.field == field.get()) && (fsal.y.x == yIn.x)
+			&& (fsal.y.u == yIn.u))
+		k[0] = fsal.k;
+	else
+		k[0] = dYdt(yIn);
+
+	// step size control exponent from the lower order of the embedded pair
+	const double exponent = -1.
+			/ (std::min<int>(Tableau::order, Tableau::embeddedOrder) + 1);
+
+	double newStep = step;
+	double r = 42;  // arbitrary value > 1
+
+	// try performing step until the target error (tolerance) or the minimum step size has been reached
+	while (r > 1) {
+		step = newStep;
+		tryStep(yIn, yOut, yErr, step, k);
+
+		r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
+		newStep = step * 0.95 * pow(r, exponent);  // update step size to keep error close to tolerance
+		newStep = clip(newStep, 0.1 * step, 5 * step);  // limit the step size change
+		newStep = clip(newStep, minStep, maxStep);
+
+		if (step == minStep)
+			break;  // performed step already at the minimum
+	}
+
+	current.setPosition(yOut.x);
+	current.setDirection(yOut.u.getUnitVector());
+	candidate->setCurrentStep(step);
+	candidate->setNextStep(newStep);
+
+	// derivatives dx/ds = u / n at both ends of the step for the dense output, the
+	// last stage of first-same-as-last methods is evaluated at the new phase-point
+	Vector3d end = Tableau::fsal ? k[Tableau::stages - 1].x :
+			current.getDirection() / field->getValue(current.getPosition());
+	candidate->setStepDerivatives(k[0].x, end);
+
+	if (Tableau::fsal) {
+		fsal.field = field.get();
+		fsal.y = Y(current.getPosition(), current.getDirection());
+		fsal.k = k[Tableau::stages - 1];
+	}
+}
+
+template<typename Tableau>
+void PropagationRK<Tableau>::setField(ref_ptr<ScalarField> f) {
+	field = f;
+}
+
+template<typename Tableau>
+void PropagationRK<Tableau>::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationRK: target error not in range 0-1");
+	tolerance = tol;
+}
+
+template<typename Tableau>
+void PropagationRK<Tableau>::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationRK: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationRK: minStep > maxStep");
+	minStep = min;
+}
+
+template<typename Tableau>
+void PropagationRK<Tableau>::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationRK: maxStep < minStep");
+	maxStep = max;
+}
+
+template<typename Tableau>
+double PropagationRK<Tableau>::getTolerance() const {
+	return tolerance;
+}
+
+template<typename Tableau>
+double PropagationRK<Tableau>::getMinimumStep() const {
+	return minStep;
+}
+
+template<typename Tableau>
+double PropagationRK<Tableau>::getMaximumStep() const {
+	return maxStep;
+}
+
+template<typename Tableau>
+bool PropagationRK<Tableau>::usesPythonObjects() const {
+	return isPythonObject(field);
+}
+
+template<typename Tableau>
+std::string PropagationRK<Tableau>::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in scalar fields using the " << Tableau::name << " method.";
+	s << " Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / meter << " m";
+	s << ", Maximum Step: " << maxStep / meter << " m";
+	return s.str();
+}
+
+template class PropagationRK<CashKarpTableau>;
+template class PropagationRK<DormandPrinceTableau>;
+template class PropagationRK<BogackiShampineTableau>;
+template class PropagationRK<Fehlberg78Tableau>;
+
+} // namespace radiopropa
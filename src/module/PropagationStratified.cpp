@@ -0,0 +1,298 @@
+#include "radiopropa/module/PropagationStratified.h"
+#include "radiopropa/Common.h"
+#include "radiopropa/module/PropagationRK.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <typeinfo>
+
+namespace radiopropa {
+
+// antiderivative of n^2 = p^2 + beta^2 with respect to p, ds = 2 / a n^2 dp along a n2linear ray
+static double linearPathIntegral(double p, double beta) {
+	return p * p * p / 3 + beta * beta * p;
+}
+
+PropagationStratified::PropagationStratified(ref_ptr<ScalarField> field,
+		double tolerance, double minStep, double maxStep) :
+		minStep(0) {
+	setField(field);
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+}
+
+PropagationStratified::State PropagationStratified::dYds(const State &y,
+		const Vector3d &start, const Vector3d &horizontal, double beta) const {
+	double n;
+	Vector3d gradient;
+	Vector3d position(start.x + y.r * horizontal.x,
+			start.y + y.r * horizontal.y, y.z);
+	field->getValueAndGradient(position, n, gradient);
+	double n2 = n * n;
+	return State(y.p / n2, gradient.z / n, beta / n2);
+}
+
+PropagationStratified::State PropagationStratified::tryStep(const State &y,
+		double h, const Vector3d &start, const Vector3d &horizontal,
+		double beta, State &error) const {
+	typedef DormandPrinceTableau T;
+	State k[T::stages];
+	State out = y;
+	error = State(0, 0, 0);
+
+	for (int i = 0; i < T::stages; i++) {
+		State y_n = y;
+		for (int j = 0; j < i; j++) {
+			y_n.z += T::a[i][j] * h * k[j].z;
+			y_n.p += T::a[i][j] * h * k[j].p;
+			y_n.r += T::a[i][j] * h * k[j].r;
+		}
+		k[i] = dYds(y_n, start, horizontal, beta);
+
+		double db = T::b[i] - T::bs[i];
+		out.z += T::b[i] * h * k[i].z;
+		out.p += T::b[i] * h * k[i].p;
+		out.r += T::b[i] * h * k[i].r;
+		error.z += db * h * k[i].z;
+		error.p += db * h * k[i].p;
+		error.r += db * h * k[i].r;
+	}
+	return out;
+}
+
+double PropagationStratified::propagateLinear(const n2linear *f,
+		const Vector3d &start, double beta, double length, State &state) const {
+	// with the parameter tau (ds = n^2 dtau) the ray is a parabola:
+	// z = z0 + p0 tau + a/4 tau^2, p = p0 + a/2 tau, r = beta tau
+	double a = f->getA();
+	double z0 = state.z;
+	double p0 = state.p;
+	double n0 = sqrt(p0 * p0 + beta * beta);
+
+	double tau;
+	if (a == 0) {
+		tau = length / (n0 * n0);
+	} else {
+		// solve s(p) = length for the final vertical slowness
+		double target = linearPathIntegral(p0, beta) + a / 2 * length;
+		double p = p0 + a / 2 * length / (n0 * n0);
+		for (int i = 0; i < 100; i++) {
+			double dp = (linearPathIntegral(p, beta) - target)
+					/ (p * p + beta * beta);
+			p -= dp;
+			if (fabs(dp) <= 1e-15 * (fabs(p) + beta))
+				break;
+		}
+		tau = 2 * (p - p0) / a;
+	}
+
+	// earliest crossing of a horizontal plane within the segment
+	bool hit = false;
+	double zHit = 0;
+	double tauMin = surfaceEpsilon / (n0 * n0);
+	for (size_t i = 0; i < planes.size(); i++) {
+		double A = a / 4, B = p0, C = z0 - planes[i];
+		double roots[2];
+		int nRoots = 0;
+		if (A == 0) {
+			if (B != 0)
+				roots[nRoots++] = -C / B;
+		} else {
+			double disc = B * B - 4 * A * C;
+			if (disc < 0)
+				continue;
+			double q = -0.5 * (B + ((B >= 0) ? 1 : -1) * sqrt(disc));
+			roots[nRoots++] = q / A;
+			if (q != 0)
+				roots[nRoots++] = C / q;
+		}
+		for (int j = 0; j < nRoots; j++) {
+			if ((roots[j] > tauMin) && (roots[j] < tau)) {
+				tau = roots[j];
+				hit = true;
+				zHit = planes[i];
+			}
+		}
+	}
+
+	state.z = hit ? zHit : z0 + p0 * tau + a / 4 * tau * tau;
+	state.p = p0 + a / 2 * tau;
+	state.r = beta * tau;
+
+	if (!hit)
+		return length;
+	if (a == 0)
+		return tau * n0 * n0;
+	return 2 / a
+			* (linearPathIntegral(state.p, beta) - linearPathIntegral(p0, beta));
+}
+
+double PropagationStratified::propagateNumerical(const Vector3d &start,
+		const Vector3d &horizontal, double beta, double length,
+		State &state) const {
+	State y = state;
+	double s = 0;
+	double h = length;
+
+	while (s < length) {
+		h = std::min(h, length - s);
+		State error;
+		State yNew = tryStep(y, h, start, horizontal, beta, error);
+
+		double r = fabs(error.p) / tolerance;  // ratio of absolute slowness error and tolerance
+		double factor = 0.95 * pow(r, -0.2);  // update step size to keep error close to tolerance
+		if ((r > 1) && (h > minStep)) {
+			h = std::max(h * clip(factor, 0.1, 1.), minStep);
+			continue;
+		}
+
+		// earliest crossing of a horizontal plane within the accepted sub-step
+		double zHit = 0;
+		double fraction = 2;
+		for (size_t i = 0; i < planes.size(); i++) {
+			double da = y.z - planes[i];
+			double db = yNew.z - planes[i];
+			if ((da == 0) || (da * db > 0))
+				continue;
+			double f = da / (da - db);
+			if (f < fraction) {
+				fraction = f;
+				zHit = planes[i];
+			}
+		}
+
+		if (fraction <= 1) {
+			// regula falsi on the sub-step length
+			double lo = 0, hi = h;
+			double flo = y.z - zHit, fhi = yNew.z - zHit;
+			double hHit = h;
+			State yHit = yNew;
+			for (int i = 0; i < 60; i++) {
+				hHit = lo - flo * (hi - lo) / (fhi - flo);
+				if (!(hHit > lo && hHit < hi))
+					hHit = 0.5 * (lo + hi);
+				yHit = tryStep(y, hHit, start, horizontal, beta, error);
+				double fm = yHit.z - zHit;
+				if ((fabs(fm) < 1e-12 * (1 + fabs(zHit))) || (hi - lo < 1e-12))
+					break;
+				if ((fm > 0) == (flo > 0)) {
+					lo = hHit;
+					flo = fm;
+				} else {
+					hi = hHit;
+					fhi = fm;
+				}
+			}
+			if (s + hHit > surfaceEpsilon) {
+				state = yHit;
+				state.z = zHit;
+				return s + hHit;
+			}
+		}
+
+		y = yNew;
+		s += h;
+		h *= clip(factor, 1., 5.);
+	}
+
+	state = y;
+	return length;
+}
+
+void PropagationStratified::process(Candidate *candidate) const {
+	// save the new previous particle state
+	ParticleState &current = candidate->current;
+	candidate->previous = current;
+
+	double length = clip(candidate->getNextStep(), minStep, maxStep);
+
+	// conserved quantities: azimuth and Snell invariant
+	Vector3d start = current.getPosition();
+	Vector3d direction = current.getDirection();
+	Vector3d horizontal(direction.x, direction.y, 0);
+	double sinTheta = horizontal.getR();
+	if (sinTheta > 0)
+		horizontal /= sinTheta;
+	double n = field->getValue(start);
+	double beta = n * sinTheta;
+
+	State state(start.z, n * direction.z, 0);
+	double step;
+	// the closed form only holds for n2linear itself, subclasses may override getValue
+	if (typeid(*field) == typeid(n2linear))
+		step = propagateLinear(static_cast<const n2linear *>(field.get()),
+				start, beta, length, state);
+	else
+		step = propagateNumerical(start, horizontal, beta, length, state);
+
+	current.setPosition(Vector3d(start.x + state.r * horizontal.x,
+			start.y + state.r * horizontal.y, state.z));
+	current.setDirection(horizontal * beta + Vector3d(0, 0, state.p));
+	candidate->setCurrentStep(step);
+	candidate->setNextStep(maxStep);
+
+	// derivatives dx/ds = u / n at both ends of the step for the dense output
+	double n2 = state.p * state.p + beta * beta;
+	candidate->setStepDerivatives(direction / n,
+			(horizontal * beta + Vector3d(0, 0, state.p)) / n2);
+}
+
+void PropagationStratified::addHorizontalPlane(double z) {
+	planes.push_back(z);
+}
+
+void PropagationStratified::setField(ref_ptr<ScalarField> f) {
+	field = f;
+}
+
+void PropagationStratified::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationStratified: target error not in range 0-1");
+	tolerance = tol;
+}
+
+void PropagationStratified::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationStratified: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationStratified: minStep > maxStep");
+	minStep = min;
+}
+
+void PropagationStratified::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationStratified: maxStep < minStep");
+	maxStep = max;
+}
+
+double PropagationStratified::getTolerance() const {
+	return tolerance;
+}
+
+double PropagationStratified::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationStratified::getMaximumStep() const {
+	return maxStep;
+}
+
+bool PropagationStratified::usesPythonObjects() const {
+	return isPythonObject(field);
+}
+
+std::string PropagationStratified::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in z-stratified scalar fields.";
+	s << " Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / meter << " m";
+	s << ", Maximum Step: " << maxStep / meter << " m";
+	s << ", Planes: " << planes.size();
+	return s.str();
+}
+
+} // namespace radiopropa
@@ -20,6 +20,7 @@ void SimplePropagation::process(Candidate *c) const {
 	Vector3d pos = c->current.getPosition();
 	Vector3d dir = c->current.getDirection();
 	c->current.setPosition(pos + dir * step);
+	c->setStepDerivatives(dir, dir);
 
 	c->setNextStep(maxStep);
 }
@@ -63,6 +63,13 @@ string PerformanceModule::getDescription() const {
 	return sstr.str();
 }
 
+bool PerformanceModule::usesPythonObjects() const {
+	for (size_t i = 0; i < modules.size(); i++)
+		if (isPythonModule(modules[i].module))
+			return true;
+	return false;
+}
+
 // ----------------------------------------------------------------------------
 ParticleFilter::ParticleFilter() {
 
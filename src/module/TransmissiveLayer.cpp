@@ -0,0 +1,202 @@
+#include "radiopropa/module/TransmissiveLayer.h"
+#include "radiopropa/Common.h"
+#include "radiopropa/Units.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace radiopropa {
+
+namespace {
+
+// signed distance of a position to the plane
+class PlaneDistance {
+	const TransmissiveLayer &layer;
+public:
+	PlaneDistance(const TransmissiveLayer &layer) :
+			layer(layer) {
+	}
+	double operator()(const Vector3d &position) const {
+		return layer.distance(position);
+	}
+};
+
+} // namespace
+
+// FresnelInterface -----------------------------------------------------------
+FresnelInterface::FresnelInterface(ref_ptr<ScalarField> field,
+		Polarization polarization) :
+		field(field), polarization(polarization), sampleDistance(1e-6 * meter) {
+}
+
+bool FresnelInterface::fresnelCoefficients(double n1, double n2,
+		double cosIncidence, double &cosTransmission, double &r,
+		double &t) const {
+	double sinTransmission = n1 / n2 * sqrt(1 - cosIncidence * cosIncidence);
+	if (sinTransmission >= 1) {
+		cosTransmission = 0;
+		r = 1;
+		t = 0;
+		return false;
+	}
+	cosTransmission = sqrt(1 - sinTransmission * sinTransmission);
+
+	double a = n1 * cosIncidence, b = n2 * cosTransmission;
+	if (polarization == TM) {
+		a = n2 * cosIncidence;
+		b = n1 * cosTransmission;
+	}
+	r = (a - b) / (a + b);
+	t = 2 * n1 * cosIncidence / (a + b);
+	return true;
+}
+
+void FresnelInterface::split(Candidate *candidate, const Vector3d &position,
+		const Vector3d &back) const {
+	candidate->current.setPosition(position);
+	double n1 = field->getValue(position + back * sampleDistance);
+	double n2 = field->getValue(position - back * sampleDistance);
+
+	Vector3d direction = candidate->current.getDirection();
+	double cosIncidence = -direction.dot(back);
+	double cosTransmission, r, t;
+	bool transmitted = fresnelCoefficients(n1, n2, cosIncidence,
+			cosTransmission, r, t);
+	double amplitude = candidate->current.getAmplitude();
+
+	if (transmitted) {
+		ref_ptr<Candidate> secondary = candidate->clone(false);
+		double eta = n1 / n2;
+		secondary->current.setDirection(direction * eta
+				+ back * (eta * cosIncidence - cosTransmission));
+		secondary->current.setAmplitude(fabs(t) * amplitude);
+		secondary->parent = candidate;
+		candidate->addSecondary(secondary);
+	}
+
+	candidate->current.setDirection(direction + back * (2 * cosIncidence));
+	candidate->current.setAmplitude(fabs(r) * amplitude);
+}
+
+void FresnelInterface::setField(ref_ptr<ScalarField> f) {
+	field = f;
+}
+
+void FresnelInterface::setPolarization(Polarization p) {
+	polarization = p;
+}
+
+void FresnelInterface::setSampleDistance(double s) {
+	if (s <= 0)
+		throw std::runtime_error("FresnelInterface: sample distance <= 0");
+	sampleDistance = s;
+}
+
+FresnelInterface::Polarization FresnelInterface::getPolarization() const {
+	return polarization;
+}
+
+double FresnelInterface::getSampleDistance() const {
+	return sampleDistance;
+}
+
+bool FresnelInterface::usesPythonObjects() const {
+	return isPythonObject(field);
+}
+
+// TransmissiveLayer ----------------------------------------------------------
+TransmissiveLayer::TransmissiveLayer(Vector3d origin, Vector3d normal,
+		ref_ptr<ScalarField> field, Polarization polarization) :
+		FresnelInterface(field, polarization), origin(origin) {
+	setNormal(normal);
+}
+
+double TransmissiveLayer::distance(const Vector3d &position) const {
+	return (position - origin).dot(normal);
+}
+
+void TransmissiveLayer::process(Candidate *candidate) const {
+	double d = distance(candidate->current.getPosition());
+	double dPrevious = distance(candidate->previous.getPosition());
+
+	// no crossing, or the step started on the plane after a previous interaction
+	if ((fabs(dPrevious) <= surfaceEpsilon) || ((d < 0) == (dPrevious < 0) && (d != 0)))
+		return;
+
+	// move the candidate back onto the plane
+	candidate->truncateStep(candidate->locateCrossing(PlaneDistance(*this), dPrevious, d));
+	Vector3d position = candidate->current.getPosition();
+	position -= normal * distance(position);
+
+	split(candidate, position, (dPrevious > 0) ? normal : normal * -1.);
+}
+
+void TransmissiveLayer::setOrigin(Vector3d o) {
+	origin = o;
+}
+
+void TransmissiveLayer::setNormal(Vector3d n) {
+	if (n.getR() == 0)
+		throw std::runtime_error("TransmissiveLayer: normal vector is zero");
+	normal = n.getUnitVector();
+}
+
+Vector3d TransmissiveLayer::getOrigin() const {
+	return origin;
+}
+
+Vector3d TransmissiveLayer::getNormal() const {
+	return normal;
+}
+
+std::string TransmissiveLayer::getDescription() const {
+	std::stringstream s;
+	s << "TransmissiveLayer: origin = " << origin / meter << " m, ";
+	s << "normal = " << normal << ", ";
+	s << "polarization = " << ((polarization == TE) ? "TE" : "TM");
+	return s.str();
+}
+
+// TransmissiveSurface --------------------------------------------------------
+TransmissiveSurface::TransmissiveSurface(ref_ptr<Surface> surface,
+		ref_ptr<ScalarField> field, Polarization polarization) :
+		FresnelInterface(field, polarization), surface(surface) {
+}
+
+void TransmissiveSurface::process(Candidate *candidate) const {
+	Vector3d a = candidate->previous.getPosition();
+	Vector3d b = candidate->current.getPosition();
+	double length = (b - a).getR();
+	if (length == 0)
+		return;
+
+	// skip the start of a step that begins on the surface after a previous interaction
+	Vector3d start = a + (b - a) * (surfaceEpsilon / length);
+	double t;
+	Vector3d normal;
+	size_t element;
+	if ((surfaceEpsilon >= length) || !surface->intersect(start, b, t, normal, element))
+		return;
+
+	Vector3d position = start + (b - start) * t;
+	candidate->truncateStep((position - a).getR() / length);
+	split(candidate, position, (normal.dot(b - a) < 0) ? normal : normal * -1.);
+}
+
+void TransmissiveSurface::setSurface(ref_ptr<Surface> s) {
+	surface = s;
+}
+
+ref_ptr<Surface> TransmissiveSurface::getSurface() const {
+	return surface;
+}
+
+std::string TransmissiveSurface::getDescription() const {
+	std::stringstream s;
+	s << "TransmissiveSurface, " << surface->getDescription() << ", ";
+	s << "polarization = " << ((polarization == TE) ? "TE" : "TM");
+	return s.str();
+}
+
+} // namespace radiopropa
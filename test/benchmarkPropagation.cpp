@@ -0,0 +1,64 @@
+// Throughput of PropagationBatchCK compared to PropagationCK.
+// Both run the same rays on the same number of threads, timed in wall-clock time.
+// Usage: benchmarkPropagation [number of rays] [batch size]
+
+#include "radiopropa/ModuleList.h"
+#include "radiopropa/Units.h"
+#include "radiopropa/module/PropagationCK.h"
+#include "radiopropa/module/PropagationBatchCK.h"
+#include "radiopropa/module/BreakCondition.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace radiopropa;
+
+double wallTime() {
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return double(std::time(0));
+#endif
+}
+
+void createRays(ModuleList::candidate_vector_t &candidates, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		double phi = 90. * deg * i / count;
+		ParticleState p;
+		p.setPosition(Vector3d(0, 0, -200 * meter));
+		p.setDirection(Vector3d(sin(phi), 0, cos(phi)));
+		candidates.push_back(new Candidate(p));
+	}
+}
+
+int main(int argc, char **argv) {
+	size_t count = (argc > 1) ? std::atoi(argv[1]) : 4096;
+	size_t batchSize = (argc > 2) ? std::atoi(argv[2]) : 64;
+
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	ModuleList single, batch;
+	single.add(new PropagationCK(ice, 1e-8, 0.001 * meter, 1 * meter));
+	single.add(new MaximumTrajectoryLength(200 * meter));
+	batch.add(new PropagationBatchCK(ice, 1e-8, 0.001 * meter, 1 * meter));
+	batch.add(new MaximumTrajectoryLength(200 * meter));
+
+	ModuleList::candidate_vector_t a, b;
+	createRays(a, count);
+	createRays(b, count);
+
+	double t0 = wallTime();
+	single.run(a, false);
+	double t1 = wallTime();
+	batch.runBatch(b, batchSize, false);
+	double t2 = wallTime();
+
+	std::cout << "PropagationCK:      " << count / (t1 - t0) << " rays/s" << std::endl;
+	std::cout << "PropagationBatchCK: " << count / (t2 - t1) << " rays/s (batch size " << batchSize << ")" << std::endl;
+	std::cout << "speedup:            " << (t1 - t0) / (t2 - t1) << std::endl;
+	return 0;
+}
@@ -4,7 +4,10 @@
 #include "radiopropa/module/Observer.h"
 #include "radiopropa/module/Boundary.h"
 #include "radiopropa/module/Tools.h"
+#include "radiopropa/module/TransmissiveLayer.h"
+#include "radiopropa/TriangleMesh.h"
 #include "radiopropa/ParticleID.h"
+#include "radiopropa/Random.h"
 
 #include "gtest/gtest.h"
 
@@ -72,6 +75,34 @@ TEST(DetectionLength, test) {
         EXPECT_TRUE(c.hasProperty("Rejected"));
 }
 
+TEST(SceneStepLimiter, boundaries) {
+	// one step limitation for a spherical and a cylindrical boundary and an observer plane
+	SphericalBoundary sphere(Vector3d(0, 0, 0), 100);
+	CylindricalBoundary cylinder(Vector3d(0, 0, -50), 40, 20);
+	Observer obs;
+	obs.add(new ObserverPlane(Vector3d(0, 0, -10), Vector3d(0, 0, 1)));
+	ref_ptr<Scene> scene = new Scene;
+	sphere.addToScene(*scene);
+	cylinder.addToScene(*scene);
+	obs.addToScene(*scene);
+	EXPECT_EQ(3, scene->getNumberOfPrimitives());
+
+	SceneStepLimiter limiter(scene, 0.5);
+	Candidate c;
+	c.setNextStep(1000);
+	c.current.setPosition(Vector3d(0, 0, 20));
+	limiter.process(&c);
+	EXPECT_DOUBLE_EQ(30.5, c.getNextStep());
+	c.setNextStep(1000);
+	c.current.setPosition(Vector3d(0, 0, -25));
+	limiter.process(&c);
+	EXPECT_DOUBLE_EQ(5.5, c.getNextStep());
+	c.setNextStep(1000);
+	c.current.setPosition(Vector3d(80, 0, -50));
+	limiter.process(&c);
+	EXPECT_NEAR(100 - sqrt(80 * 80 + 50 * 50.) + 0.5, c.getNextStep(), 1e-12);
+}
+
 //** ============================= Observers ================================ */
 TEST(ObserverFeature, SmallSphere) {
 	// detect if the current position is inside and the previous outside of the sphere
@@ -86,14 +117,48 @@ TEST(ObserverFeature, SmallSphere) {
 	obs.process(&c);
 	EXPECT_TRUE(c.isActive());
 
-	// limit step
-	EXPECT_NEAR(c.getNextStep(), 0.436, 0.001);
+	// no step limitation
+	EXPECT_DOUBLE_EQ(10, c.getNextStep());
 
-	// detection: particle just entered
+	// detection: particle just entered, reported at the crossing
 	c.current.setPosition(Vector3d(0.9, 0, 0));
 	c.previous.setPosition(Vector3d(1.1, 0, 0));
 	obs.process(&c);
 	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(1, c.current.getPosition().x, 1e-9);
+}
+
+TEST(ObserverFeature, SmallSpherePassThrough) {
+	// a step entering and leaving the sphere is detected at the entry
+	Observer obs;
+	obs.add(new ObserverSmallSphere(Vector3d(0, 0, 0), 0.1));
+	Candidate c;
+	c.previous.setPosition(Vector3d(-1, 0, 0));
+	c.current.setPosition(Vector3d(1, 0, 0));
+	obs.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(-0.1, c.current.getPosition().x, 1e-9);
+
+	// a step passing beside the sphere is not
+	Candidate d;
+	d.previous.setPosition(Vector3d(-1, 0.2, 0));
+	d.current.setPosition(Vector3d(1, 0.2, 0));
+	obs.process(&d);
+	EXPECT_TRUE(d.isActive());
+}
+
+TEST(ObserverFeature, TrackingPassThrough) {
+	// tracking starts at the entry of a step passing through the sphere
+	Observer obs;
+	obs.setDeactivateOnDetection(false);
+	obs.add(new ObserverTracking(Vector3d(0, 0, 0), 0.1, 0.01));
+	Candidate c;
+	c.setNextStep(10);
+	c.previous.setPosition(Vector3d(0, -1, 0));
+	c.current.setPosition(Vector3d(0, 1, 0));
+	obs.process(&c);
+	EXPECT_NEAR(-0.1, c.current.getPosition().y, 1e-9);
+	EXPECT_DOUBLE_EQ(0.01, c.getNextStep());
 }
 
 TEST(ObserverFeature, LargeSphere) {
@@ -109,14 +174,15 @@ TEST(ObserverFeature, LargeSphere) {
 	obs.process(&c);
 	EXPECT_TRUE(c.isActive());
 
-	// limit step
-	EXPECT_DOUBLE_EQ(c.getNextStep(), 1);
+	// no step limitation
+	EXPECT_DOUBLE_EQ(10, c.getNextStep());
 
-	// detection: particle just left
+	// detection: particle just left, reported at the crossing
 	c.current.setPosition(Vector3d(11, 0, 0));
 	c.previous.setPosition(Vector3d(9.5, 0, 0));
 	obs.process(&c);
 	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(10, c.current.getPosition().x, 1e-9);
 }
 
 TEST(ObserverFeature, Point) {
@@ -125,18 +191,191 @@ TEST(ObserverFeature, Point) {
 	Candidate c;
 	c.setNextStep(10);
 
-	// no detection, limit step
+	// no detection
 	c.current.setPosition(Vector3d(5, 0, 0));
 	obs.process(&c);
 	EXPECT_TRUE(c.isActive());
 
-	// limit step
-	EXPECT_DOUBLE_EQ(5, c.getNextStep());
+	// no step limitation
+	EXPECT_DOUBLE_EQ(10, c.getNextStep());
 
-	// detection
-	c.current.setPosition(Vector3d(0, 0, 0));
+	// detection, reported at the crossing
+	c.previous.setPosition(Vector3d(5, 0, 0));
+	c.current.setPosition(Vector3d(-3, 0, 0));
 	obs.process(&c);
 	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(0, c.current.getPosition().x, 1e-9);
+}
+
+TEST(ObserverFeature, Plane) {
+	Observer obs;
+	obs.setDeactivateOnDetection(false);
+	ObserverPlane *plane = new ObserverPlane(Vector3d(0, 0, -300), Vector3d(0, 0, 2));
+	obs.add(plane);
+	obs.setFlag("Detected", "yes");
+
+	// no detection on the same side
+	Candidate c;
+	c.previous.setPosition(Vector3d(0, 0, -240));
+	c.current.setPosition(Vector3d(0, 0, -250));
+	c.setCurrentStep(10);
+	obs.process(&c);
+	EXPECT_FALSE(c.hasProperty("Detected"));
+
+	// detection downwards, reported at the crossing
+	c.previous.setPosition(Vector3d(0, 0, -290));
+	c.current.setPosition(Vector3d(12, 0, -306));
+	c.current.setDirection(Vector3d(0.6, 0, -0.8));
+	c.setTrajectoryLength(0);
+	c.setCurrentStep(20);
+	obs.process(&c);
+	EXPECT_TRUE(c.hasProperty("Detected"));
+	EXPECT_DOUBLE_EQ(-300, c.current.getPosition().z);
+	EXPECT_NEAR(7.5, c.current.getPosition().x, 1e-9);
+	EXPECT_NEAR(12.5, c.getTrajectoryLength(), 1e-9);
+	EXPECT_NEAR(12.5, c.getCurrentStep(), 1e-9);
+
+	// a step starting on the plane is not detected again
+	c.removeProperty("Detected");
+	c.previous = c.current;
+	c.current.setPosition(Vector3d(13.5, 0, -308));
+	c.setCurrentStep(10);
+	obs.process(&c);
+	EXPECT_FALSE(c.hasProperty("Detected"));
+
+	// detection upwards
+	c.previous.setPosition(Vector3d(0, 0, -305));
+	c.current.setPosition(Vector3d(0, 0, -295));
+	c.setCurrentStep(10);
+	obs.process(&c);
+	EXPECT_TRUE(c.hasProperty("Detected"));
+
+	// step limiting to the distance to the plane, with a lower bound
+	plane->setStepLimiting(true, 0.5);
+	c.previous.setPosition(Vector3d(0, 0, -280));
+	c.current.setPosition(Vector3d(0, 0, -290));
+	c.setNextStep(100);
+	obs.process(&c);
+	EXPECT_DOUBLE_EQ(10, c.getNextStep());
+	c.current.setPosition(Vector3d(0, 0, -299.9));
+	obs.process(&c);
+	EXPECT_DOUBLE_EQ(0.5, c.getNextStep());
+}
+
+TEST(ObserverFeature, Rectangle) {
+	Observer obs;
+	ObserverRectangle *rectangle = new ObserverRectangle(Vector3d(0, 0, 0), Vector3d(0, 2, 0), Vector3d(0, 0, 1));
+	obs.add(rectangle);
+	EXPECT_THROW(ObserverRectangle(Vector3d(0.), Vector3d(1, 0, 0), Vector3d(1, 1, 0)), std::runtime_error);
+
+	// crossing of the plane outside of the rectangle
+	Candidate c;
+	c.previous.setPosition(Vector3d(-1, 2.5, 0.5));
+	c.current.setPosition(Vector3d(1, 2.5, 0.5));
+	c.setCurrentStep(2);
+	obs.process(&c);
+	EXPECT_TRUE(c.isActive());
+	EXPECT_NEAR(sqrt(10.), rectangle->distanceToArea(Vector3d(-3, 1, 2)), 1e-12);
+
+	// crossing inside
+	c.previous.setPosition(Vector3d(-1, 1.5, 0.5));
+	c.current.setPosition(Vector3d(1, 1.5, 0.5));
+	obs.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_DOUBLE_EQ(0, c.current.getPosition().x);
+	EXPECT_NEAR(1, c.getCurrentStep(), 1e-9);
+}
+
+TEST(ObserverFeature, Disc) {
+	Observer obs;
+	ObserverDisc *disc = new ObserverDisc(Vector3d(0, 0, 10), Vector3d(0, 0, 1), 2);
+	obs.add(disc);
+	EXPECT_NEAR(5, disc->distanceToArea(Vector3d(0, 6, 13)), 1e-12);
+	EXPECT_NEAR(3, disc->distanceToArea(Vector3d(1, 1, 7)), 1e-12);
+
+	// crossing outside of the disc
+	Candidate c;
+	c.previous.setPosition(Vector3d(2, 1, 9));
+	c.current.setPosition(Vector3d(2, 1, 11));
+	c.setCurrentStep(2);
+	obs.process(&c);
+	EXPECT_TRUE(c.isActive());
+
+	// crossing inside
+	c.previous.setPosition(Vector3d(1, 1, 9));
+	c.current.setPosition(Vector3d(1, 1, 11));
+	obs.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_DOUBLE_EQ(10, c.current.getPosition().z);
+}
+
+TEST(ObserverFeature, ReceiverArray) {
+	// 20 x 20 antennas in 100 m depth
+	std::vector<Vector3d> antennas;
+	for (int i = 0; i < 20; i++)
+		for (int j = 0; j < 20; j++)
+			antennas.push_back(Vector3d(10 * i, 10 * j, -100 + (i % 3)));
+	ObserverReceiverArray *array = new ObserverReceiverArray(antennas, 1.5);
+	EXPECT_EQ(400, array->getNumberOfReceivers());
+	Observer obs;
+	obs.setDeactivateOnDetection(false);
+	obs.add(array);
+
+	// first receiver entered compared to testing all receivers
+	Random random(42);
+	int detections = 0;
+	for (int k = 0; k < 1000; k++) {
+		Vector3d a(random.randUniform(-5, 195), random.randUniform(-5, 195), random.randUniform(-103, -97));
+		Vector3d b = a + random.randVector() * random.randUniform(0, 20);
+		double tBest = 1;
+		int expected = -1;
+		for (size_t i = 0; i < antennas.size(); i++) {
+			Vector3d m = a - antennas[i];
+			if (m.getR() <= 1.5)
+				continue;
+			Vector3d d = b - a;
+			double p = m.dot(d) / d.getR2(), q = (m.getR2() - 2.25) / d.getR2();
+			if (p * p - q < 0)
+				continue;
+			double t = -p - sqrt(p * p - q);
+			if ((t >= 0) && (t <= tBest)) {
+				tBest = t;
+				expected = i;
+			}
+		}
+
+		Candidate c;
+		c.previous.setPosition(a);
+		c.current.setPosition(b);
+		c.setCurrentStep((b - a).getR());
+		obs.process(&c);
+		ASSERT_EQ(expected >= 0, c.hasProperty("ReceiverIndex"));
+		if (expected < 0)
+			continue;
+		detections++;
+		EXPECT_EQ(expected, c.getProperty("ReceiverIndex").asUInt64());
+		EXPECT_NEAR(1.5, (c.current.getPosition() - antennas[expected]).getR(), 1e-9);
+		EXPECT_TRUE(c.isActive());
+	}
+	EXPECT_GT(detections, 50);
+
+	// a step leaving a sphere after its detection
+	Candidate c;
+	c.previous.setPosition(Vector3d(0, 0, -101.5));
+	c.current.setPosition(Vector3d(0, 0, -90));
+	c.setCurrentStep(11.5);
+	obs.process(&c);
+	EXPECT_FALSE(c.hasProperty("ReceiverIndex"));
+
+	// step limiting to the nearest sphere not containing the candidate
+	array->setStepLimiting(true, 0.1);
+	c.previous.setPosition(Vector3d(0, 0, -80));
+	c.current.setPosition(Vector3d(0, 0, -90));
+	c.setNextStep(100);
+	obs.process(&c);
+	EXPECT_NEAR(8.5, c.getNextStep(), 1e-12);
+	EXPECT_NEAR(8.5, array->distanceToNearest(Vector3d(0, 0, -90)), 1e-12);
+	EXPECT_NEAR(8.5, array->distanceToNearest(Vector3d(0, 0, -100)), 1e-12);
 }
 
 TEST(ObserverFeature, DetectAll) {
@@ -289,6 +528,17 @@ TEST(CubicBoundary, outside) {
 	EXPECT_TRUE(c.hasProperty("Rejected"));
 }
 
+TEST(CubicBoundary, crossing) {
+	CubicBoundary cube(Vector3d(0, 0, 0), 10);
+	Candidate c;
+	c.previous.setPosition(Vector3d(5, 9, 5));
+	c.current.setPosition(Vector3d(5, 11, 5));
+	c.setCurrentStep(2);
+	cube.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(10, c.current.getPosition().y, 1e-9);
+}
+
 TEST(CubicBoundary, limitStepLower) {
 	CubicBoundary cube(Vector3d(10, 10, 10), 10);
 	cube.setLimitStep(true);
@@ -330,6 +580,20 @@ TEST(SphericalBoundary, outside) {
 	EXPECT_TRUE(c.hasProperty("I passed the galactic border"));
 }
 
+TEST(SphericalBoundary, crossing) {
+	// the rejected candidate is moved back to the boundary
+	SphericalBoundary sphere(Vector3d(0, 0, 0), 10);
+	Candidate c;
+	c.previous.setPosition(Vector3d(0, 0, 8));
+	c.current.setPosition(Vector3d(0, 0, 12));
+	c.setCurrentStep(4);
+	sphere.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(10, c.current.getPosition().z, 1e-9);
+	EXPECT_NEAR(2, c.getCurrentStep(), 1e-9);
+	EXPECT_NEAR(2, c.getTrajectoryLength(), 1e-9);
+}
+
 TEST(SphericalBoundary, limitStep) {
 	SphericalBoundary sphere(Vector3d(0, 0, 0), 10);
 	sphere.setLimitStep(true);
@@ -399,6 +663,233 @@ TEST(CylindricalBoundary, limitStep) {
 	EXPECT_DOUBLE_EQ(c.getNextStep(), 1.5);
 }
 
+//** ========================= Interfaces =================================== */
+// refractive index n1 below z = 0 and n2 above
+class StepField: public ScalarField {
+	double n1, n2;
+public:
+	StepField(double n1, double n2) : n1(n1), n2(n2) {
+	}
+	double getValue(const Vector3d &position) const {
+		return (position.z < 0) ? n1 : n2;
+	}
+};
+
+// candidate stepping straight from start to end
+Candidate straightStep(Vector3d start, Vector3d end) {
+	Candidate c;
+	c.previous.setPosition(start);
+	c.previous.setDirection(end - start);
+	c.current.setPosition(end);
+	c.current.setDirection(end - start);
+	c.current.setAmplitude(1);
+	c.setCurrentStep((end - start).getR());
+	return c;
+}
+
+TEST(TransmissiveLayer, normalIncidence) {
+	TransmissiveLayer layer(Vector3d(5, 5, 0), Vector3d(0, 0, 2), new StepField(1, 1.5));
+	Candidate c = straightStep(Vector3d(0, 0, -1), Vector3d(0, 0, 3));
+	layer.process(&c);
+
+	// reflected at the plane
+	EXPECT_NEAR(0, c.current.getPosition().z, 1e-12);
+	EXPECT_NEAR(1, c.getCurrentStep(), 1e-12);
+	EXPECT_NEAR(-1, c.current.getDirection().z, 1e-12);
+	EXPECT_NEAR(0.2, c.current.getAmplitude(), 1e-12);
+
+	// transmitted secondary
+	ASSERT_EQ(1, c.secondaries.size());
+	Candidate *s = c.secondaries[0];
+	EXPECT_NEAR(0, s->current.getPosition().z, 1e-12);
+	EXPECT_NEAR(1, s->current.getDirection().z, 1e-12);
+	EXPECT_NEAR(0.8, s->current.getAmplitude(), 1e-12);
+	EXPECT_EQ(&c, s->parent);
+
+	// the next step starts on the plane and is not another crossing
+	c.previous = c.current;
+	c.current.setPosition(Vector3d(0, 0, -2));
+	layer.process(&c);
+	EXPECT_EQ(1, c.secondaries.size());
+}
+
+TEST(TransmissiveLayer, snell) {
+	double n1 = 1.35, n2 = 1.78;
+	TransmissiveLayer layer(Vector3d(0.), Vector3d(0, 0, 1), new StepField(n1, n2));
+	Vector3d direction(sin(0.6), 0, cos(0.6));
+	for (int p = 0; p < 2; p++) {
+		layer.setPolarization(p ? TransmissiveLayer::TM : TransmissiveLayer::TE);
+		Candidate c = straightStep(direction * -2., direction * 3.);
+		layer.process(&c);
+		ASSERT_EQ(1, c.secondaries.size());
+		Candidate *s = c.secondaries[0];
+
+		// angle of reflection and Snell's law
+		Vector3d reflected = c.current.getDirection();
+		Vector3d refracted = s->current.getDirection();
+		EXPECT_NEAR(-direction.z, reflected.z, 1e-12);
+		EXPECT_NEAR(direction.x, reflected.x, 1e-12);
+		EXPECT_NEAR(n1 * sin(0.6), n2 * refracted.x, 1e-12);
+		EXPECT_NEAR(1, refracted.getR(), 1e-12);
+		EXPECT_GT(refracted.z, 0);
+
+		// conservation of the energy flux through the plane
+		double r = c.current.getAmplitude(), t = s->current.getAmplitude();
+		EXPECT_NEAR(1, r * r + n2 * refracted.z / (n1 * direction.z) * t * t, 1e-12);
+	}
+}
+
+TEST(TransmissiveLayer, totalReflection) {
+	// from the optically dense side beyond the critical angle
+	TransmissiveLayer layer(Vector3d(0.), Vector3d(0, 0, 1), new StepField(1.0, 1.5));
+	Vector3d direction(sin(1.), 0, -cos(1.));
+	Candidate c = straightStep(direction * -2., direction * 3.);
+	layer.process(&c);
+	EXPECT_EQ(0, c.secondaries.size());
+	EXPECT_DOUBLE_EQ(1, c.current.getAmplitude());
+	EXPECT_NEAR(cos(1.), c.current.getDirection().z, 1e-12);
+
+	// no crossing
+	Candidate d = straightStep(Vector3d(0, 0, 1), Vector3d(1, 0, 2));
+	layer.process(&d);
+	EXPECT_EQ(0, d.secondaries.size());
+	EXPECT_DOUBLE_EQ(2, d.current.getPosition().z);
+}
+
+// the square |x|, |y| < 100 in the plane z = 0
+ref_ptr<TriangleMesh> flatSquare() {
+	std::vector<Vector3d> vertices;
+	vertices.push_back(Vector3d(-100, -100, 0));
+	vertices.push_back(Vector3d(100, -100, 0));
+	vertices.push_back(Vector3d(100, 100, 0));
+	vertices.push_back(Vector3d(-100, 100, 0));
+	unsigned int corners[6] = {0, 1, 2, 0, 2, 3};
+	return new TriangleMesh(vertices, std::vector<unsigned int>(corners, corners + 6));
+}
+
+TEST(TransmissiveSurface, sameAsLayer) {
+	ref_ptr<ScalarField> field = new StepField(1.35, 1.78);
+	TransmissiveLayer layer(Vector3d(0.), Vector3d(0, 0, 1), field, TransmissiveLayer::TM);
+	TransmissiveSurface surface(flatSquare(), field, TransmissiveSurface::TM);
+	EXPECT_EQ("TransmissiveSurface, TriangleMesh: 2 triangles, polarization = TM", surface.getDescription());
+	// through the common edge of the two triangles
+	Vector3d direction(sin(0.6), 0.1, -cos(0.6));
+	Candidate c1 = straightStep(direction * -2., direction * 3.);
+	Candidate c2 = c1;
+	layer.process(&c1);
+	surface.process(&c2);
+
+	EXPECT_NEAR(0, (c1.current.getPosition() - c2.current.getPosition()).getR(), 1e-12);
+	EXPECT_NEAR(0, (c1.current.getDirection() - c2.current.getDirection()).getR(), 1e-12);
+	EXPECT_NEAR(c1.current.getAmplitude(), c2.current.getAmplitude(), 1e-12);
+	EXPECT_NEAR(c1.getCurrentStep(), c2.getCurrentStep(), 1e-12);
+	ASSERT_EQ(1, c2.secondaries.size());
+	EXPECT_NEAR(0, (c1.secondaries[0]->current.getDirection() - c2.secondaries[0]->current.getDirection()).getR(), 1e-12);
+	EXPECT_NEAR(c1.secondaries[0]->current.getAmplitude(), c2.secondaries[0]->current.getAmplitude(), 1e-12);
+
+	// the next step starts on the surface and is not another crossing
+	c2.previous = c2.current;
+	c2.current.setPosition(c2.current.getPosition() + c2.current.getDirection());
+	surface.process(&c2);
+	EXPECT_EQ(1, c2.secondaries.size());
+
+	// outside of the square
+	Candidate c3 = straightStep(Vector3d(150, 0, 1), Vector3d(150, 0, -1));
+	surface.process(&c3);
+	EXPECT_EQ(0, c3.secondaries.size());
+}
+
+TEST(Observer, earliestCrossing) {
+	// the step is truncated once, at the earliest crossing of the detecting features
+	Observer obs;
+	obs.add(new ObserverPlane(Vector3d(0, 0, -2), Vector3d(0, 0, 1)));
+	obs.add(new ObserverPlane(Vector3d(0, 0, -1), Vector3d(0, 0, 1)));
+	Candidate c = straightStep(Vector3d(0, 0, 0), Vector3d(0, 0, -4));
+	obs.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(-1, c.current.getPosition().z, 1e-9);
+	EXPECT_NEAR(1, c.getCurrentStep(), 1e-9);
+
+	// a vetoed candidate keeps its step
+	Observer vetoed;
+	vetoed.add(new ObserverPlane(Vector3d(0, 0, -1), Vector3d(0, 0, 1)));
+	vetoed.add(new ObserverInactiveVeto());
+	Candidate d = straightStep(Vector3d(0, 0, 0), Vector3d(0, 0, -4));
+	d.setActive(false);
+	vetoed.process(&d);
+	EXPECT_DOUBLE_EQ(-4, d.current.getPosition().z);
+	EXPECT_DOUBLE_EQ(4, d.getCurrentStep());
+
+	// checking a feature does not modify the candidate
+	ObserverPlane plane(Vector3d(0, 0, -1), Vector3d(0, 0, 1));
+	Candidate e = straightStep(Vector3d(0, 0, 0), Vector3d(0, 0, -4));
+	double fraction;
+	EXPECT_EQ(DETECTED, plane.checkCrossing(&e, fraction));
+	EXPECT_NEAR(0.25, fraction, 1e-12);
+	EXPECT_EQ(DETECTED, plane.checkDetection(&e));
+	EXPECT_DOUBLE_EQ(-4, e.current.getPosition().z);
+}
+
+TEST(ObserverSurface, detection) {
+	Observer obs;
+	obs.add(new ObserverSurface(flatSquare()));
+	Candidate c = straightStep(Vector3d(10, 10, 4), Vector3d(10, 20, -1));
+	obs.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(0, (c.current.getPosition() - Vector3d(10, 18, 0)).getR(), 1e-12);
+
+	Candidate d = straightStep(Vector3d(10, 10, 4), Vector3d(10, 20, 1));
+	obs.process(&d);
+	EXPECT_TRUE(d.isActive());
+}
+
+TEST(ObserverSurface, continueAfterDetection) {
+	// without deactivation the next step starts on the surface and is not detected again
+	Observer obs;
+	obs.setDeactivateOnDetection(false);
+	obs.add(new ObserverSurface(flatSquare()));
+	Candidate c = straightStep(Vector3d(10, 10, 4), Vector3d(10, 10, -4));
+	obs.process(&c);
+	EXPECT_NEAR(0, c.current.getPosition().z, 1e-12);
+	EXPECT_NEAR(4, c.getCurrentStep(), 1e-12);
+
+	Candidate next = straightStep(c.current.getPosition(), Vector3d(10, 10, -4));
+	obs.process(&next);
+	EXPECT_NEAR(-4, next.current.getPosition().z, 1e-12);
+	EXPECT_NEAR(4, next.getCurrentStep(), 1e-12);
+}
+
+TEST(ReflectiveSurface, heightmap) {
+	// tilted plane z = 0.5 x - 10 sampled on a raster
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(-50, -50, 0), 100, 100, 1, 1.);
+	for (int ix = 0; ix < 100; ix++)
+		for (int iy = 0; iy < 100; iy++)
+			grid->get(ix, iy, 0) = 0.5 * (ix - 49.5) - 10;
+	ReflectiveSurface surface(new Heightmap(grid));
+
+	Candidate c = straightStep(Vector3d(3, 2, 10), Vector3d(3, 2, -20));
+	surface.process(&c);
+	EXPECT_NEAR(-8.5, c.current.getPosition().z, 1e-9);
+	EXPECT_NEAR(18.5, c.getCurrentStep(), 1e-9);
+	// mirrored at the normal (-0.5, 0, 1) / |n|
+	Vector3d n = Vector3d(-0.5, 0, 1).getUnitVector();
+	Vector3d expected = Vector3d(0, 0, -1) + n * (2 * n.z);
+	EXPECT_NEAR(0, (c.current.getDirection() - expected).getR(), 1e-12);
+
+	// the next step leaves the surface without another reflection
+	Candidate next = straightStep(c.current.getPosition(), c.current.getPosition() + expected * 5);
+	surface.process(&next);
+	EXPECT_NEAR(0, (next.current.getDirection() - expected).getR(), 1e-12);
+
+	// detection with the same surface
+	Observer obs;
+	obs.add(new ObserverSurface(surface.getSurface()));
+	Candidate d = straightStep(Vector3d(3, 2, 10), Vector3d(3, 2, -20));
+	obs.process(&d);
+	EXPECT_FALSE(d.isActive());
+	EXPECT_NEAR(-8.5, d.current.getPosition().z, 1e-9);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -3,6 +3,9 @@
   	ParticleState
   	Random
   	Common functions
+  	ScalarField
+  	Surface
+  	TriangleMesh
  */
 
 #include "radiopropa/Candidate.h"
@@ -14,12 +17,29 @@
 #include "radiopropa/Grid.h"
 #include "radiopropa/GridTools.h"
 #include "radiopropa/EmissionMap.h"
+#include "radiopropa/ScalarField.h"
+#include "radiopropa/Scene.h"
+#include "radiopropa/Surface.h"
+#include "radiopropa/TriangleMesh.h"
 
 #include <HepPID/ParticleIDMethods.hh>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdint.h>
 #include "gtest/gtest.h"
 
 namespace radiopropa {
 
+// path of a scratch file in the temporary directory
+std::string temporaryFile(const std::string &name) {
+	const char *directory = std::getenv("TMPDIR");
+	return std::string(directory ? directory : "/tmp") + "/" + name;
+}
+
 TEST(ParticleState, position) {
 	ParticleState particle;
 	Vector3d v(1, 3, 5);
@@ -87,6 +107,15 @@ TEST(ParticleState, Charge) {
 	EXPECT_DOUBLE_EQ(0, particle.getCharge());
 }
 
+TEST(ParticleState, radioRay) {
+	// mass and charge are derived from the id, a radio ray has neither
+	ParticleState particle;
+	EXPECT_EQ(0, particle.getMass());
+	EXPECT_EQ(0, particle.getCharge());
+	particle.setId(11);
+	EXPECT_DOUBLE_EQ(mass_electron, particle.getMass());
+}
+
 TEST(ParticleState, Rigidity) {
 	ParticleState particle;
 
@@ -102,6 +131,39 @@ TEST(Candidate, currentStep) {
 	EXPECT_DOUBLE_EQ(candidate.getCurrentStep(), 1 * Mpc);
 }
 
+TEST(Candidate, denseOutput) {
+	// Hermite interpolation reproduces the parabola x = (s, s^2, 0)
+	Candidate c;
+	c.previous.setPosition(Vector3d(0, 0, 0));
+	c.current.setPosition(Vector3d(1, 1, 0));
+	c.setCurrentStep(1);
+	EXPECT_FALSE(c.hasStepDerivatives());
+	EXPECT_NEAR(0, (c.getInterpolatedPosition(0.5) - Vector3d(0.5, 0.5, 0)).getR(), 1e-12);
+
+	c.setStepDerivatives(Vector3d(1, 0, 0), Vector3d(1, 2, 0));
+	EXPECT_TRUE(c.hasStepDerivatives());
+	EXPECT_NEAR(0, (c.getInterpolatedPosition(0.5) - Vector3d(0.5, 0.25, 0)).getR(), 1e-12);
+	EXPECT_NEAR(0, (c.getInterpolatedDirection(0.5) - Vector3d(1, 1, 0).getUnitVector()).getR(), 1e-12);
+
+	// crossing of the plane y = 0.25
+	struct Y {
+		double operator()(const Vector3d &x) const { return x.y - 0.25; }
+	};
+	double t = c.locateCrossing(Y(), -0.25, 0.75);
+	EXPECT_NEAR(0.5, t, 1e-9);
+
+	// the truncated step keeps the same curve
+	c.truncateStep(0.5);
+	EXPECT_DOUBLE_EQ(0.5, c.getCurrentStep());
+	EXPECT_DOUBLE_EQ(0.5, c.getTrajectoryLength());
+	EXPECT_NEAR(0, (c.current.getPosition() - Vector3d(0.5, 0.25, 0)).getR(), 1e-12);
+	EXPECT_NEAR(0, (c.getInterpolatedPosition(0.5) - Vector3d(0.25, 0.0625, 0)).getR(), 1e-12);
+
+	// a new step discards the derivatives
+	c.setCurrentStep(1);
+	EXPECT_FALSE(c.hasStepDerivatives());
+}
+
 TEST(Candidate, limitNextStep) {
 	Candidate candidate;
 	candidate.setNextStep(5 * Mpc);
@@ -127,6 +189,109 @@ TEST(Candidate, property) {
 	EXPECT_EQ("bar", value);
 }
 
+TEST(Candidate, propertyKey) {
+	PropertyKey foo = propertyKey("foo");
+	EXPECT_EQ(foo, propertyKey("foo"));
+	EXPECT_NE(foo, propertyKey("bar"));
+	EXPECT_EQ("foo", propertyName(foo));
+
+	// the string and the key API access the same property
+	Candidate candidate;
+	candidate.setProperty(foo, 1.5);
+	EXPECT_TRUE(candidate.hasProperty("foo"));
+	EXPECT_DOUBLE_EQ(1.5, candidate.getProperty("foo").asDouble());
+	EXPECT_THROW(candidate.getProperty(propertyKey("baz")), std::runtime_error);
+	EXPECT_TRUE(candidate.removeProperty(foo));
+	EXPECT_FALSE(candidate.hasProperty("foo"));
+	EXPECT_FALSE(candidate.removeProperty(foo));
+}
+
+TEST(Candidate, propertyLookupDoesNotRegister) {
+	Candidate candidate;
+	PropertyKey key;
+	EXPECT_FALSE(candidate.hasProperty("neverSet"));
+	EXPECT_FALSE(candidate.removeProperty("neverSet"));
+	EXPECT_THROW(candidate.getProperty("neverSet"), std::runtime_error);
+	EXPECT_FALSE(findPropertyKey("neverSet", key));
+
+	candidate.setProperty("neverSet", 1);
+	EXPECT_TRUE(findPropertyKey("neverSet", key));
+	EXPECT_EQ(key, propertyKey("neverSet"));
+}
+
+TEST(Candidate, propertyKeysOfOtherThreads) {
+	// names registered by other threads are found by the cache of this thread
+	std::vector<PropertyKey> keys(8);
+#pragma omp parallel for
+	for (int i = 0; i < 8; i++) {
+		std::stringstream name;
+		name << "threadName" << i;
+		keys[i] = propertyKey(name.str());
+	}
+	for (int i = 0; i < 8; i++) {
+		std::stringstream name;
+		name << "threadName" << i;
+		PropertyKey key;
+		EXPECT_TRUE(findPropertyKey(name.str(), key));
+		EXPECT_EQ(keys[i], key);
+		EXPECT_EQ(name.str(), propertyName(key));
+	}
+}
+
+TEST(Candidate, propertyNamesInParallel) {
+	// names are resolved by every thread while others register new ones
+	std::vector<int> resolved(64, 0);
+#pragma omp parallel for
+	for (int i = 0; i < 64; i++) {
+		std::stringstream name;
+		name << "parallelName" << i;
+		PropertyKey key = propertyKey(name.str());
+		resolved[i] = (propertyName(key) == name.str())
+				&& (propertyName(propertyKey("foo")) == "foo");
+	}
+	for (int i = 0; i < 64; i++)
+		EXPECT_TRUE(resolved[i]);
+	EXPECT_THROW(propertyName(PropertyKey(1000000)), std::runtime_error);
+}
+
+TEST(PropertyMap, iterator) {
+	// names and values like the former map of names
+	Candidate candidate;
+	candidate.setProperty("first", 1);
+	candidate.setProperty("second", "two");
+	std::map<std::string, std::string> seen;
+	Candidate::PropertyMap::const_iterator i;
+	for (i = candidate.properties.begin(); i != candidate.properties.end(); ++i)
+		seen[i->first] = i->second.toString();
+	EXPECT_EQ(2, seen.size());
+	EXPECT_EQ("1", seen["first"]);
+	EXPECT_EQ("two", seen["second"]);
+}
+
+TEST(PropertyMap, overflow) {
+	// more properties than inline slots, removed in an arbitrary order
+	PropertyMap properties;
+	size_t n = PropertyMap::slots + 3;
+	for (size_t i = 0; i < n; i++)
+		properties.set(100 + i, Variant::fromUInt64(i));
+	EXPECT_EQ(n, properties.size());
+	properties.set(100, Variant::fromUInt64(42));
+	EXPECT_EQ(n, properties.size());
+	EXPECT_EQ(42, properties.find(100)->asUInt64());
+
+	EXPECT_TRUE(properties.erase(101));
+	EXPECT_TRUE(properties.erase(100 + n - 1));
+	EXPECT_FALSE(properties.erase(101));
+	EXPECT_EQ(n - 2, properties.size());
+	EXPECT_TRUE(properties.find(101) == 0);
+	for (size_t i = 2; i < n - 1; i++)
+		EXPECT_EQ(i, properties.find(100 + i)->asUInt64());
+
+	properties.clear();
+	EXPECT_TRUE(properties.empty());
+	EXPECT_TRUE(properties.find(102) == 0);
+}
+
 TEST(Candidate, addSecondary) {
 	Candidate c;
 	c.current.setAmplitude(5);
@@ -149,6 +314,34 @@ TEST(Candidate, addSecondary) {
 	EXPECT_TRUE(Vector3d(0,0,1) == s.created.getDirection());
 }
 
+TEST(Candidate, size) {
+	// only the hot part is stored in the candidate, the provenance, properties and random stream are allocated apart
+	EXPECT_LE(sizeof(Candidate), 320u);
+	EXPECT_LT(sizeof(Candidate), 2 * sizeof(ParticleState) + 2 * sizeof(Vector3d) + sizeof(PropertyMap) + sizeof(RandomStream));
+}
+
+TEST(Candidate, copy) {
+	Candidate c(ParticleState(0, 1, Vector3d(1, 2, 3)));
+	c.setProperty("foo", 1);
+	c.addSecondary(0, 2);
+
+	Candidate d(c);
+	EXPECT_EQ(c.getSerialNumber(), d.getSerialNumber());
+	EXPECT_EQ(Vector3d(1, 2, 3), d.source.getPosition());
+	EXPECT_EQ(1, d.secondaries.size());
+	d.source.setPosition(Vector3d(4, 5, 6));
+	d.removeProperty("foo");
+	EXPECT_EQ(Vector3d(1, 2, 3), c.source.getPosition());
+	EXPECT_TRUE(c.hasProperty("foo"));
+
+	Candidate e;
+	e = c;
+	EXPECT_EQ(c.getSerialNumber(), e.getSerialNumber());
+	EXPECT_EQ(Vector3d(1, 2, 3), e.source.getPosition());
+	EXPECT_TRUE(e.hasProperty("foo"));
+	EXPECT_EQ(c.getRandomStream().randInt(), e.getRandomStream().randInt());
+}
+
 
 TEST(Candidate, serialNumber) {
 	Candidate::setNextSerialNumber(42);
@@ -156,6 +349,56 @@ TEST(Candidate, serialNumber) {
 	EXPECT_EQ(43, c.getSourceSerialNumber());
 }
 
+TEST(CandidatePool, recycle) {
+	CandidatePool::clear();
+	CandidatePool::resetStatistics();
+
+	ref_ptr<Candidate> c = CandidatePool::acquire(ParticleState(0, 1, Vector3d(1, 2, 3)));
+	EXPECT_EQ(Vector3d(1, 2, 3), c->source.getPosition());
+	c->setProperty("foo", "bar");
+	c->setTrajectoryLength(5);
+	c->setActive(false);
+	c->addSecondary(0, 1);
+	EXPECT_EQ(2, CandidatePool::getAllocations());
+	EXPECT_EQ(0, CandidatePool::getReuses());
+
+	// the candidate and its secondary return to the pool and come back as new candidates
+	Candidate *address = c.get();
+	uint64_t serialNumber = c->getSerialNumber();
+	c = 0;
+	c = CandidatePool::acquire();
+	EXPECT_EQ(address, c.get());
+	EXPECT_EQ(1, CandidatePool::getReuses());
+	EXPECT_FALSE(c->hasProperty("foo"));
+	EXPECT_EQ(0, c->secondaries.size());
+	EXPECT_TRUE(c->isActive());
+	EXPECT_EQ(0, c->getTrajectoryLength());
+	EXPECT_EQ(0, c->parent);
+	EXPECT_EQ(Vector3d(0, 0, 0), c->source.getPosition());
+	EXPECT_LT(serialNumber, c->getSerialNumber());
+	c = 0;
+
+	// no allocations in the steady state
+	for (int i = 0; i < 100; i++) {
+		ref_ptr<Candidate> candidate = CandidatePool::acquire();
+		candidate->addSecondary(0, 1);
+		ref_ptr<Candidate> cloned = candidate->clone(true);
+	}
+	EXPECT_EQ(4, CandidatePool::getAllocations());
+
+	// candidates that were not acquired from the pool are deleted
+	CandidatePool::clear();
+	CandidatePool::resetStatistics();
+	c = new Candidate();
+	c = 0;
+	c = CandidatePool::acquire();
+	EXPECT_EQ(1, CandidatePool::getAllocations());
+	EXPECT_EQ(0, CandidatePool::getReuses());
+	c = 0;
+
+	CandidatePool::clear();
+}
+
 TEST(common, digit) {
 	EXPECT_EQ(1, digit(1234, 1000));
 	EXPECT_EQ(2, digit(1234, 100));
@@ -237,6 +480,7 @@ TEST(PIDdigit, consistencyWithReferenceImplementation){
 }
 
 TEST(Random, seed) {
+	uint64_t previousSeed = RandomStream::getRunSeed();
 	Random &a = Random::instance();
 	Random &b = Random::instance();
 
@@ -254,6 +498,100 @@ TEST(Random, seed) {
 
 	// seeding should work for all instances
 	EXPECT_EQ(r1, r3);
+	RandomStream::setRunSeed(previousSeed);
+}
+
+TEST(Random, seedRunSeed) {
+	uint64_t previousSeed = RandomStream::getRunSeed();
+
+	// seeding the instance of the master thread seeds the sources and candidates as before
+	Random::instance().seed(42);
+	EXPECT_EQ(42, RandomStream::getRunSeed());
+	EXPECT_EQ(42, Candidate().getRandomStream().getSeed());
+	Random::seedThreads(7);
+	EXPECT_EQ(7, RandomStream::getRunSeed());
+
+	// other generators do not
+	Random other;
+	other.seed(3);
+	EXPECT_EQ(7, RandomStream::getRunSeed());
+	RandomStream::setRunSeed(previousSeed);
+}
+
+TEST(RandomStream, philox) {
+	// known answer of Philox4x32-10 for the zero key and counter (Random123)
+	RandomStream random(0, 0);
+	EXPECT_EQ(0x6627e8d5u, random.randInt());
+	EXPECT_EQ(0xe169c58du, random.randInt());
+	EXPECT_EQ(0xbc57ac4cu, random.randInt());
+	EXPECT_EQ(0x9b00dbd8u, random.randInt());
+	EXPECT_EQ(4, random.getCounter());
+
+	// any position of a stream is reached directly
+	RandomStream a(42, 7);
+	for (int i = 0; i < 10; i++)
+		a.randInt();
+	RandomStream b(42, 7, 10);
+	EXPECT_EQ(a.randInt(), b.randInt());
+
+	// streams of other seeds, serial numbers and secondaries differ
+	RandomStream c(42, 8, 11);
+	RandomStream d(43, 7, 11);
+	RandomStream e = b.split(0);
+	b.setCounter(11);
+	uint32_t r = b.randInt();
+	EXPECT_NE(r, c.randInt());
+	EXPECT_NE(r, d.randInt());
+	EXPECT_NE(r, e.randInt());
+	EXPECT_EQ(b.split(0).randInt(), b.split(0).randInt());
+	EXPECT_NE(b.split(0).randInt(), b.split(1).randInt());
+}
+
+TEST(RandomStream, fill) {
+	// the bulk generation continues the stream like single draws
+	RandomStream a(1, 2, 3);
+	RandomStream b(1, 2, 3);
+	std::vector<double> values(203);
+	a.fillUniform(&values[0], values.size());
+	for (size_t i = 0; i < values.size(); i++) {
+		EXPECT_EQ(b.rand(), values[i]);
+		EXPECT_GE(values[i], 0);
+		EXPECT_LT(values[i], 1);
+	}
+	EXPECT_EQ(b.getCounter(), a.getCounter());
+
+	// moments of the normal distribution
+	std::vector<double> normals(100001);
+	a.fillNormal(&normals[0], normals.size(), 1, 2);
+	double sum = 0, sum2 = 0;
+	for (size_t i = 0; i < normals.size(); i++) {
+		sum += normals[i];
+		sum2 += normals[i] * normals[i];
+	}
+	double mean = sum / normals.size();
+	EXPECT_NEAR(1, mean, 0.03);
+	EXPECT_NEAR(4, sum2 / normals.size() - mean * mean, 0.1);
+}
+
+TEST(RandomStream, candidate) {
+	uint64_t previousSeed = RandomStream::getRunSeed();
+	RandomStream::setRunSeed(3);
+	Candidate candidate;
+	EXPECT_EQ(3, candidate.getRandomStream().getSeed());
+	EXPECT_EQ(candidate.getSerialNumber(), candidate.getRandomStream().getStream());
+
+	// the stream restarts with the serial number
+	candidate.setSerialNumber(12);
+	double r = candidate.getRandomStream().rand();
+	candidate.setSerialNumber(12);
+	EXPECT_EQ(r, candidate.getRandomStream().rand());
+
+	// secondaries continue with a stream split from their parent
+	candidate.addSecondary(0, 0);
+	candidate.addSecondary(0, 0);
+	EXPECT_EQ(candidate.getRandomStream().split(1).getStream(),
+			candidate.secondaries[1]->getRandomStream().getStream());
+	RandomStream::setRunSeed(previousSeed);
 }
 
 TEST(Grid, PeriodicClamp) {
@@ -536,6 +874,558 @@ TEST(Variant, stringConversion)
 	}
 }
 
+TEST(Variant, strings)
+{
+	// inline and heap strings, copied into each other
+	std::string shortString = "Detected";
+	std::string longString(3 * Variant::smallStringSize, 'x');
+	Variant s(shortString), l(longString);
+	EXPECT_TRUE(s == shortString);
+	EXPECT_TRUE(l == longString);
+	EXPECT_EQ(shortString.size(), s.getSize());
+	EXPECT_EQ(longString.size(), l.getSize());
+
+	Variant v = s;
+	EXPECT_TRUE(v == s);
+	v = l;
+	EXPECT_EQ(longString, v.toString());
+	v = shortString;
+	EXPECT_EQ(shortString, v.asString());
+	v = v;
+	EXPECT_EQ(shortString, v.toString());
+	EXPECT_FALSE(v != "Detected");
+
+	char buffer[100];
+	EXPECT_EQ(longString.size(), l.copyToBuffer(buffer));
+	EXPECT_EQ(longString, std::string(buffer, longString.size()));
+
+	v = 1.5;
+	EXPECT_DOUBLE_EQ(1.5, v.asDouble());
+	EXPECT_THROW(v.asString(), Variant::bad_conversion);
+}
+
+#if __cplusplus >= 201103L
+TEST(Variant, move) {
+	std::string shortString = "Detected";
+	std::string longString(3 * Variant::smallStringSize, 'x');
+
+	// move construction leaves the source empty
+	Variant s(shortString), l(longString);
+	Variant ms(std::move(s)), ml(std::move(l));
+	EXPECT_EQ(shortString, ms.asString());
+	EXPECT_EQ(longString, ml.asString());
+	EXPECT_EQ(Variant::TYPE_NONE, s.getType());
+	EXPECT_EQ(Variant::TYPE_NONE, l.getType());
+
+	// inline -> heap
+	Variant v(longString);
+	v = Variant(shortString);
+	EXPECT_EQ(shortString, v.asString());
+	EXPECT_EQ(shortString.size(), v.getSize());
+
+	// heap -> inline
+	v = Variant(longString);
+	EXPECT_EQ(longString, v.asString());
+	EXPECT_EQ(longString.size(), v.getSize());
+
+	// heap -> heap and a non-string source
+	Variant w(std::string(2 * Variant::smallStringSize, 'y'));
+	v = std::move(w);
+	EXPECT_EQ(std::string(2 * Variant::smallStringSize, 'y'), v.asString());
+	EXPECT_EQ(Variant::TYPE_NONE, w.getType());
+	v = Variant(1.5);
+	EXPECT_DOUBLE_EQ(1.5, v.asDouble());
+
+	// moved-from variants can be reused
+	s = longString;
+	EXPECT_EQ(longString, s.asString());
+	Variant &self = ml;
+	ml = std::move(self);
+	EXPECT_EQ(longString, ml.asString());
+}
+#endif
+
+void compareBatchEvaluation(const ScalarField &field) {
+	size_t n = 101;
+	std::vector<double> x(n), y(n), z(n), v(n), w(n), gx(n), gy(n), gz(n);
+	for (size_t i = 0; i < n; i++) {
+		x[i] = 0.5 * i;
+		y[i] = -0.25 * i;
+		z[i] = -2000. + 40. * i;
+	}
+	field.getValues(n, &x[0], &y[0], &z[0], &v[0]);
+	field.getValuesAndGradients(n, &x[0], &y[0], &z[0], &w[0], &gx[0], &gy[0], &gz[0]);
+	for (size_t i = 0; i < n; i++) {
+		Vector3d p(x[i], y[i], z[i]);
+		Vector3d g = field.getGradient(p);
+		double f = field.getValue(p);
+		EXPECT_NEAR(f, v[i], 1e-14 * fabs(f));
+		EXPECT_NEAR(f, w[i], 1e-14 * fabs(f));
+		EXPECT_NEAR(g.x, gx[i], 1e-14 * g.getR());
+		EXPECT_NEAR(g.y, gy[i], 1e-14 * g.getR());
+		EXPECT_NEAR(g.z, gz[i], 1e-14 * g.getR());
+	}
+}
+
+void compareFusedEvaluation(const ScalarField &field) {
+	for (int i = 0; i < 20; i++) {
+		Vector3d p(i, -2. * i, -1000. + 100. * i);
+		double value;
+		Vector3d gradient;
+		field.getValueAndGradient(p, value, gradient);
+		EXPECT_DOUBLE_EQ(field.getValue(p), value);
+		EXPECT_NEAR(0, (field.getGradient(p) - gradient).getR(), 1e-15);
+	}
+}
+
+// samples of an exponential firn profile at irregular depths
+TabulatedDepthProfile firnProfile() {
+	std::vector<double> z, n;
+	for (int i = 0; i <= 30; i++) {
+		z.push_back(-2000. * pow(1 - i / 30., 2));
+		n.push_back(1.78 - 0.43 * exp(0.0132 * z.back()));
+	}
+	return TabulatedDepthProfile(z, n);
+}
+
+TEST(ScalarField, fusedEvaluation) {
+	compareFusedEvaluation(ScalarField());
+	compareFusedEvaluation(GorhamIceModel());
+	compareFusedEvaluation(n2linear(1.3, 1e-4));
+	compareFusedEvaluation(LinearIncrease(1.1, Vector3d(0, 0, 0.01)));
+	compareFusedEvaluation(firnProfile());
+}
+
+TEST(ScalarField, batchEvaluation) {
+	compareBatchEvaluation(ScalarField());
+	compareBatchEvaluation(GorhamIceModel());
+	compareBatchEvaluation(GorhamIceModel(1.78, -0.43, 0.0132));
+	compareBatchEvaluation(n2linear(1.3, 1e-4));
+	compareBatchEvaluation(LinearIncrease(1.1, Vector3d(0, 0, 0.01)));
+	compareBatchEvaluation(firnProfile());
+}
+
+TEST(ScalarField, batchEvaluationRange) {
+	// the vectorized exponential is finite up to the clamp at 709.78, where 2^1024 is needed
+	GorhamIceModel field(1.3, 1., -1.);
+	double z[3] = {709.6, 709.78, 800.};
+	double x[3] = {0, 0, 0}, v[3];
+	field.getValues(3, x, x, z, v);
+	for (int i = 0; i < 3; i++)
+		EXPECT_TRUE(std::isfinite(v[i]));
+	double f = field.getValue(Vector3d(0, 0, z[0]));
+	EXPECT_NEAR(f, v[0], 1e-13 * fabs(f));
+	EXPECT_NEAR(1.3 + (1 - exp(709.78)), v[1], 1e-13 * exp(709.78));
+	EXPECT_EQ(v[1], v[2]);
+}
+
+TEST(TabulatedDepthProfile, interpolation) {
+	TabulatedDepthProfile profile = firnProfile();
+	const std::vector<double> &z = profile.getDepths();
+	const std::vector<double> &n = profile.getIndices();
+
+	// exact at the samples, monotone and close to the sampled profile in between
+	for (size_t i = 0; i + 1 < z.size(); i++) {
+		EXPECT_DOUBLE_EQ(n[i], profile.getValue(Vector3d(0, 0, z[i])));
+		double previous = n[i];
+		for (int j = 1; j <= 10; j++) {
+			double zj = z[i] + (z[i + 1] - z[i]) * j / 10.;
+			double value = profile.getValue(Vector3d(1, 2, zj));
+			EXPECT_LE(value, previous + 1e-15);
+			EXPECT_NEAR(1.78 - 0.43 * exp(0.0132 * zj), value, 2e-3);
+			previous = value;
+		}
+	}
+
+	// gradient is the derivative of the interpolated value
+	Vector3d p(0, 0, -123.4);
+	double h = 1e-4;
+	Vector3d gradient = profile.getGradient(p);
+	EXPECT_DOUBLE_EQ(0, gradient.x);
+	EXPECT_DOUBLE_EQ(0, gradient.y);
+	EXPECT_NEAR((profile.getValue(p + Vector3d(0, 0, h)) - profile.getValue(p - Vector3d(0, 0, h))) / (2 * h), gradient.z, 1e-8);
+
+	// constant beyond the samples
+	EXPECT_DOUBLE_EQ(n.front(), profile.getValue(Vector3d(0, 0, -3000)));
+	EXPECT_DOUBLE_EQ(n.back(), profile.getValue(Vector3d(0, 0, 10)));
+	EXPECT_DOUBLE_EQ(0, profile.getGradient(Vector3d(0, 0, 10)).z);
+}
+
+TEST(TabulatedDepthProfile, linear) {
+	// a linear profile is reproduced exactly, also with uneven spacing
+	double zs[] = {-100, -90, -50, -49, -10, 0};
+	std::vector<double> z(zs, zs + 6), n;
+	for (size_t i = 0; i < z.size(); i++)
+		n.push_back(1.3 - 0.001 * z[i]);
+	TabulatedDepthProfile profile(z, n);
+	for (double zi = -99.5; zi < 0; zi += 0.7) {
+		double value;
+		Vector3d gradient;
+		profile.getValueAndGradient(Vector3d(0, 0, zi), value, gradient);
+		EXPECT_NEAR(1.3 - 0.001 * zi, value, 1e-12);
+		EXPECT_NEAR(-0.001, gradient.z, 1e-12);
+	}
+
+	std::vector<double> unordered(z.rbegin(), z.rend());
+	EXPECT_THROW(TabulatedDepthProfile(unordered, n), std::runtime_error);
+	EXPECT_THROW(TabulatedDepthProfile(z, std::vector<double>(2, 1.)), std::runtime_error);
+}
+
+TEST(ScalarFieldGrid, trilinear) {
+	// a linear function is reproduced exactly inside the sampled volume
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(0.), 4, 5, 6, 1.);
+	ScalarFieldGrid field(grid, Vector3d(-10, 0, 100), Vector3d(8, 20, 3));
+	Vector3d spacing(2, 4, 0.5);
+	Vector3d g(0.01, -0.02, 0.3);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 6; iz++) {
+				Vector3d p = Vector3d(-10, 0, 100) + (Vector3d(ix, iy, iz) + Vector3d(0.5)) * spacing;
+				grid->get(ix, iy, iz) = 1.5 + g.dot(p - Vector3d(-10, 0, 100));
+			}
+
+	Vector3d p(-7.3, 11.2, 101.9);
+	double value;
+	Vector3d gradient;
+	field.getValueAndGradient(p, value, gradient);
+	EXPECT_NEAR(1.5 + g.dot(p - Vector3d(-10, 0, 100)), value, 1e-6);
+	EXPECT_NEAR(0, (gradient - g).getR(), 1e-6);
+	EXPECT_DOUBLE_EQ(value, field.getValue(p));
+	EXPECT_NEAR(0, (field.getGradient(p) - gradient).getR(), 1e-15);
+
+	// clamped beyond the outermost samples in x, no gradient along x
+	Vector3d q(-20, 11.2, 101.9);
+	field.getValueAndGradient(q, value, gradient);
+	EXPECT_NEAR(1.5 + g.dot(Vector3d(1, 11.2, 1.9)), value, 1e-6);
+	EXPECT_DOUBLE_EQ(0, gradient.x);
+	EXPECT_NEAR(g.y, gradient.y, 1e-6);
+	EXPECT_NEAR(g.z, gradient.z, 1e-6);
+}
+
+TEST(ScalarFieldGrid, gradientConsistency) {
+	// the gradient is the derivative of the interpolated value
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(0.), 8, 1.);
+	for (int i = 0; i < 8 * 8 * 8; i++)
+		grid->getGrid()[i] = 1.3 + 0.1 * sin(i);
+	ScalarFieldGrid field(grid);
+	EXPECT_TRUE(field.getExtent() == Vector3d(8.));
+
+	Vector3d p(3.3, 4.1, 2.7);
+	Vector3d gradient = field.getGradient(p);
+	double h = 1e-6;
+	EXPECT_NEAR((field.getValue(p + Vector3d(h, 0, 0)) - field.getValue(p - Vector3d(h, 0, 0))) / (2 * h), gradient.x, 1e-6);
+	EXPECT_NEAR((field.getValue(p + Vector3d(0, h, 0)) - field.getValue(p - Vector3d(0, h, 0))) / (2 * h), gradient.y, 1e-6);
+	EXPECT_NEAR((field.getValue(p + Vector3d(0, 0, h)) - field.getValue(p - Vector3d(0, 0, h))) / (2 * h), gradient.z, 1e-6);
+
+	EXPECT_THROW(field.setExtent(Vector3d(1, 0, 1)), std::runtime_error);
+}
+
+TEST(GridTools, bakeScalarField) {
+	// the baked grid reproduces the field at the cell centers and interpolates in between
+	ref_ptr<ScalarField> field = new GorhamIceModel();
+	ref_ptr<ScalarFieldGrid> baked = bakeScalarField(field, Vector3d(-50, -50, -200),
+			Vector3d(100, 100, 200), 4, 1, 400);
+	EXPECT_EQ(400, baked->getGrid()->getNz());
+	for (int i = 0; i < 400; i += 7) {
+		Vector3d p(-37.5, 3, -200 + (i + 0.5) * 0.5);
+		EXPECT_NEAR(field->getValue(p), baked->getValue(p), 1e-6);
+	}
+	Vector3d p(10, -20, -12.3);
+	EXPECT_NEAR(field->getValue(p), baked->getValue(p), 1e-4);
+	EXPECT_NEAR(field->getGradient(p).z, baked->getGradient(p).z, 1e-4);
+
+	// serial and parallel baking give the same grid
+	ref_ptr<ScalarFieldGrid> serial = bakeScalarField(field, Vector3d(-50, -50, -200),
+			Vector3d(100, 100, 200), 4, 1, 400, false);
+	EXPECT_TRUE(serial->getGrid()->getGrid() == baked->getGrid()->getGrid());
+
+	// dump and load with the volume
+	std::string filename = temporaryFile("testBake.raw");
+	dumpScalarFieldGrid(baked, filename);
+	ref_ptr<ScalarFieldGrid> loaded = loadScalarFieldGrid(filename);
+	EXPECT_TRUE(loaded->getOrigin() == baked->getOrigin());
+	EXPECT_TRUE(loaded->getExtent() == baked->getExtent());
+	EXPECT_TRUE(loaded->getGrid()->getGrid() == baked->getGrid()->getGrid());
+	EXPECT_DOUBLE_EQ(baked->getValue(p), loaded->getValue(p));
+
+	dumpGrid(baked->getGrid(), filename);
+	EXPECT_THROW(loadScalarFieldGrid(filename), std::runtime_error);
+	std::remove(filename.c_str());
+}
+
+TEST(GridTools, fromScalarField) {
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(-1, -2, -3), 2, 3, 4, 0.5);
+	ref_ptr<ScalarField> field = new LinearIncrease(1.1, Vector3d(0.1, 0.2, 0.3));
+	fromScalarField(grid, field);
+	EXPECT_FLOAT_EQ(field->getValue(Vector3d(-0.25, -0.75, -1.25)), grid->get(1, 2, 3));
+	EXPECT_FLOAT_EQ(field->getValue(Vector3d(-0.75, -1.75, -2.75)), grid->get(0, 0, 0));
+}
+
+TEST(GridTools, bakeDepthProfile) {
+	ref_ptr<ScalarField> field = new GorhamIceModel();
+	ref_ptr<TabulatedDepthProfile> profile = bakeDepthProfile(field, -300, 0, 301);
+	for (double z = -299.7; z < 0; z += 3.1)
+		EXPECT_NEAR(field->getValue(Vector3d(0, 0, z)), profile->getValue(Vector3d(5, 5, z)), 1e-6);
+
+	std::string filename = temporaryFile("testBake.txt");
+	dumpDepthProfile(profile, filename);
+	ref_ptr<TabulatedDepthProfile> loaded = loadDepthProfile(filename);
+	EXPECT_TRUE(loaded->getDepths() == profile->getDepths());
+	EXPECT_TRUE(loaded->getIndices() == profile->getIndices());
+	std::remove(filename.c_str());
+
+	EXPECT_THROW(bakeDepthProfile(field, 0, -300, 301), std::runtime_error);
+}
+
+// rough terrain z = f(x, y) on a square of N x N cells, two triangles per cell
+void terrain(size_t N, std::vector<Vector3d> &vertices, std::vector<unsigned int> &indices) {
+	for (size_t i = 0; i <= N; i++)
+		for (size_t j = 0; j <= N; j++)
+			vertices.push_back(Vector3d(i, j, 3 * sin(0.3 * i) * cos(0.2 * j) + 0.5 * sin(7. * i * j)));
+	for (size_t i = 0; i < N; i++)
+		for (size_t j = 0; j < N; j++) {
+			unsigned int a = i * (N + 1) + j, b = a + N + 1;
+			unsigned int corners[6] = {a, b, a + 1, a + 1, b, b + 1};
+			indices.insert(indices.end(), corners, corners + 6);
+		}
+}
+
+// first intersection by testing all triangles
+bool bruteForceIntersect(const std::vector<Vector3d> &v, const std::vector<unsigned int> &idx,
+		const Vector3d &a, const Vector3d &b, double &tBest) {
+	Vector3d d = b - a;
+	bool hit = false;
+	tBest = 1;
+	for (size_t i = 0; i < idx.size(); i += 3) {
+		Vector3d e1 = v[idx[i + 1]] - v[idx[i]], e2 = v[idx[i + 2]] - v[idx[i]];
+		Vector3d n = e1.cross(e2);
+		double denominator = n.dot(d);
+		if (denominator == 0)
+			continue;
+		double t = n.dot(v[idx[i]] - a) / denominator;
+		if ((t < 0) || (t > tBest))
+			continue;
+		// barycentric coordinates of the point in the plane
+		Vector3d p = a + d * t - v[idx[i]];
+		double d11 = e1.dot(e1), d12 = e1.dot(e2), d22 = e2.dot(e2);
+		double p1 = p.dot(e1), p2 = p.dot(e2);
+		double det = d11 * d22 - d12 * d12;
+		double u = (d22 * p1 - d12 * p2) / det, w = (d11 * p2 - d12 * p1) / det;
+		if ((u < 0) || (w < 0) || (u + w > 1))
+			continue;
+		tBest = t;
+		hit = true;
+	}
+	return hit;
+}
+
+TEST(TriangleMesh, intersect) {
+	std::vector<Vector3d> vertices;
+	std::vector<unsigned int> indices;
+	terrain(100, vertices, indices);
+	TriangleMesh mesh(vertices, indices);
+	EXPECT_EQ(20000, mesh.getNumberOfTriangles());
+	EXPECT_LT(mesh.getNumberOfNodes(), 20000);
+
+	// same first intersection as testing all triangles
+	Random random(42);
+	int hits = 0;
+	for (int i = 0; i < 200; i++) {
+		Vector3d a(random.rand(100), random.rand(100), random.randUniform(-6, 6));
+		Vector3d b = a + random.randVector() * random.rand(30);
+		double t, tBrute;
+		Vector3d normal;
+		size_t triangle;
+		bool hit = mesh.intersect(a, b, t, normal, triangle);
+		ASSERT_EQ(bruteForceIntersect(vertices, indices, a, b, tBrute), hit);
+		if (!hit)
+			continue;
+		hits++;
+		EXPECT_NEAR(tBrute, t, 1e-9);
+		Vector3d e1 = vertices[indices[3 * triangle + 1]] - vertices[indices[3 * triangle]];
+		Vector3d e2 = vertices[indices[3 * triangle + 2]] - vertices[indices[3 * triangle]];
+		EXPECT_NEAR(0, (e1.cross(e2).getUnitVector() - normal).getR(), 1e-12);
+	}
+	EXPECT_GT(hits, 20);
+
+	EXPECT_THROW(TriangleMesh(vertices, std::vector<unsigned int>(4, 0)), std::runtime_error);
+}
+
+TEST(TriangleMesh, load) {
+	// a unit square as one quad and as a triangle with relative indices
+	std::string objFile = temporaryFile("testMesh.obj");
+	std::string stlFile = temporaryFile("testMesh.stl");
+	std::ofstream obj(objFile.c_str());
+	obj << "# square\nv 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1/1 2/2 3/3 4/4\nv 0 0 1\nf -5 -4 -1\n";
+	obj.close();
+	ref_ptr<TriangleMesh> mesh = loadTriangleMesh(objFile, 2);
+	EXPECT_EQ(3, mesh->getNumberOfTriangles());
+	EXPECT_EQ(5, mesh->getNumberOfVertices());
+	EXPECT_TRUE(mesh->getUpperCorner() == Vector3d(2, 2, 2));
+	EXPECT_TRUE(mesh->intersect(Vector3d(1.9, 1.9, -1), Vector3d(1.9, 1.9, 1)));
+	EXPECT_FALSE(mesh->intersect(Vector3d(2.1, 1.9, -1), Vector3d(2.1, 1.9, 1)));
+
+	// binary STL with a single triangle
+	std::ofstream stl(stlFile.c_str(), std::ios::binary);
+	char header[80] = {0};
+	uint32_t count = 1;
+	float corners[12] = {0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0};
+	uint16_t attributes = 0;
+	stl.write(header, sizeof(header));
+	stl.write((char*) &count, sizeof(count));
+	stl.write((char*) corners, sizeof(corners));
+	stl.write((char*) &attributes, sizeof(attributes));
+	stl.close();
+	mesh = loadTriangleMesh(stlFile);
+	EXPECT_EQ(1, mesh->getNumberOfTriangles());
+	double t;
+	Vector3d normal;
+	size_t triangle;
+	EXPECT_TRUE(mesh->intersect(Vector3d(0.2, 0.2, 1), Vector3d(0.2, 0.2, -3), t, normal, triangle));
+	EXPECT_DOUBLE_EQ(0.25, t);
+	EXPECT_DOUBLE_EQ(1, normal.z);
+
+	EXPECT_THROW(loadTriangleMesh("testMesh.ply"), std::runtime_error);
+	std::remove(objFile.c_str());
+	std::remove(stlFile.c_str());
+}
+
+TEST(Heightmap, sameAsMesh) {
+	// raster of a rough terrain and the same surface as a triangle mesh
+	size_t N = 61;
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(10, 20, 0), N, N, 1, 2.);
+	std::vector<Vector3d> vertices;
+	std::vector<unsigned int> indices;
+	terrain(N - 1, vertices, indices);
+	for (size_t i = 0; i < vertices.size(); i++) {
+		grid->get(i / N, i % N, 0) = vertices[i].z;
+		vertices[i] = Vector3d(11 + 2 * vertices[i].x, 21 + 2 * vertices[i].y, float(vertices[i].z));
+	}
+	// cells split along the same diagonal as in the heightmap
+	indices.clear();
+	for (size_t i = 0; i < N - 1; i++)
+		for (size_t j = 0; j < N - 1; j++) {
+			unsigned int a = i * N + j, b = a + N;
+			unsigned int corners[6] = {a, b, b + 1, a, b + 1, a + 1};
+			indices.insert(indices.end(), corners, corners + 6);
+		}
+	Heightmap heightmap(grid);
+	TriangleMesh mesh(vertices, indices);
+
+	Random random(7);
+	int hits = 0;
+	for (int i = 0; i < 300; i++) {
+		Vector3d a(random.randUniform(0, 140), random.randUniform(10, 150), random.randUniform(-5, 5));
+		Vector3d b = a + random.randVector() * random.rand(50);
+		double t1, t2;
+		Vector3d n1, n2;
+		size_t e1, e2;
+		bool hit = heightmap.intersect(a, b, t1, n1, e1);
+		ASSERT_EQ(mesh.intersect(a, b, t2, n2, e2), hit);
+		if (!hit)
+			continue;
+		hits++;
+		EXPECT_NEAR(t2, t1, 1e-9);
+		EXPECT_NEAR(0, (n1 - n2).getR(), 1e-9);
+		EXPECT_GT(n1.z, 0);
+		Vector3d p = a + (b - a) * t1;
+		EXPECT_NEAR(p.z, heightmap.getHeight(p.x, p.y), 1e-9);
+	}
+	EXPECT_GT(hits, 30);
+}
+
+TEST(Heightmap, memoryMapped) {
+	ref_ptr<ScalarGrid> grid = new ScalarGrid(Vector3d(-5, -5, 0), 7, 5, 1, 1.);
+	for (int ix = 0; ix < 7; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			grid->get(ix, iy, 0) = ix + 10 * iy;
+	std::string filename = temporaryFile("testHeightmap.raw");
+	dumpGrid(grid, filename);
+
+	Heightmap heightmap(filename, Vector3d(-5, -5, 0), 7, 5, 1.);
+	EXPECT_TRUE(heightmap.isMemoryMapped());
+	EXPECT_EQ("Heightmap: 7 x 5 samples", heightmap.getDescription());
+	EXPECT_FLOAT_EQ(34, heightmap.getSample(4, 3));
+	// linear in the samples and clamped outside
+	EXPECT_NEAR(2.25 + 10 * 1.75, heightmap.getHeight(-2.25, -2.75), 1e-6);
+	EXPECT_NEAR(6 + 40, heightmap.getHeight(10, 10), 1e-6);
+	// vertical segments, also exactly through a sample
+	double t;
+	Vector3d normal;
+	size_t element;
+	EXPECT_TRUE(heightmap.intersect(Vector3d(-0.5, -1.5, 100), Vector3d(-0.5, -1.5, -100), t, normal, element));
+	EXPECT_NEAR(0.5 - 34 / 200., t, 1e-7);
+	EXPECT_TRUE(heightmap.intersect(Vector3d(-1, -1, 100), Vector3d(-1, -1, -100)));
+	EXPECT_FALSE(heightmap.intersect(Vector3d(-1, -1, 100), Vector3d(-1, -1, 50)));
+
+	EXPECT_THROW(Heightmap(filename, Vector3d(0.), 7, 6, 1.), std::runtime_error);
+	std::remove(filename.c_str());
+}
+
+TEST(Scene, distance) {
+	// many small primitives and a few large ones, compared to testing all primitives
+	Scene scene;
+	Random random(3);
+	for (int i = 0; i < 200; i++) {
+		Vector3d p(random.randUniform(-100, 100), random.randUniform(-100, 100), random.randUniform(-100, 100));
+		switch (i % 5) {
+		case 0:
+			scene.addSphere(p, random.randUniform(0.5, 3));
+			break;
+		case 1:
+			scene.addBox(p, Vector3d(1, 2, 3));
+			break;
+		case 2:
+			scene.addDisc(p, random.randVector(), 2);
+			break;
+		case 3:
+			scene.addRectangle(p, Vector3d(2, 0, 0), Vector3d(0, 1, 1));
+			break;
+		case 4:
+			scene.addCylinder(p, 4, 1);
+			break;
+		}
+	}
+	scene.addEllipsoid(Vector3d(-50, 0, 0), Vector3d(50, 0, 0), 400);
+	scene.addPlane(Vector3d(0, 0, 150), Vector3d(0, 0, 1));
+	EXPECT_EQ(202, scene.getNumberOfPrimitives());
+	EXPECT_EQ(Scene::PlanePrimitive, scene.getType(201));
+
+	for (int k = 0; k < 500; k++) {
+		Vector3d p(random.randUniform(-120, 120), random.randUniform(-120, 120), random.randUniform(-120, 120));
+		double expected = std::numeric_limits<double>::infinity();
+		for (size_t i = 0; i < scene.getNumberOfPrimitives(); i++)
+			expected = std::min(expected, scene.distanceTo(i, p));
+		size_t nearest;
+		double d = scene.distance(p, nearest);
+		EXPECT_DOUBLE_EQ(expected, d);
+		EXPECT_DOUBLE_EQ(d, scene.distanceTo(nearest, p));
+	}
+
+	// exact distances
+	EXPECT_DOUBLE_EQ(5, scene.distanceTo(201, Vector3d(3, 4, 145)));
+	Scene box;
+	box.addBox(Vector3d(0, 0, 0), Vector3d(10, 10, 10));
+	EXPECT_DOUBLE_EQ(2, box.distance(Vector3d(5, 2, 5)));
+	EXPECT_DOUBLE_EQ(5, box.distance(Vector3d(13, 14, 5)));
+	// primitives added after a query are included in the next one
+	box.addSphere(Vector3d(5, 20, 5), 5);
+	EXPECT_DOUBLE_EQ(1, box.distance(Vector3d(5, 14, 5)));
+	EXPECT_EQ(std::numeric_limits<double>::infinity(), Scene().distance(Vector3d(0.)));
+}
+
+TEST(Scene, concurrentFirstQuery) {
+	// threads racing to the first query all see the complete hierarchy
+	Scene scene;
+	for (int i = 0; i < 1000; i++)
+		scene.addSphere(Vector3d(10 * i, 0, 0), 1);
+	std::vector<double> d(64);
+#pragma omp parallel for
+	for (int i = 0; i < 64; i++)
+		d[i] = scene.distance(Vector3d(10 * (i * 15) + 3, 0, 0));
+	for (int i = 0; i < 64; i++)
+		EXPECT_DOUBLE_EQ(2, d[i]);
+}
 
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
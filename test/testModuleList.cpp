@@ -3,9 +3,14 @@
 #include "radiopropa/ParticleID.h"
 #include "radiopropa/module/SimplePropagation.h"
 #include "radiopropa/module/BreakCondition.h"
+#include "radiopropa/module/BatchModule.h"
+#include "radiopropa/module/Observer.h"
+#include "radiopropa/module/PropagationCK.h"
 
 #include "gtest/gtest.h"
 
+#include <map>
+
 namespace radiopropa {
 
 TEST(ModuleList, process) {
@@ -54,6 +59,161 @@ TEST(ModuleList, runSource) {
 	modules.run(&source, 100, false);
 }
 
+// ends each candidate and splits it into two secondaries of half the amplitude, down to 1/64
+class SplitModule: public Module {
+public:
+	void process(Candidate *candidate) const {
+		double amplitude = candidate->current.getAmplitude();
+		if (amplitude > 1 / 64.) {
+			for (int i = 0; i < 2; i++) {
+				ref_ptr<Candidate> secondary = candidate->clone(false);
+				secondary->current.setAmplitude(amplitude / 2);
+				secondary->parent = candidate;
+				candidate->addSecondary(secondary);
+			}
+		}
+		candidate->setActive(false);
+	}
+};
+
+// number of candidates in the tree, checking that all were propagated
+size_t treeSize(Candidate *candidate) {
+	EXPECT_FALSE(candidate->isActive());
+	size_t n = 1;
+	for (size_t i = 0; i < candidate->secondaries.size(); i++) {
+		EXPECT_EQ(candidate, candidate->secondaries[i]->parent);
+		n += treeSize(candidate->secondaries[i]);
+	}
+	return n;
+}
+
+TEST(ModuleList, runSecondaries) {
+	ModuleList modules;
+	modules.add(new SplitModule());
+	EXPECT_FALSE(modules.getParallelSecondaries());
+
+	for (int parallel = 0; parallel < 2; parallel++) {
+		modules.setParallelSecondaries(parallel == 1);
+		ParticleState initial;
+		initial.setAmplitude(1);
+		ref_ptr<Candidate> candidate = new Candidate(initial);
+		modules.run(candidate);
+		EXPECT_EQ(127, treeSize(candidate));
+
+		ModuleList::candidate_vector_t candidates;
+		for (int i = 0; i < 5; i++)
+			candidates.push_back(new Candidate(initial));
+		modules.run(candidates);
+		for (int i = 0; i < 5; i++)
+			EXPECT_EQ(127, treeSize(candidates[i]));
+	}
+}
+
+// halves the amplitudes of a block, deactivates candidates below 0.3 and turns them to +x
+class HalveAmplitude: public BatchModule {
+public:
+	void processBlock(CandidateBlock &block) const {
+		double *amplitudes = block.getAmplitudes();
+		double *directions = block.getDirections();
+		unsigned char *active = block.getActive();
+		for (size_t i = 0; i < block.size(); i++) {
+			EXPECT_TRUE(active[i]);
+			amplitudes[i] *= 0.5;
+			if (amplitudes[i] < 0.3) {
+				active[i] = false;
+				directions[3 * i] = 2;
+				directions[3 * i + 1] = 0;
+				directions[3 * i + 2] = 0;
+			}
+		}
+	}
+};
+
+TEST(ModuleList, runBatchModule) {
+	ModuleList modules;
+	modules.add(new HalveAmplitude());
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 10; i++) {
+		ParticleState initial;
+		initial.setAmplitude(1);
+		initial.setPosition(Vector3d(i, 0, 0));
+		initial.setDirection(Vector3d(0, 0, 1));
+		candidates.push_back(new Candidate(initial));
+	}
+	modules.runBatch(candidates, 4, false);
+	for (int i = 0; i < 10; i++) {
+		EXPECT_FALSE(candidates[i]->isActive());
+		EXPECT_DOUBLE_EQ(0.25, candidates[i]->current.getAmplitude());
+		EXPECT_EQ(Vector3d(1, 0, 0), candidates[i]->current.getDirection());
+		EXPECT_EQ(Vector3d(i, 0, 0), candidates[i]->current.getPosition());
+	}
+
+	// single candidates through process
+	ref_ptr<Candidate> candidate = new Candidate();
+	candidate->current.setAmplitude(1);
+	modules.run(candidate);
+	EXPECT_TRUE(candidate->isActive() == false);
+	EXPECT_DOUBLE_EQ(0.25, candidate->current.getAmplitude());
+}
+
+// records the storage of the blocks, optionally keeping a reference like a NumPy view
+class StorageProbe: public BatchModule {
+public:
+	mutable const Referenced *storage;
+	bool keep;
+	StorageProbe() :
+			storage(0), keep(false) {
+	}
+	void processBlock(CandidateBlock &block) const {
+		storage = block.getStorage();
+		if (keep)
+			storage->addReference();
+	}
+};
+
+TEST(ModuleList, reuseCandidateBlock) {
+	ref_ptr<StorageProbe> probe = new StorageProbe();
+	ref_ptr<Candidate> candidate = new Candidate();
+	probe->process(candidate);
+	const Referenced *first = probe->storage;
+	probe->process(candidate);
+	EXPECT_EQ(first, probe->storage);
+
+	// a kept view gets the arrays, the next block new ones
+	probe->keep = true;
+	probe->process(candidate);
+	EXPECT_EQ(first, probe->storage);
+	probe->keep = false;
+	probe->process(candidate);
+	EXPECT_NE(first, probe->storage);
+	EXPECT_EQ(1, first->getReferenceCount());
+	first->removeReference();
+}
+
+// stand in for Python directors in the PythonModulePolicy tests
+class FakePythonModule: public SimplePropagation {
+};
+
+class FakePythonFeature: public ObserverFeature {
+};
+
+class FakePythonField: public n2linear {
+public:
+	FakePythonField() :
+			n2linear(1.78, 0) {
+	}
+};
+
+class FakePythonSourceFeature: public SourceFeature {
+};
+
+bool isFakePythonObject(const Referenced *object) {
+	return dynamic_cast<const FakePythonModule *>(object)
+			|| dynamic_cast<const FakePythonFeature *>(object)
+			|| dynamic_cast<const FakePythonField *>(object)
+			|| dynamic_cast<const FakePythonSourceFeature *>(object);
+}
+
 #if _OPENMP
 #include <omp.h>
 TEST(ModuleList, runOpenMP) {
@@ -67,8 +227,146 @@ TEST(ModuleList, runOpenMP) {
 	omp_set_num_threads(2);
 	modules.run(&source, 1000, false);
 }
+
+TEST(ModuleList, runSchedules) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	EXPECT_THROW(modules.setSchedule(ModuleList::DynamicSchedule, 0), std::runtime_error);
+	omp_set_num_threads(4);
+
+	ModuleList::Schedule schedules[4] = { ModuleList::StaticSchedule, ModuleList::DynamicSchedule,
+			ModuleList::GuidedSchedule, ModuleList::WorkStealingSchedule };
+	for (int k = 0; k < 4; k++) {
+		// every candidate is propagated exactly once, whatever the schedule
+		modules.setSchedule(schedules[k], 3);
+		ModuleList::candidate_vector_t candidates;
+		for (int i = 0; i < 1000; i++)
+			candidates.push_back(new Candidate(ParticleState()));
+		modules.run(candidates, false);
+		for (int i = 0; i < 1000; i++) {
+			EXPECT_FALSE(candidates[i]->isActive());
+			EXPECT_DOUBLE_EQ(1 * Mpc, candidates[i]->getTrajectoryLength());
+		}
+
+		std::vector<double> busy = modules.getThreadBusyTimes();
+		EXPECT_EQ(4, busy.size());
+		for (size_t i = 0; i < busy.size(); i++)
+			EXPECT_GE(busy[i], 0);
+	}
+}
+
+// records the direction and a random number of each candidate by serial number
+class RecordRandom: public Module {
+public:
+	mutable std::map<uint64_t, std::pair<Vector3d, double> > records;
+	void process(Candidate *candidate) const {
+		double r = RandomStream::instance().rand();
+#pragma omp critical
+		records[candidate->getSerialNumber()] = std::make_pair(candidate->current.getDirection(), r);
+		candidate->setActive(false);
+	}
+};
+
+TEST(ModuleList, reproducibleRandom) {
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	uint64_t previousSeed = RandomStream::getRunSeed();
+	RandomStream::setRunSeed(11);
+
+	// same serial numbers and random numbers per candidate for any number of threads
+	std::map<uint64_t, std::pair<Vector3d, double> > records[2];
+	int threads[2] = {1, 4};
+	for (int k = 0; k < 2; k++) {
+		ref_ptr<RecordRandom> record = new RecordRandom();
+		ModuleList modules;
+		modules.add(record);
+		omp_set_num_threads(threads[k]);
+		Candidate::setNextSerialNumber(1000);
+		modules.run(&source, 200, false);
+		records[k] = record->records;
+	}
+	EXPECT_EQ(200, records[0].size());
+	EXPECT_TRUE(records[0] == records[1]);
+	RandomStream::setRunSeed(previousSeed);
+}
+
+TEST(ModuleList, pythonModulePolicy) {
+	ModuleList modules;
+	ref_ptr<ModuleList> nested = new ModuleList();
+	nested->add(new FakePythonModule());
+	modules.add(nested);
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	EXPECT_EQ(ModuleList::PythonSerial, modules.getPythonModulePolicy());
+	EXPECT_FALSE(modules.hasPythonModules());
+
+	setPythonObjectCheck(isFakePythonObject);
+	EXPECT_TRUE(modules.hasPythonModules());
+	int previousThreads = omp_get_max_threads();
+	omp_set_num_threads(4);
+
+	// a single thread for the Python modules
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 100; i++)
+		candidates.push_back(new Candidate(ParticleState()));
+	modules.run(candidates, false);
+	EXPECT_EQ(1, modules.getThreadBusyTimes().size());
+	for (int i = 0; i < 100; i++)
+		EXPECT_DOUBLE_EQ(1 * Mpc, candidates[i]->getTrajectoryLength());
+
+	modules.setPythonModulePolicy(ModuleList::PythonFail);
+	EXPECT_THROW(modules.run(candidates, false), std::runtime_error);
+	EXPECT_THROW(modules.runBatch(candidates), std::runtime_error);
+
+	modules.setPythonModulePolicy(ModuleList::PythonParallel);
+	modules.run(candidates, false);
+	EXPECT_EQ(4, modules.getThreadBusyTimes().size());
+
+	setPythonObjectCheck(0);
+	EXPECT_FALSE(modules.hasPythonModules());
+	omp_set_num_threads(previousThreads);
+}
 #endif
 
+TEST(ModuleList, pythonObjects) {
+	setPythonObjectCheck(isFakePythonObject);
+
+	// observer features and the actions on detection
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new ObserverDetectAll());
+	EXPECT_FALSE(isPythonModule(observer));
+	observer->onDetection(new FakePythonModule());
+	EXPECT_TRUE(isPythonModule(observer));
+	observer = new Observer();
+	observer->add(new FakePythonFeature());
+	EXPECT_TRUE(isPythonModule(observer));
+
+	// refractivity fields of the propagation
+	ref_ptr<PropagationCK> propagation = new PropagationCK(new n2linear(1.78, 0));
+	EXPECT_FALSE(isPythonModule(propagation));
+	propagation->setField(new FakePythonField());
+	EXPECT_TRUE(isPythonModule(propagation));
+
+	ModuleList modules;
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	modules.add(propagation);
+	EXPECT_TRUE(modules.hasPythonModules());
+
+	// features of sources
+	ref_ptr<Source> source = new Source();
+	source->add(new SourcePosition(Vector3d(0.)));
+	EXPECT_FALSE(source->usesPythonObjects());
+	source->add(new FakePythonSourceFeature());
+	EXPECT_TRUE(source->usesPythonObjects());
+	SourceList sources;
+	sources.add(source);
+	EXPECT_TRUE(sources.usesPythonObjects());
+
+	setPythonObjectCheck(0);
+	EXPECT_FALSE(modules.hasPythonModules());
+	EXPECT_FALSE(source->usesPythonObjects());
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -2,6 +2,13 @@
 #include "radiopropa/ParticleID.h"
 #include "radiopropa/module/SimplePropagation.h"
 #include "radiopropa/module/PropagationCK.h"
+#include "radiopropa/module/PropagationBatchCK.h"
+#include "radiopropa/module/PropagationRK.h"
+#include "radiopropa/module/PropagationStratified.h"
+#include "radiopropa/module/BreakCondition.h"
+#include "radiopropa/module/Observer.h"
+#include "radiopropa/RaySolver.h"
+#include "radiopropa/ModuleList.h"
 
 #include "gtest/gtest.h"
 
@@ -51,6 +58,475 @@ TEST(testPropagationCK, zeroField) {
 	EXPECT_DOUBLE_EQ(5 * minStep, c.getNextStep());  // acceleration by factor 5
 }
 
+TEST(testPropagationCK, denseOutputDetection) {
+	// the detection on the interpolated step agrees with a fine step propagation
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	Vector3d detected[2];
+	int steps[2];
+	double maxStep[2] = { 10 * meter, 1e-3 * meter };
+	for (int i = 0; i < 2; i++) {
+		ModuleList sim;
+		sim.add(new PropagationCK(ice, 1e-10, 1e-4 * meter, maxStep[i]));
+		ref_ptr<Observer> obs = new Observer();
+		obs->add(new ObserverLargeSphere(Vector3d(0, 0, -100 * meter), 30 * meter));
+		sim.add(obs);
+
+		ParticleState p;
+		p.setPosition(Vector3d(0, 0, -100 * meter));
+		p.setDirection(Vector3d(1, 0, 1));
+		ref_ptr<Candidate> c = new Candidate(p);
+		c->setNextStep(maxStep[i]);
+		for (steps[i] = 0; c->isActive(); steps[i]++)
+			sim.process(c);
+		detected[i] = c->current.getPosition();
+	}
+	EXPECT_NEAR(30 * meter, (detected[0] - Vector3d(0, 0, -100 * meter)).getR(), 1e-9 * meter);
+	EXPECT_NEAR(0, (detected[0] - detected[1]).getR(), 1e-3 * meter);
+	EXPECT_LT(steps[0], steps[1] / 100);
+}
+
+// counts the evaluations of a field
+class CountingField: public ScalarField {
+	ref_ptr<ScalarField> field;
+public:
+	mutable int values, gradients;
+	CountingField(ref_ptr<ScalarField> field) :
+			field(field), values(0), gradients(0) {
+	}
+	double getValue(const Vector3d &position) const {
+		values++;
+		return field->getValue(position);
+	}
+	Vector3d getGradient(const Vector3d &position) const {
+		gradients++;
+		return field->getGradient(position);
+	}
+	void getValueAndGradient(const Vector3d &position, double &value,
+			Vector3d &gradient) const {
+		gradients++;
+		field->getValueAndGradient(position, value, gradient);
+	}
+};
+
+TEST(testPropagationCK, fieldEvaluations) {
+	// an accepted step costs the six stages and the value of n at its end
+	ref_ptr<CountingField> field = new CountingField(new n2linear(1.78, 0));
+	PropagationCK propa(field);
+	Candidate c;
+	c.current.setDirection(Vector3d(1, 0, 1));
+	propa.process(&c);
+	EXPECT_TRUE(c.hasStepDerivatives());
+	EXPECT_EQ(6, field->gradients);
+	EXPECT_EQ(1, field->values);
+}
+
+TEST(testPropagationBatchCK, zeroField) {
+	PropagationBatchCK propa(new ScalarField());
+
+	double minStep = 0.001 * meter;
+	propa.setMinimumStep(minStep);
+
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, 0));
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+	c.setNextStep(0);
+
+	propa.process(&c);
+
+	EXPECT_DOUBLE_EQ(minStep, c.getCurrentStep());  // perform minimum step
+	EXPECT_DOUBLE_EQ(5 * minStep, c.getNextStep());  // acceleration by factor 5
+}
+
+TEST(testPropagationBatchCK, sameAsPropagationCK) {
+	// a block of rays stepped in lockstep follows the single-ray integrator
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	PropagationCK single(ice, 1e-8, 0.001 * meter, 1 * meter);
+	PropagationBatchCK batch(ice, 1e-8, 0.001 * meter, 1 * meter);
+
+	std::vector<ref_ptr<Candidate> > a, b;
+	std::vector<Candidate *> block;
+	for (int i = 0; i < 16; i++) {
+		double phi = i * 5 * deg;
+		ParticleState p;
+		p.setPosition(Vector3d(0, 0, -100 * meter));
+		p.setDirection(Vector3d(sin(phi), 0, cos(phi)));
+		a.push_back(new Candidate(p));
+		b.push_back(new Candidate(p));
+		block.push_back(b.back());
+	}
+
+	for (int step = 0; step < 200; step++) {
+		for (size_t i = 0; i < a.size(); i++)
+			single.process(a[i]);
+		batch.processBatch(block);
+	}
+
+	for (size_t i = 0; i < a.size(); i++) {
+		EXPECT_NEAR(a[i]->getTrajectoryLength(), b[i]->getTrajectoryLength(), 1e-9);
+		EXPECT_NEAR(0, (a[i]->current.getPosition() - b[i]->current.getPosition()).getR(), 1e-6);
+		EXPECT_NEAR(0, (a[i]->current.getDirection() - b[i]->current.getDirection()).getR(), 1e-8);
+	}
+}
+
+TEST(testPropagationBatchCK, runBatch) {
+	ModuleList sim;
+	sim.add(new PropagationBatchCK(new GorhamIceModel(), 1e-6));
+	sim.add(new MaximumTrajectoryLength(50 * meter));
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 100; i++) {
+		ParticleState p;
+		p.setPosition(Vector3d(0, 0, -100 * meter));
+		p.setDirection(Vector3d(sin(i * 0.9 * deg), 0, cos(i * 0.9 * deg)));
+		candidates.push_back(new Candidate(p));
+	}
+	sim.runBatch(candidates, 32);
+
+	for (size_t i = 0; i < candidates.size(); i++) {
+		EXPECT_FALSE(candidates[i]->isActive());
+		EXPECT_NEAR(50 * meter, candidates[i]->getTrajectoryLength(), 1 * meter);
+	}
+}
+
+TEST(testPropagationBatchCK, matchesPropagationCK) {
+	// the batched propagator follows the same rays as PropagationCK
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	ModuleList single, batch;
+	single.add(new PropagationCK(ice, 1e-8, 0.001 * meter, 1 * meter));
+	single.add(new MaximumTrajectoryLength(200 * meter));
+	batch.add(new PropagationBatchCK(ice, 1e-8, 0.001 * meter, 1 * meter));
+	batch.add(new MaximumTrajectoryLength(200 * meter));
+
+	ModuleList::candidate_vector_t a, b;
+	for (int i = 0; i < 64; i++) {
+		double phi = 90. * deg * i / 64;
+		ParticleState p;
+		p.setPosition(Vector3d(0, 0, -200 * meter));
+		p.setDirection(Vector3d(sin(phi), 0, cos(phi)));
+		a.push_back(new Candidate(p));
+		b.push_back(new Candidate(p));
+	}
+
+	for (size_t i = 0; i < a.size(); i++)
+		single.run(a[i]);
+	batch.runBatch(b);
+
+	for (size_t i = 0; i < a.size(); i++)
+		EXPECT_NEAR(0, (a[i]->current.getPosition() - b[i]->current.getPosition()).getR(), 1e-3 * meter);
+}
+
+TEST(testPropagationRK, zeroField) {
+	PropagationRKDormandPrince propa(new ScalarField());
+
+	double minStep = 0.001 * meter;
+	propa.setMinimumStep(minStep);
+
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, 0));
+	p.setDirection(Vector3d(0, 1, 0));
+	Candidate c(p);
+	c.setNextStep(0);
+
+	propa.process(&c);
+
+	EXPECT_DOUBLE_EQ(minStep, c.getCurrentStep());  // perform minimum step
+	EXPECT_DOUBLE_EQ(5 * minStep, c.getNextStep());  // acceleration by factor 5
+}
+
+template<typename Propagation>
+Vector3d propagateRay(ref_ptr<ScalarField> field, double step) {
+	// fixed step size, so that all methods take the same steps
+	Propagation propa(field, 1e-4, step, step);
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, -200 * meter));
+	p.setDirection(Vector3d(sin(40 * deg), 0, cos(40 * deg)));
+	Candidate c(p);
+	while (c.getTrajectoryLength() < 300 * meter - 1e-9)
+		propa.process(&c);
+	return c.current.getPosition();
+}
+
+template<typename Tableau>
+void checkTableau() {
+	double sb = 0, sbs = 0;
+	for (int i = 0; i < Tableau::stages; i++) {
+		sb += Tableau::b[i];
+		sbs += Tableau::bs[i];
+		for (int j = i; j < Tableau::stages; j++)
+			EXPECT_EQ(0, Tableau::a[i][j]);  // explicit method
+	}
+	EXPECT_NEAR(1, sb, 1e-14);
+	EXPECT_NEAR(1, sbs, 1e-14);
+}
+
+TEST(testPropagationRK, tableaus) {
+	checkTableau<CashKarpTableau>();
+	checkTableau<DormandPrinceTableau>();
+	checkTableau<BogackiShampineTableau>();
+	checkTableau<Fehlberg78Tableau>();
+
+	// all methods follow the same ray through the firn
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	Vector3d reference = propagateRay<PropagationCK>(ice, 2 * meter);
+	EXPECT_NEAR(0, (propagateRay<PropagationRKCashKarp>(ice, 2 * meter) - reference).getR(), 1e-6);
+	EXPECT_NEAR(0, (propagateRay<PropagationRKDormandPrince>(ice, 2 * meter) - reference).getR(), 1e-6);
+	EXPECT_NEAR(0, (propagateRay<PropagationRKBogackiShampine>(ice, 2 * meter) - reference).getR(), 1e-5);
+	EXPECT_NEAR(0, (propagateRay<PropagationRKFehlberg78>(ice, 2 * meter) - reference).getR(), 1e-6);
+}
+
+TEST(testPropagationRK, sameAsPropagationCK) {
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	PropagationCK ck(ice, 1e-8);
+	PropagationRKCashKarp rk(ice, 1e-8);
+
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, -100 * meter));
+	p.setDirection(Vector3d(1, 0, 1));
+	Candidate a(p), b(p);
+	for (int i = 0; i < 100; i++) {
+		ck.process(&a);
+		rk.process(&b);
+	}
+	EXPECT_NEAR(a.getTrajectoryLength(), b.getTrajectoryLength(), 1e-9);
+	EXPECT_NEAR(0, (a.current.getPosition() - b.current.getPosition()).getR(), 1e-6);
+}
+
+// hides the type of a field, so that PropagationStratified integrates it numerically
+class WrappedField: public ScalarField {
+	ref_ptr<ScalarField> field;
+public:
+	WrappedField(ref_ptr<ScalarField> field) :
+			field(field) {
+	}
+	double getValue(const Vector3d &position) const {
+		return field->getValue(position);
+	}
+	Vector3d getGradient(const Vector3d &position) const {
+		return field->getGradient(position);
+	}
+};
+
+TEST(testPropagationStratified, closedFormSameAsNumerical) {
+	ref_ptr<ScalarField> linear = new n2linear(1.35, -0.01);
+	PropagationStratified exact(linear);
+	PropagationStratified numerical(new WrappedField(linear), 1e-10);
+
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, -100 * meter));
+	p.setDirection(Vector3d(1, 1, 1));
+	Candidate a(p), b(p);
+	for (int i = 0; i < 10; i++) {
+		a.setNextStep(50 * meter);
+		b.setNextStep(50 * meter);
+		exact.process(&a);
+		numerical.process(&b);
+	}
+	EXPECT_DOUBLE_EQ(500 * meter, a.getTrajectoryLength());
+	EXPECT_NEAR(0, (a.current.getPosition() - b.current.getPosition()).getR(), 1e-6 * meter);
+	EXPECT_NEAR(0, (a.current.getDirection() - b.current.getDirection()).getR(), 1e-8);
+}
+
+// subclass of n2linear with a uniform refractive index
+class UniformN2linear: public n2linear {
+public:
+	UniformN2linear() : n2linear(1.35, -0.01) {
+	}
+	double getValue(const Vector3d &position) const {
+		return 1.35;
+	}
+	Vector3d getGradient(const Vector3d &position) const {
+		return Vector3d(0, 0, 0);
+	}
+	void getValueAndGradient(const Vector3d &position, double &value,
+			Vector3d &gradient) const {
+		value = getValue(position);
+		gradient = getGradient(position);
+	}
+};
+
+TEST(testPropagationStratified, n2linearSubclass) {
+	// the closed form of n2linear is not applied to subclasses
+	PropagationStratified propa(new UniformN2linear(), 1e-10);
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, -100 * meter));
+	p.setDirection(Vector3d(1, 0, 1));
+	Candidate c(p);
+	c.setNextStep(50 * meter);
+	propa.process(&c);
+	Vector3d displacement = c.current.getPosition() - p.getPosition();
+	EXPECT_GT(displacement.getR(), 1 * meter);
+	EXPECT_NEAR(0, displacement.getAngleTo(Vector3d(1, 0, 1)), 1e-6);
+	EXPECT_NEAR(0, c.current.getDirection().getAngleTo(Vector3d(1, 0, 1)), 1e-6);
+}
+
+TEST(testPropagationStratified, sameAsPropagationCK) {
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	PropagationStratified stratified(ice, 1e-10);
+	PropagationCK ck(ice, 1e-10, 1e-3 * meter, 0.1 * meter);
+
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, -150 * meter));
+	p.setDirection(Vector3d(sin(60 * deg), 0, cos(60 * deg)));
+	Candidate a(p), b(p);
+	a.setNextStep(200 * meter);
+	stratified.process(&a);
+	while (b.getTrajectoryLength() < 200 * meter - 1e-9) {
+		b.setNextStep(std::min(b.getNextStep(), 200 * meter - b.getTrajectoryLength()));
+		ck.process(&b);
+	}
+	EXPECT_NEAR(200 * meter, b.getTrajectoryLength(), 1e-9);
+	EXPECT_NEAR(0, (a.current.getPosition() - b.current.getPosition()).getR(), 1e-2 * meter);
+}
+
+TEST(testPropagationStratified, turningPoint) {
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	PropagationStratified propa(ice);
+
+	// a shallow upgoing ray is bent back into the ice within a single step
+	ParticleState p;
+	p.setPosition(Vector3d(0, 0, -100 * meter));
+	p.setDirection(Vector3d(sin(80 * deg), 0, cos(80 * deg)));
+	Candidate c(p);
+	double beta = ice->getValue(p.getPosition()) * sin(80 * deg);
+
+	c.setNextStep(1 * kilo * meter);
+	propa.process(&c);
+	Vector3d x = c.current.getPosition();
+	Vector3d u = c.current.getDirection();
+	EXPECT_DOUBLE_EQ(1 * kilo * meter, c.getCurrentStep());
+	EXPECT_LT(u.z, 0);
+	EXPECT_LT(x.z, 0);
+	EXPECT_NEAR(0, x.y, 1e-12);
+	EXPECT_NEAR(beta, ice->getValue(x) * sqrt(u.x * u.x + u.y * u.y), 1e-8);
+}
+
+TEST(testPropagationStratified, horizontalPlanes) {
+	ref_ptr<ScalarField> fields[2] = { new n2linear(1.35, -0.01), new GorhamIceModel() };
+	for (int i = 0; i < 2; i++) {
+		PropagationStratified propa(fields[i]);
+		propa.addHorizontalPlane(-50 * meter);
+		propa.addHorizontalPlane(-20 * meter);
+
+		ParticleState p;
+		p.setPosition(Vector3d(0, 0, -100 * meter));
+		p.setDirection(Vector3d(1, 0, 1));
+		Candidate c(p);
+
+		// the segment ends on the first plane, the next one starts there
+		c.setNextStep(1 * kilo * meter);
+		propa.process(&c);
+		EXPECT_DOUBLE_EQ(-50 * meter, c.current.getPosition().z);
+		EXPECT_LT(c.getCurrentStep(), 200 * meter);  // optical path length
+		EXPECT_GT(c.getCurrentStep(), 50 * meter);
+
+		c.setNextStep(1 * kilo * meter);
+		propa.process(&c);
+		EXPECT_DOUBLE_EQ(-20 * meter, c.current.getPosition().z);
+	}
+}
+
+TEST(testPropagationStratified, exceptions) {
+	PropagationStratified propa(new GorhamIceModel());
+	EXPECT_THROW(propa.setTolerance(2), std::runtime_error);
+	EXPECT_THROW(propa.setMinimumStep(-1), std::runtime_error);
+	EXPECT_THROW(propa.setMaximumStep(1e-4 * meter), std::runtime_error);
+}
+
+TEST(testRaySolver, homogeneous) {
+	RaySolver solver(new n2linear(1.78, 0));
+	Vector3d emitter(0, 0, -200 * meter), receiver(300 * meter, 400 * meter, -100 * meter);
+	std::vector<RaySolution> solutions = solver.solve(emitter, receiver);
+
+	// straight line and mirror image at the surface
+	ASSERT_EQ(2, solutions.size());
+	EXPECT_EQ(RaySolution::Direct, solutions[0].type);
+	EXPECT_NEAR(1.78 * (receiver - emitter).getR(), solutions[0].pathLength, 1e-6 * meter);
+	EXPECT_NEAR(0, (solutions[0].launchDirection - (receiver - emitter).getUnitVector()).getR(), 1e-8);
+	EXPECT_EQ(RaySolution::Reflected, solutions[1].type);
+	EXPECT_EQ(1, solutions[1].reflections);
+	EXPECT_NEAR(1.78 * (receiver - Vector3d(0, 0, 200 * meter)).getR(), solutions[1].pathLength, 1e-6 * meter);
+
+	// vertical
+	solutions = solver.solve(emitter, Vector3d(0, 0, -50 * meter));
+	ASSERT_EQ(2, solutions.size());
+	EXPECT_NEAR(1.78 * 150 * meter, solutions[0].pathLength, 1e-6 * meter);
+	EXPECT_NEAR(1.78 * 250 * meter, solutions[1].pathLength, 1e-6 * meter);
+
+	solver.setReflectiveSurface(false);
+	EXPECT_EQ(1, solver.solve(emitter, receiver).size());
+
+	// a receiver above the surface is reached through it, without reflection
+	solver.setReflectiveSurface(true);
+	Vector3d antenna(300 * meter, 400 * meter, 2 * meter);
+	solutions = solver.solve(emitter, antenna);
+	ASSERT_EQ(1, solutions.size());
+	EXPECT_EQ(RaySolution::Direct, solutions[0].type);
+	EXPECT_EQ(0, solutions[0].reflections);
+	EXPECT_NEAR(1.78 * (antenna - emitter).getR(), solutions[0].pathLength, 1e-6 * meter);
+	solutions = solver.solve(antenna, emitter);
+	ASSERT_EQ(1, solutions.size());
+	EXPECT_NEAR(1.78 * (antenna - emitter).getR(), solutions[0].pathLength, 1e-6 * meter);
+}
+
+TEST(testRaySolver, refracted) {
+	RaySolver solver(new GorhamIceModel());
+	Vector3d emitter(0, 0, -200 * meter), receiver(500 * meter, 0, -150 * meter);
+	std::vector<RaySolution> solutions = solver.solve(emitter, receiver);
+
+	// the upgoing ray turns over inside the ice before it reaches the receiver
+	ASSERT_EQ(2, solutions.size());
+	EXPECT_EQ(RaySolution::Refracted, solutions[0].type);
+	EXPECT_EQ(0, solutions[0].reflections);
+	EXPECT_GT(solutions[0].launchDirection.z, 0);
+	EXPECT_LT(solutions[0].receiveDirection.z, 0);
+	EXPECT_EQ(RaySolution::Reflected, solutions[1].type);
+}
+
+TEST(testRaySolver, sameAsPropagationCK) {
+	ref_ptr<ScalarField> ice = new GorhamIceModel();
+	RaySolver solver(ice);
+	Vector3d emitter(0, 0, -200 * meter), receiver(300 * meter, 0, -100 * meter);
+	std::vector<RaySolution> solutions = solver.solve(emitter, receiver);
+	ASSERT_EQ(2, solutions.size());
+	EXPECT_EQ(0, solutions[0].reflections);
+	EXPECT_EQ(1, solutions[1].reflections);
+
+	// follow the unreflected ray with the general propagation
+	PropagationCK propa(ice, 1e-10, 1e-3 * meter, 1 * meter);
+	ParticleState p;
+	p.setPosition(emitter);
+	p.setDirection(solutions[0].launchDirection);
+	Candidate c(p);
+	while (c.getTrajectoryLength() < solutions[0].pathLength - 1e-9) {
+		c.setNextStep(std::min(c.getNextStep(), solutions[0].pathLength - c.getTrajectoryLength()));
+		propa.process(&c);
+	}
+	EXPECT_NEAR(0, (c.current.getPosition() - receiver).getR(), 1e-2 * meter);
+	EXPECT_NEAR(0, (c.current.getDirection() - solutions[0].receiveDirection).getR(), 1e-4);
+}
+
+TEST(testRaySolver, parallel) {
+	RaySolver solver(new GorhamIceModel());
+	std::vector<Vector3d> emitters, receivers;
+	for (int i = 0; i < 16; i++) {
+		emitters.push_back(Vector3d(0, 0, -(100 + 10 * i) * meter));
+		receivers.push_back(Vector3d((200 + 20 * i) * meter, 0, -50 * meter));
+	}
+	std::vector<std::vector<RaySolution> > solutions = solver.solve(emitters, receivers);
+	ASSERT_EQ(16, solutions.size());
+	EXPECT_EQ(2, solutions[0].size());
+	for (size_t i = 0; i < 16; i++) {
+		std::vector<RaySolution> single = solver.solve(emitters[i], receivers[i]);
+		ASSERT_EQ(single.size(), solutions[i].size());
+		for (size_t j = 0; j < single.size(); j++)
+			EXPECT_DOUBLE_EQ(single[j].pathLength, solutions[i][j].pathLength);
+	}
+
+	receivers.pop_back();
+	EXPECT_THROW(solver.solve(emitters, receivers), std::runtime_error);
+}
+
 //TEST(testPropagationCK, proton) {
 //	PropagationCK propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
 //
@@ -52,6 +52,15 @@ TEST(Vector3, cross) {
 	EXPECT_TRUE(v == Vector3d(0, 0, 1));
 }
 
+TEST(Vector3, elementwise) {
+	Vector3d a(1, 5, -2), b(3, -1, -2);
+	EXPECT_TRUE(a.min(b) == Vector3d(1, -1, -2));
+	EXPECT_TRUE(a.max(b) == Vector3d(3, 5, -2));
+	EXPECT_DOUBLE_EQ(1, a.getComponent(0));
+	EXPECT_DOUBLE_EQ(5, a.getComponent(1));
+	EXPECT_DOUBLE_EQ(-2, a.getComponent(2));
+}
+
 TEST(Vector3, angle) {
 	// 45 degrees
 	double a = Vector3d(1, 1, 0).getAngleTo(Vector3d(1, 0, 0));